@@ -152,6 +152,10 @@ if (USE_OPENCL)
       list(APPEND Caffe_INCLUDE_DIRS PUBLIC ${CLFFT_INCLUDE_DIR} ${FFTW3_INCLUDE_DIR} ${FFTW3F_INCLUDE_DIR})
       list(APPEND Caffe_LINKER_LIBS PUBLIC ${CLFFT_LIBRARY} ${FFTW3_LIBRARY} ${FFTW3F_LIBRARY})
       list(APPEND Caffe_DEFINITIONS PUBLIC -DUSE_FFT)
+      if(FFTW3_THREADS_LIBRARY AND FFTW3F_THREADS_LIBRARY)
+        list(APPEND Caffe_LINKER_LIBS PUBLIC ${FFTW3_THREADS_LIBRARY} ${FFTW3F_THREADS_LIBRARY})
+        list(APPEND Caffe_DEFINITIONS PUBLIC -DUSE_FFTW_THREADS)
+      endif()
     else()
       set(USE_FFT OFF)
     endif()
@@ -257,6 +261,7 @@ if(NOT APPLE)
     find_package(OpenBLAS REQUIRED)
     list(APPEND Caffe_INCLUDE_DIRS PUBLIC ${OpenBLAS_INCLUDE_DIR})
     list(APPEND Caffe_LINKER_LIBS PUBLIC ${OpenBLAS_LIB})
+    list(APPEND Caffe_DEFINITIONS PUBLIC -DUSE_OPENBLAS)
   elseif(BLAS STREQUAL "MKL" OR BLAS STREQUAL "mkl")
     find_package(MKL REQUIRED)
     list(APPEND Caffe_INCLUDE_DIRS PUBLIC ${MKL_INCLUDE_DIR})
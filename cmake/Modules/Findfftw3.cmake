@@ -20,6 +20,8 @@ SET(FFTW3_LIB_SEARCH_PATHS
 
 FIND_PATH(FFTW3_INCLUDE_DIR NAMES fftw3.h PATHS ${FFTW3_INCLUDE_SEARCH_PATHS})
 FIND_LIBRARY(FFTW3_LIBRARY NAMES fftw3 PATHS ${FFTW3_LIB_SEARCH_PATHS})
+# Optional, runs single transforms on several threads
+FIND_LIBRARY(FFTW3_THREADS_LIBRARY NAMES fftw3_threads PATHS ${FFTW3_LIB_SEARCH_PATHS})
 
 SET(FFTW3_FOUND ON)
 
@@ -49,4 +51,5 @@ ENDIF (FFTW3_FOUND)
 MARK_AS_ADVANCED(
     FFTW3_INCLUDE_DIR
     FFTW3_LIBRARY
+    FFTW3_THREADS_LIBRARY
 )
@@ -20,6 +20,8 @@ SET(FFTW3F_LIB_SEARCH_PATHS
 
 FIND_PATH(FFTW3F_INCLUDE_DIR NAMES fftw3.h PATHS ${FFTW3F_INCLUDE_SEARCH_PATHS})
 FIND_LIBRARY(FFTW3F_LIBRARY NAMES fftw3f PATHS ${FFTW3F_LIB_SEARCH_PATHS})
+# Optional, runs single transforms on several threads
+FIND_LIBRARY(FFTW3F_THREADS_LIBRARY NAMES fftw3f_threads PATHS ${FFTW3F_LIB_SEARCH_PATHS})
 
 SET(FFTW3F_FOUND ON)
 
@@ -49,5 +51,6 @@ ENDIF (FFTW3F_FOUND)
 MARK_AS_ADVANCED(
     FFTW3F_INCLUDE_DIR
     FFTW3F_LIBRARY
+    FFTW3F_THREADS_LIBRARY
 )
 
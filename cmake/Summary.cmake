@@ -116,6 +116,7 @@ function(caffe_print_configuration_summary)
   caffe_status("  CPU_ONLY          :   ${CPU_ONLY}")
   caffe_status("  USE_OPENCV        :   ${USE_OPENCV}")
   caffe_status("  USE_FFT           :   ${USE_FFT}")
+  caffe_status("  USE_NATIVE_ARCH   :   ${USE_NATIVE_ARCH}")
   caffe_status("  USE_LEVELDB       :   ${USE_LEVELDB}")
   caffe_status("  USE_LMDB          :   ${USE_LMDB}")
   caffe_status("  USE_NCCL          :   ${USE_NCCL}")
@@ -5,13 +5,18 @@
 #include "caffe_config.h"
 #endif
 
+#include <atomic>
 #include <string>
 #include <vector>
+
+#include <boost/thread/tss.hpp>
+
 #include "caffe/blob.hpp"
 #include "caffe/backend/backend.hpp"
 #include "caffe/backend/device_program.hpp"
 #include "caffe/backend/device_kernel.hpp"
 #include "caffe/backend/vptr.hpp"
+#include "caffe/util/host_allocator.hpp"
 
 namespace caffe {
 
@@ -31,6 +36,17 @@ class Device {
   void increase_memory_usage(uint_tp bytes);
   void decrease_memory_usage(uint_tp bytes);
   void reset_peak_memory_usage();
+  void set_peak_memory_usage(uint_tp bytes);
+  // The memory allocated less the memory freed on this device by the calling
+  // thread, and its peak since the last reset, which tell apart the memory
+  // of code running in one thread while others allocate too. Negative if the
+  // thread freed memory that others allocated.
+  int_tp thread_memory_usage();
+  int_tp thread_peak_memory_usage();
+  void reset_thread_peak_memory_usage();
+  void set_thread_peak_memory_usage(int_tp bytes);
+  // Cache hits, misses and fragmentation of the host memory allocations.
+  HostAllocator::Stats host_memory_stats();
 
   virtual void Init();
   virtual bool CheckCapability(string cap);
@@ -353,8 +369,16 @@ class Device {
   int id_;
   int list_id_;
   Backend backend_;
-  uint_tp memory_usage_;
-  uint_tp peak_memory_usage_;
+  // Atomic, as blobs are allocated and freed from prefetch threads, thread
+  // pool workers and solver replicas at once.
+  std::atomic<uint_tp> memory_usage_;
+  std::atomic<uint_tp> peak_memory_usage_;
+  struct ThreadMemoryUsage {
+    int_tp usage;
+    int_tp peak;
+  };
+  ThreadMemoryUsage* thread_usage();
+  boost::thread_specific_ptr<ThreadMemoryUsage> thread_usage_;
   vector<shared_ptr<Blob<half_float::half> > > buff_h_;
   vector<shared_ptr<Blob<float> > > buff_f_;
   vector<shared_ptr<Blob<double> > > buff_d_;
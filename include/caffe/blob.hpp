@@ -31,6 +31,7 @@ class Blob {
         diff_(),
         count_(0),
         capacity_(0),
+        need_diff_(true),
         device_(Caffe::GetDefaultDevice()) {
   }
   explicit Blob(Device *dev)
@@ -38,6 +39,7 @@ class Blob {
         diff_(),
         count_(0),
         capacity_(0),
+        need_diff_(true),
         device_(dev) {
   }
   explicit Blob(const uint_tp num, const uint_tp channels, const uint_tp height,
@@ -261,8 +263,18 @@ class Blob {
     return data_;
   }
 
+  /**
+   * @brief A number that changes whenever the data may change: on every
+   *        mutable access, and when it is shared from another blob or
+   *        replaced. Caches derived from the data, such as packed or
+   *        quantized weights, keep the version they were built from.
+   */
+  inline uint64_t data_version() const {
+    return data_ ? data_->version() : 0;
+  }
+
   inline const shared_ptr<SyncedMemory>& diff() const {
-    CHECK(diff_);
+    InitDiff();
     return diff_;
   }
 
@@ -314,6 +326,15 @@ class Blob {
    */
   void ShareDiff(const Blob& other);
 
+  /**
+   * @brief Set whether the blob has a diff. A blob that does not need one
+   *        releases its diff_ and does not allocate one on Reshape, so that
+   *        the diff of blobs that never take part in Backward is not
+   *        materialized. It still allocates one when the diff is accessed.
+   */
+  void set_need_diff(bool need_diff);
+  inline bool need_diff() const { return need_diff_; }
+
   bool ShapeEquals(const BlobProto& other);
 
   /**
@@ -322,8 +343,11 @@ class Blob {
   Device *get_device();
 
  protected:
+  // Allocates the diff_ of a blob that does not need one, on access.
+  void InitDiff() const;
+
   shared_ptr<SyncedMemory> data_;
-  shared_ptr<SyncedMemory> diff_;
+  mutable shared_ptr<SyncedMemory> diff_;
   shared_ptr<SyncedMemory> shape_data_;
   shared_ptr<SyncedMemory> shape_stride_data_;
   vector<uint_tp> shape_;
@@ -331,11 +355,46 @@ class Blob {
   vector<uint_tp> offset_shape_;
   uint_tp count_;
   uint_tp capacity_;
+  bool need_diff_;
   Device *device_;
 
   DISABLE_COPY_AND_ASSIGN(Blob);
 };  // class Blob
 
+/**
+ * @brief Tells when a cache derived from the data of some blobs, such as
+ *        packed, transformed or quantized weights, must be built again, by
+ *        keeping the data versions of the blobs it was last built from.
+ */
+class BlobDataVersions {
+ public:
+  // Whether the blobs, or their data, differ from those of the last Update.
+  template<typename Dtype>
+  bool Changed(const vector<shared_ptr<Blob<Dtype> > >& blobs) const {
+    if (blobs.size() != versions_.size()) {
+      return true;
+    }
+    for (int_tp i = 0; i < blobs.size(); ++i) {
+      if (blobs[i]->data_version() != versions_[i]) {
+        return true;
+      }
+    }
+    return false;
+  }
+  template<typename Dtype>
+  void Update(const vector<shared_ptr<Blob<Dtype> > >& blobs) {
+    versions_.resize(blobs.size());
+    for (int_tp i = 0; i < blobs.size(); ++i) {
+      versions_[i] = blobs[i]->data_version();
+    }
+  }
+  // Makes the next Changed true.
+  void Clear() { versions_.clear(); }
+
+ private:
+  vector<uint64_t> versions_;
+};
+
 typedef variant<
     Blob<bool>,
     Blob<char>,
@@ -151,6 +151,7 @@ namespace cv {class Mat;}
 namespace caffe {
 
 class Device;
+class ThreadPool;
 
 // a global initialization function that you should call in your main function.
 // Currently it initializes google flags and google logging.
@@ -242,6 +243,21 @@ class Caffe {
   inline static void set_multiprocess(bool val) { Get().multiprocess_ = val; }
   inline static bool root_solver() { return Get().solver_rank_ == 0; }
 
+  // The pool of CPU threads CPU layers parallelize on: the process wide pool,
+  // unless set_thread_pool gave the calling thread another.
+  static ThreadPool& thread_pool();
+  // Makes the calling thread parallelize on pool, or on the process wide
+  // pool again if NULL. The workers of a pool parallelize on it.
+  inline static void set_thread_pool(ThreadPool* pool) {
+    Get().thread_pool_ = pool;
+  }
+  // Sets the number of CPU threads of the pool and of BLAS, or all cores if
+  // num_threads is 0, optionally pinning each thread to a core, counting
+  // from first_cpu. The pool must not be in use.
+  static void set_cpu_threads(int_tp num_threads, bool pin_threads = false,
+                              int_tp first_cpu = 0);
+  static int_tp cpu_threads();
+
   // Get the default device
   static Device *GetDefaultDevice();
   static Device *GetCPUDevice();
@@ -279,6 +295,8 @@ class Caffe {
   int solver_count_;
   int solver_rank_;
   bool multiprocess_;
+  // The pool set by set_thread_pool, or NULL.
+  ThreadPool* thread_pool_;
 };
 
 }  // namespace caffe
@@ -6,7 +6,9 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/binarization.hpp"
 #include "caffe/util/im2col.hpp"
+#include "caffe/util/quantization.hpp"
 
 namespace caffe {
 
@@ -46,6 +48,14 @@ class BaseConvolutionLayer : public Layer<Dtype, MItype, MOtype> {
                          Dtype* output);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype* weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // Variants of the gemm helpers for batch consecutive images (at most
+  // col_batch_): one im2col of all their columns and one GEMM per group.
+  void forward_cpu_gemm_batch(const Dtype* input, const Dtype* weights,
+                              Dtype* output, const int_tp batch);
+  void backward_cpu_gemm_batch(const Dtype* input, const Dtype* weights,
+                               Dtype* output, const int_tp batch);
+  void weight_cpu_gemm_batch(const Dtype* input, const Dtype* output,
+                             Dtype* weights, const int_tp batch);
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(vptr<const Dtype> col_input, const uint_tp col_input_off,
@@ -106,6 +116,13 @@ class BaseConvolutionLayer : public Layer<Dtype, MItype, MOtype> {
   bool is_1x1_;
   bool force_nd_im2col_;
   bool use_colbuffer_;
+  /// @brief Whether forward_cpu_gemm computes in INT8_QUANTIZED.
+  bool quantized_;
+  /// @brief Whether forward_cpu_gemm computes in a *_PACKED_BINARY type.
+  bool binary_;
+  /// @brief The number of images the CPU passes im2col at once, within the
+  ///        col_buffer_budget.
+  int_tp col_batch_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -138,6 +155,28 @@ class BaseConvolutionLayer : public Layer<Dtype, MItype, MOtype> {
     }
   }
 
+  inline void conv_im2col_batch_cpu(const Dtype* data, const int_tp batch,
+                                    Dtype* col_buff) {
+    im2col_batch_cpu(data, batch, conv_in_channels_,
+        conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+        kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+        pad_.cpu_data()[0], pad_.cpu_data()[1],
+        stride_.cpu_data()[0], stride_.cpu_data()[1],
+        dilation_.cpu_data()[0], dilation_.cpu_data()[1], col_buff);
+  }
+  inline void conv_col2im_batch_cpu(const Dtype* col_buff, const int_tp batch,
+                                    Dtype* data) {
+    col2im_batch_cpu(col_buff, batch, conv_in_channels_,
+        conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+        kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+        pad_.cpu_data()[0], pad_.cpu_data()[1],
+        stride_.cpu_data()[0], stride_.cpu_data()[1],
+        dilation_.cpu_data()[0], dilation_.cpu_data()[1], data);
+  }
+  // Copies the batch outputs, top_dim_ apart, into batch_output_buffer_ as
+  // one (channels x (batch * spatial)) matrix.
+  void gather_cpu_batch(const Dtype* output, const int_tp batch);
+
 #ifndef CPU_ONLY
   inline void conv_im2col_gpu(vptr<Dtype> data, vptr<Dtype> col_buff) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
@@ -172,6 +211,14 @@ class BaseConvolutionLayer : public Layer<Dtype, MItype, MOtype> {
   }
 #endif  // !CPU_ONLY
 
+  // INT8_QUANTIZED variant of forward_cpu_gemm; the output is dequantized.
+  void forward_cpu_gemm_quantized(const Dtype* input, const Dtype* weights,
+                                  Dtype* output);
+  // *_PACKED_BINARY variant of forward_cpu_gemm, on the signs of the input
+  // (or its packed signs) and the scaled signs of the weights.
+  void forward_cpu_gemm_binary(const Dtype* input, const Dtype* weights,
+                               Dtype* output);
+
   int_tp num_kernels_im2col_;
   int_tp num_kernels_col2im_;
   int_tp conv_out_channels_;
@@ -185,6 +232,23 @@ class BaseConvolutionLayer : public Layer<Dtype, MItype, MOtype> {
 
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+  // The columns and the outputs of col_batch_ images of the batched passes,
+  // as [group][kernel_dim_][image][spatial] and [channel][image][spatial].
+  vector<Dtype> batch_col_buffer_;
+  vector<Dtype> batch_output_buffer_;
+
+  // The weights are quantized again on the first forward after they change.
+  QuantizedWeights quantized_weights_;
+  BlobDataVersions quantized_versions_;
+  vector<uint8_t> quantized_col_buffer_;
+  vector<int32_t> quantized_output_;
+
+  // The weights are binarized again on the first forward after they change.
+  BinaryWeights binary_weights_;
+  BlobDataVersions binary_versions_;
+  vector<uint64_t> binary_input_;
+  vector<uint64_t> binary_col_buffer_;
+  vector<int32_t> binary_output_;
 };
 
 }  // namespace caffe
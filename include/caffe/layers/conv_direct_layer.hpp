@@ -0,0 +1,99 @@
+#ifndef CAFFE_CONV_DIRECT_LAYER_HPP_
+#define CAFFE_CONV_DIRECT_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Convolves the input directly, without im2col, on channel blocked
+ *        data on the CPU.
+ *
+ * The output channels are computed in blocks of the vector width, i.e. in
+ * the NativeBlockedLayout: the micro-kernels keep a row segment of output
+ * pixels of a few channel blocks in registers and accumulate the products
+ * of every input value with the weight vectors of the blocks into them.
+ * The bottom may be in NCHW or any blocked layout and the top in NCHW or
+ * the NativeBlockedLayout, as given by the bottom_layout and top_layout of
+ * the layer; InsertReorders picks these and adds ReorderLayers where needed.
+ * The weight and bottom gradients are computed directly as well, so no
+ * column buffer is ever allocated.
+ *
+ * Used for the DIRECT engine. Grouped, quantized, binary and not 2D
+ * convolutions, as well as the GPU paths, run like a CAFFE engine
+ * ConvolutionLayer and need NCHW blobs.
+ */
+template<typename Dtype, typename MItype, typename MOtype>
+class ConvolutionLayerDirect
+    : public ConvolutionLayer<Dtype, MItype, MOtype> {
+ public:
+  explicit ConvolutionLayerDirect(const LayerParameter& param)
+      : ConvolutionLayer<Dtype, MItype, MOtype>(param) {
+  }
+  virtual void LayerSetUp(const vector<Blob<MItype>*>& bottom,
+                          const vector<Blob<MOtype>*>& top);
+  virtual void Reshape(const vector<Blob<MItype>*>& bottom,
+                       const vector<Blob<MOtype>*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<MItype>*>& bottom,
+                           const vector<Blob<MOtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<MOtype>*>& top,
+                            const vector<bool>& propagate_down,
+                            const vector<Blob<MItype>*>& bottom);
+
+  // Reshapes the NCHW views of the bottoms to the shapes of the bottoms.
+  void reshape_plain_bottoms(const vector<Blob<MItype>*>& bottom);
+  // Packs the weights and biases if they changed since they were last packed.
+  void pack_weights();
+  // Packs the weights for the gradient with respect to the bottom.
+  void pack_backward_weights();
+  // Computes output row oh of the output channel blocks [ob_begin, ob_end).
+  // An NCHW top needs a row_buffer of ob_end - ob_begin blocks of the row.
+  void forward_cpu_direct_row(const Dtype* input, const int_tp oh,
+                              const int_tp ob_begin, const int_tp ob_end,
+                              Dtype* output, Dtype* row_buffer);
+  // Gathers the top gradient of output row oh into row_buffer, as [ow][out
+  // channel] gradients.
+  void gather_top_diff_row(const Dtype* top_diff, const int_tp oh,
+                           Dtype* row_buffer);
+  void weight_cpu_direct_row(const Dtype* input, const int_tp oh,
+                             const Dtype* top_diff_row, Dtype* weight_diff);
+  void backward_cpu_direct_row(const int_tp oh, const Dtype* top_diff_row,
+                               Dtype* bottom_diff);
+
+  /// @brief Whether the layer's shape is supported by the direct path.
+  bool direct_;
+  Layout bottom_layout_;
+  Layout top_layout_;
+  // The bottoms and tops as seen by the BaseConvolutionLayer, with the
+  // NCHW shapes of the blobs. They only carry shapes, never data.
+  vector<shared_ptr<Blob<MItype> > > plain_bottom_;
+  vector<shared_ptr<Blob<MOtype> > > plain_top_;
+  vector<Blob<MItype>*> plain_bottom_vec_;
+  vector<Blob<MOtype>*> plain_top_vec_;
+
+  bool backward_weights_packed_;
+  // The versions of the weights and biases as last packed, to detect
+  // changes.
+  BlobDataVersions weight_versions_;
+  // [out block][in block][kh][kw][in channel of block][out channel of block]
+  vector<Dtype> packed_weights_;
+  // [in block][kh][kw][out channel][in channel of block]
+  vector<Dtype> packed_backward_weights_;
+  vector<Dtype> packed_bias_;
+  // [slice][out block][in channel][kh][kw][out channel of block]
+  vector<Dtype> weight_diff_buffer_;
+  // [slice][out channel]
+  vector<Dtype> bias_diff_buffer_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_CONV_DIRECT_LAYER_HPP_
@@ -119,7 +119,11 @@ class ConvolutionLayerFFT : public BaseConvolutionLayer<Dtype> {
   int stride_w_;
   int stride_h_;
 
-  // CPU buffers and handles
+  // CPU buffers and handles. The map buffers hold one map per channel or
+  // output, so each direction runs as one batched transform. The plans
+  // belong to the process wide cache in util/fft.hpp.
+  int fft_cpu_height_;
+  int fft_cpu_width_;
   Dtype* fft_weights_real_;
   Dtype* fft_map_in_real_;
   std::complex<Dtype>* fft_weights_complex_;
@@ -128,6 +132,8 @@ class ConvolutionLayerFFT : public BaseConvolutionLayer<Dtype> {
   Dtype* fft_map_out_real_;
   void* fft_handle_;
   void* ifft_handle_;
+  void* fft_backward_handle_;
+  void* ifft_backward_handle_;
   void* fft_many_handle_;
 
   // GPU buffers and handles
@@ -8,6 +8,7 @@
 #include "caffe/proto/caffe.pb.h"
 
 #include "caffe/layers/base_conv_layer.hpp"
+#include "caffe/layers/pooling_layer.hpp"
 
 namespace caffe {
 
@@ -26,6 +27,16 @@ namespace caffe {
  *   inputs so that the im2col matrix has a column for each input region to
  *   be filtered. col2im restores the output spatial structure by rolling up
  *   the output channel n' columns of the output matrix.
+ *
+ *   Depthwise convolutions, with one filter per input channel (group ==
+ *   channels == num_output), skip the im2col and the per group GEMMs on the
+ *   CPU and compute each channel's stencil directly instead.
+ *
+ *   On the CPU, fuse_type folds the layers that usually follow into the
+ *   convolution: the bias, the residual sum of FUSED_CONV_ELTWISE_RELU
+ *   (the residual is the second bottom), the ReLU and the max pooling of
+ *   FUSED_CONV_MAX_POOLING_RELU are applied to each image while its output
+ *   is still in cache. Fused layers are inference only.
  */
 template<typename Dtype, typename MItype, typename MOtype>
 class ConvolutionLayer
@@ -66,10 +77,17 @@ class ConvolutionLayer
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype, MItype, MOtype>(param) {
   }
+  virtual void LayerSetUp(const vector<Blob<MItype>*>& bottom,
+                          const vector<Blob<MOtype>*>& top);
+  virtual void Reshape(const vector<Blob<MItype>*>& bottom,
+                       const vector<Blob<MOtype>*>& top);
 
   virtual inline const char* type() const {
     return "Convolution";
   }
+  virtual inline bool EqualNumBottomTopBlobs() const {
+    return !IsFusedWithEltwiseReLU();
+  }
 
   virtual uint_tp ForwardFlops() {
     uint_tp group = this->group_;
@@ -100,6 +118,45 @@ class ConvolutionLayer
     return false;
   }
   virtual void compute_output_shape();
+
+  // Whether the CPU passes run the depthwise kernels: a 2D convolution with
+  // one filter per input channel in floating point.
+  inline bool is_depthwise() const {
+    return this->num_spatial_axes_ == 2 && !this->force_nd_im2col_ &&
+        this->group_ == this->channels_ &&
+        this->num_output_ == this->channels_ && !this->quantized_ &&
+        !this->binary_;
+  }
+
+  inline bool IsFused() const {
+    return this->layer_param_.convolution_param().fuse_type()
+        != ConvolutionParameter_FuseType_UNFUSED;
+  }
+  inline bool IsFusedWithMaxPoolAndReLU() const {
+    return this->layer_param_.convolution_param().fuse_type()
+        == ConvolutionParameter_FuseType_FUSED_CONV_MAX_POOLING_RELU;
+  }
+  inline bool IsFusedWithEltwiseReLU() const {
+    return this->layer_param_.convolution_param().fuse_type()
+        == ConvolutionParameter_FuseType_FUSED_CONV_ELTWISE_RELU;
+  }
+  // Whether relu_param.negative_slope applies, as in the spatial engine.
+  inline bool IsFusedWithReLU() const {
+    return IsFusedWithEltwiseReLU() ||
+        this->layer_param_.convolution_param().fuse_type()
+        == ConvolutionParameter_FuseType_FUSED_CONV_RELU;
+  }
+  void Forward_cpu_fused(const vector<Blob<MItype>*>& bottom,
+                         const vector<Blob<MOtype>*>& top);
+
+  Dtype negative_slope_;
+  // Max pooling of one image of the convolution output, for
+  // FUSED_CONV_MAX_POOLING_RELU.
+  shared_ptr<PoolingLayer<Dtype, Dtype, Dtype> > pool_layer_;
+  Blob<Dtype> fused_conv_output_;
+  Blob<Dtype> fused_pool_output_;
+  vector<Blob<Dtype>*> fused_conv_vec_;
+  vector<Blob<Dtype>*> fused_pool_vec_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,77 @@
+#ifndef CAFFE_CONV_WINOGRAD_LAYER_HPP_
+#define CAFFE_CONV_WINOGRAD_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Convolves the input with 3x3 filters by the Winograd minimal
+ *        filtering algorithm F(4x4, 3x3) on the CPU.
+ *
+ * The input is cut into overlapping 6x6 tiles, each producing a 4x4 output
+ * tile. In the transformed domain the convolution of a tile is an
+ * elementwise product, so for each of the 36 tile positions the products
+ * over all channels and tiles are one GEMM, of the transformed filters with
+ * the transformed input tiles. This needs 36 instead of 144 multiplications
+ * per output tile and channel pair.
+ *
+ * Used for the WINOGRAD engine. Convolutions that are not 2D with 3x3
+ * kernels, stride 1, dilation 1 and padding at most 2 run like a CAFFE
+ * engine ConvolutionLayer, as do the GPU paths. The filters are transformed
+ * at LayerSetUp and again whenever they change, e.g. when trained weights
+ * are loaded. The forward pass and the gradient with respect to the bottom
+ * use the Winograd algorithm, the weight gradient uses im2col and GEMM.
+ */
+template<typename Dtype, typename MItype, typename MOtype>
+class ConvolutionLayerWinograd
+    : public ConvolutionLayer<Dtype, MItype, MOtype> {
+ public:
+  explicit ConvolutionLayerWinograd(const LayerParameter& param)
+      : ConvolutionLayer<Dtype, MItype, MOtype>(param) {
+  }
+  virtual void LayerSetUp(const vector<Blob<MItype>*>& bottom,
+                          const vector<Blob<MOtype>*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<MItype>*>& bottom,
+                           const vector<Blob<MOtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<MOtype>*>& top,
+                            const vector<bool>& propagate_down,
+                            const vector<Blob<MItype>*>& bottom);
+
+  // Transforms the filters if they changed since the last transform.
+  void transform_weights();
+  // Transforms the filters flipped and with input and output channels
+  // swapped, for the gradient with respect to the bottom.
+  void transform_backward_weights();
+  // Correlates num images of in_channels x height x width with the filters
+  // transformed_weights, laid out as 36 out_channels x (in_channels / group)
+  // matrices, into out_channels x (height + 2 * pad_h - 2) x
+  // (width + 2 * pad_w - 2) outputs.
+  void winograd_cpu(const int_tp num, const Dtype* input,
+                    const int_tp in_channels, const int_tp height,
+                    const int_tp width, const int_tp pad_h,
+                    const int_tp pad_w, const Dtype* transformed_weights,
+                    const int_tp out_channels, Dtype* output);
+
+  /// @brief Whether the layer's shape is supported by the Winograd path.
+  bool winograd_;
+  bool backward_weights_transformed_;
+  // The versions of the filters as last transformed, to detect changes.
+  BlobDataVersions weight_versions_;
+  vector<Dtype> transformed_weights_;
+  vector<Dtype> transformed_backward_weights_;
+  vector<Dtype> transformed_input_;
+  vector<Dtype> transformed_output_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_CONV_WINOGRAD_LAYER_HPP_
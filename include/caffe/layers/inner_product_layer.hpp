@@ -7,6 +7,8 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/binarization.hpp"
+#include "caffe/util/quantization.hpp"
 #ifdef USE_OPENCL
 #include <boost/filesystem.hpp>
 #endif
@@ -53,6 +55,28 @@ class InnerProductLayer : public Layer<Dtype, MItype, MOtype> {
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
   bool transpose_;  ///< if true, assume transposed weights
+
+  // INT8_QUANTIZED inference, see Forward_cpu. The weights are quantized
+  // again on the first quantized forward pass after they change.
+  void Forward_cpu_quantized(const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
+  bool quantized_;
+  QuantizedWeights quantized_weights_;
+  BlobDataVersions quantized_versions_;
+  vector<uint8_t> quantized_bottom_;
+  vector<int32_t> quantized_top_;
+
+  // *_PACKED_BINARY inference, with the signs packed along the channel
+  // axis of the bottom. The weights are binarized again on the first binary
+  // forward pass after they change.
+  void Forward_cpu_binary(const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
+  bool binary_;
+  int_tp binary_channels_;
+  BinaryWeights binary_weights_;
+  BlobDataVersions binary_versions_;
+  vector<uint64_t> binary_bottom_;
+  vector<int32_t> binary_top_;
 };
 
 }  // namespace caffe
@@ -17,6 +17,11 @@ namespace caffe {
 /**
  * @brief Normalize the input in a local region across or within feature maps.
  *
+ * With fuse_type FUSED_POOL_MAX the normalization across channels is
+ * followed by the max pooling of lrn_param.pooling_param, and the top is the
+ * pooled output. The CPU computes both in one pass over bands of rows, without
+ * storing the normalized input; Backward recomputes it.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template<typename Dtype, typename MItype, typename MOtype>
@@ -51,6 +56,9 @@ class LRNLayer : public Layer<Dtype, MItype, MOtype> {
   virtual void CrossChannelForward_gpu(
       const vector<Blob<MItype>*>& bottom,
       const vector<Blob<MOtype>*>& top);
+  virtual void FusedPoolMaxForward_cpu(
+      const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
   virtual void WithinChannelForward(const vector<Blob<MItype>*>& bottom,
       const vector<Blob<MOtype>*>& top);
   virtual void CrossChannelBackward_cpu(const vector<Blob<MOtype>*>& top,
@@ -79,6 +87,19 @@ class LRNLayer : public Layer<Dtype, MItype, MOtype> {
   // scale_ stores the int_tpermediate summing results
   Blob<Dtype> scale_;
 
+  // Fields used for normalization ACROSS_CHANNELS fused with max pooling
+  bool fuse_pool_max_;
+  int_tp pool_kernel_h_, pool_kernel_w_;
+  int_tp pool_stride_h_, pool_stride_w_;
+  int_tp pool_pad_h_, pool_pad_w_;
+  shared_ptr<PoolingLayer<Dtype, Dtype, Dtype> > fused_pool_layer_;
+  Blob<Dtype> lrn_top_;
+  vector<Blob<Dtype>*> lrn_top_vec_;
+  // Scratch output of the pooling recomputed by the CPU backward pass, so
+  // that top is left untouched.
+  Blob<Dtype> fused_pool_top_;
+  vector<Blob<Dtype>*> fused_pool_top_vec_;
+
   // Fields used for normalization WITHIN_CHANNEL
   shared_ptr<SplitLayer<Dtype, Dtype, Dtype> > split_layer_;
   vector<Blob<Dtype>*> split_top_vec_;
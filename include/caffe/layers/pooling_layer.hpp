@@ -74,6 +74,10 @@ class PoolingLayer : public Layer<Dtype, MItype, MOtype> {
   int_tp max_top_blobs_;
   Blob<Dtype> rand_idx_;
   Blob<int_tp> max_idx_;
+  /// The window relative max and stochastic indices of Forward_cpu, for
+  /// windows of up to 256 elements. Larger windows keep them in max_idx_.
+  Blob<uint8_t> window_idx_;
+  bool use_window_idx_;
 };
 
 }  // namespace caffe
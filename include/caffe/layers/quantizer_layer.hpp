@@ -0,0 +1,52 @@
+#ifndef CAFFE_QUANTIZER_LAYER_HPP_
+#define CAFFE_QUANTIZER_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/neuron_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Converts between the bottom_data_type and top_data_type of the
+ *        layer, i.e. quantizes, dequantizes or requantizes its input.
+ *        Inserted by InsertConversions where the top and bottom data types
+ *        of connected layers differ.
+ *
+ * Quantized values are zero point centred INT8_QUANTIZED codes, with the
+ * scale and zero point given by bottom_quantization and top_quantization.
+ * *_PACKED_BINARY blobs hold the signs of the values packed along axis 1,
+ * see WritePackedSigns; they unpack to +1 and -1.
+ */
+template<typename Dtype, typename MItype, typename MOtype>
+class QuantizerLayer : public NeuronLayer<Dtype, MItype, MOtype> {
+ public:
+  explicit QuantizerLayer(const LayerParameter& param)
+      : NeuronLayer<Dtype, MItype, MOtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
+
+  virtual inline const char* type() const { return "Quantizer"; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
+  /// @brief Straight-through gradient, scaled by the code to value ratios.
+  virtual void Backward_cpu(const vector<Blob<MOtype>*>& top,
+      const vector<bool>& propagate_down,
+      const vector<Blob<MItype>*>& bottom);
+
+  bool bottom_quantized_, top_quantized_;
+  bool bottom_binary_, top_binary_;
+  vector<uint64_t> packed_signs_;
+  Dtype bottom_scale_, top_scale_;
+  int_tp top_zero_point_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_QUANTIZER_LAYER_HPP_
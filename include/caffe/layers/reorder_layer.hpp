@@ -0,0 +1,49 @@
+#ifndef CAFFE_REORDER_LAYER_HPP_
+#define CAFFE_REORDER_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Reorders its input from the bottom_layout into the top_layout of
+ *        the layer, e.g. from NCHW into the channel blocked NCHW8C.
+ *        Inserted by InsertReorders where the top and bottom layouts of
+ *        connected layers differ.
+ */
+template<typename Dtype, typename MItype, typename MOtype>
+class ReorderLayer : public Layer<Dtype, MItype, MOtype> {
+ public:
+  explicit ReorderLayer(const LayerParameter& param)
+      : Layer<Dtype, MItype, MOtype>(param) {}
+  virtual void Reshape(const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
+
+  virtual inline const char* type() const { return "Reorder"; }
+  virtual inline int_tp ExactNumBottomBlobs() const { return 1; }
+  virtual inline int_tp ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<MOtype>*>& top,
+      const vector<bool>& propagate_down,
+      const vector<Blob<MItype>*>& bottom);
+
+  // Reorders count values from the from layout into the to layout.
+  void reorder(const Layout from, const Layout to, const Dtype* x, Dtype* y);
+
+  int_tp num_;
+  int_tp channels_;
+  int_tp inner_;
+  // The NCHW values, when reordering between two blocked layouts.
+  vector<Dtype> plain_buffer_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_REORDER_LAYER_HPP_
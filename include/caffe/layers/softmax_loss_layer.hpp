@@ -125,6 +125,9 @@ class SoftmaxWithLossLayer : public LossLayer<Dtype, MItype, MOtype> {
   LossParameter_NormalizationMode normalization_;
 
   int_tp softmax_axis_, outer_num_, inner_num_;
+  /// The per location maxima and sums of exponentials of the CPU pass, which
+  /// computes the probabilities and the loss together.
+  Blob<Dtype> max_, sum_;
 };
 
 }  // namespace caffe
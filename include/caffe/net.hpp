@@ -70,6 +70,12 @@ class Net {
   void BackwardFromTo(int_tp start, int_tp end);
   void BackwardFrom(int_tp start);
   void BackwardTo(int_tp end);
+  /**
+   * @brief Gives the blobs the diffs that Backward reads or writes. Nets of
+   *        the TEST phase only get them on their first Backward, so call
+   *        this before writing the top diffs of such a net.
+   */
+  void PrepareBackward();
 
   /**
    * @brief Reshape all layers from bottom to top.
@@ -137,6 +143,32 @@ class Net {
       const {
     return layers_;
   }
+  /// @brief returns the bytes of memory used by the blobs between layers
+  inline uint_tp memory_used() const {
+    return memory_used_ * sizeof(Dtype);
+  }
+  /// @brief The bytes of memory held by a layer.
+  struct LayerMemory {
+    uint_tp top_data;
+    uint_tp top_diff;
+    uint_tp param_data;
+    uint_tp param_diff;
+    /// Allocated by the Forward and Backward passes of the layer beyond its
+    /// blobs, such as the im2col buffer, while profile_memory.
+    uint_tp internal;
+    /// The most memory held at once during a Forward or Backward pass of the
+    /// layer beyond what was held before it, while profile_memory.
+    uint_tp peak;
+  };
+  /// @brief Records the internal and peak memory of each layer in Forward
+  ///        and Backward, from the memory usage of the device by the thread
+  ///        running the layer, so that concurrent layers are told apart.
+  void set_profile_memory(bool profile_memory);
+  /// @brief returns the memory held by each layer, indexed by layer id.
+  ///        Blobs shared by several layers count for the first of them.
+  vector<LayerMemory> layer_memory() const;
+  /// @brief returns a report of the layers by descending memory.
+  string MemoryReport() const;
   /// @brief returns the phase: TRAIN or TEST
   inline Phase phase() const {
     return phase_;
@@ -287,6 +319,42 @@ class Net {
   void BackwardDebugInfo(const int_tp layer_id);
   /// @brief Helper for displaying debug info in Update.
   void UpdateDebugInfo(const int_tp param_id);
+  /// @brief Gives a diff to the blobs that Backward reads or writes, if
+  ///        backward, and to the blobs of loss layers, and releases the
+  ///        diffs of all other blobs.
+  void SetNeedDiffs(const bool backward);
+  /// @brief The bytes of the allocated blobs of a layer.
+  uint_tp LayerBlobBytes(const int_tp layer_id) const;
+  /// @brief The memory of the calling thread when a pass of a layer started.
+  struct LayerMemoryStart {
+    int_tp usage;
+    int_tp peak_usage;
+    uint_tp blob_bytes;
+  };
+  /// @brief Helpers recording the memory of a Forward or Backward pass of a
+  ///        layer, if profile_memory_.
+  LayerMemoryStart StartLayerMemory(const int_tp layer_id);
+  void StopLayerMemory(const int_tp layer_id, const LayerMemoryStart& start);
+  /// @brief Places the blobs that are not live at the same time in one
+  ///        arena, if plan_memory_.
+  void PlanMemory();
+  /// @brief Finds the layers each layer depends on, if concurrent_layers_.
+  void InitLayerDependencies();
+  /// @brief Whether ForwardFromTo and BackwardFromTo run the layers
+  ///        concurrently.
+  bool RunsConcurrently() const;
+  /// @brief Runs the Forward, or the Backward, of the layers from start to
+  ///        end on Caffe::thread_pool(), each once the layers it depends on
+  ///        are done. Returns the loss of each Forward by layer id.
+  vector<Dtype> RunLayersConcurrently(int_tp start, int_tp end,
+                                      const bool backward);
+  /// @brief Runs the Forward or Backward of one layer with its callbacks.
+  Dtype ForwardLayer(const int_tp layer_id);
+  void BackwardLayer(const int_tp layer_id);
+  /// @brief Folds the trained weights of folded_layers_ into the copied
+  ///        convolutions.
+  void FoldTrainedLayers(const set<string>& copied_layers,
+      const map<string, vector<shared_ptr<Blob<Dtype> > > >& folded_weights);
 
   /// @brief The network name
   string name_;
@@ -343,6 +411,28 @@ class Net {
   vector<bool> has_params_decay_;
   /// The bytes of memory used by this net
   uint_tp memory_used_;
+  /// Whether the blobs have the diffs needed by Backward. TEST phase nets
+  /// only get them on their first Backward.
+  bool backward_diffs_;
+  /// The memory recorded by StopLayerMemory, indexed by layer id.
+  bool profile_memory_;
+  vector<uint_tp> layer_internal_memory_;
+  vector<uint_tp> layer_peak_memory_;
+  /// Whether the blobs live in memory_arena_, as planned by PlanMemory.
+  bool plan_memory_;
+  shared_ptr<SyncedMemory> memory_arena_;
+  /// The memories PlanMemory placed in memory_arena_.
+  vector<shared_ptr<SyncedMemory> > arena_memories_;
+  /// The BatchNorm and Scale layers folded into each convolution with
+  /// NetState.fuse_layers, by the name of the convolution.
+  map<string, vector<LayerParameter> > folded_layers_;
+  /// Whether layers that do not depend on each other run concurrently on
+  /// the CPU, as set by NetState.concurrent_layers.
+  bool concurrent_layers_;
+  /// The earlier layers whose Forward each layer waits for, indexed by layer
+  /// id, and the later layers waiting for it. Backward waits the other way.
+  vector<vector<int_tp> > layer_deps_;
+  vector<vector<int_tp> > layer_dependents_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
 
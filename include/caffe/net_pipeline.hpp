@@ -0,0 +1,106 @@
+#ifndef CAFFE_NET_PIPELINE_HPP_
+#define CAFFE_NET_PIPELINE_HPP_
+
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Runs the Forward of a net on the CPU as a pipeline of stages, for
+ *        throughput-oriented scoring of large batches.
+ *
+ * The layers are split into contiguous stages of about equal
+ * Layer::ForwardFlops. Each stage runs its layers with ForwardFromTo on a
+ * copy of the net sharing the weights of the original, on a thread pool of
+ * its own cores. The batch in the input blobs of the net is streamed through
+ * the stages in micro-batches, so the stages work on consecutive
+ * micro-batches at once. The blobs passed between stages are double
+ * buffered: a stage may run one micro-batch ahead of the stages reading its
+ * tops. The outputs of the micro-batches are gathered into the output blobs
+ * of the net, which must all have the batch as their first axis.
+ */
+template<typename Dtype>
+class NetPipeline {
+ public:
+  // Splits net into num_stages stages, running micro_batch items at a time.
+  // The cores in cpus are split evenly among the stages, whose threads are
+  // pinned to them. Without cpus, each stage gets an equal share of
+  // Caffe::cpu_threads() unpinned threads.
+  NetPipeline(Net<Dtype>* net, int_tp num_stages, int_tp micro_batch,
+              const vector<int_tp>& cpus);
+  ~NetPipeline();
+
+  // Runs the Forward of the net on its input blobs, whose first axis must be
+  // a multiple of the micro batch, and returns its output blobs.
+  const vector<Blob<Dtype>*>& Forward();
+
+  inline int_tp num_stages() const { return stage_starts_.size(); }
+  // The first layer of each stage.
+  inline const vector<int_tp>& stage_starts() const { return stage_starts_; }
+  // The copy of the net and the thread pool each stage runs its layers on.
+  inline Net<Dtype>* stage_net(int_tp stage) const {
+    return stage_nets_[stage].get();
+  }
+  inline ThreadPool* stage_pool(int_tp stage) const {
+    return stage_pools_[stage].get();
+  }
+
+ private:
+  // Splits the layers into stages and finds the blobs passed between them.
+  void InitStages(int_tp num_stages);
+  // Reshapes the stage nets and the buffers to the micro batch.
+  void Reshape();
+  // The thread of a stage, running each Forward through it.
+  void StageLoop(int_tp stage);
+  // Runs micro-batches 0 to num_micro_batches - 1 through stage.
+  void RunStage(int_tp stage, int_tp num_micro_batches);
+
+  Net<Dtype>* net_;
+  int_tp micro_batch_;
+  vector<int_tp> stage_starts_;
+  vector<int_tp> stage_ends_;
+  vector<shared_ptr<Net<Dtype> > > stage_nets_;
+  vector<shared_ptr<ThreadPool> > stage_pools_;
+  // The core the thread of each stage is pinned to, or -1.
+  vector<int_tp> stage_cpus_;
+  // The blobs each stage reads from a buffer filled by an earlier stage, and
+  // those it fills buffers of, by blob id. Stage 0 fills the buffers of the
+  // net inputs.
+  vector<vector<int_tp> > stage_reads_;
+  vector<vector<int_tp> > stage_writes_;
+  // The last stage using a buffer filled by each stage.
+  vector<int_tp> stage_last_user_;
+  // The net outputs each stage writes last, by output index.
+  vector<vector<int_tp> > stage_outputs_;
+  // Two buffers of each blob passed between stages, by blob id.
+  vector<vector<shared_ptr<Blob<Dtype> > > > buffers_;
+  // The data of the input and output blobs of net_, by index.
+  vector<const Dtype*> input_data_;
+  vector<Dtype*> output_data_;
+  // The micro-batches each stage has run.
+  vector<int_tp> stage_done_;
+  // The threads of the stages, which live as long as the pipeline. They
+  // run a Forward when passes_ is raised, and count the stages that
+  // finished it in stages_finished_.
+  vector<shared_ptr<boost::thread> > stage_threads_;
+  int_tp passes_;
+  int_tp num_micro_batches_;
+  int_tp stages_finished_;
+  bool stop_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+
+  DISABLE_COPY_AND_ASSIGN(NetPipeline);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_NET_PIPELINE_HPP_
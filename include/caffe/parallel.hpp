@@ -6,13 +6,11 @@
 #endif
 
 #include <boost/date_time/posix_time/posix_time.hpp>
-
-#ifdef USE_CUDA
-#ifdef USE_NCCL
-
 #include <boost/thread.hpp>
 
+#include <deque>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -23,7 +21,12 @@
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/blocking_queue.hpp"
+
+#ifdef USE_CUDA
+#ifdef USE_NCCL
 #include "caffe/util/nccl.hpp"
+#endif  // USE_NCCL
+#endif  // USE_CUDA
 
 namespace caffe {
 
@@ -55,6 +58,152 @@ class Params {
 DISABLE_COPY_AND_ASSIGN(Params);
 };
 
+// Params stored in host memory.
+template<typename Dtype>
+class CPUParams : public Params<Dtype> {
+ public:
+  explicit CPUParams(shared_ptr<Solver<Dtype> > root_solver);
+  virtual ~CPUParams();
+
+  void Configure(Solver<Dtype>* solver) const;
+
+ protected:
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+/**
+ * @brief Trains replicas of a solver in threads of one process on the CPU,
+ *        each on its own shard of the data, averaging their gradients in
+ *        host memory after every iteration.
+ *
+ * Each replica keeps its weights and gradients in one contiguous buffer.
+ * The gradients are reduced in slices, one per replica: each replica sums
+ * its slice over all replicas in blocks that stay in its cache, and then
+ * gathers the slices reduced by the others. Every element crosses the
+ * memory bus about twice, whatever the number of replicas, and the sums are
+ * taken in rank order, so that all replicas apply the same update.
+ */
+template<typename Dtype>
+class HostAllreduce : public CPUParams<Dtype>,
+                      public Solver<Dtype>::Callback {
+ public:
+  explicit HostAllreduce(shared_ptr<Solver<Dtype> > solver);
+
+  // The replicas of a Run by rank, and the barrier they meet at.
+  void set_replicas(vector<HostAllreduce<Dtype>*>* replicas,
+                    boost::barrier* barrier);
+
+  /**
+   * Copies the weights of rank 0 to the other replicas.
+   */
+  void Broadcast();
+
+  /**
+   * Trains num_replicas replicas of the solver, which must have been created
+   * with Caffe::solver_count() set to num_replicas. The CPU threads are
+   * split evenly among the replicas, and pinned to cores if pin_threads.
+   */
+  void Run(int_tp num_replicas, bool pin_threads, const char* restore);
+
+ protected:
+  void on_start() {}
+  void on_gradients_ready();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  vector<HostAllreduce<Dtype>*>* replicas_;
+  boost::barrier* barrier_;
+  // The running sum of a block of the reduced slice.
+  vector<Dtype> block_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+#ifndef _MSC_VER
+/**
+ * @brief Trains a solver in each of several processes on the CPU, each on its
+ *        own shard of the data, averaging their gradients with a ring
+ *        allreduce over Unix domain sockets.
+ *
+ * Process Caffe::solver_rank() of Caffe::solver_count() sends to the next
+ * rank and receives from the previous one. The gradients are reduced in
+ * buckets of contiguous parameters: each bucket is summed in chunks around
+ * the ring, and the chunks are then passed around once more, so that every
+ * process sends and receives about twice the bucket whatever the number of
+ * processes. With layer_wise_reduce, a communication thread reduces the
+ * buckets of the layers that have completed their backward, while the
+ * backward of the earlier layers runs.
+ */
+template<typename Dtype>
+class ProcessAllreduce : public CPUParams<Dtype>,
+                         public Solver<Dtype>::Callback,
+                         public Net<Dtype>::Callback {
+ public:
+  /**
+   * Connects to the processes of the other ranks through the sockets in dir.
+   * First create the directory (new_dir), then pass it to each process.
+   */
+  ProcessAllreduce(shared_ptr<Solver<Dtype> > solver, const string& dir);
+  ~ProcessAllreduce();
+
+  static string new_dir();
+
+  /**
+   * Copies the weights of rank 0 to the other processes.
+   */
+  void Broadcast();
+
+  /**
+   * Broadcasts the weights and trains the solver of this process.
+   */
+  void Run();
+
+ protected:
+  void on_start();
+  void run(int layer);  // Net callback
+  void on_gradients_ready();
+
+  // Queues the gradients [begin, end) for the communication thread.
+  void Queue(uint_tp begin, uint_tp end);
+  // Averages the gradients [begin, end) over the processes.
+  void Allreduce(uint_tp begin, uint_tp end);
+  void CommunicationEntry();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  int_tp rank_;
+  int_tp count_;
+  // The sockets to the next and from the previous rank.
+  int send_fd_;
+  int recv_fd_;
+  // The chunk received from the previous rank.
+  vector<Dtype> chunk_;
+  // The gradients of layers done with the last backward of the iteration
+  // start at ready_begin_, those queued at queued_begin_. The net calls run
+  // for one layer at a time, in reverse order, as it does not run its layers
+  // concurrently with after_backward callbacks; run checks that each layer
+  // of a backward precedes the previous_layer_.
+  int_tp backward_passes_;
+  int_tp previous_layer_;
+  uint_tp ready_begin_;
+  uint_tp queued_begin_;
+  // The buckets queued for the communication thread, and whether it stops.
+  std::deque<std::pair<uint_tp, uint_tp> > buckets_;
+  int_tp pending_;
+  bool stop_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  shared_ptr<boost::thread> thread_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+#endif  // !_MSC_VER
+
+#ifdef USE_CUDA
+#ifdef USE_NCCL
+
 // Params stored in GPU memory.
 template<typename Dtype>
 class GPUParams : public Params<Dtype> {
@@ -125,8 +274,9 @@ class NCCL : public GPUParams<Dtype>,
   using Params<Dtype>::diff_;
 };
 
-}  // namespace caffe
-
 #endif  // USE_NCCL
 #endif  // USE_CUDA
+
+}  // namespace caffe
+
 #endif  // header
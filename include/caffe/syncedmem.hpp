@@ -1,6 +1,8 @@
 #ifndef CAFFE_SYNCEDMEM_HPP_
 #define CAFFE_SYNCEDMEM_HPP_
 
+#include <stdint.h>
+
 #include <cstdlib>
 
 #ifdef USE_MKL
@@ -30,7 +32,8 @@ class SyncedMemory {
         own_cpu_data_(false),
         own_gpu_data_(false),
         own_zero_copy_data_(false),
-        device_(device_context) {
+        device_(device_context),
+        version_(NextVersion()) {
   }
   explicit SyncedMemory(uint_tp size, Device *device_context)
       : cpu_ptr_(NULL),
@@ -40,7 +43,8 @@ class SyncedMemory {
         own_cpu_data_(false),
         own_gpu_data_(false),
         own_zero_copy_data_(false),
-        device_(device_context) {
+        device_(device_context),
+        version_(NextVersion()) {
   }
 
   ~SyncedMemory();
@@ -50,6 +54,9 @@ class SyncedMemory {
   void set_gpu_data(vptr<void> data);
   void* mutable_cpu_data();
   vptr<void> mutable_gpu_data();
+  // Frees the data, or lets go of data set by set_cpu_data or set_gpu_data.
+  // The next access allocates it again, zeroed.
+  void clear_data();
   enum SyncedHead {
     UNINITIALIZED,
     HEAD_AT_CPU,
@@ -62,12 +69,19 @@ class SyncedMemory {
   uint_tp size() {
     return size_;
   }
+  // Changes on every mutable access and whenever the memory is replaced,
+  // and differs from the version of every other SyncedMemory, so that a
+  // cache derived from the data can tell whether it is still current.
+  uint64_t version() const {
+    return version_;
+  }
 
  private:
   void check_device();
 
   void to_cpu();
   void to_gpu();
+  static uint64_t NextVersion();
   void* cpu_ptr_;
   vptr<void> gpu_ptr_;
 
@@ -77,6 +91,7 @@ class SyncedMemory {
   bool own_gpu_data_;
   bool own_zero_copy_data_;
   Device *device_;
+  uint64_t version_;
 
 DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };
@@ -0,0 +1,146 @@
+#ifndef CAFFE_UTIL_BINARIZATION_HPP_
+#define CAFFE_UTIL_BINARIZATION_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Layers computing in one of the *_PACKED_BINARY types work on the signs of
+// their inputs and weights, +1 for values >= 0 and -1 otherwise. The signs
+// are packed along the channel axis into 64-bit words, with a set bit for
+// +1 and the unused bits of the last word of a channel run cleared, so that
+// a dot product of n signs is n - 2 * popcount(a ^ b).
+//
+// In memory all four types use 64-bit words; the width of the type only
+// sets the row padding of packed_data in a BlobProto.
+const int_tp kBinaryWordBits = 64;
+
+inline bool IsPackedBinary(const DataType type) {
+  return type >= INT8_PACKED_BINARY && type <= INT64_PACKED_BINARY;
+}
+
+// The number of 64-bit words holding the given number of signs.
+inline int_tp BinaryWords(const int_tp bits) {
+  return (bits + kBinaryWordBits - 1) / kBinaryWordBits;
+}
+
+/**
+ * @brief c = popcount(a * b^T) with XOR as the product, a an m x k and b an
+ *        n x k matrix of 64-bit words and c an m x n int32 matrix, all row
+ *        major and contiguous.
+ *
+ * Uses AVX-512 VPOPCNTDQ where available, otherwise a nibble lookup table
+ * popcount on AVX2, otherwise the scalar popcount.
+ */
+void caffe_cpu_gemm_xor_popcount(const int_tp m, const int_tp n,
+                                 const int_tp k, const uint64_t* a,
+                                 const uint64_t* b, int32_t* c);
+
+/**
+ * @brief Packs the signs of x, an outer x channels x inner array, along the
+ *        channel axis. y is outer x inner x BinaryWords(channels) words.
+ */
+template<typename Dtype>
+void caffe_cpu_pack_signs(const int_tp outer, const int_tp channels,
+                          const int_tp inner, const Dtype* x, uint64_t* y);
+
+/**
+ * @brief Inverse of caffe_cpu_pack_signs, writing +1 and -1.
+ */
+template<typename Dtype>
+void caffe_cpu_unpack_signs(const int_tp outer, const int_tp channels,
+                            const int_tp inner, const uint64_t* x, Dtype* y);
+
+/**
+ * @brief Copies the packed signs of a num x channels x inner blob into, or
+ *        out of, the blob's data.
+ *
+ * Blobs are typed by the net's Dtype, so a blob in a *_PACKED_BINARY type
+ * keeps its logical shape and stores the inner x BinaryWords(channels)
+ * words of each index n of its first axis at the start of the slot of n,
+ * i.e. at data + n * channels * inner.
+ */
+template<typename Dtype>
+void WritePackedSigns(const int_tp num, const int_tp channels,
+                      const int_tp inner, const uint64_t* words, Dtype* data);
+template<typename Dtype>
+void ReadPackedSigns(const int_tp num, const int_tp channels,
+                     const int_tp inner, const Dtype* data, uint64_t* words);
+
+/**
+ * @brief im2col of a packed height x width x words image: every row of col
+ *        holds the kernel_h x kernel_w x words input words of one output
+ *        position, with zero words for the padding.
+ */
+void caffe_cpu_im2col_binary(const uint64_t* data_im, const int_tp words,
+                             const int_tp height, const int_tp width,
+                             const int_tp kernel_h, const int_tp kernel_w,
+                             const int_tp pad_h, const int_tp pad_w,
+                             const int_tp stride_h, const int_tp stride_w,
+                             const int_tp dilation_h,
+                             const int_tp dilation_w, uint64_t* data_col);
+
+/**
+ * @brief Binary encoding of a weight matrix, the left hand side of
+ *        caffe_cpu_gemm_xor_popcount.
+ *
+ * Every row approximates the rows x channels x inner weights as the scale
+ * mean(|w|) times the signs of w, packed like caffe_cpu_pack_signs. For
+ * convolutions inner runs over the kernel taps, whose popcounts are kept to
+ * correct the zero padding words of caffe_cpu_im2col_binary.
+ */
+class BinaryWeights {
+ public:
+  BinaryWeights() : rows_(0), channels_(0), inner_(0) {}
+
+  template<typename Dtype>
+  void Binarize(const int_tp rows, const int_tp channels, const int_tp inner,
+                const Dtype* w);
+  inline bool initialized() const { return rows_ > 0; }
+  inline int_tp rows() const { return rows_; }
+  inline int_tp channels() const { return channels_; }
+  inline int_tp inner() const { return inner_; }
+  // The number of words of each row.
+  inline int_tp row_words() const { return inner_ * BinaryWords(channels_); }
+  inline const uint64_t* data() const { return &data_[0]; }
+  inline float scale(const int_tp row) const { return scales_[row]; }
+  // The number of +1 signs at index i of the inner axis of row.
+  inline int32_t popcount(const int_tp row, const int_tp i) const {
+    return popcounts_[row * inner_ + i];
+  }
+
+ private:
+  int_tp rows_;
+  int_tp channels_;
+  int_tp inner_;
+  vector<uint64_t> data_;
+  vector<float> scales_;
+  vector<int32_t> popcounts_;
+
+  DISABLE_COPY_AND_ASSIGN(BinaryWeights);
+};
+
+/**
+ * @brief Writes the data of blob to proto as INT64_PACKED_BINARY
+ *        packed_data: the signs of every index of the first axis in blob
+ *        order, with scale mean(|w|), 32x smaller than float data.
+ */
+template<typename Dtype>
+void BinaryBlobToProto(const Blob<Dtype>& blob, BlobProto* proto);
+
+/**
+ * @brief Decodes the *_PACKED_BINARY packed_data of proto into count real
+ *        values, +scale or -scale.
+ */
+template<typename Dtype>
+void BinaryBlobFromProto(const BlobProto& proto, const int_tp count,
+                         Dtype* data);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BINARIZATION_HPP_
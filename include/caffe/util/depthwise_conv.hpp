@@ -0,0 +1,49 @@
+#ifndef _CAFFE_UTIL_DEPTHWISE_CONV_HPP_
+#define _CAFFE_UTIL_DEPTHWISE_CONV_HPP_
+
+#include "caffe/definitions.hpp"
+
+namespace caffe {
+
+// Depthwise 2D convolution of num x channels images, each with its own
+// kernel_h x kernel_w filter of weights, plus the per channel bias if not
+// NULL. Computes the stencils directly, row by row, and runs the images in
+// parallel with OpenMP.
+template<typename Dtype>
+void depthwise_conv_cpu(const Dtype* data_im, const int_tp num,
+                        const int_tp channels, const int_tp height,
+                        const int_tp width, const int_tp kernel_h,
+                        const int_tp kernel_w, const int_tp pad_h,
+                        const int_tp pad_w, const int_tp stride_h,
+                        const int_tp stride_w, const int_tp dilation_h,
+                        const int_tp dilation_w, const Dtype* weights,
+                        const Dtype* bias, Dtype* data_out);
+
+// Gradient of depthwise_conv_cpu with respect to its input, which is
+// overwritten.
+template<typename Dtype>
+void depthwise_conv_backward_cpu(const Dtype* diff_out, const int_tp num,
+                                 const int_tp channels, const int_tp height,
+                                 const int_tp width, const int_tp kernel_h,
+                                 const int_tp kernel_w, const int_tp pad_h,
+                                 const int_tp pad_w, const int_tp stride_h,
+                                 const int_tp stride_w,
+                                 const int_tp dilation_h,
+                                 const int_tp dilation_w,
+                                 const Dtype* weights, Dtype* diff_im);
+
+// Gradient of depthwise_conv_cpu with respect to its weights, which is
+// accumulated into weights_diff. Runs the channels in parallel.
+template<typename Dtype>
+void depthwise_conv_weight_cpu(const Dtype* data_im, const Dtype* diff_out,
+                               const int_tp num, const int_tp channels,
+                               const int_tp height, const int_tp width,
+                               const int_tp kernel_h, const int_tp kernel_w,
+                               const int_tp pad_h, const int_tp pad_w,
+                               const int_tp stride_h, const int_tp stride_w,
+                               const int_tp dilation_h,
+                               const int_tp dilation_w, Dtype* weights_diff);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DEPTHWISE_CONV_HPP_
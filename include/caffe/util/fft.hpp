@@ -56,6 +56,10 @@ template <typename Dtype> void* caffe_cpu_fft_plan_many_dft_r2c(int rank,
     const int *n, int howmany, Dtype *in, const int *inemded, int istride,
     int idist, std::complex<Dtype> *out, const int *onembed, int ostride,
     int odist, unsigned flags);
+template <typename Dtype> void* caffe_cpu_fft_plan_many_dft_c2r(int rank,
+    const int *n, int howmany, std::complex<Dtype> *in, const int *inembed,
+    int istride, int idist, Dtype *out, const int *onembed, int ostride,
+    int odist, unsigned flags);
 template <typename Dtype> void caffe_cpu_fft_destroy_plan(void* plan);
 template <typename Dtype> void caffe_cpu_fft_execute(const void* plan);
 template <typename Dtype> void caffe_cpu_fft_execute_dft_r2c(const void* plan,
@@ -63,6 +67,23 @@ template <typename Dtype> void caffe_cpu_fft_execute_dft_r2c(const void* plan,
 template <typename Dtype> void caffe_cpu_fft_execute_dft_c2r(const void* plan,
     std::complex<Dtype> *in, Dtype  *out);
 
+// Batched 2D real transforms of howmany contiguous n0 x n1 maps, taken from
+// a process wide cache keyed by the geometry and Dtype. A plan is made with
+// FFTW_MEASURE on scratch buffers the first time its geometry is seen and
+// lives until exit, so callers must not destroy it. Run the plans with
+// caffe_cpu_fft_execute_dft_r2c and caffe_cpu_fft_execute_dft_c2r on
+// buffers from caffe_cpu_fft_malloc. In place r2c plans take real maps
+// padded to n0 x 2 * (n1 / 2 + 1).
+//
+// With USE_FFTW_THREADS the transforms run on the OpenMP thread count, or
+// on every core in builds without OpenMP. If CAFFE_FFTW_WISDOM names a
+// directory, FFTW wisdom is loaded from it before the first plan and saved
+// back after each new one, so later runs skip the measurements.
+template <typename Dtype> void* caffe_cpu_fft_cached_plan_r2c(int n0, int n1,
+    int howmany, bool in_place);
+template <typename Dtype> void* caffe_cpu_fft_cached_plan_c2r(int n0, int n1,
+    int howmany);
+
 // --- GPU ---
 
 #ifndef CPU_ONLY
@@ -0,0 +1,33 @@
+#ifndef CAFFE_UTIL_FUSE_LAYERS_HPP_
+#define CAFFE_UTIL_FUSE_LAYERS_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters with the BatchNorm and Scale layers that directly
+// follow a convolution removed and, if fuse_activations, the ReLU and the
+// residual Eltwise SUM + ReLU that follow it folded into the convolution's
+// fuse_type, as is the max pooling following an LRN across channels into the
+// LRN's. The removed BatchNorm and Scale layers are returned by the name of
+// the convolution they belong to, in order, so that their trained weights
+// can be folded into the convolution with FoldLayerWeights.
+void FuseLayers(const NetParameter& param, const bool fuse_activations,
+    NetParameter* param_fused,
+    map<string, vector<LayerParameter> >* folded_layers);
+
+// Folds the per channel affine transform of a BatchNorm or Scale layer,
+// given its trained weights, into the weights and bias of the convolution
+// it follows.
+template<typename Dtype>
+void FoldLayerWeights(const LayerParameter& folded_layer,
+    const vector<const Dtype*>& folded_weights, const int_tp num_output,
+    const int_tp weight_dim, Dtype* conv_weights, Dtype* conv_bias);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FUSE_LAYERS_HPP_
@@ -0,0 +1,122 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <atomic>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe caching allocator for host memory.
+ *
+ * Allocations are returned page aligned (CAFFE_MALLOC_PAGE_ALIGN). Up to
+ * 1MB, they are rounded up to size classes of 1 to 4 pages and then of four
+ * steps per power of two, which loses less than 20% of a block beyond the
+ * rounding to pages. Larger allocations are passed to the system allocator
+ * rounded to pages only. The size of a block is kept in a table, not in
+ * the block, so that a block takes no memory beyond its size class.
+ *
+ * Freed blocks of a size class are kept on a free list of the freeing
+ * thread, up to a few blocks per class, and beyond that on a global free
+ * list shared by all threads. Freed large blocks are kept globally, and
+ * reused for allocations at most 1/8 smaller. So the blob reallocations of
+ * variable-shape inputs and of repeatedly created nets do not go back to
+ * the system allocator.
+ *
+ * The environment variable CAFFE_HOST_CACHE_LIMIT sets the megabytes kept
+ * cached (default 1024, 0 disables caching), and CAFFE_HOST_HUGE_PAGES=1
+ * backs the whole 2MB pages of large blocks with transparent huge pages
+ * where supported.
+ */
+class HostAllocator {
+ public:
+  struct Stats {
+    // Allocations served from the cache and from the system.
+    uint_tp hits;
+    uint_tp misses;
+    // Bytes asked for by the live allocations.
+    uint_tp requested_bytes;
+    // Bytes of the blocks of the live allocations, the difference to
+    // requested_bytes being lost to internal fragmentation.
+    uint_tp allocated_bytes;
+    uint_tp peak_allocated_bytes;
+    // Bytes of the free blocks held in the cache.
+    uint_tp cached_bytes;
+  };
+
+  static HostAllocator* Get();
+
+  // Returns a page aligned block of at least size bytes.
+  void* Allocate(uint_tp size);
+  // Returns the block to the cache, or to the system if the cache is full.
+  // Returns the bytes asked for by the allocation of ptr.
+  uint_tp Free(void* ptr);
+  // Returns the blocks cached globally and by the calling thread to the
+  // system.
+  void EmptyCache();
+
+  Stats stats() const;
+  void set_cache_limit(uint_tp bytes);
+  void set_huge_pages(bool huge_pages);
+
+  // Bytes of the block a fresh allocation of size takes.
+  static uint_tp class_bytes(uint_tp size);
+  // Bytes asked for by the allocation of ptr.
+  static uint_tp size(void* ptr);
+
+ private:
+  struct Block {
+    // The size class of the block, or -1 for large blocks.
+    int_tp size_class;
+    uint_tp size;
+    uint_tp bytes;
+  };
+  // The blocks of the live allocations, sharded by address.
+  struct BlockTable {
+    boost::mutex mutex;
+    std::unordered_map<void*, Block> blocks;
+  };
+
+  struct ThreadCache {
+    ~ThreadCache();
+    vector<vector<void*> > blocks;
+  };
+
+  HostAllocator();
+
+  ThreadCache* thread_cache();
+  BlockTable* block_table(void* ptr);
+  void* SystemAllocate(uint_tp bytes);
+  void SystemFree(void* ptr);
+  void ReleaseToGlobal(ThreadCache* cache);
+
+  static const uint_tp kThreadCacheBlocks = 4;
+  static const int_tp kNumBlockTables = 64;
+
+  boost::thread_specific_ptr<ThreadCache> thread_cache_;
+  boost::mutex mutex_;
+  vector<vector<void*> > global_blocks_;
+  std::multimap<uint_tp, void*> large_blocks_;
+  BlockTable block_tables_[kNumBlockTables];
+  std::atomic<uint_tp> cache_limit_;
+  std::atomic<bool> huge_pages_;
+  std::atomic<uint_tp> hits_;
+  std::atomic<uint_tp> misses_;
+  std::atomic<uint_tp> requested_bytes_;
+  std::atomic<uint_tp> allocated_bytes_;
+  std::atomic<uint_tp> peak_allocated_bytes_;
+  std::atomic<uint_tp> cached_bytes_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
@@ -36,6 +36,28 @@ void col2im_cpu(const Dtype* data_col, const int_tp channels,
                 const int_tp dilation_h, const int_tp dilation_w,
                 Dtype* data_im);
 
+// im2col_cpu of num consecutive images into one column matrix of
+// (channels * kernel_h * kernel_w) x (num * output_h * output_w) values,
+// the columns of image n starting at column n * output_h * output_w.
+template<typename Dtype>
+void im2col_batch_cpu(const Dtype* data_im, const int_tp num,
+                      const int_tp channels, const int_tp height,
+                      const int_tp width, const int_tp kernel_h,
+                      const int_tp kernel_w, const int_tp pad_h,
+                      const int_tp pad_w, const int_tp stride_h,
+                      const int_tp stride_w, const int_tp dilation_h,
+                      const int_tp dilation_w, Dtype* data_col);
+
+// col2im_cpu of a column matrix of im2col_batch_cpu into num images.
+template<typename Dtype>
+void col2im_batch_cpu(const Dtype* data_col, const int_tp num,
+                      const int_tp channels, const int_tp height,
+                      const int_tp width, const int_tp kernel_h,
+                      const int_tp kernel_w, const int_tp pad_h,
+                      const int_tp pad_w, const int_tp stride_h,
+                      const int_tp stride_w, const int_tp dilation_h,
+                      const int_tp dilation_w, Dtype* data_im);
+
 template<typename Dtype>
 void im2col_nd_gpu(const Dtype* data_im, const int_tp num_spatial_axes,
                    const int_tp col_size, const int_tp* im_shape,
@@ -7,17 +7,36 @@
 
 namespace caffe {
 
+// Copy NetParameters with QuantizerLayers added wherever a layer consumes a
+// bottom blob in a different quantized data type than it was produced in.
 void InsertConversions(const NetParameter& param, NetParameter* param_convert);
 
-void ConfigureConvertLayer(const string& layer_name, const string& blob_name,
-    const int_tp blob_idx, const int_tp split_count, const float loss_weight,
-    LayerParameter* split_layer_param);
+void ConfigureConvertLayer(const LayerParameter& producer_param,
+    const LayerParameter& consumer_param, const string& blob_name,
+    const int_tp blob_idx, LayerParameter* convert_layer_param);
 
 string ConvertLayerName(const string& layer_name, const string& blob_name,
     const int_tp blob_idx);
 
 string ConvertBlobName(const string& layer_name, const string& blob_name,
-    const int_tp blob_idx, const int_tp split_idx);
+    const int_tp blob_idx);
+
+// Copy NetParameters with ReorderLayers added wherever a layer consumes a
+// bottom blob in a different layout than it was produced in. Layers without
+// explicit layouts get theirs resolved first: DIRECT engine convolutions
+// produce the NativeBlockedLayout where they can, elementwise layers keep the
+// layout of their input and net outputs are always NCHW.
+void InsertReorders(const NetParameter& param, NetParameter* param_reorder);
+
+void ConfigureReorderLayer(const Layout from,
+    const LayerParameter& consumer_param, const string& blob_name,
+    const int_tp blob_idx, LayerParameter* reorder_layer_param);
+
+string ReorderLayerName(const string& layer_name, const string& blob_name,
+    const int_tp blob_idx);
+
+string ReorderBlobName(const string& layer_name, const string& blob_name,
+    const int_tp blob_idx);
 
 }  // namespace caffe
 
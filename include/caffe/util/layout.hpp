@@ -0,0 +1,61 @@
+#ifndef CAFFE_UTIL_LAYOUT_HPP_
+#define CAFFE_UTIL_LAYOUT_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// The number of channels per block of a layout, 1 for NCHW.
+inline int_tp LayoutBlock(const Layout layout) {
+  switch (layout) {
+    case NCHW8C:
+      return 8;
+    case NCHW16C:
+      return 16;
+    default:
+      return 1;
+  }
+}
+
+/**
+ * @brief The blocked layout the DIRECT convolution engine computes in: the
+ *        number of floats in a vector register, NCHW16C with AVX-512 and
+ *        NCHW8C otherwise.
+ */
+Layout NativeBlockedLayout();
+
+/**
+ * @brief The shape of a blob in the given layout, from the shape of the
+ *        blob in NCHW (N, C, spatial...). Blocked layouts need C to be a
+ *        multiple of the block.
+ */
+vector<int_tp> LayoutShape(const vector<int_tp>& shape, const Layout layout);
+
+/**
+ * @brief The NCHW shape of a blob with the given shape in layout.
+ */
+vector<int_tp> PlainShape(const vector<int_tp>& shape, const Layout layout);
+
+/**
+ * @brief Reorders x, num x channels x inner in NCHW, into y in the layout
+ *        blocked by block: num x (channels / block) x inner x block.
+ */
+template<typename Dtype>
+void caffe_cpu_to_blocked(const int_tp num, const int_tp channels,
+                          const int_tp inner, const int_tp block,
+                          const Dtype* x, Dtype* y);
+
+/**
+ * @brief Inverse of caffe_cpu_to_blocked.
+ */
+template<typename Dtype>
+void caffe_cpu_from_blocked(const int_tp num, const int_tp channels,
+                            const int_tp inner, const int_tp block,
+                            const Dtype* x, Dtype* y);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_LAYOUT_HPP_
@@ -98,6 +98,13 @@ void caffe_exp(const int_tp n, const Dtype* a, Dtype* Y);
 template<typename Dtype>
 void caffe_log(const int_tp n, const Dtype* a, Dtype* Y);
 
+// Y = tanh(a) and Y = 1 / (1 + exp(-a)), vectorized for float and half.
+template<typename Dtype>
+void caffe_tanh(const int_tp n, const Dtype* a, Dtype* Y);
+
+template<typename Dtype>
+void caffe_sigmoid(const int_tp n, const Dtype* a, Dtype* Y);
+
 template<typename Dtype>
 void caffe_abs(const int_tp n, const Dtype* a, Dtype* Y);
 
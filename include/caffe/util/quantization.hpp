@@ -0,0 +1,172 @@
+#ifndef CAFFE_UTIL_QUANTIZATION_HPP_
+#define CAFFE_UTIL_QUANTIZATION_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// INT8_QUANTIZED uses signed symmetric codes in [-127, 127] for weights and
+// unsigned affine codes in [0, 255] for activations. While blobs are typed
+// by the net's Dtype, quantized activations are stored as zero point
+// centred codes (code - zero_point), so that a zero in a quantized blob is a
+// real zero, e.g. for the padding inserted by im2col.
+const int_tp kQuantizedWeightMax = 127;
+const int_tp kQuantizedActivationMax = 255;
+
+/**
+ * @brief c = a * b^T, with a an m x k int8 matrix, b an n x k uint8 matrix
+ *        and c an m x n int32 matrix, all row major and contiguous.
+ *
+ * Both operands are k-contiguous so that the inner products can be computed
+ * with the widening integer dot product instructions (AVX-512 VNNI or
+ * AVX2) without repacking.
+ */
+void caffe_cpu_gemm_s8u8s32(const int_tp m, const int_tp n, const int_tp k,
+                            const int8_t* a, const uint8_t* b, int32_t* c);
+
+/**
+ * @brief Computes an affine uint8 quantization covering [min_value,
+ *        max_value]. The range is extended to include 0 so that zero is
+ *        exactly representable.
+ */
+void ComputeActivationQuantization(float min_value, float max_value,
+                                   QuantizationParameter* param);
+
+// Per-tensor scale and zero point of an activation quantization.
+float ActivationScale(const QuantizationParameter& param);
+int_tp ActivationZeroPoint(const QuantizationParameter& param);
+
+/**
+ * @brief Gets the quantization of the n bottom values x of a layer computing
+ *        in INT8_QUANTIZED: its bottom_quantization if set, otherwise one
+ *        computed from the range of x.
+ */
+template<typename Dtype>
+void GetBottomQuantization(const LayerParameter& param, const int_tp n,
+                           const Dtype* x, QuantizationParameter* quantization);
+
+/**
+ * @brief Quantizes n real values (or, if is_code, already quantized zero
+ *        point centred codes) to the uint8 activation encoding.
+ */
+template<typename Dtype>
+void caffe_cpu_quantize_activations(const int_tp n, const Dtype* x,
+                                    const bool is_code,
+                                    const QuantizationParameter& param,
+                                    uint8_t* y);
+
+/**
+ * @brief Like caffe_cpu_quantize_activations, but also transposes the
+ *        row major rows x cols input, as needed to feed an im2col buffer
+ *        to caffe_cpu_gemm_s8u8s32.
+ */
+template<typename Dtype>
+void caffe_cpu_quantize_activations_transposed(const int_tp rows,
+                                               const int_tp cols,
+                                               const Dtype* x,
+                                               const bool is_code,
+                                               const QuantizationParameter&
+                                               param, uint8_t* y);
+
+/**
+ * @brief Per-row symmetric int8 encoding of a weight matrix, the left hand
+ *        side of caffe_cpu_gemm_s8u8s32.
+ *
+ * Besides the codes, it keeps the per-row scales and code sums, the latter
+ * to remove the activation zero point from the int32 accumulators.
+ */
+class QuantizedWeights {
+ public:
+  QuantizedWeights() : rows_(0), cols_(0) {}
+
+  /**
+   * @brief Quantizes the row major rows x cols matrix w, or, if transposed,
+   *        the matrix stored column major (i.e. w^T is given).
+   */
+  template<typename Dtype>
+  void Quantize(const int_tp rows, const int_tp cols, const Dtype* w,
+                const bool transposed);
+  inline bool initialized() const { return rows_ > 0; }
+  inline int_tp rows() const { return rows_; }
+  inline int_tp cols() const { return cols_; }
+  inline const int8_t* data() const { return &data_[0]; }
+  inline float scale(const int_tp row) const { return scales_[row]; }
+  inline int32_t row_sum(const int_tp row) const { return row_sums_[row]; }
+
+ private:
+  int_tp rows_;
+  int_tp cols_;
+  vector<int8_t> data_;
+  vector<float> scales_;
+  vector<int32_t> row_sums_;
+
+  DISABLE_COPY_AND_ASSIGN(QuantizedWeights);
+};
+
+/**
+ * @brief Histogram of the magnitudes of a blob over many forward passes, to
+ *        calibrate the quantization of the blob.
+ *
+ * The histogram covers [0, num_bins * bin_width). Whenever a larger value
+ * arrives, adjacent bins are merged and the bin width doubles, so that the
+ * calibration data is only passed over once.
+ */
+class ActivationHistogram {
+ public:
+  explicit ActivationHistogram(const int_tp num_bins = 2048);
+
+  template<typename Dtype>
+  void Add(const int_tp n, const Dtype* x);
+
+  /**
+   * @brief Returns the smallest clipping threshold below which the given
+   *        percentage of the values lie.
+   */
+  float PercentileThreshold(const float percentile) const;
+  /**
+   * @brief Returns the clipping threshold which minimizes the KL-divergence
+   *        between the clipped distribution and its quantization to
+   *        num_levels levels.
+   */
+  float KLThreshold(const int_tp num_levels) const;
+  /**
+   * @brief Gets the activation quantization for clipping at threshold:
+   *        [-threshold, threshold] if any negative values were seen,
+   *        otherwise [0, threshold].
+   */
+  void GetQuantization(const float threshold,
+                       QuantizationParameter* param) const;
+
+  inline bool has_negative() const { return has_negative_; }
+  inline int64_t count() const { return count_; }
+
+ private:
+  vector<int64_t> bins_;
+  float bin_width_;
+  bool has_negative_;
+  int64_t count_;
+};
+
+/**
+ * @brief Writes the data of blob to proto as INT8_QUANTIZED packed_data,
+ *        with one symmetric scale per index of the first axis.
+ */
+template<typename Dtype>
+void QuantizedBlobToProto(const Blob<Dtype>& blob, BlobProto* proto);
+
+/**
+ * @brief Decodes the INT8_QUANTIZED packed_data of proto into count real
+ *        values.
+ */
+template<typename Dtype>
+void QuantizedBlobFromProto(const BlobProto& proto, const int_tp count,
+                            Dtype* data);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_QUANTIZATION_HPP_
@@ -0,0 +1,89 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Elements per chunk of a parallel_for over an elementwise loop, enough to
+// amortize scheduling the chunk.
+const int_tp kParallelElementGrain = 16384;
+
+/**
+ * @brief A work-stealing pool of CPU threads.
+ *
+ * Each worker owns a deque of tasks. It runs its newest task first and, once
+ * its deque is empty, steals the oldest task of another worker. A thread
+ * waiting for the tasks it scheduled runs queued tasks meanwhile, so tasks
+ * can schedule and wait for tasks of their own, as a layer running on the
+ * pool does when it calls parallel_for.
+ *
+ * Workers run OpenMP regions and, with MKL, BLAS calls single threaded, so
+ * that parallelism on the pool does not multiply with theirs, and take the
+ * pool as their Caffe::thread_pool(). The process wide pool is
+ * Caffe::thread_pool() of threads that did not set another. OpenBLAS has no
+ * thread count per thread, see SerialBlasScope.
+ */
+class ThreadPool {
+ public:
+  typedef std::function<void()> Task;
+
+  // Starts num_threads - 1 workers; the thread calling parallel_for or Wait
+  // is the last. Unless cpus is empty, worker i is pinned to the core
+  // cpus[i % cpus.size()], counting from 1, as cpus[0] is left to the
+  // calling thread.
+  ThreadPool(int_tp num_threads, const vector<int_tp>& cpus);
+  ~ThreadPool();
+
+  int_tp num_threads() const;
+
+  // Calls body(chunk_begin, chunk_end) on disjoint chunks of [begin, end),
+  // of at least grain indices unless the range is smaller, and returns once
+  // all have been processed.
+  void parallel_for(int_tp begin, int_tp end, int_tp grain,
+                    const std::function<void(int_tp, int_tp)>& body);
+
+  // Queues task to run on a worker and returns.
+  void Schedule(const Task& task);
+  // Runs queued tasks until pending, decremented by the tasks waited for
+  // with Done, reaches 0, sleeping while there are none to run.
+  void Wait(const std::atomic<int_tp>& pending);
+  // Decrements pending, waking the threads waiting for it once it reaches 0.
+  void Done(std::atomic<int_tp>* pending);
+
+  // Pins the calling thread to the core cpu, where supported.
+  static void PinCallingThread(int_tp cpu);
+
+ private:
+  class Impl;
+  shared_ptr<Impl> impl_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+/**
+ * @brief Makes OpenBLAS run single threaded while an instance lives.
+ *
+ * OpenBLAS takes one thread count for the whole process, which the workers
+ * of a pool can not lower for themselves as they do for MKL and OpenMP. So
+ * code calling BLAS from several threads at once, such as layers running
+ * concurrently on a pool, holds an instance, lest each of N threads run N
+ * BLAS threads. The last instance to go restores the thread count. Without
+ * OpenBLAS, it does nothing.
+ */
+class SerialBlasScope {
+ public:
+  SerialBlasScope();
+  ~SerialBlasScope();
+
+ private:
+  DISABLE_COPY_AND_ASSIGN(SerialBlasScope);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
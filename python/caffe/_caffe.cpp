@@ -570,12 +570,15 @@ BOOST_PYTHON_MODULE(_caffe) {
             bp::arg("level")=0, bp::arg("stages")=bp::object())))
     .def("_forward", &ForwardFromTo_NoGIL)
     .def("_backward", &BackwardFromTo_NoGIL)
+    .def("prepare_backward", &Net<Dtype>::PrepareBackward)
     .def("reshape", &Net<Dtype>::Reshape)
     .def("clear_param_diffs", &Net<Dtype>::ClearParamDiffs)
     // The cast is to select a particular overload.
     .def("copy_from", static_cast<void (Net<Dtype>::*)(const string)>(
         &Net<Dtype>::CopyTrainedLayersFrom))
     .def("share_with", &Net<Dtype>::ShareTrainedLayersWith)
+    .def("set_profile_memory", &Net<Dtype>::set_profile_memory)
+    .def("memory_report", &Net<Dtype>::MemoryReport)
     .add_property("_blob_loss_weights", bp::make_function(
         &Net<Dtype>::blob_loss_weights, bp::return_internal_reference<>()))
     .def("_bottom_ids", bp::make_function(&Net<Dtype>::bottom_ids,
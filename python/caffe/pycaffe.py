@@ -178,6 +178,8 @@ def _Net_backward(self, diffs=None, start=None, end=None, **kwargs):
     if kwargs:
         if set(kwargs.keys()) != set(self.outputs):
             raise Exception('Top diff arguments do not match net outputs.')
+        # Share the diffs that backward uses before writing the top diffs.
+        self.prepare_backward()
         # Set top diffs according to defined shapes and make arrays single and
         # C-contiguous as Caffe expects.
         for top, diff in six.iteritems(kwargs):
@@ -166,6 +166,47 @@ class TestNet(unittest.TestCase):
                 self.assertEqual(abs(self.net.params[name][i].data
                     - net2.params[name][i].data).sum(), 0)
 
+class TestTestPhaseDiffs(unittest.TestCase):
+    """Blobs that the backward of a TEST net does not use get no diff until
+    it is accessed or backward is called."""
+
+    TEST_NET = """
+name: "test_phase_diffs"
+layer { type: 'DummyData' name: 'data' top: 'data'
+  dummy_data_param { num: 5 channels: 2 height: 3 width: 4
+    data_filler { type: 'gaussian' std: 1 } } }
+layer { type: 'ReLU' name: 'relu' bottom: 'data' top: 'relu' }
+layer { type: 'InnerProduct' name: 'ip' bottom: 'relu' top: 'ip'
+  loss_weight: 1
+  inner_product_param { num_output: 3
+    weight_filler { type: 'gaussian' std: 1 } } }
+"""
+
+    def setUp(self):
+        self.f = tempfile.NamedTemporaryFile(mode='w+', delete=False)
+        self.f.write(self.TEST_NET)
+        self.f.close()
+        self.net = caffe.Net(self.f.name, caffe.TEST)
+
+    def tearDown(self):
+        os.remove(self.f.name)
+
+    def test_diff(self):
+        data = self.net.blobs['data']
+        self.assertEqual(data.diff.shape, data.data.shape)
+
+    def test_backward(self):
+        self.net.forward()
+        self.net.clear_param_diffs()
+        ip = self.net.blobs['ip']
+        top_diff = np.random.uniform(size=ip.data.shape).astype(np.float32)
+        diffs = self.net.backward(diffs=['relu'], ip=top_diff)
+        self.assertIn('relu', diffs)
+        np.testing.assert_allclose(ip.diff, top_diff)
+        relu = self.net.blobs['relu'].data.reshape(ip.data.shape[0], -1)
+        np.testing.assert_allclose(self.net.params['ip'][0].diff,
+                                   np.dot(top_diff.T, relu), rtol=1e-3)
+
 class TestLevels(unittest.TestCase):
 
     TEST_NET = """
@@ -4,39 +4,25 @@
 #include <vector>
 
 #include "caffe/backend/device.hpp"
+#include "caffe/util/host_allocator.hpp"
 
 namespace caffe {
 
-Device::Device() {}
+Device::Device() : memory_usage_(0), peak_memory_usage_(0) {}
 
 void Device::Init() {}
 
 string Device::name() { return "CPU"; }
 
 void Device::MallocMemHost(void** ptr, uint_tp size) {
-#ifdef USE_MKL
-  *ptr = mkl_malloc(size ? size : 1, 64);
-#else
-#ifdef _MSC_VER
-  *ptr = malloc(((size - 1) / CAFFE_MALLOC_CACHE_ALIGN + 1)
-                * CAFFE_MALLOC_CACHE_ALIGN);
-#else
-  CHECK_EQ(0, posix_memalign(ptr, CAFFE_MALLOC_PAGE_ALIGN,
-           ((size - 1) / CAFFE_MALLOC_CACHE_ALIGN + 1)
-           * CAFFE_MALLOC_CACHE_ALIGN))
-              << "Host memory allocation error of size: "
-              << size << " b";
-#endif  // _MSC_VER
-#endif  // USE_MKL
-  CHECK(*ptr) << "host allocation of size " << size << " failed";
+  *ptr = HostAllocator::Get()->Allocate(size);
+  // Host memory is the device memory of the CPU. As for GPUs, the requested
+  // bytes are counted, which lets the bytes held by blobs be compared.
+  increase_memory_usage(size);
 }
 
 void Device::FreeMemHost(void* ptr) {
-#ifdef USE_MKL
-  mkl_free(ptr);
-#else
-  free(ptr);
-#endif  // USE_MKL
+  decrease_memory_usage(HostAllocator::Get()->Free(ptr));
 }
 
 uint_tp Device::num_queues() {
@@ -125,18 +111,60 @@ uint_tp Device::peak_memory_usage() {
 }
 
 void Device::increase_memory_usage(uint_tp bytes) {
-  memory_usage_ += bytes;
-  if (memory_usage_ > peak_memory_usage_) {
-    peak_memory_usage_ = memory_usage_;
+  const uint_tp usage = memory_usage_ += bytes;
+  uint_tp peak = peak_memory_usage_;
+  while (usage > peak &&
+         !peak_memory_usage_.compare_exchange_weak(peak, usage)) {
   }
+  ThreadMemoryUsage* thread = thread_usage();
+  thread->usage += bytes;
+  thread->peak = std::max(thread->peak, thread->usage);
 }
 
 void Device::decrease_memory_usage(uint_tp bytes) {
   memory_usage_ -= bytes;
+  thread_usage()->usage -= bytes;
 }
 
 void Device::reset_peak_memory_usage() {
-  peak_memory_usage_ = memory_usage_;
+  peak_memory_usage_ = memory_usage_.load();
+}
+
+void Device::set_peak_memory_usage(uint_tp bytes) {
+  peak_memory_usage_ = std::max(bytes, memory_usage_.load());
+}
+
+Device::ThreadMemoryUsage* Device::thread_usage() {
+  ThreadMemoryUsage* thread = thread_usage_.get();
+  if (!thread) {
+    thread = new ThreadMemoryUsage();
+    thread->usage = 0;
+    thread->peak = 0;
+    thread_usage_.reset(thread);
+  }
+  return thread;
+}
+
+int_tp Device::thread_memory_usage() {
+  return thread_usage()->usage;
+}
+
+int_tp Device::thread_peak_memory_usage() {
+  return thread_usage()->peak;
+}
+
+void Device::reset_thread_peak_memory_usage() {
+  ThreadMemoryUsage* thread = thread_usage();
+  thread->peak = thread->usage;
+}
+
+void Device::set_thread_peak_memory_usage(int_tp bytes) {
+  ThreadMemoryUsage* thread = thread_usage();
+  thread->peak = std::max(bytes, thread->usage);
+}
+
+HostAllocator::Stats Device::host_memory_stats() {
+  return HostAllocator::Get()->stats();
 }
 
 
@@ -2,6 +2,7 @@
 #include "caffe/backend/opencl/ocl_device_program.hpp"
 #include "caffe/backend/opencl/caffe_opencl.hpp"
 #include "caffe/backend/opencl/ocl_dev_ptr.hpp"
+#include "caffe/util/host_allocator.hpp"
 
 namespace caffe {
 
@@ -91,29 +92,11 @@ string OclDevice::name() {
 }
 
 void OclDevice::MallocMemHost(void** ptr, uint_tp size) {
-#ifdef USE_MKL
-  *ptr = mkl_malloc(size ? size : 1, 64);
-#else
-#ifdef _MSC_VER
-  *ptr = malloc(((size - 1) / CAFFE_MALLOC_CACHE_ALIGN + 1)
-                * CAFFE_MALLOC_CACHE_ALIGN);
-#else
-  CHECK_EQ(0, posix_memalign(ptr, CAFFE_MALLOC_PAGE_ALIGN,
-           ((size - 1) / CAFFE_MALLOC_CACHE_ALIGN + 1)
-           * CAFFE_MALLOC_CACHE_ALIGN))
-              << "Host memory allocation error of size: "
-              << size << " b";
-#endif  // _MSC_VER
-#endif  // USE_MKL
-  CHECK(*ptr) << "Host allocation of size " << size << " failed";
+  *ptr = HostAllocator::Get()->Allocate(size);
 }
 
 void OclDevice::FreeMemHost(void* ptr) {
-#ifdef USE_MKL
-  mkl_free(ptr);
-#else
-  free(ptr);
-#endif  // USE_MKL
+  HostAllocator::Get()->Free(ptr);
 }
 
 vptr<void> OclDevice::MallocMemDevice(uint_tp size, void** ptr,
@@ -6,7 +6,9 @@
 #include "caffe/backend/device.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
+#include "caffe/util/binarization.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantization.hpp"
 
 namespace caffe {
 
@@ -53,7 +55,11 @@ bool Blob<Dtype>::Reshape(const vector<uint_tp>& shape,
   if (count_ > capacity_) {
     capacity_ = count_;
     data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype), device_));
-    diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype), device_));
+    if (need_diff_) {
+      diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype), device_));
+    } else {
+      diff_.reset();
+    }
     return true;
   }
   return false;
@@ -92,14 +98,14 @@ Blob<Dtype>::Blob(const uint_tp num, const uint_tp channels,
                   const uint_tp height, const uint_tp width,
                   Device *device_context)
     // capacity_ must be initialized before calling Reshape
-    : capacity_(0), device_(device_context) {
+    : capacity_(0), need_diff_(true), device_(device_context) {
   Reshape(num, channels, height, width);
 }
 
 template<typename Dtype>
 Blob<Dtype>::Blob(const vector<uint_tp>& shape, Device *device_context)
     // capacity_ must be initialized before calling Reshape
-    : capacity_(0), device_(device_context) {
+    : capacity_(0), need_diff_(true), device_(device_context) {
   Reshape(shape);
 }
 
@@ -122,7 +128,11 @@ void Blob<Dtype>::set_cpu_data(Dtype* data) {
   size_t size = count_ * sizeof(Dtype);
   if (data_->size() != size) {
     data_.reset(new SyncedMemory(size, device_));
-    diff_.reset(new SyncedMemory(size, device_));
+    if (need_diff_) {
+      diff_.reset(new SyncedMemory(size, device_));
+    } else {
+      diff_.reset();
+    }
   }
   data_->set_cpu_data(data);
 }
@@ -139,20 +149,24 @@ void Blob<Dtype>::set_gpu_data(vptr<Dtype> data) {
   size_t size = count_ * sizeof(Dtype);
   if (data_->size() != size) {
     data_.reset(new SyncedMemory(size, device_));
-    diff_.reset(new SyncedMemory(size, device_));
+    if (need_diff_) {
+      diff_.reset(new SyncedMemory(size, device_));
+    } else {
+      diff_.reset();
+    }
   }
   data_->set_gpu_data(data);
 }
 
 template <typename Dtype>
 const Dtype* Blob<Dtype>::cpu_diff() const {
-  CHECK(diff_);
+  InitDiff();
   return (const Dtype*) diff_->cpu_data();
 }
 
 template<typename Dtype>
 vptr<const Dtype> Blob<Dtype>::gpu_diff() const {
-  CHECK(diff_);
+  InitDiff();
   return diff_->gpu_data();
 }
 
@@ -170,13 +184,13 @@ vptr<Dtype> Blob<Dtype>::mutable_gpu_data() {
 
 template<typename Dtype>
 Dtype* Blob<Dtype>::mutable_cpu_diff() {
-  CHECK(diff_);
+  InitDiff();
   return static_cast<Dtype*>(diff_->mutable_cpu_data());
 }
 
 template<typename Dtype>
 vptr<Dtype> Blob<Dtype>::mutable_gpu_diff() {
-  CHECK(diff_);
+  InitDiff();
   return diff_->mutable_gpu_data();
 }
 
@@ -189,18 +203,40 @@ void Blob<Dtype>::ShareData(const Blob& other) {
 template<typename Dtype>
 void Blob<Dtype>::ShareDiff(const Blob& other) {
   CHECK_EQ(count_, other.count());
-  diff_ = other.diff();
+  // The other blob may not need a diff either.
+  diff_ = other.diff_;
+}
+
+template<typename Dtype>
+void Blob<Dtype>::InitDiff() const {
+  if (!diff_ && data_) {
+    diff_.reset(new SyncedMemory(data_->size(), device_));
+  }
+  CHECK(diff_);
+}
+
+template<typename Dtype>
+void Blob<Dtype>::set_need_diff(bool need_diff) {
+  need_diff_ = need_diff;
+  if (!need_diff_) {
+    diff_.reset();
+  } else if (data_) {
+    InitDiff();
+  }
 }
 
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
-// Blob<uint_tp> or Blob<uint_tp>.
+// Blob<uint_tp>, Blob<int_tp> or Blob<uint8_t>.
 template<> void Blob<uint_tp>::Update() {
   NOT_IMPLEMENTED;
 }
 template<> void Blob<int_tp>::Update() {
   NOT_IMPLEMENTED;
 }
+template<> void Blob<uint8_t>::Update() {
+  NOT_IMPLEMENTED;
+}
 
 template<typename Dtype>
 void Blob<Dtype>::Update() {
@@ -240,6 +276,11 @@ template<> int_tp Blob<int_tp>::asum_data() const {
   return 0;
 }
 
+template<> uint8_t Blob<uint8_t>::asum_data() const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
 template<typename Dtype>
 Device *Blob<Dtype>::get_device() {
   return device_;
@@ -281,6 +322,11 @@ template<> int_tp Blob<int_tp>::asum_diff() const {
   return 0;
 }
 
+template<> uint8_t Blob<uint8_t>::asum_diff() const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
 template<typename Dtype>
 Dtype Blob<Dtype>::asum_diff() const {
   if (!diff_) {
@@ -317,6 +363,11 @@ template<> int_tp Blob<int_tp>::sumsq_data() const {
   return 0;
 }
 
+template<> uint8_t Blob<uint8_t>::sumsq_data() const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
 template<typename Dtype>
 Dtype Blob<Dtype>::sumsq_data() const {
   Dtype sumsq;
@@ -361,6 +412,11 @@ template<> int_tp Blob<int_tp>::sumsq_diff() const {
   return 0;
 }
 
+template<> uint8_t Blob<uint8_t>::sumsq_diff() const {
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
 template<typename Dtype>
 Dtype Blob<Dtype>::sumsq_diff() const {
   Dtype sumsq;
@@ -402,6 +458,10 @@ template<> void Blob<int_tp>::scale_data(int_tp scale_factor) {
   NOT_IMPLEMENTED;
 }
 
+template<> void Blob<uint8_t>::scale_data(uint8_t scale_factor) {
+  NOT_IMPLEMENTED;
+}
+
 template<typename Dtype>
 void Blob<Dtype>::scale_data(Dtype scale_factor) {
   Dtype* data;
@@ -440,6 +500,10 @@ template<> void Blob<int_tp>::scale_diff(int_tp scale_factor) {
   NOT_IMPLEMENTED;
 }
 
+template<> void Blob<uint8_t>::scale_diff(uint8_t scale_factor) {
+  NOT_IMPLEMENTED;
+}
+
 template<typename Dtype>
 void Blob<Dtype>::scale_diff(Dtype scale_factor) {
   Dtype* diff;
@@ -552,7 +616,11 @@ void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
   }
   // copy data
   Dtype* data_vec = mutable_cpu_data();
-  if (proto.double_data_size() > 0) {
+  if (proto.data_type() == INT8_QUANTIZED) {
+    QuantizedBlobFromProto(proto, count_, data_vec);
+  } else if (IsPackedBinary(proto.data_type())) {
+    BinaryBlobFromProto(proto, count_, data_vec);
+  } else if (proto.double_data_size() > 0) {
     CHECK_EQ(count_, proto.double_data_size());
     for (uint_tp i = 0; i < count_; ++i) {
       data_vec[i] = proto.double_data(i);
@@ -641,6 +709,7 @@ void Blob<float>::ToProto(BlobProto* proto, bool write_diff) const {
 INSTANTIATE_CLASS_1T(Blob);
 template class Blob<int_tp>;
 template class Blob<uint_tp>;
+template class Blob<uint8_t>;
 
 }  // namespace caffe
 
@@ -7,6 +7,7 @@
 #include <boost/thread.hpp>
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cmath>
 #include <cstdio>
@@ -21,6 +22,19 @@
 #include "caffe/backend/hip/hip_device.hpp"
 #include "caffe/backend/opencl/ocl_device.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef USE_MKL
+#include <mkl.h>
+#endif
+
+#ifdef USE_OPENBLAS
+extern "C" void openblas_set_num_threads(int num_threads);
+#endif
 
 #if defined(USE_OPENCL)
   #if defined(USE_CLBLAS)
@@ -58,6 +72,71 @@ Caffe& Caffe::Get() {
   return *(thread_instance_.get());
 }
 
+// The CPU thread pool is shared by all threads.
+static boost::mutex thread_pool_mutex_;
+static shared_ptr<ThreadPool> global_thread_pool_;
+
+static int_tp DefaultCPUThreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return std::max(boost::thread::hardware_concurrency(), 1u);
+#endif
+}
+
+ThreadPool& Caffe::thread_pool() {
+  if (Get().thread_pool_) {
+    return *Get().thread_pool_;
+  }
+  boost::mutex::scoped_lock lock(thread_pool_mutex_);
+  if (!global_thread_pool_) {
+    global_thread_pool_.reset(new ThreadPool(DefaultCPUThreads(),
+                                             vector<int_tp>()));
+  }
+  return *global_thread_pool_;
+}
+
+void Caffe::set_cpu_threads(int_tp num_threads, bool pin_threads,
+                            int_tp first_cpu) {
+  CHECK_GE(num_threads, 0);
+  if (num_threads == 0) {
+    num_threads = DefaultCPUThreads();
+  }
+  vector<int_tp> cpus;
+  if (pin_threads) {
+    const int_tp num_cpus = std::max(boost::thread::hardware_concurrency(),
+                                     1u);
+    for (int_tp i = 0; i < num_threads; ++i) {
+      cpus.push_back((first_cpu + i) % num_cpus);
+    }
+    // The calling thread takes the first core.
+    ThreadPool::PinCallingThread(cpus[0]);
+  }
+  {
+    boost::mutex::scoped_lock lock(thread_pool_mutex_);
+    global_thread_pool_.reset();
+    global_thread_pool_.reset(new ThreadPool(num_threads, cpus));
+  }
+  // BLAS and OpenMP called outside the pool use as many threads; the
+  // workers of the pool call them single threaded, and OpenBLAS, which has
+  // no thread count per thread, while a SerialBlasScope lives.
+#ifdef _OPENMP
+  omp_set_num_threads(num_threads);
+#endif
+#ifdef USE_MKL
+  mkl_set_num_threads(num_threads);
+#endif
+#ifdef USE_OPENBLAS
+  openblas_set_num_threads(num_threads);
+#endif
+  LOG(INFO) << "Using " << num_threads << " CPU threads"
+            << (pin_threads ? ", pinned to cores" : "");
+}
+
+int_tp Caffe::cpu_threads() {
+  return thread_pool().num_threads();
+}
+
 // random seeding
 int64_t cluster_seedgen(void) {
   int64_t s, seed, pid;
@@ -129,11 +208,13 @@ Caffe::Caffe(const Caffe &obj)
       mode_(Caffe::CPU),
       cpu_device_(new Device()),
       default_device_(cpu_device_.get()),
-      solver_count_(1) {
+      solver_count_(1), thread_pool_(NULL) {
   mode_ = obj.mode_;
   default_device_ = obj.default_device_;
   cpu_device_ = obj.cpu_device_;
   solver_count_ = obj.solver_count_;
+  solver_rank_ = obj.solver_rank_;
+  multiprocess_ = obj.multiprocess_;
 }
 
 void Caffe::SelectDevice(int id, bool listId) {
@@ -194,7 +275,8 @@ Caffe::Caffe() : random_generator_(),
                  mode_(Caffe::CPU),
                  cpu_device_(new Device(-1, -1, Backend::BACKEND_CPU)),
                  default_device_(cpu_device_.get()),
-                 solver_count_(1), solver_rank_(0), multiprocess_(false) { }
+                 solver_count_(1), solver_rank_(0), multiprocess_(false),
+                 thread_pool_(NULL) { }
 
 Caffe::~Caffe() {}
 
@@ -244,6 +326,8 @@ Caffe::RNG::RNG() : generator_(new Generator()) {}
 
 Caffe::RNG::RNG(size_t seed) : generator_(new Generator(seed)) {}
 
+Caffe::RNG::RNG(const RNG& other) : generator_(other.generator_) {}
+
 Caffe::RNG& Caffe::RNG::operator=(const RNG& other) {
   generator_ = other.generator_;
   return *this;
@@ -266,7 +350,8 @@ Caffe::Caffe()
       mode_(Caffe::CPU),
       cpu_device_(new Device()),
       default_device_(cpu_device_.get()),
-    solver_count_(1), solver_rank_(0), multiprocess_(false) {
+    solver_count_(1), solver_rank_(0), multiprocess_(false),
+    thread_pool_(NULL) {
 }
 
 Caffe::~Caffe() {
@@ -626,8 +711,12 @@ Caffe::RNG::RNG(size_t seed)
     : generator_(new Generator(seed)) {
 }
 
+Caffe::RNG::RNG(const RNG& other)
+    : generator_(other.generator_) {
+}
+
 Caffe::RNG& Caffe::RNG::operator=(const RNG& other) {
-  generator_.reset(other.generator_.get());
+  generator_ = other.generator_;
   return *this;
 }
 
@@ -8,9 +8,11 @@
 
 #include "caffe/layer.hpp"
 #include "caffe/layer_factory.hpp"
+#include "caffe/layers/conv_direct_layer.hpp"
 #include "caffe/layers/conv_fft_layer.hpp"
 #include "caffe/layers/conv_layer.hpp"
 #include "caffe/layers/conv_spatial_layer.hpp"
+#include "caffe/layers/conv_winograd_layer.hpp"
 #include "caffe/layers/deconv_layer.hpp"
 #include "caffe/layers/lrn_layer.hpp"
 #include "caffe/layers/pooling_layer.hpp"
@@ -172,6 +174,14 @@ shared_ptr<Layer<Dtype> > GetConvolutionLayer(const LayerParameter& param) {
              (new ConvolutionLayerFFT<Dtype>(param));
   }
 #endif  // USE_FFT
+  if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    return shared_ptr<Layer<Dtype> >
+             (new ConvolutionLayerWinograd<Dtype>(param));
+  }
+  if (engine == ConvolutionParameter_Engine_DIRECT) {
+    return shared_ptr<Layer<Dtype> >
+             (new ConvolutionLayerDirect<Dtype>(param));
+  }
 
   if (engine == ConvolutionParameter_Engine_CUDNN
       && (Caffe::GetDevice(param.device(), true)->backend() == BACKEND_OPENCL
@@ -295,8 +305,10 @@ shared_ptr<Layer<Dtype> > GetLRNLayer(const LayerParameter& param) {
 #endif
   }
 
+  // Only the Caffe engine fuses the following pooling.
   if (engine == LRNParameter_Engine_CAFFE
-      || Caffe::GetDevice(param.device(), true)->backend() == BACKEND_OPENCL) {
+      || Caffe::GetDevice(param.device(), true)->backend() == BACKEND_OPENCL
+      || param.lrn_param().fuse_type() != LRNParameter_FuseType_UNFUSED) {
     return shared_ptr<Layer<Dtype> >(new LRNLayer<Dtype>(param));
 #ifdef USE_CUDNN
   } else if (engine == LRNParameter_Engine_CUDNN) {
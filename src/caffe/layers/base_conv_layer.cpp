@@ -13,6 +13,16 @@ void BaseConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(
             const vector<Blob<MItype>*>& bottom,
             const vector<Blob<MOtype>*>& top) {
   use_colbuffer_ = true;
+  quantized_ = this->layer_param_.compute_data_type() == INT8_QUANTIZED;
+  if (quantized_) {
+    CHECK(!reverse_dimensions())
+        << "INT8_QUANTIZED is not supported by deconvolution.";
+    CHECK_EQ(this->phase_, TEST)
+        << "INT8_QUANTIZED convolution is only supported for inference.";
+    CHECK_NE(this->layer_param_.top_data_type(), INT8_QUANTIZED)
+        << "INT8_QUANTIZED convolution outputs dequantized values.";
+  }
+  binary_ = IsPackedBinary(this->layer_param_.compute_data_type());
 
   // Configure the kernel size, padding, stride, and inputs.
   ConvolutionParameter conv_param = this->layer_param_.convolution_param();
@@ -136,6 +146,19 @@ void BaseConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(
     conv_out_channels_ = num_output_;
     conv_in_channels_ = channels_;
   }
+  if (binary_) {
+    CHECK(!reverse_dimensions())
+        << "Binary computation is not supported by deconvolution.";
+    CHECK_EQ(this->phase_, TEST)
+        << "Binary convolution is only supported for inference.";
+    CHECK_EQ(num_spatial_axes_, 2)
+        << "Binary convolution is only supported for 2D inputs.";
+    CHECK_EQ(group_, 1)
+        << "Binary convolution packs all channels and has no groups.";
+    CHECK(this->layer_param_.top_data_type() == FLOAT ||
+          this->layer_param_.top_data_type() == DOUBLE)
+        << "Binary convolution outputs real values.";
+  }
   // Handle the parameters: weights and biases.
   // - blobs_[0] holds the filter weights
   // - blobs_[1] holds the biases (optional)
@@ -260,6 +283,18 @@ void BaseConvolutionLayer<Dtype, MItype, MOtype>::Reshape(
 
   bottom_dim_ = bottom[0]->count(channel_axis_);
   top_dim_ = top[0]->count(channel_axis_);
+  // The CPU passes im2col as many images at once as fit into the budget,
+  // counting their columns and outputs.
+  col_batch_ = 1;
+  const uint_tp col_buffer_budget =
+      this->layer_param_.convolution_param().col_buffer_budget();
+  if (col_buffer_budget > 0 && !reverse_dimensions() && !force_nd_im2col_ &&
+      num_spatial_axes_ == 2 && !quantized_ && !binary_) {
+    const uint_tp image_bytes = (kernel_dim_ * group_ + conv_out_channels_) *
+        conv_out_spatial_dim_ * sizeof(Dtype);
+    col_batch_ = std::max(static_cast<int_tp>(1), std::min(num_,
+        static_cast<int_tp>(col_buffer_budget / image_bytes)));
+  }
   num_kernels_im2col_ = conv_in_channels_ * conv_out_spatial_dim_;
   num_kernels_col2im_ = reverse_dimensions() ? top_dim_ : bottom_dim_;
 
@@ -284,6 +319,14 @@ void BaseConvolutionLayer<Dtype, MItype, MOtype>::forward_cpu_gemm(
                                                    const Dtype* weights,
                                                    Dtype* output,
                                                    bool skip_im2col) {
+  if (quantized_) {
+    forward_cpu_gemm_quantized(input, weights, output);
+    return;
+  }
+  if (binary_) {
+    forward_cpu_gemm_binary(input, weights, output);
+    return;
+  }
   const Dtype* col_buff = input;
   if (!is_1x1_) {
     if (!skip_im2col) {
@@ -300,6 +343,119 @@ void BaseConvolutionLayer<Dtype, MItype, MOtype>::forward_cpu_gemm(
   }
 }
 
+template<typename Dtype, typename MItype, typename MOtype>
+void BaseConvolutionLayer<Dtype, MItype, MOtype>::forward_cpu_gemm_quantized(
+                                                   const Dtype* input,
+                                                   const Dtype* weights,
+                                                   Dtype* output) {
+  // Requantize whenever the weights changed, e.g. by a solver step,
+  // CopyTrainedLayersFrom or folding.
+  if (quantized_versions_.Changed(this->blobs_)) {
+    quantized_weights_.Quantize(conv_out_channels_, kernel_dim_, weights,
+                                false);
+    quantized_versions_.Update(this->blobs_);
+  }
+  // Quantize the input as a whole, so that all groups share one scale.
+  QuantizationParameter input_quantization;
+  GetBottomQuantization(this->layer_param_, bottom_dim_, input,
+                        &input_quantization);
+  const bool is_code =
+      this->layer_param_.bottom_data_type() == INT8_QUANTIZED;
+  const float input_scale = ActivationScale(input_quantization);
+  const int32_t input_zero_point = ActivationZeroPoint(input_quantization);
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+    col_buff = col_buffer_.cpu_data();
+  }
+  const int_tp group_out_channels = conv_out_channels_ / group_;
+  quantized_col_buffer_.resize(col_offset_);
+  quantized_output_.resize(output_offset_);
+  for (int_tp g = 0; g < group_; ++g) {
+    caffe_cpu_quantize_activations_transposed(kernel_dim_,
+        conv_out_spatial_dim_, col_buff + col_offset_ * g, is_code,
+        input_quantization, &quantized_col_buffer_[0]);
+    caffe_cpu_gemm_s8u8s32(group_out_channels, conv_out_spatial_dim_,
+                           kernel_dim_,
+                           quantized_weights_.data() + weight_offset_ * g,
+                           &quantized_col_buffer_[0], &quantized_output_[0]);
+    for (int_tp c = 0; c < group_out_channels; ++c) {
+      const int_tp channel = group_out_channels * g + c;
+      const float scale = quantized_weights_.scale(channel) * input_scale;
+      const int32_t offset =
+          input_zero_point * quantized_weights_.row_sum(channel);
+      const int32_t* acc = &quantized_output_[c * conv_out_spatial_dim_];
+      Dtype* out = output + output_offset_ * g + c * conv_out_spatial_dim_;
+      for (int_tp j = 0; j < conv_out_spatial_dim_; ++j) {
+        out[j] = static_cast<Dtype>(scale * (acc[j] - offset));
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void BaseConvolutionLayer<Dtype, MItype, MOtype>::forward_cpu_gemm_binary(
+                                                   const Dtype* input,
+                                                   const Dtype* weights,
+                                                   Dtype* output) {
+  const int_tp* kernel_shape = kernel_shape_.cpu_data();
+  const int_tp* pad = pad_.cpu_data();
+  const int_tp* stride = stride_.cpu_data();
+  const int_tp* dilation = dilation_.cpu_data();
+  const int_tp height = conv_input_shape_.cpu_data()[1];
+  const int_tp width = conv_input_shape_.cpu_data()[2];
+  const int_tp taps = kernel_shape[0] * kernel_shape[1];
+  // Binarize again whenever the weights changed.
+  if (binary_versions_.Changed(this->blobs_)) {
+    binary_weights_.Binarize(conv_out_channels_, channels_, taps, weights);
+    binary_versions_.Update(this->blobs_);
+  }
+  const int_tp words = BinaryWords(channels_);
+  binary_input_.resize(height * width * words);
+  if (IsPackedBinary(this->layer_param_.bottom_data_type())) {
+    ReadPackedSigns(1, channels_, height * width, input, &binary_input_[0]);
+  } else {
+    caffe_cpu_pack_signs(1, channels_, height * width, input,
+                         &binary_input_[0]);
+  }
+  binary_col_buffer_.resize(conv_out_spatial_dim_ * taps * words);
+  caffe_cpu_im2col_binary(&binary_input_[0], words, height, width,
+                          kernel_shape[0], kernel_shape[1], pad[0], pad[1],
+                          stride[0], stride[1], dilation[0], dilation[1],
+                          &binary_col_buffer_[0]);
+  binary_output_.resize(conv_out_channels_ * conv_out_spatial_dim_);
+  caffe_cpu_gemm_xor_popcount(conv_out_channels_, conv_out_spatial_dim_,
+                              taps * words, binary_weights_.data(),
+                              &binary_col_buffer_[0], &binary_output_[0]);
+  // A dot product of n signs is n - 2 * popcount(xor). The zero words of
+  // the padding taps must not count, but contributed
+  // channels - 2 * popcount(weights) to it.
+  const int_tp output_w = output_shape_[1];
+  vector<int_tp> padding_taps;
+  for (int_tp j = 0; j < conv_out_spatial_dim_; ++j) {
+    padding_taps.clear();
+    for (int_tp kh = 0; kh < kernel_shape[0]; ++kh) {
+      const int_tp h = (j / output_w) * stride[0] - pad[0] + kh * dilation[0];
+      for (int_tp kw = 0; kw < kernel_shape[1]; ++kw) {
+        const int_tp w = (j % output_w) * stride[1] - pad[1] +
+            kw * dilation[1];
+        if (h < 0 || h >= height || w < 0 || w >= width) {
+          padding_taps.push_back(kh * kernel_shape[1] + kw);
+        }
+      }
+    }
+    for (int_tp c = 0; c < conv_out_channels_; ++c) {
+      int32_t dot = taps * channels_ -
+          2 * binary_output_[c * conv_out_spatial_dim_ + j];
+      for (int_tp t = 0; t < padding_taps.size(); ++t) {
+        dot -= channels_ - 2 * binary_weights_.popcount(c, padding_taps[t]);
+      }
+      output[c * conv_out_spatial_dim_ + j] =
+          static_cast<Dtype>(binary_weights_.scale(c) * dot);
+    }
+  }
+}
+
 template<typename Dtype, typename MItype, typename MOtype>
 void BaseConvolutionLayer<Dtype, MItype, MOtype>::forward_cpu_bias(
                                                    Dtype* output,
@@ -357,6 +513,94 @@ void BaseConvolutionLayer<Dtype, MItype, MOtype>::backward_cpu_bias(
                         bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template<typename Dtype, typename MItype, typename MOtype>
+void BaseConvolutionLayer<Dtype, MItype, MOtype>::gather_cpu_batch(
+                                                  const Dtype* output,
+                                                  const int_tp batch) {
+  batch_output_buffer_.resize(conv_out_channels_ * batch *
+                              conv_out_spatial_dim_);
+  for (int_tp n = 0; n < batch; ++n) {
+    for (int_tp c = 0; c < conv_out_channels_; ++c) {
+      caffe_copy(conv_out_spatial_dim_,
+                 output + n * top_dim_ + c * conv_out_spatial_dim_,
+                 &batch_output_buffer_[(c * batch + n) *
+                                       conv_out_spatial_dim_]);
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void BaseConvolutionLayer<Dtype, MItype, MOtype>::forward_cpu_gemm_batch(
+                                                   const Dtype* input,
+                                                   const Dtype* weights,
+                                                   Dtype* output,
+                                                   const int_tp batch) {
+  const int_tp batch_spatial_dim = batch * conv_out_spatial_dim_;
+  batch_col_buffer_.resize(kernel_dim_ * group_ * batch_spatial_dim);
+  batch_output_buffer_.resize(conv_out_channels_ * batch_spatial_dim);
+  conv_im2col_batch_cpu(input, batch, &batch_col_buffer_[0]);
+  for (int_tp g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
+                          conv_out_channels_ / group_, batch_spatial_dim,
+                          kernel_dim_, (Dtype) 1., weights + weight_offset_ * g,
+                          &batch_col_buffer_[kernel_dim_ * batch_spatial_dim
+                                             * g], (Dtype) 0.,
+                          &batch_output_buffer_[conv_out_channels_ / group_
+                                                * batch_spatial_dim * g]);
+  }
+  for (int_tp n = 0; n < batch; ++n) {
+    for (int_tp c = 0; c < conv_out_channels_; ++c) {
+      caffe_copy(conv_out_spatial_dim_,
+                 &batch_output_buffer_[(c * batch + n) *
+                                       conv_out_spatial_dim_],
+                 output + n * top_dim_ + c * conv_out_spatial_dim_);
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void BaseConvolutionLayer<Dtype, MItype, MOtype>::backward_cpu_gemm_batch(
+                                                    const Dtype* output,
+                                                    const Dtype* weights,
+                                                    Dtype* input,
+                                                    const int_tp batch) {
+  const int_tp batch_spatial_dim = batch * conv_out_spatial_dim_;
+  batch_col_buffer_.resize(kernel_dim_ * group_ * batch_spatial_dim);
+  gather_cpu_batch(output, batch);
+  for (int_tp g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
+                          batch_spatial_dim, conv_out_channels_ / group_,
+                          (Dtype) 1., weights + weight_offset_ * g,
+                          &batch_output_buffer_[conv_out_channels_ / group_
+                                                * batch_spatial_dim * g],
+                          (Dtype) 0.,
+                          &batch_col_buffer_[kernel_dim_ * batch_spatial_dim
+                                             * g]);
+  }
+  conv_col2im_batch_cpu(&batch_col_buffer_[0], batch, input);
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void BaseConvolutionLayer<Dtype, MItype, MOtype>::weight_cpu_gemm_batch(
+                                                  const Dtype* input,
+                                                  const Dtype* output,
+                                                  Dtype* weights,
+                                                  const int_tp batch) {
+  const int_tp batch_spatial_dim = batch * conv_out_spatial_dim_;
+  batch_col_buffer_.resize(kernel_dim_ * group_ * batch_spatial_dim);
+  conv_im2col_batch_cpu(input, batch, &batch_col_buffer_[0]);
+  gather_cpu_batch(output, batch);
+  for (int_tp g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
+                          kernel_dim_, batch_spatial_dim, (Dtype) 1.,
+                          &batch_output_buffer_[conv_out_channels_ / group_
+                                                * batch_spatial_dim * g],
+                          &batch_col_buffer_[kernel_dim_ * batch_spatial_dim
+                                             * g], (Dtype) 1.,
+                          weights + weight_offset_ * g);
+  }
+}
+
 #ifndef CPU_ONLY
 
 template<typename Dtype, typename MItype, typename MOtype>
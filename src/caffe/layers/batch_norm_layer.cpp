@@ -3,6 +3,7 @@
 
 #include "caffe/layers/batch_norm_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -113,13 +114,18 @@ void BatchNormLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MItype
         mean_.mutable_cpu_data());
   }
 
-  // subtract mean
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, -1, num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 1., top_data);
+  // subtract mean, a (num, channel) plane at a time
+  const Dtype* mean_data = mean_.cpu_data();
+  Caffe::thread_pool().parallel_for(0, num * channels_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int_tp p = begin; p < end; ++p) {
+      const Dtype mean = mean_data[p % channels_];
+      Dtype* plane = top_data + p * spatial_dim;
+      for (int_tp i = 0; i < spatial_dim; ++i) {
+        plane[i] -= mean;
+      }
+    }
+  });
 
   if (!use_global_stats_) {
     // compute variance using var(X) = E((X-EX)^2)
@@ -150,15 +156,21 @@ void BatchNormLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MItype
   caffe_sqrt(variance_.count(), variance_.cpu_data(),
              variance_.mutable_cpu_data());
 
-  // replicate variance to input size
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-                        batch_sum_multiplier_.cpu_data(), variance_.cpu_data(),
-                        0., num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-                        spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-                        spatial_sum_multiplier_.cpu_data(), 0.,
-                        temp_.mutable_cpu_data());
-  caffe_div(temp_.count(), top_data, temp_.cpu_data(), top_data);
+  // replicate variance to input size, for Backward, and divide by it
+  const Dtype* std_data = variance_.cpu_data();
+  Dtype* temp_data = temp_.mutable_cpu_data();
+  Caffe::thread_pool().parallel_for(0, num * channels_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int_tp p = begin; p < end; ++p) {
+      const Dtype stddev = std_data[p % channels_];
+      Dtype* plane = top_data + p * spatial_dim;
+      Dtype* temp_plane = temp_data + p * spatial_dim;
+      for (int_tp i = 0; i < spatial_dim; ++i) {
+        temp_plane[i] = stddev;
+        plane[i] /= stddev;
+      }
+    }
+  });
   // TODO(cdoersch): The caching is only needed because later in-place layers
   //                 might clobber the data.  Can we skip this if they won't?
   caffe_copy(x_norm_.count(), top_data, x_norm_.mutable_cpu_data());
@@ -2,11 +2,14 @@
 #include <vector>
 
 #include "caffe/layers/bnll_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
 const float kBNLL_THRESHOLD = 50.;
-
+// Elements per block of the vectorized transcendentals.
+const int_tp kBNLLBlock = 1024;
 
 template<typename Dtype, typename MItype, typename MOtype>
 void BNLLLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MItype>*>& bottom,
@@ -14,11 +17,27 @@ void BNLLLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MItype>*>&
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int_tp count = bottom[0]->count();
-  for (int_tp i = 0; i < count; ++i) {
-    top_data[i] = bottom_data[i] > 0 ?
-        bottom_data[i] + log(1. + exp(-bottom_data[i])) :
-        log(1. + exp(bottom_data[i]));
-  }
+  // log(1 + exp(x)) = max(x, 0) + log(1 + exp(-|x|)).
+  Caffe::thread_pool().parallel_for(0, (count + kBNLLBlock - 1) / kBNLLBlock,
+      kParallelElementGrain / kBNLLBlock, [&](int_tp begin, int_tp end) {
+    for (int_tp b = begin; b < end; ++b) {
+      const int_tp block = b * kBNLLBlock;
+      const int_tp block_size = std::min(kBNLLBlock, count - block);
+      Dtype logval[kBNLLBlock];
+      for (int_tp i = 0; i < block_size; ++i) {
+        logval[i] = -std::abs(bottom_data[block + i]);
+      }
+      caffe_exp(block_size, logval, logval);
+      for (int_tp i = 0; i < block_size; ++i) {
+        logval[i] += Dtype(1);
+      }
+      caffe_log(block_size, logval, logval);
+      for (int_tp i = 0; i < block_size; ++i) {
+        top_data[block + i] = std::max(bottom_data[block + i], Dtype(0))
+            + logval[i];
+      }
+    }
+  });
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -30,11 +49,24 @@ void BNLLLayer<Dtype, MItype, MOtype>::Backward_cpu(const vector<Blob<MOtype>*>&
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int_tp count = bottom[0]->count();
-    Dtype expval;
-    for (int_tp i = 0; i < count; ++i) {
-      expval = exp(std::min(bottom_data[i], Dtype(kBNLL_THRESHOLD)));
-      bottom_diff[i] = top_diff[i] * expval / (expval + 1.);
-    }
+    // exp(x) / (exp(x) + 1) is the sigmoid of x. The blocks keep in place
+    // computation, where top_diff is bottom_diff, correct.
+    Caffe::thread_pool().parallel_for(0, (count + kBNLLBlock - 1) / kBNLLBlock,
+        kParallelElementGrain / kBNLLBlock, [&](int_tp begin, int_tp end) {
+      for (int_tp b = begin; b < end; ++b) {
+        const int_tp block = b * kBNLLBlock;
+        const int_tp block_size = std::min(kBNLLBlock, count - block);
+        Dtype sigmoidval[kBNLLBlock];
+        for (int_tp i = 0; i < block_size; ++i) {
+          sigmoidval[i] = std::min(bottom_data[block + i],
+                                   Dtype(kBNLL_THRESHOLD));
+        }
+        caffe_sigmoid(block_size, sigmoidval, sigmoidval);
+        for (int_tp i = 0; i < block_size; ++i) {
+          bottom_diff[block + i] = top_diff[block + i] * sigmoidval[i];
+        }
+      }
+    });
   }
 }
 
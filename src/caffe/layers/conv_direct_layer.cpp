@@ -0,0 +1,838 @@
+#include <algorithm>
+#include <vector>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define CAFFE_DIRECT_CONV_AVX2
+#if defined(__AVX512F__)
+#define CAFFE_DIRECT_CONV_AVX512
+#endif
+#endif
+
+#include "caffe/layers/conv_direct_layer.hpp"
+#include "caffe/util/layout.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// The channel block of the NativeBlockedLayout, one vector register of
+// floats. The micro-kernels keep kDirectWidth x kDirectBlocks vectors in
+// registers, e.g. the outputs of kDirectWidth pixels of a row for
+// kDirectBlocks output channel blocks, so that every input value loaded is
+// used kDirectBlocks times and every weight vector kDirectWidth times.
+#if defined(CAFFE_DIRECT_CONV_AVX512)
+const int_tp kDirectBlock = 16;
+const int_tp kDirectWidth = 6;
+const int_tp kDirectBlocks = 4;
+#elif defined(CAFFE_DIRECT_CONV_AVX2)
+const int_tp kDirectBlock = 8;
+const int_tp kDirectWidth = 4;
+const int_tp kDirectBlocks = 3;
+#else
+const int_tp kDirectBlock = 8;
+const int_tp kDirectWidth = 4;
+const int_tp kDirectBlocks = 2;
+#endif
+
+// kDirectBlock values and the operations the micro-kernels need on them,
+// left to the compiler to vectorize in general.
+template<typename Dtype>
+struct DirectVector {
+  Dtype v[kDirectBlock];
+
+  static inline DirectVector load(const Dtype* x) {
+    DirectVector r;
+    for (int_tp l = 0; l < kDirectBlock; ++l) {
+      r.v[l] = x[l];
+    }
+    return r;
+  }
+  static inline DirectVector zero() {
+    DirectVector r;
+    for (int_tp l = 0; l < kDirectBlock; ++l) {
+      r.v[l] = Dtype(0);
+    }
+    return r;
+  }
+  // this += a * b
+  inline void fmadd(const Dtype a, const DirectVector& b) {
+    for (int_tp l = 0; l < kDirectBlock; ++l) {
+      v[l] += a * b.v[l];
+    }
+  }
+  inline void store(Dtype* x) const {
+    for (int_tp l = 0; l < kDirectBlock; ++l) {
+      x[l] = v[l];
+    }
+  }
+  // x += this
+  inline void add_to(Dtype* x) const {
+    for (int_tp l = 0; l < kDirectBlock; ++l) {
+      x[l] += v[l];
+    }
+  }
+};
+
+#if defined(CAFFE_DIRECT_CONV_AVX512)
+template<>
+struct DirectVector<float> {
+  __m512 v;
+
+  static inline DirectVector load(const float* x) {
+    DirectVector r;
+    r.v = _mm512_loadu_ps(x);
+    return r;
+  }
+  static inline DirectVector zero() {
+    DirectVector r;
+    r.v = _mm512_setzero_ps();
+    return r;
+  }
+  inline void fmadd(const float a, const DirectVector& b) {
+    v = _mm512_fmadd_ps(_mm512_set1_ps(a), b.v, v);
+  }
+  inline void store(float* x) const {
+    _mm512_storeu_ps(x, v);
+  }
+  inline void add_to(float* x) const {
+    _mm512_storeu_ps(x, _mm512_add_ps(_mm512_loadu_ps(x), v));
+  }
+};
+#elif defined(CAFFE_DIRECT_CONV_AVX2)
+template<>
+struct DirectVector<float> {
+  __m256 v;
+
+  static inline DirectVector load(const float* x) {
+    DirectVector r;
+    r.v = _mm256_loadu_ps(x);
+    return r;
+  }
+  static inline DirectVector zero() {
+    DirectVector r;
+    r.v = _mm256_setzero_ps();
+    return r;
+  }
+  inline void fmadd(const float a, const DirectVector& b) {
+    v = _mm256_fmadd_ps(_mm256_set1_ps(a), b.v, v);
+  }
+  inline void store(float* x) const {
+    _mm256_storeu_ps(x, v);
+  }
+  inline void add_to(float* x) const {
+    _mm256_storeu_ps(x, _mm256_add_ps(_mm256_loadu_ps(x), v));
+  }
+};
+#endif  // CAFFE_DIRECT_CONV_AVX512
+
+// The range [begin, end) of taps k of a kernel dimension for which
+// origin + k * dilation lies in [0, size).
+static inline void valid_taps(const int_tp origin, const int_tp dilation,
+                              const int_tp kernel, const int_tp size,
+                              int_tp* begin, int_tp* end) {
+  *begin = origin < 0 ? (-origin + dilation - 1) / dilation : 0;
+  *end = origin < size ? std::min(kernel, (size - 1 - origin) / dilation + 1)
+                       : 0;
+  *end = std::max(*begin, *end);
+}
+
+// The range [begin, end) of outputs o for which o * stride + offset lies in
+// [0, size).
+static inline void valid_outputs(const int_tp offset, const int_tp stride,
+                                 const int_tp outputs, const int_tp size,
+                                 int_tp* begin, int_tp* end) {
+  *begin = offset < 0 ? (-offset + stride - 1) / stride : 0;
+  *end = offset < size ? std::min(outputs, (size - 1 - offset) / stride + 1)
+                       : 0;
+  *end = std::max(*begin, *end);
+}
+
+// The geometry of a 2D convolution.
+struct DirectGeometry {
+  int_tp height, width, out_height, out_width;
+  int_tp kernel_h, kernel_w, stride_h, stride_w;
+  int_tp pad_h, pad_w, dilation_h, dilation_w;
+};
+
+static DirectGeometry direct_geometry(const int_tp* input_shape,
+    const vector<int_tp>& output_shape, const int_tp* kernel_shape,
+    const int_tp* stride, const int_tp* pad, const int_tp* dilation) {
+  DirectGeometry g;
+  g.height = input_shape[1];
+  g.width = input_shape[2];
+  g.out_height = output_shape[0];
+  g.out_width = output_shape[1];
+  g.kernel_h = kernel_shape[0];
+  g.kernel_w = kernel_shape[1];
+  g.stride_h = stride[0];
+  g.stride_w = stride[1];
+  g.pad_h = pad[0];
+  g.pad_w = pad[1];
+  g.dilation_h = dilation[0];
+  g.dilation_w = dilation[1];
+  return g;
+}
+
+// Computes kWidth outputs, stride_w input pixels apart in a row, of kBlocks
+// output channel blocks from all in_blocks x in_block input channels and
+// the taps [kh_begin, kh_end) x [kw_begin, kw_end) of the kernel, which
+// must lie in the image for all the outputs. (ih0, iw0) is the input pixel
+// of tap (0, 0) of the first output. The weights and outputs of consecutive
+// blocks are weight_step and output_step apart, the outputs of a block
+// kDirectBlock.
+template<typename Dtype, int_tp kWidth, int_tp kBlocks>
+static void direct_forward_kernel(const DirectGeometry& g,
+    const Dtype* input, const int_tp in_blocks, const int_tp in_block,
+    const Dtype* weights, const int_tp weight_step, const Dtype* bias,
+    const int_tp ih0, const int_tp iw0, const int_tp kh_begin,
+    const int_tp kh_end, const int_tp kw_begin, const int_tp kw_end,
+    Dtype* output, const int_tp output_step) {
+  DirectVector<Dtype> acc[kWidth][kBlocks];
+  for (int_tp b = 0; b < kBlocks; ++b) {
+    const DirectVector<Dtype> bv = bias ?
+        DirectVector<Dtype>::load(bias + b * kDirectBlock) :
+        DirectVector<Dtype>::zero();
+    for (int_tp r = 0; r < kWidth; ++r) {
+      acc[r][b] = bv;
+    }
+  }
+  const int_tp step = g.stride_w * in_block;
+  for (int_tp cb = 0; cb < in_blocks; ++cb) {
+    for (int_tp kh = kh_begin; kh < kh_end; ++kh) {
+      const int_tp ih = ih0 + kh * g.dilation_h;
+      for (int_tp kw = kw_begin; kw < kw_end; ++kw) {
+        const Dtype* in = input + ((cb * g.height + ih) * g.width + iw0 +
+            kw * g.dilation_w) * in_block;
+        const Dtype* w = weights + ((cb * g.kernel_h + kh) * g.kernel_w +
+            kw) * in_block * kDirectBlock;
+        for (int_tp ci = 0; ci < in_block; ++ci) {
+          DirectVector<Dtype> wv[kBlocks];
+          for (int_tp b = 0; b < kBlocks; ++b) {
+            wv[b] = DirectVector<Dtype>::load(w + b * weight_step +
+                                              ci * kDirectBlock);
+          }
+          for (int_tp r = 0; r < kWidth; ++r) {
+            const Dtype x = in[r * step + ci];
+            for (int_tp b = 0; b < kBlocks; ++b) {
+              acc[r][b].fmadd(x, wv[b]);
+            }
+          }
+        }
+      }
+    }
+  }
+  for (int_tp b = 0; b < kBlocks; ++b) {
+    for (int_tp r = 0; r < kWidth; ++r) {
+      acc[r][b].store(output + b * output_step + r * kDirectBlock);
+    }
+  }
+}
+
+// Computes output row oh of kBlocks output channel blocks: the outputs
+// whose taps all lie in the image horizontally in strips of kDirectWidth,
+// the others one by one.
+template<typename Dtype, int_tp kBlocks>
+static void direct_forward_row(const DirectGeometry& g, const Dtype* input,
+    const int_tp in_blocks, const int_tp in_block, const Dtype* weights,
+    const int_tp weight_step, const Dtype* bias, const int_tp oh,
+    Dtype* output, const int_tp output_step) {
+  const int_tp ih0 = oh * g.stride_h - g.pad_h;
+  int_tp kh_begin, kh_end;
+  valid_taps(ih0, g.dilation_h, g.kernel_h, g.height, &kh_begin, &kh_end);
+  int_tp ow_begin, ow_end;
+  valid_outputs(-g.pad_w, g.stride_w, g.out_width,
+                g.width - (g.kernel_w - 1) * g.dilation_w, &ow_begin,
+                &ow_end);
+  for (int_tp ow = 0; ow < g.out_width; ) {
+    const int_tp iw0 = ow * g.stride_w - g.pad_w;
+    if (ow >= ow_begin && ow + kDirectWidth <= ow_end) {
+      direct_forward_kernel<Dtype, kDirectWidth, kBlocks>(g, input,
+          in_blocks, in_block, weights, weight_step, bias, ih0, iw0,
+          kh_begin, kh_end, 0, g.kernel_w, output + ow * kDirectBlock,
+          output_step);
+      ow += kDirectWidth;
+    } else {
+      int_tp kw_begin, kw_end;
+      valid_taps(iw0, g.dilation_w, g.kernel_w, g.width, &kw_begin, &kw_end);
+      direct_forward_kernel<Dtype, 1, kBlocks>(g, input, in_blocks,
+          in_block, weights, weight_step, bias, ih0, iw0, kh_begin, kh_end,
+          kw_begin, kw_end, output + ow * kDirectBlock, output_step);
+      ++ow;
+    }
+  }
+}
+
+// Adds the gradients of kWidth input pixels, bottom_step values apart, of
+// kBlocks input channel blocks through one kernel tap: the products of the
+// channels top gradients of each of kWidth outputs, top_step apart, with the
+// channels x kDirectBlock weights of the tap. The weights and gradients of
+// consecutive blocks are weight_step and bottom_block_step apart.
+template<typename Dtype, int_tp kWidth, int_tp kBlocks>
+static void direct_backward_kernel(const Dtype* top_diff,
+    const int_tp top_step, const int_tp channels, const Dtype* weights,
+    const int_tp weight_step, Dtype* bottom_diff, const int_tp bottom_step,
+    const int_tp bottom_block_step) {
+  DirectVector<Dtype> acc[kWidth][kBlocks];
+  for (int_tp r = 0; r < kWidth; ++r) {
+    for (int_tp b = 0; b < kBlocks; ++b) {
+      acc[r][b] = DirectVector<Dtype>::zero();
+    }
+  }
+  for (int_tp o = 0; o < channels; ++o) {
+    DirectVector<Dtype> wv[kBlocks];
+    for (int_tp b = 0; b < kBlocks; ++b) {
+      wv[b] = DirectVector<Dtype>::load(weights + b * weight_step +
+                                        o * kDirectBlock);
+    }
+    for (int_tp r = 0; r < kWidth; ++r) {
+      const Dtype x = top_diff[r * top_step + o];
+      for (int_tp b = 0; b < kBlocks; ++b) {
+        acc[r][b].fmadd(x, wv[b]);
+      }
+    }
+  }
+  for (int_tp b = 0; b < kBlocks; ++b) {
+    for (int_tp r = 0; r < kWidth; ++r) {
+      acc[r][b].add_to(bottom_diff + b * bottom_block_step + r * bottom_step);
+    }
+  }
+}
+
+// Adds the gradients of input row ih0 + kh * dilation_h of kBlocks input
+// channel blocks, for all kh, through the taps of output row oh.
+template<typename Dtype, int_tp kBlocks>
+static void direct_backward_row(const DirectGeometry& g,
+    const Dtype* top_diff, const int_tp top_step, const int_tp channels,
+    const Dtype* weights, const int_tp weight_step, const int_tp oh,
+    Dtype* bottom_diff, const int_tp bottom_block_step) {
+  const int_tp ih0 = oh * g.stride_h - g.pad_h;
+  int_tp kh_begin, kh_end;
+  valid_taps(ih0, g.dilation_h, g.kernel_h, g.height, &kh_begin, &kh_end);
+  const int_tp bottom_step = g.stride_w * kDirectBlock;
+  for (int_tp kh = kh_begin; kh < kh_end; ++kh) {
+    Dtype* diff_row =
+        bottom_diff + (ih0 + kh * g.dilation_h) * g.width * kDirectBlock;
+    for (int_tp kw = 0; kw < g.kernel_w; ++kw) {
+      const Dtype* w =
+          weights + (kh * g.kernel_w + kw) * channels * kDirectBlock;
+      const int_tp offset = kw * g.dilation_w - g.pad_w;
+      int_tp ow_begin, ow_end;
+      valid_outputs(offset, g.stride_w, g.out_width, g.width, &ow_begin,
+                    &ow_end);
+      int_tp ow = ow_begin;
+      for (; ow + kDirectWidth <= ow_end; ow += kDirectWidth) {
+        direct_backward_kernel<Dtype, kDirectWidth, kBlocks>(
+            top_diff + ow * top_step, top_step, channels, w, weight_step,
+            diff_row + (ow * g.stride_w + offset) * kDirectBlock,
+            bottom_step, bottom_block_step);
+      }
+      for (; ow < ow_end; ++ow) {
+        direct_backward_kernel<Dtype, 1, kBlocks>(top_diff + ow * top_step,
+            top_step, channels, w, weight_step,
+            diff_row + (ow * g.stride_w + offset) * kDirectBlock,
+            bottom_step, bottom_block_step);
+      }
+    }
+  }
+}
+
+// Adds the gradients of the weights of one tap for kWidth input channels and
+// kBlocks output channel blocks: the sums over count outputs of the input
+// values, input_step apart from input[j] for channel j, times the top
+// gradients, top_step apart. The gradients of consecutive channels and
+// blocks are weight_step and weight_block_step apart.
+template<typename Dtype, int_tp kWidth, int_tp kBlocks>
+static void direct_weight_kernel(const Dtype* const* input,
+    const int_tp input_step, const int_tp count, const Dtype* top_diff,
+    const int_tp top_step, Dtype* weight_diff, const int_tp weight_step,
+    const int_tp weight_block_step) {
+  DirectVector<Dtype> acc[kWidth][kBlocks];
+  for (int_tp j = 0; j < kWidth; ++j) {
+    for (int_tp b = 0; b < kBlocks; ++b) {
+      acc[j][b] = DirectVector<Dtype>::zero();
+    }
+  }
+  for (int_tp i = 0; i < count; ++i) {
+    DirectVector<Dtype> tv[kBlocks];
+    for (int_tp b = 0; b < kBlocks; ++b) {
+      tv[b] = DirectVector<Dtype>::load(top_diff + i * top_step +
+                                        b * kDirectBlock);
+    }
+    for (int_tp j = 0; j < kWidth; ++j) {
+      const Dtype x = input[j][i * input_step];
+      for (int_tp b = 0; b < kBlocks; ++b) {
+        acc[j][b].fmadd(x, tv[b]);
+      }
+    }
+  }
+  for (int_tp b = 0; b < kBlocks; ++b) {
+    for (int_tp j = 0; j < kWidth; ++j) {
+      acc[j][b].add_to(weight_diff + b * weight_block_step + j * weight_step);
+    }
+  }
+}
+
+// Runs direct_weight_kernel for kWidth input channels over all out_blocks
+// output channel blocks.
+template<typename Dtype, int_tp kWidth>
+static void direct_weight_blocks(const Dtype* const* input,
+    const int_tp input_step, const int_tp count, const Dtype* top_diff,
+    const int_tp top_step, const int_tp out_blocks, Dtype* weight_diff,
+    const int_tp weight_step, const int_tp weight_block_step) {
+  int_tp ob = 0;
+  for (; ob + kDirectBlocks <= out_blocks; ob += kDirectBlocks) {
+    direct_weight_kernel<Dtype, kWidth, kDirectBlocks>(input, input_step,
+        count, top_diff + ob * kDirectBlock, top_step,
+        weight_diff + ob * weight_block_step, weight_step, weight_block_step);
+  }
+  for (; ob < out_blocks; ++ob) {
+    direct_weight_kernel<Dtype, kWidth, 1>(input, input_step, count,
+        top_diff + ob * kDirectBlock, top_step,
+        weight_diff + ob * weight_block_step, weight_step, weight_block_step);
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::LayerSetUp(
+      const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  const LayerParameter& param = this->layer_param_;
+  bottom_layout_ = param.bottom_layout();
+  top_layout_ = param.top_layout();
+  plain_bottom_.resize(bottom.size());
+  plain_bottom_vec_.resize(bottom.size());
+  for (int_tp i = 0; i < bottom.size(); ++i) {
+    plain_bottom_[i].reset(new Blob<MItype>());
+    plain_bottom_vec_[i] = plain_bottom_[i].get();
+  }
+  plain_top_.resize(top.size());
+  plain_top_vec_.resize(top.size());
+  for (int_tp i = 0; i < top.size(); ++i) {
+    plain_top_[i].reset(new Blob<MOtype>());
+    plain_top_vec_[i] = plain_top_[i].get();
+  }
+  reshape_plain_bottoms(bottom);
+  ConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(plain_bottom_vec_,
+                                                      plain_top_vec_);
+  direct_ = Caffe::mode() == Caffe::CPU && this->num_spatial_axes_ == 2 &&
+      !this->force_nd_im2col_ && this->group_ == 1 && !this->quantized_ &&
+      !this->binary_;
+  if (!direct_) {
+    CHECK(bottom_layout_ == NCHW && top_layout_ == NCHW)
+        << "Layer " << param.name() << " is not an ungrouped 2D convolution "
+        << "on the CPU and needs NCHW bottoms and tops.";
+    LOG(INFO) << "Layer " << param.name() << " is not an ungrouped 2D "
+              << "convolution on the CPU, falling back from DIRECT.";
+    return;
+  }
+  CHECK_EQ(LayoutBlock(NativeBlockedLayout()), kDirectBlock);
+  CHECK(top_layout_ == NCHW || top_layout_ == NativeBlockedLayout())
+      << "Layer " << param.name() << " produces NCHW or "
+      << Layout_Name(NativeBlockedLayout()) << " tops.";
+  weight_versions_.Clear();
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::reshape_plain_bottoms(
+      const vector<Blob<MItype>*>& bottom) {
+  for (int_tp i = 0; i < bottom.size(); ++i) {
+    const vector<int_tp> shape(bottom[i]->shape().begin(),
+                               bottom[i]->shape().end());
+    plain_bottom_[i]->Reshape(PlainShape(shape, bottom_layout_));
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::Reshape(
+      const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  reshape_plain_bottoms(bottom);
+  // Only shapes the column buffer, which the direct path never touches and
+  // so never allocates.
+  ConvolutionLayer<Dtype, MItype, MOtype>::Reshape(plain_bottom_vec_,
+                                                   plain_top_vec_);
+  for (int_tp i = 0; i < top.size(); ++i) {
+    const vector<int_tp> shape(plain_top_[i]->shape().begin(),
+                               plain_top_[i]->shape().end());
+    top[i]->Reshape(LayoutShape(shape, top_layout_));
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::pack_weights() {
+  const int_tp out_channels = this->num_output_;
+  const int_tp out_blocks = (out_channels + kDirectBlock - 1) / kDirectBlock;
+  if (!weight_versions_.Changed(this->blobs_)) {
+    return;
+  }
+  weight_versions_.Update(this->blobs_);
+  backward_weights_packed_ = false;
+  if (this->bias_term_) {
+    packed_bias_.assign(out_blocks * kDirectBlock, Dtype(0));
+    caffe_copy(out_channels, this->blobs_[1]->cpu_data(), &packed_bias_[0]);
+  }
+  const Blob<Dtype>& weights = *this->blobs_[0];
+  const Dtype* weight = weights.cpu_data();
+  const int_tp in_channels = this->channels_;
+  const int_tp in_block = LayoutBlock(bottom_layout_);
+  const int_tp in_blocks = in_channels / in_block;
+  const int_tp kernel_dim = weights.count(2);
+  packed_weights_.assign(out_blocks * in_channels * kernel_dim * kDirectBlock,
+                         Dtype(0));
+  for (int_tp o = 0; o < out_channels; ++o) {
+    for (int_tp c = 0; c < in_channels; ++c) {
+      for (int_tp k = 0; k < kernel_dim; ++k) {
+        packed_weights_[((((o / kDirectBlock) * in_blocks + c / in_block) *
+            kernel_dim + k) * in_block + c % in_block) * kDirectBlock +
+            o % kDirectBlock] = weight[(o * in_channels + c) * kernel_dim + k];
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::pack_backward_weights() {
+  if (backward_weights_packed_) {
+    return;
+  }
+  backward_weights_packed_ = true;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const int_tp out_channels = this->num_output_;
+  const int_tp in_channels = this->channels_;
+  const int_tp in_blocks = (in_channels + kDirectBlock - 1) / kDirectBlock;
+  const int_tp kernel_dim = this->blobs_[0]->count(2);
+  packed_backward_weights_.assign(
+      in_blocks * kernel_dim * out_channels * kDirectBlock, Dtype(0));
+  for (int_tp o = 0; o < out_channels; ++o) {
+    for (int_tp c = 0; c < in_channels; ++c) {
+      for (int_tp k = 0; k < kernel_dim; ++k) {
+        packed_backward_weights_[(((c / kDirectBlock) * kernel_dim + k) *
+            out_channels + o) * kDirectBlock + c % kDirectBlock] =
+            weight[(o * in_channels + c) * kernel_dim + k];
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::forward_cpu_direct_row(
+    const Dtype* input, const int_tp oh, const int_tp ob_begin,
+    const int_tp ob_end, Dtype* output, Dtype* row_buffer) {
+  const DirectGeometry g = direct_geometry(this->conv_input_shape_.cpu_data(),
+      this->output_shape_, this->kernel_shape_.cpu_data(),
+      this->stride_.cpu_data(), this->pad_.cpu_data(),
+      this->dilation_.cpu_data());
+  const int_tp out_channels = this->num_output_;
+  const int_tp out_spatial_dim = g.out_height * g.out_width;
+  const int_tp in_block = LayoutBlock(bottom_layout_);
+  const int_tp in_blocks = this->channels_ / in_block;
+  const int_tp weight_step =
+      this->channels_ * g.kernel_h * g.kernel_w * kDirectBlock;
+  const bool blocked_top = top_layout_ != NCHW;
+  // A row of an NCHW top is computed blocked into row_buffer first.
+  const int_tp output_step = (blocked_top ? out_spatial_dim : g.out_width) *
+      kDirectBlock;
+  Dtype* out = blocked_top ? output + ob_begin * output_step +
+      oh * g.out_width * kDirectBlock : row_buffer;
+  int_tp ob = ob_begin;
+  for (; ob + kDirectBlocks <= ob_end; ob += kDirectBlocks) {
+    direct_forward_row<Dtype, kDirectBlocks>(g, input, in_blocks, in_block,
+        &packed_weights_[ob * weight_step], weight_step,
+        this->bias_term_ ? &packed_bias_[ob * kDirectBlock] : NULL, oh,
+        out + (ob - ob_begin) * output_step, output_step);
+  }
+  for (; ob < ob_end; ++ob) {
+    direct_forward_row<Dtype, 1>(g, input, in_blocks, in_block,
+        &packed_weights_[ob * weight_step], weight_step,
+        this->bias_term_ ? &packed_bias_[ob * kDirectBlock] : NULL, oh,
+        out + (ob - ob_begin) * output_step, output_step);
+  }
+  if (!blocked_top) {
+    const int_tp o_end = std::min(ob_end * kDirectBlock, out_channels);
+    for (int_tp o = ob_begin * kDirectBlock; o < o_end; ++o) {
+      const Dtype* from = row_buffer +
+          (o / kDirectBlock - ob_begin) * output_step + o % kDirectBlock;
+      Dtype* to = output + o * out_spatial_dim + oh * g.out_width;
+      for (int_tp ow = 0; ow < g.out_width; ++ow) {
+        to[ow] = from[ow * kDirectBlock];
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::gather_top_diff_row(
+    const Dtype* top_diff, const int_tp oh, Dtype* row_buffer) {
+  const int_tp out_height = this->output_shape_[0];
+  const int_tp out_width = this->output_shape_[1];
+  const int_tp out_channels = this->num_output_;
+  const int_tp out_blocks = (out_channels + kDirectBlock - 1) / kDirectBlock;
+  const int_tp row_step = out_blocks * kDirectBlock;
+  if (top_layout_ != NCHW) {
+    for (int_tp ob = 0; ob < out_blocks; ++ob) {
+      const Dtype* top_row =
+          top_diff + (ob * out_height + oh) * out_width * kDirectBlock;
+      for (int_tp ow = 0; ow < out_width; ++ow) {
+        caffe_copy(kDirectBlock, top_row + ow * kDirectBlock,
+                   row_buffer + ow * row_step + ob * kDirectBlock);
+      }
+    }
+    return;
+  }
+  for (int_tp o = 0; o < out_channels; ++o) {
+    const Dtype* top_row = top_diff + (o * out_height + oh) * out_width;
+    for (int_tp ow = 0; ow < out_width; ++ow) {
+      row_buffer[ow * row_step + o] = top_row[ow];
+    }
+  }
+  // The channels padding the last block get zero gradients.
+  for (int_tp ow = 0; ow < out_width; ++ow) {
+    caffe_set(row_step - out_channels, Dtype(0),
+              row_buffer + ow * row_step + out_channels);
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::weight_cpu_direct_row(
+    const Dtype* input, const int_tp oh, const Dtype* top_diff_row,
+    Dtype* weight_diff) {
+  const DirectGeometry g = direct_geometry(this->conv_input_shape_.cpu_data(),
+      this->output_shape_, this->kernel_shape_.cpu_data(),
+      this->stride_.cpu_data(), this->pad_.cpu_data(),
+      this->dilation_.cpu_data());
+  const int_tp in_channels = this->channels_;
+  const int_tp in_block = LayoutBlock(bottom_layout_);
+  const int_tp out_blocks =
+      (this->num_output_ + kDirectBlock - 1) / kDirectBlock;
+  const int_tp top_step = out_blocks * kDirectBlock;
+  const int_tp weight_step = g.kernel_h * g.kernel_w * kDirectBlock;
+  const int_tp weight_block_step = in_channels * weight_step;
+  const int_tp ih0 = oh * g.stride_h - g.pad_h;
+  int_tp kh_begin, kh_end;
+  valid_taps(ih0, g.dilation_h, g.kernel_h, g.height, &kh_begin, &kh_end);
+  const Dtype* channel_input[kDirectWidth];
+  for (int_tp kh = kh_begin; kh < kh_end; ++kh) {
+    const int_tp ih = ih0 + kh * g.dilation_h;
+    for (int_tp kw = 0; kw < g.kernel_w; ++kw) {
+      const int_tp offset = kw * g.dilation_w - g.pad_w;
+      int_tp ow_begin, ow_end;
+      valid_outputs(offset, g.stride_w, g.out_width, g.width, &ow_begin,
+                    &ow_end);
+      if (ow_begin == ow_end) {
+        continue;
+      }
+      const int_tp iw = ow_begin * g.stride_w + offset;
+      const Dtype* top_diff = top_diff_row + ow_begin * top_step;
+      Dtype* diff = weight_diff + (kh * g.kernel_w + kw) * kDirectBlock;
+      for (int_tp c = 0; c < in_channels; ) {
+        const int_tp channels =
+            c + kDirectWidth <= in_channels ? kDirectWidth : 1;
+        for (int_tp j = 0; j < channels; ++j) {
+          channel_input[j] = input + ((((c + j) / in_block) * g.height + ih) *
+              g.width + iw) * in_block + (c + j) % in_block;
+        }
+        if (channels == kDirectWidth) {
+          direct_weight_blocks<Dtype, kDirectWidth>(channel_input,
+              g.stride_w * in_block, ow_end - ow_begin, top_diff, top_step,
+              out_blocks, diff + c * weight_step, weight_step,
+              weight_block_step);
+        } else {
+          direct_weight_blocks<Dtype, 1>(channel_input,
+              g.stride_w * in_block, ow_end - ow_begin, top_diff, top_step,
+              out_blocks, diff + c * weight_step, weight_step,
+              weight_block_step);
+        }
+        c += channels;
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::backward_cpu_direct_row(
+    const int_tp oh, const Dtype* top_diff_row, Dtype* bottom_diff) {
+  const DirectGeometry g = direct_geometry(this->conv_input_shape_.cpu_data(),
+      this->output_shape_, this->kernel_shape_.cpu_data(),
+      this->stride_.cpu_data(), this->pad_.cpu_data(),
+      this->dilation_.cpu_data());
+  const int_tp out_channels = this->num_output_;
+  const int_tp top_step =
+      (out_channels + kDirectBlock - 1) / kDirectBlock * kDirectBlock;
+  const int_tp in_blocks =
+      (this->channels_ + kDirectBlock - 1) / kDirectBlock;
+  const int_tp weight_step =
+      g.kernel_h * g.kernel_w * out_channels * kDirectBlock;
+  const int_tp bottom_block_step = g.height * g.width * kDirectBlock;
+  int_tp cb = 0;
+  for (; cb + kDirectBlocks <= in_blocks; cb += kDirectBlocks) {
+    direct_backward_row<Dtype, kDirectBlocks>(g, top_diff_row, top_step,
+        out_channels, &packed_backward_weights_[cb * weight_step],
+        weight_step, oh, bottom_diff + cb * bottom_block_step,
+        bottom_block_step);
+  }
+  for (; cb < in_blocks; ++cb) {
+    direct_backward_row<Dtype, 1>(g, top_diff_row, top_step,
+        out_channels, &packed_backward_weights_[cb * weight_step],
+        weight_step, oh, bottom_diff + cb * bottom_block_step,
+        bottom_block_step);
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::Forward_cpu(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  if (!direct_) {
+    ConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  pack_weights();
+  const int_tp out_height = this->output_shape_[0];
+  const int_tp out_blocks =
+      (this->num_output_ + kDirectBlock - 1) / kDirectBlock;
+  // Each task computes one row of an image for up to kDirectBlocks output
+  // channel blocks.
+  const int_tp groups = (out_blocks + kDirectBlocks - 1) / kDirectBlocks;
+  const int_tp row_size = top_layout_ == NCHW ?
+      kDirectBlocks * this->output_shape_[1] * kDirectBlock : 0;
+  for (int_tp i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    Caffe::thread_pool().parallel_for(0, this->num_ * out_height * groups, 1,
+        [&](int_tp begin, int_tp end) {
+      vector<Dtype> row_buffer(row_size);
+      for (int_tp t = begin; t < end; ++t) {
+        const int_tp n = t / (out_height * groups);
+        const int_tp oh = t / groups % out_height;
+        const int_tp ob = t % groups * kDirectBlocks;
+        forward_cpu_direct_row(bottom_data + n * this->bottom_dim_, oh, ob,
+                               std::min(ob + kDirectBlocks, out_blocks),
+                               top_data + n * this->top_dim_,
+                               row_buffer.data());
+      }
+    });
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerDirect<Dtype, MItype, MOtype>::Backward_cpu(
+    const vector<Blob<MOtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<MItype>*>& bottom) {
+  if (!direct_) {
+    ConvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(top, propagate_down,
+                                                          bottom);
+    return;
+  }
+  pack_weights();
+  pack_backward_weights();
+  const int_tp out_height = this->output_shape_[0];
+  const int_tp out_width = this->output_shape_[1];
+  const int_tp out_channels = this->num_output_;
+  const int_tp out_blocks = (out_channels + kDirectBlock - 1) / kDirectBlock;
+  const int_tp in_channels = this->channels_;
+  const int_tp in_block = LayoutBlock(bottom_layout_);
+  const int_tp in_blocks = (in_channels + kDirectBlock - 1) / kDirectBlock;
+  const int_tp spatial_dim = this->conv_input_shape_.cpu_data()[1] *
+      this->conv_input_shape_.cpu_data()[2];
+  const bool native_bottom = bottom_layout_ == NativeBlockedLayout();
+  const bool weight_gradient = this->param_propagate_down_[0];
+  const bool bias_gradient = this->bias_term_ && this->param_propagate_down_[1];
+  const int_tp row_size = out_width * out_blocks * kDirectBlock;
+  const int_tp bottom_diff_size = in_blocks * kDirectBlock * spatial_dim;
+  const int_tp weight_diff_size =
+      out_blocks * this->blobs_[0]->count(1) * kDirectBlock;
+  // The images are split into a slice per thread. Each slice sums the
+  // parameter gradients of its images separately, and the slices are added
+  // in order, so that the gradients do not depend on the order of the
+  // threads.
+  const int_tp slices =
+      std::min(this->num_, Caffe::thread_pool().num_threads());
+  if (weight_gradient) {
+    weight_diff_buffer_.assign(slices * weight_diff_size, Dtype(0));
+  }
+  if (bias_gradient) {
+    bias_diff_buffer_.assign(slices * out_channels, Dtype(0));
+  }
+  for (int_tp i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* bottom_diff = propagate_down[i] ? bottom[i]->mutable_cpu_diff() :
+        NULL;
+    Caffe::thread_pool().parallel_for(0, slices, 1,
+        [&](int_tp begin, int_tp end) {
+      vector<Dtype> row_buffer(row_size);
+      // The bottom gradient of one image in the NativeBlockedLayout, if the
+      // bottom is in another layout.
+      vector<Dtype> bottom_diff_buffer(
+          propagate_down[i] && !native_bottom ? bottom_diff_size : 0);
+      for (int_tp s = begin; s < end; ++s) {
+        Dtype* slice_weight_diff = weight_gradient ?
+            &weight_diff_buffer_[s * weight_diff_size] : NULL;
+        Dtype* slice_bias_diff = bias_gradient ?
+            &bias_diff_buffer_[s * out_channels] : NULL;
+        for (int_tp n = this->num_ * s / slices;
+             n < this->num_ * (s + 1) / slices; ++n) {
+          Dtype* diff = NULL;
+          if (propagate_down[i]) {
+            diff = native_bottom ? bottom_diff + n * this->bottom_dim_ :
+                bottom_diff_buffer.data();
+            caffe_set(native_bottom ? this->bottom_dim_ : bottom_diff_size,
+                      Dtype(0), diff);
+          }
+          for (int_tp oh = 0; oh < out_height; ++oh) {
+            gather_top_diff_row(top_diff + n * this->top_dim_, oh,
+                                row_buffer.data());
+            if (bias_gradient) {
+              for (int_tp ow = 0; ow < out_width; ++ow) {
+                caffe_axpy(out_channels, Dtype(1),
+                           &row_buffer[ow * out_blocks * kDirectBlock],
+                           slice_bias_diff);
+              }
+            }
+            if (weight_gradient) {
+              weight_cpu_direct_row(bottom_data + n * this->bottom_dim_, oh,
+                                    row_buffer.data(), slice_weight_diff);
+            }
+            if (propagate_down[i]) {
+              backward_cpu_direct_row(oh, row_buffer.data(), diff);
+            }
+          }
+          if (propagate_down[i] && !native_bottom) {
+            Dtype* bottom_image_diff = bottom_diff + n * this->bottom_dim_;
+            for (int_tp c = 0; c < in_channels; ++c) {
+              const Dtype* from = diff +
+                  (c / kDirectBlock) * spatial_dim * kDirectBlock +
+                  c % kDirectBlock;
+              Dtype* to = bottom_image_diff +
+                  (c / in_block) * spatial_dim * in_block + c % in_block;
+              for (int_tp j = 0; j < spatial_dim; ++j) {
+                to[j * in_block] = from[j * kDirectBlock];
+              }
+            }
+          }
+        }
+      }
+    });
+  }
+  if (weight_gradient) {
+    Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+    const int_tp inner = this->blobs_[0]->count(1);
+    for (int_tp s = 0; s < slices; ++s) {
+      for (int_tp o = 0; o < out_channels; ++o) {
+        const Dtype* from = &weight_diff_buffer_[s * weight_diff_size] +
+            (o / kDirectBlock) * inner * kDirectBlock + o % kDirectBlock;
+        for (int_tp k = 0; k < inner; ++k) {
+          weight_diff[o * inner + k] += from[k * kDirectBlock];
+        }
+      }
+    }
+  }
+  if (bias_gradient) {
+    for (int_tp s = 0; s < slices; ++s) {
+      caffe_axpy(out_channels, Dtype(1), &bias_diff_buffer_[s * out_channels],
+                 this->blobs_[1]->mutable_cpu_diff());
+    }
+  }
+}
+
+INSTANTIATE_CLASS_3T(ConvolutionLayerDirect);
+
+}  // namespace caffe
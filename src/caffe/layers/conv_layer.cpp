@@ -1,9 +1,104 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/depthwise_conv.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
+// output = relu(input + bias + residual) over num x channels x spatial_dim
+// values, with the per channel bias and the residual skipped if NULL.
+// output may be input.
+template<typename Dtype>
+static void conv_fused_epilogue(const Dtype* input, const Dtype* bias,
+                                const Dtype* residual, const int_tp num,
+                                const int_tp channels,
+                                const int_tp spatial_dim,
+                                const Dtype negative_slope, Dtype* output) {
+  // The planes of the images are independent.
+  Caffe::thread_pool().parallel_for(0, num * channels,
+      std::max(kParallelElementGrain / std::max(spatial_dim, int_tp(1)),
+               int_tp(1)),
+      [&](int_tp begin, int_tp end) {
+    for (int_tp p = begin; p < end; ++p) {
+      const int_tp c = p % channels;
+      const Dtype bias_value = bias ? bias[c] : Dtype(0);
+      const Dtype* in = input + p * spatial_dim;
+      const Dtype* res = residual ? residual + p * spatial_dim : NULL;
+      Dtype* out = output + p * spatial_dim;
+      for (int_tp i = 0; i < spatial_dim; ++i) {
+        const Dtype value = in[i] + bias_value + (res ? res[i] : Dtype(0));
+        out[i] = std::max(value, Dtype(0))
+            + negative_slope * std::min(value, Dtype(0));
+      }
+    }
+  });
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(
+      const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top) {
+  BaseConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(bottom, top);
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  if (IsFusedWithEltwiseReLU()) {
+    CHECK_EQ(conv_param.eltwise_param().coeff_size(), 0);
+    CHECK_EQ(bottom.size(), 2);
+    CHECK_EQ(conv_param.eltwise_param().operation(),
+             EltwiseParameter_EltwiseOp_SUM);
+  }
+  if (IsFusedWithMaxPoolAndReLU()) {
+    CHECK_EQ(conv_param.pooling_param().pool(),
+             PoolingParameter_PoolMethod_MAX)
+        << "Only max pooling can be fused into a convolution.";
+    pool_layer_.reset();
+  }
+  negative_slope_ = IsFusedWithReLU() ?
+      Dtype(conv_param.relu_param().negative_slope()) : Dtype(0);
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayer<Dtype, MItype, MOtype>::Reshape(
+      const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top) {
+  if (IsFusedWithEltwiseReLU()) {
+    const vector<Blob<MItype>*> bottom_image(bottom.begin(), bottom.end() - 1);
+    BaseConvolutionLayer<Dtype, MItype, MOtype>::Reshape(bottom_image, top);
+    CHECK(bottom.back()->shape() == top[0]->shape())
+        << "The residual must have the shape of the convolution output.";
+  } else {
+    BaseConvolutionLayer<Dtype, MItype, MOtype>::Reshape(bottom, top);
+  }
+  if (!IsFusedWithMaxPoolAndReLU()) {
+    return;
+  }
+  // The images are convolved and pooled one at a time, so the buffers hold
+  // a single image and the tops take the pooled spatial shape.
+  vector<uint_tp> image_shape = top[0]->shape();
+  std::fill(image_shape.begin(), image_shape.begin() + this->channel_axis_, 1);
+  fused_conv_output_.Reshape(image_shape);
+  if (!pool_layer_) {
+    fused_conv_vec_.assign(1, &fused_conv_output_);
+    fused_pool_vec_.assign(1, &fused_pool_output_);
+    LayerParameter pool_param;
+    pool_param.mutable_pooling_param()->CopyFrom(
+        this->layer_param_.convolution_param().pooling_param());
+    pool_layer_.reset(new PoolingLayer<Dtype, Dtype, Dtype>(pool_param));
+    pool_layer_->SetUp(fused_conv_vec_, fused_pool_vec_);
+  } else {
+    pool_layer_->Reshape(fused_conv_vec_, fused_pool_vec_);
+  }
+  vector<uint_tp> top_shape = top[0]->shape();
+  for (int_tp i = this->channel_axis_ + 1; i < top_shape.size(); ++i) {
+    top_shape[i] = fused_pool_output_.shape(i);
+  }
+  for (int_tp top_id = 0; top_id < top.size(); ++top_id) {
+    top[top_id]->Reshape(top_shape);
+  }
+}
+
 template<typename Dtype, typename MItype, typename MOtype>
 void ConvolutionLayer<Dtype, MItype, MOtype>::compute_output_shape() {
   const int_tp* kernel_shape_data = this->kernel_shape_.cpu_data();
@@ -25,13 +120,35 @@ void ConvolutionLayer<Dtype, MItype, MOtype>::compute_output_shape() {
 template<typename Dtype, typename MItype, typename MOtype>
 void ConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MItype>*>& bottom,
                                           const vector<Blob<MOtype>*>& top) {
+  if (IsFused()) {
+    Forward_cpu_fused(bottom, top);
+    return;
+  }
   const Dtype* weight = this->blobs_[0]->cpu_data();
   for (int_tp i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
+    if (is_depthwise()) {
+      const int_tp* kernel_shape = this->kernel_shape_.cpu_data();
+      const int_tp* pad = this->pad_.cpu_data();
+      const int_tp* stride = this->stride_.cpu_data();
+      const int_tp* dilation = this->dilation_.cpu_data();
+      depthwise_conv_cpu(bottom_data, this->num_, this->channels_,
+          this->input_shape(1), this->input_shape(2), kernel_shape[0],
+          kernel_shape[1], pad[0], pad[1], stride[0], stride[1], dilation[0],
+          dilation[1], weight,
+          this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL, top_data);
+      continue;
+    }
     for (int_tp n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-                             top_data + n * this->top_dim_);
+      if (this->col_batch_ == 1) {
+        this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+                               top_data + n * this->top_dim_);
+      } else if (n % this->col_batch_ == 0) {
+        this->forward_cpu_gemm_batch(bottom_data + n * this->bottom_dim_,
+            weight, top_data + n * this->top_dim_,
+            std::min(this->col_batch_, this->num_ - n));
+      }
       if (this->bias_term_) {
         const Dtype* bias = this->blobs_[1]->cpu_data();
         this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
@@ -40,10 +157,76 @@ void ConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MIty
   }
 }
 
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu_fused(
+      const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top) {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const bool pool = IsFusedWithMaxPoolAndReLU();
+  for (int_tp i = 0; i < top.size(); ++i) {
+    // The output of one image, pooled if the pooling is fused.
+    const int_tp spatial_dim = top[i]->count(this->channel_axis_ + 1);
+    const int_tp out_dim = top[i]->count(this->channel_axis_);
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    const Dtype* residual = IsFusedWithEltwiseReLU() ?
+        bottom.back()->cpu_data() : NULL;
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    if (is_depthwise() && !pool) {
+      // The depthwise convolution and the epilogue both run over the
+      // channels of the whole batch at once.
+      const int_tp* kernel_shape = this->kernel_shape_.cpu_data();
+      const int_tp* pad = this->pad_.cpu_data();
+      const int_tp* stride = this->stride_.cpu_data();
+      const int_tp* dilation = this->dilation_.cpu_data();
+      depthwise_conv_cpu(bottom_data, this->num_, this->channels_,
+          this->input_shape(1), this->input_shape(2), kernel_shape[0],
+          kernel_shape[1], pad[0], pad[1], stride[0], stride[1], dilation[0],
+          dilation[1], weight, static_cast<const Dtype*>(NULL), top_data);
+      conv_fused_epilogue(static_cast<const Dtype*>(top_data), bias,
+          residual, this->num_, this->num_output_, spatial_dim,
+          negative_slope_, top_data);
+      continue;
+    }
+    // One image at a time, without the batched im2col, so that the epilogue
+    // reads the convolution output back from cache.
+    for (int_tp n = 0; n < this->num_; ++n) {
+      Dtype* conv_output = pool ? fused_conv_output_.mutable_cpu_data() :
+          top_data + n * this->top_dim_;
+      if (is_depthwise()) {
+        const int_tp* kernel_shape = this->kernel_shape_.cpu_data();
+        const int_tp* pad = this->pad_.cpu_data();
+        const int_tp* stride = this->stride_.cpu_data();
+        const int_tp* dilation = this->dilation_.cpu_data();
+        depthwise_conv_cpu(bottom_data + n * this->bottom_dim_, 1,
+            this->channels_, this->input_shape(1), this->input_shape(2),
+            kernel_shape[0], kernel_shape[1], pad[0], pad[1], stride[0],
+            stride[1], dilation[0], dilation[1], weight,
+            static_cast<const Dtype*>(NULL), conv_output);
+      } else {
+        this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+                               conv_output);
+      }
+      const Dtype* epilogue_input = conv_output;
+      if (pool) {
+        // The bias and the ReLU are monotonic per channel, so they commute
+        // with the max and only run over the pooled outputs.
+        pool_layer_->Forward(fused_conv_vec_, fused_pool_vec_);
+        epilogue_input = fused_pool_output_.cpu_data();
+      }
+      conv_fused_epilogue(epilogue_input, bias,
+          residual ? residual + n * out_dim : NULL, int_tp(1),
+          this->num_output_, spatial_dim, negative_slope_,
+          top_data + n * out_dim);
+    }
+  }
+}
+
 template<typename Dtype, typename MItype, typename MOtype>
 void ConvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(const vector<Blob<MOtype>*>& top,
                                            const vector<bool>& propagate_down,
                                            const vector<Blob<MItype>*>& bottom) {
+  CHECK(!IsFused()) << "Fused convolutions are inference only.";
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   for (int_tp i = 0; i < top.size(); ++i) {
@@ -57,7 +240,38 @@ void ConvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(const vector<Blob<MOt
         this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
       }
     }
-    if (this->param_propagate_down_[0] || propagate_down[i]) {
+    if (is_depthwise()) {
+      const int_tp* kernel_shape = this->kernel_shape_.cpu_data();
+      const int_tp* pad = this->pad_.cpu_data();
+      const int_tp* stride = this->stride_.cpu_data();
+      const int_tp* dilation = this->dilation_.cpu_data();
+      if (this->param_propagate_down_[0]) {
+        depthwise_conv_weight_cpu(bottom_data, top_diff, this->num_,
+            this->channels_, this->input_shape(1), this->input_shape(2),
+            kernel_shape[0], kernel_shape[1], pad[0], pad[1], stride[0],
+            stride[1], dilation[0], dilation[1], weight_diff);
+      }
+      if (propagate_down[i]) {
+        depthwise_conv_backward_cpu(top_diff, this->num_, this->channels_,
+            this->input_shape(1), this->input_shape(2), kernel_shape[0],
+            kernel_shape[1], pad[0], pad[1], stride[0], stride[1],
+            dilation[0], dilation[1], weight, bottom_diff);
+      }
+    } else if (this->col_batch_ > 1 &&
+               (this->param_propagate_down_[0] || propagate_down[i])) {
+      for (int_tp n = 0; n < this->num_; n += this->col_batch_) {
+        const int_tp batch = std::min(this->col_batch_, this->num_ - n);
+        // gradient w.r.t. weight, one GEMM per group for the whole batch.
+        if (this->param_propagate_down_[0]) {
+          this->weight_cpu_gemm_batch(bottom_data + n * this->bottom_dim_,
+              top_diff + n * this->top_dim_, weight_diff, batch);
+        }
+        if (propagate_down[i]) {
+          this->backward_cpu_gemm_batch(top_diff + n * this->top_dim_,
+              weight, bottom_diff + n * this->bottom_dim_, batch);
+        }
+      }
+    } else if (this->param_propagate_down_[0] || propagate_down[i]) {
       for (int_tp n = 0; n < this->num_; ++n) {
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
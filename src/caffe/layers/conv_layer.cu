@@ -8,6 +8,8 @@ template<typename Dtype, typename MItype, typename MOtype>
 void ConvolutionLayer<Dtype, MItype, MOtype>::Forward_gpu(
       const vector<Blob<MItype>*>& bottom,
       const vector<Blob<MOtype>*>& top) {
+  CHECK(!IsFused()) << "Fused convolutions run on the CPU or on the "
+                    << "spatial engine.";
   vptr<const Dtype> weight = this->blobs_[0]->gpu_data();
   for (int_tp i = 0; i < bottom.size(); ++i) {
     vptr<const Dtype> bottom_data = bottom[i]->gpu_data();
@@ -9,6 +9,7 @@
 #include "caffe/util/fft.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -102,44 +103,44 @@ void ConvolutionLayerFFT<Dtype>::fft_setup(const vector<Blob<MItype>*>& bottom,
 
 template<typename Dtype, typename MItype, typename MOtype>
 void ConvolutionLayerFFT<Dtype>::fft_cpu_setup() {
-  if (fft_cpu_initialized_) {
+  // Layer::Forward reshapes on every call, so the buffers are only rebuilt
+  // when the transform size changes.
+  if (fft_cpu_initialized_ && fft_cpu_height_ == fft_height_ &&
+      fft_cpu_width_ == fft_width_) {
     return;
   }
+  fft_cpu_clean();
 
   // Allocate buffers for fft
   int num_weights = this->num_output_ * (this->channels_ / this->group_);
+  int num_maps = std::max(this->num_output_, this->channels_);
   fft_weights_complex_ = (std::complex<Dtype> *) caffe_cpu_fft_malloc<Dtype>(
       num_weights * fft_map_complex_size_ * sizeof(std::complex<Dtype> ));
   fft_map_in_real_ = reinterpret_cast<Dtype *> (caffe_cpu_fft_malloc<Dtype>(
-      fft_map_real_size_ * sizeof(Dtype)));
+      num_maps * fft_map_real_size_ * sizeof(Dtype)));
   fft_map_in_complex_ = (std::complex<Dtype> *) caffe_cpu_fft_malloc<Dtype>(
-      fft_map_complex_size_ * sizeof(std::complex<Dtype>));
+      num_maps * fft_map_complex_size_ * sizeof(std::complex<Dtype>));
   fft_map_out_complex_ = (std::complex<Dtype>*) caffe_cpu_fft_malloc<Dtype>(
-      std::max(this->num_output_, this->channels_) *
-      fft_map_complex_size_ * sizeof(std::complex<Dtype>));
+      num_maps * fft_map_complex_size_ * sizeof(std::complex<Dtype>));
   fft_map_out_real_ = reinterpret_cast<Dtype *> (caffe_cpu_fft_malloc<Dtype>(
-      std::max(this->num_output_, this->channels_) *
-      fft_map_real_size_ * sizeof(Dtype)));
-
-  // Create fft and ifft plans
-  fft_handle_ = caffe_cpu_fft_plan_dft_r2c_2d<Dtype>(fft_height_, fft_width_,
-      fft_map_in_real_, fft_map_in_complex_, FFTW_ESTIMATE);
-  ifft_handle_ = caffe_cpu_fft_plan_dft_c2r_2d<Dtype>(fft_height_, fft_width_,
-      fft_map_out_complex_, fft_map_out_real_, FFTW_ESTIMATE);
-
-  // Create plan for batched in place transform
-  int in_N[2] = { fft_height_, fft_width_ };
-  int in_stride = 1;
-  int in_dist = fft_height_ * 2*fft_complex_width_;
-  int out_N[2] = { fft_height_, fft_complex_width_ };
-  int out_stride = 1;
-  int out_dist = fft_height_ * fft_complex_width_;
-  int in_N_inplace[2] = { fft_height_, 2*fft_complex_width_ };
-  fft_many_handle_ = caffe_cpu_fft_plan_many_dft_r2c<Dtype>(2, in_N,
-      num_weights, reinterpret_cast<Dtype*>(fft_weights_complex_),
-      in_N_inplace, in_stride, in_dist, fft_weights_complex_,
-      out_N, out_stride, out_dist, FFTW_ESTIMATE);
-
+      num_maps * fft_map_real_size_ * sizeof(Dtype)));
+
+  // Batched fft of the bottom channels and ifft of the top outputs, the
+  // other way around for the backward pass, and the in place fft of the
+  // padded weights.
+  fft_handle_ = caffe_cpu_fft_cached_plan_r2c<Dtype>(fft_height_, fft_width_,
+      this->channels_, false);
+  ifft_handle_ = caffe_cpu_fft_cached_plan_c2r<Dtype>(fft_height_, fft_width_,
+      this->num_output_);
+  fft_backward_handle_ = caffe_cpu_fft_cached_plan_r2c<Dtype>(fft_height_,
+      fft_width_, this->num_output_, false);
+  ifft_backward_handle_ = caffe_cpu_fft_cached_plan_c2r<Dtype>(fft_height_,
+      fft_width_, this->channels_);
+  fft_many_handle_ = caffe_cpu_fft_cached_plan_r2c<Dtype>(fft_height_,
+      fft_width_, num_weights, true);
+
+  fft_cpu_height_ = fft_height_;
+  fft_cpu_width_ = fft_width_;
   fft_cpu_initialized_ = true;
 }
 
@@ -163,9 +164,6 @@ void ConvolutionLayerFFT<Dtype>::fft_cpu_clean() {
     caffe_cpu_fft_free<Dtype>(fft_weights_complex_);
     caffe_cpu_fft_free<Dtype>(fft_map_out_complex_);
     caffe_cpu_fft_free<Dtype>(fft_map_out_real_);
-    caffe_cpu_fft_destroy_plan<Dtype>(fft_handle_);
-    caffe_cpu_fft_destroy_plan<Dtype>(ifft_handle_);
-    caffe_cpu_fft_destroy_plan<Dtype>(fft_many_handle_);
   }
   fft_cpu_initialized_ = false;
 }
@@ -179,98 +177,109 @@ void ConvolutionLayerFFT<Dtype>::fft_compute_weights() {
   // Left-top 0-padding of weights
 
   const Dtype* weight = this->blobs_[0]->cpu_data();
-  for (int n = 0; n < this->num_output_; n++) {
-    for (int c = 0; c < ch_gr; c++) {
-      for (int h = 0; h < kernel_h_; h++) {
-        for (int w = 0; w < kernel_w_; w++) {
-          int map_offset = n * ch_gr + c;
-          int src_idx = (map_offset*kernel_h_ + h)*kernel_w_ + w;
-          int dst_idx = (map_offset*fft_height_ + h)*2*fft_complex_width_ + w;
-          (reinterpret_cast<Dtype*>(fft_weights_complex_))[dst_idx] =
-              weight[src_idx];
+  Caffe::thread_pool().parallel_for(0, this->num_output_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int n = begin; n < end; n++) {
+      for (int c = 0; c < ch_gr; c++) {
+        for (int h = 0; h < kernel_h_; h++) {
+          for (int w = 0; w < kernel_w_; w++) {
+            int map_offset = n * ch_gr + c;
+            int src_idx = (map_offset*kernel_h_ + h)*kernel_w_ + w;
+            int dst_idx = (map_offset*fft_height_ + h)*2*fft_complex_width_ + w;
+            (reinterpret_cast<Dtype*>(fft_weights_complex_))[dst_idx] =
+                weight[src_idx];
+          }
         }
       }
     }
-  }
+  });
   // Batched in-place FFT of padded weights
-  caffe_cpu_fft_execute<Dtype>(fft_many_handle_);
+  caffe_cpu_fft_execute_dft_r2c<Dtype>(fft_many_handle_,
+      reinterpret_cast<Dtype*>(fft_weights_complex_), fft_weights_complex_);
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
 void ConvolutionLayerFFT<Dtype>::Forward_cpu_fft_task(const Dtype* bottom_data,
          int bottom_data_offset, Dtype* top_data, int top_data_offset, int n) {
-  // clear buffer
-  caffe_memset((this->num_output_ * fft_map_complex_size_ *
-      sizeof(std::complex<Dtype>)), 0., fft_map_out_complex_);
-
   int ch_gr = this->channels_ / this->group_;
   int out_gr = this->num_output_ / this->group_;
   int map_in_size = height_ * width_;
-  for (int c = 0; c < this->channels_; c++) {
-    caffe_memset(fft_map_real_size_ * sizeof(Dtype), 0., fft_map_in_real_);
-
-    // Select a specific channel map in a specific feature map in bottom data
-    const Dtype* map_in = const_cast<Dtype*>(bottom_data + bottom_data_offset +
-        c * map_in_size);
-    // Left-top 0-padding of bottom data
-    for (int h = 0; h < height_; h++) {
-      for (int w = 0; w < width_; w++) {
-        int src_idx = h * width_ + w;
-        int dst_idx = (h + pad_h_) * fft_width_ + (w + pad_w_);
-        fft_map_in_real_[dst_idx] = map_in[src_idx];
+  Caffe::thread_pool().parallel_for(0, this->channels_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int c = begin; c < end; c++) {
+      Dtype* map_in_real = fft_map_in_real_ + c * fft_map_real_size_;
+      caffe_memset(fft_map_real_size_ * sizeof(Dtype), 0., map_in_real);
+
+      // Select a specific channel map in a specific feature map in bottom data
+      const Dtype* map_in = bottom_data + bottom_data_offset + c * map_in_size;
+      // Left-top 0-padding of bottom data
+      for (int h = 0; h < height_; h++) {
+        for (int w = 0; w < width_; w++) {
+          int src_idx = h * width_ + w;
+          int dst_idx = (h + pad_h_) * fft_width_ + (w + pad_w_);
+          map_in_real[dst_idx] = map_in[src_idx];
+        }
       }
     }
+  });
 
-    // FFT of padded bottom data
-    caffe_cpu_fft_execute_dft_r2c<Dtype>(fft_handle_, fft_map_in_real_,
-        fft_map_in_complex_);
+  // FFT of all padded bottom channels
+  caffe_cpu_fft_execute_dft_r2c<Dtype>(fft_handle_, fft_map_in_real_,
+      fft_map_in_complex_);
 
-    // Multiplication of FFT bottom data and FFT weights
-    int g = c / ch_gr;
-    int c_offset= c % ch_gr;
-    int out_first = g * out_gr;
-    int out_last = (g + 1) * out_gr;
-    for (int out = out_first; out < out_last; out++) {
+  // Multiplication of FFT bottom data and FFT weights. Each output only
+  // accumulates into its own map, so the outputs run in parallel.
+  Caffe::thread_pool().parallel_for(0, this->num_output_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int out = begin; out < end; out++) {
       std::complex<Dtype>* map_out_complex = fft_map_out_complex_ +
           out * fft_map_complex_size_;
-      std::complex<Dtype>* weights_complex = fft_weights_complex_ +
-          (out * ch_gr + c_offset) * fft_map_complex_size_;
-      for (int i = 0; i < fft_map_complex_size_; i++) {
-        // FFT for correlation requires conj (fft_of_weights)
-        Dtype x_real = std::real(fft_map_in_complex_[i]);
-        Dtype x_imag = std::imag(fft_map_in_complex_[i]);
-        Dtype y_real = std::real(weights_complex[i]);
-        Dtype y_imag = std::imag(weights_complex[i]);
-        Dtype z_real = x_real*y_real + x_imag*y_imag;
-        Dtype z_imag = - x_real*y_imag + x_imag*y_real;
-        map_out_complex[i] += std::complex<Dtype>(z_real, z_imag);
+      std::fill(map_out_complex, map_out_complex + fft_map_complex_size_,
+          std::complex<Dtype>(0));
+      int g = out / out_gr;
+      for (int c_offset = 0; c_offset < ch_gr; c_offset++) {
+        const std::complex<Dtype>* map_in_complex = fft_map_in_complex_ +
+            (g * ch_gr + c_offset) * fft_map_complex_size_;
+        const std::complex<Dtype>* weights_complex = fft_weights_complex_ +
+            (out * ch_gr + c_offset) * fft_map_complex_size_;
+        for (int i = 0; i < fft_map_complex_size_; i++) {
+          // FFT for correlation requires conj (fft_of_weights)
+          Dtype x_real = std::real(map_in_complex[i]);
+          Dtype x_imag = std::imag(map_in_complex[i]);
+          Dtype y_real = std::real(weights_complex[i]);
+          Dtype y_imag = std::imag(weights_complex[i]);
+          Dtype z_real = x_real*y_real + x_imag*y_imag;
+          Dtype z_imag = - x_real*y_imag + x_imag*y_real;
+          map_out_complex[i] += std::complex<Dtype>(z_real, z_imag);
+        }
       }
     }
-  }
+  });
+
+  // IFFT of all results
+  caffe_cpu_fft_execute_dft_c2r<Dtype>(ifft_handle_, fft_map_out_complex_,
+      fft_map_out_real_);
 
   Dtype ifft_scale = 1. / ((Dtype) fft_map_real_size_);
-  for (int out = 0; out < this->num_output_; out++) {
-    // IFFT of results
-    std::complex<Dtype>* map_out_complex = fft_map_out_complex_ +
-        out * fft_map_complex_size_;
-    Dtype* map_out_real = fft_map_out_real_ + out * fft_map_real_size_;
-    caffe_cpu_fft_execute_dft_c2r<Dtype>(ifft_handle_, map_out_complex,
-        map_out_real);
-
-    // Mapping from IFFT result to top data
-    Dtype* map_out = top_data + top_data_offset + out * map_out_size_;
-    for (int h_out = 0; h_out < height_out_; h_out++) {
-      for (int w_out = 0; w_out < width_out_; w_out++) {
-        int h = h_out  * stride_h_;
-        int w = w_out  * stride_w_;
-        if ((h < fft_height_) &&  (w < fft_width_)) {
-          int src_idx = h * fft_width_ + w;
-          int dst_idx = h_out * width_out_ + w_out;
-          map_out[dst_idx] = ifft_scale * map_out_real[src_idx];
+  Caffe::thread_pool().parallel_for(0, this->num_output_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int out = begin; out < end; out++) {
+      // Mapping from IFFT result to top data
+      const Dtype* map_out_real = fft_map_out_real_ + out * fft_map_real_size_;
+      Dtype* map_out = top_data + top_data_offset + out * map_out_size_;
+      for (int h_out = 0; h_out < height_out_; h_out++) {
+        for (int w_out = 0; w_out < width_out_; w_out++) {
+          int h = h_out  * stride_h_;
+          int w = w_out  * stride_w_;
+          if ((h < fft_height_) &&  (w < fft_width_)) {
+            int src_idx = h * fft_width_ + w;
+            int dst_idx = h_out * width_out_ + w_out;
+            map_out[dst_idx] = ifft_scale * map_out_real[src_idx];
+          }
         }
       }
     }
-  }
+  });
   // bias
   if (this->bias_term_) {
     const Dtype* bias = this->blobs_[1]->cpu_data();
@@ -309,73 +318,80 @@ void ConvolutionLayerFFT<Dtype>::Backward_cpu_fft_task(
   const Dtype* top_diff = top[i]->cpu_diff();
   Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
 
-  // Clear buffers
-  caffe_memset(fft_map_real_size_ * sizeof(Dtype), 0., fft_map_in_real_);
-  caffe_memset(this->channels_ * fft_map_complex_size_*
-      sizeof(std::complex<Dtype>), 0., fft_map_out_complex_);
-
   int ch_gr = this->channels_ / this->group_;
   int out_gr = this->num_output_ / this->group_;
   int map_in_size = height_out_ * width_out_;
-  for (int out = 0; out < this->num_output_; out++) {
-    const Dtype* map_in = const_cast<Dtype*>(top_diff + n * this->top_dim_ +
-        out * map_in_size);
-    // Left-top 0-padding of top data
-    for (int h = 0; h < height_out_; h++) {
-      for (int w = 0; w < width_out_; w++) {
-        int h_pad = h * stride_h_;
-        int w_pad = w * stride_w_;
-        fft_map_in_real_[h_pad * fft_width_ + w_pad] =
-              map_in[h * width_out_ + w];
+  Caffe::thread_pool().parallel_for(0, this->num_output_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int out = begin; out < end; out++) {
+      Dtype* map_in_real = fft_map_in_real_ + out * fft_map_real_size_;
+      caffe_memset(fft_map_real_size_ * sizeof(Dtype), 0., map_in_real);
+      const Dtype* map_in = top_diff + n * this->top_dim_ + out * map_in_size;
+      // Left-top 0-padding of top data
+      for (int h = 0; h < height_out_; h++) {
+        for (int w = 0; w < width_out_; w++) {
+          int h_pad = h * stride_h_;
+          int w_pad = w * stride_w_;
+          map_in_real[h_pad * fft_width_ + w_pad] = map_in[h * width_out_ + w];
+        }
       }
     }
+  });
 
-    // FFT of padded top data
-    caffe_cpu_fft_execute_dft_r2c<Dtype>(fft_handle_, fft_map_in_real_,
-        fft_map_in_complex_);
+  // FFT of all padded top data
+  caffe_cpu_fft_execute_dft_r2c<Dtype>(fft_backward_handle_, fft_map_in_real_,
+      fft_map_in_complex_);
 
-    // Multiplication of FFT top data and FFT weights
-    int g = out / out_gr;
-    int c_first = g * ch_gr;
-    int c_last = (g + 1) * ch_gr;
-    for (int c = c_first; c < c_last; c++) {
-      int c_offset = c % ch_gr;
+  // Multiplication of FFT top data and FFT weights. Each channel only
+  // accumulates into its own map, so the channels run in parallel.
+  Caffe::thread_pool().parallel_for(0, this->channels_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int c = begin; c < end; c++) {
       std::complex<Dtype>* map_out_complex = fft_map_out_complex_ +
           c * fft_map_complex_size_;
-      std::complex<Dtype>* weights_complex = fft_weights_complex_ +
-          (out * ch_gr + c_offset) * fft_map_complex_size_;
-      for (int i = 0; i < fft_map_complex_size_; i++) {
-        Dtype x_real = std::real(fft_map_in_complex_[i]);
-        Dtype x_imag = std::imag(fft_map_in_complex_[i]);
-        Dtype y_real = std::real(weights_complex[i]);
-        Dtype y_imag = std::imag(weights_complex[i]);
-        Dtype z_real = x_real * y_real - x_imag * y_imag;
-        Dtype z_imag = x_real * y_imag + x_imag * y_real;
-        map_out_complex[i] += std::complex<Dtype>(z_real, z_imag);
-     }
+      std::fill(map_out_complex, map_out_complex + fft_map_complex_size_,
+          std::complex<Dtype>(0));
+      int g = c / ch_gr;
+      int c_offset = c % ch_gr;
+      for (int out = g * out_gr; out < (g + 1) * out_gr; out++) {
+        const std::complex<Dtype>* map_in_complex = fft_map_in_complex_ +
+            out * fft_map_complex_size_;
+        const std::complex<Dtype>* weights_complex = fft_weights_complex_ +
+            (out * ch_gr + c_offset) * fft_map_complex_size_;
+        for (int i = 0; i < fft_map_complex_size_; i++) {
+          Dtype x_real = std::real(map_in_complex[i]);
+          Dtype x_imag = std::imag(map_in_complex[i]);
+          Dtype y_real = std::real(weights_complex[i]);
+          Dtype y_imag = std::imag(weights_complex[i]);
+          Dtype z_real = x_real * y_real - x_imag * y_imag;
+          Dtype z_imag = x_real * y_imag + x_imag * y_real;
+          map_out_complex[i] += std::complex<Dtype>(z_real, z_imag);
+        }
+      }
     }
-  }
+  });
+
+  // IFFT of all results
+  caffe_cpu_fft_execute_dft_c2r<Dtype>(ifft_backward_handle_,
+      fft_map_out_complex_, fft_map_out_real_);
 
   Dtype ifft_scale = 1. / ((Dtype) fft_map_real_size_);
-  for (int c = 0; c < this->channels_; c++) {
-    // IFFT of results
-    std::complex<Dtype>* map_out_complex = fft_map_out_complex_ +
-        c * fft_map_complex_size_;
-    caffe_cpu_fft_execute_dft_c2r<Dtype>(ifft_handle_, map_out_complex,
-        fft_map_out_real_);
-
-    // Mapping from IFFT result to bottom data
-    Dtype* map_out = reinterpret_cast<Dtype*>(bottom_diff +
-        n * this->bottom_dim_ + c * map_size_);
-    for (int h_out = 0; h_out < height_; h_out++) {
-      for (int w_out = 0; w_out < width_; w_out++) {
-        int h = h_out + pad_h_;
-        int w = w_out + pad_w_;
-        map_out[h_out * width_ + w_out] =
-            ifft_scale * fft_map_out_real_[h * fft_width_ + w];
+  Caffe::thread_pool().parallel_for(0, this->channels_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int c = begin; c < end; c++) {
+      // Mapping from IFFT result to bottom data
+      const Dtype* map_out_real = fft_map_out_real_ + c * fft_map_real_size_;
+      Dtype* map_out = bottom_diff + n * this->bottom_dim_ + c * map_size_;
+      for (int h_out = 0; h_out < height_; h_out++) {
+        for (int w_out = 0; w_out < width_; w_out++) {
+          int h = h_out + pad_h_;
+          int w = w_out + pad_w_;
+          map_out[h_out * width_ + w_out] =
+              ifft_scale * map_out_real[h * fft_width_ + w];
+        }
       }
     }
-  }
+  });
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "caffe/layers/conv_winograd_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// F(4x4, 3x3): 6x6 input tiles, 4x4 output tiles and 36 tile positions.
+const int_tp kWinogradTile = 6;
+const int_tp kWinogradOutputTile = 4;
+const int_tp kWinogradPositions = kWinogradTile * kWinogradTile;
+// The transformed input and output tiles of one GEMM batch should stay in
+// L2 while the 36 GEMMs run.
+const int_tp kWinogradBlockBytes = 1 << 20;
+
+// The F(4x4, 3x3) transforms of Lavin and Gray, "Fast Algorithms for
+// Convolutional Neural Networks": U = G g G^T for a filter g, V = B^T d B
+// for an input tile d and Y = A^T M A for a product M. Each 2D transform
+// applies the 1D transform to the columns and then to the rows.
+template<typename Dtype>
+static inline void filter_transform_1d(const Dtype g0, const Dtype g1,
+                                       const Dtype g2, Dtype* u,
+                                       const int_tp stride) {
+  u[0] = g0 / 4;
+  u[stride] = -(g0 + g1 + g2) / 6;
+  u[2 * stride] = -(g0 - g1 + g2) / 6;
+  u[3 * stride] = g0 / 24 + g1 / 12 + g2 / 6;
+  u[4 * stride] = g0 / 24 - g1 / 12 + g2 / 6;
+  u[5 * stride] = g2;
+}
+
+template<typename Dtype>
+static inline void input_transform_1d(const Dtype* d, const int_tp d_stride,
+                                      Dtype* v, const int_tp v_stride) {
+  const Dtype d0 = d[0], d1 = d[d_stride], d2 = d[2 * d_stride],
+      d3 = d[3 * d_stride], d4 = d[4 * d_stride], d5 = d[5 * d_stride];
+  v[0] = 4 * d0 - 5 * d2 + d4;
+  v[v_stride] = -4 * (d1 + d2) + d3 + d4;
+  v[2 * v_stride] = 4 * (d1 - d2) - d3 + d4;
+  v[3 * v_stride] = 2 * (d3 - d1) - d2 + d4;
+  v[4 * v_stride] = 2 * (d1 - d3) - d2 + d4;
+  v[5 * v_stride] = 4 * d1 - 5 * d3 + d5;
+}
+
+template<typename Dtype>
+static inline void output_transform_1d(const Dtype* m, const int_tp m_stride,
+                                       Dtype* y, const int_tp y_stride) {
+  const Dtype m0 = m[0], m1 = m[m_stride], m2 = m[2 * m_stride],
+      m3 = m[3 * m_stride], m4 = m[4 * m_stride], m5 = m[5 * m_stride];
+  y[0] = m0 + m1 + m2 + m3 + m4;
+  y[y_stride] = m1 - m2 + 2 * (m3 - m4);
+  y[2 * y_stride] = m1 + m2 + 4 * (m3 + m4);
+  y[3 * y_stride] = m1 - m2 + 8 * (m3 - m4) + m5;
+}
+
+// Transforms the 3x3 filter g, read with the given element strides so that
+// it can be flipped, into the 6x6 u.
+template<typename Dtype>
+static void winograd_filter_transform(const Dtype* g, const int_tp row_step,
+                                      const int_tp col_step, Dtype* u) {
+  Dtype t[kWinogradTile * 3];
+  for (int_tp j = 0; j < 3; ++j) {
+    filter_transform_1d(g[j * col_step], g[row_step + j * col_step],
+                        g[2 * row_step + j * col_step], t + j, 3);
+  }
+  for (int_tp i = 0; i < kWinogradTile; ++i) {
+    filter_transform_1d(t[i * 3], t[i * 3 + 1], t[i * 3 + 2],
+                        u + i * kWinogradTile, 1);
+  }
+}
+
+template<typename Dtype>
+static void winograd_input_transform(const Dtype* d, Dtype* v) {
+  Dtype t[kWinogradPositions];
+  for (int_tp j = 0; j < kWinogradTile; ++j) {
+    input_transform_1d(d + j, kWinogradTile, t + j, kWinogradTile);
+  }
+  for (int_tp i = 0; i < kWinogradTile; ++i) {
+    input_transform_1d(t + i * kWinogradTile, 1, v + i * kWinogradTile, 1);
+  }
+}
+
+template<typename Dtype>
+static void winograd_output_transform(const Dtype* m, Dtype* y) {
+  Dtype t[kWinogradOutputTile * kWinogradTile];
+  for (int_tp j = 0; j < kWinogradTile; ++j) {
+    output_transform_1d(m + j, kWinogradTile, t + j, kWinogradTile);
+  }
+  for (int_tp i = 0; i < kWinogradOutputTile; ++i) {
+    output_transform_1d(t + i * kWinogradTile, 1,
+                        y + i * kWinogradOutputTile, 1);
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerWinograd<Dtype, MItype, MOtype>::LayerSetUp(
+      const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  ConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(bottom, top);
+  const int_tp* kernel_shape = this->kernel_shape_.cpu_data();
+  const int_tp* stride = this->stride_.cpu_data();
+  const int_tp* pad = this->pad_.cpu_data();
+  const int_tp* dilation = this->dilation_.cpu_data();
+  winograd_ = this->num_spatial_axes_ == 2 && !this->force_nd_im2col_ &&
+      !this->quantized_ && !this->binary_;
+  for (int_tp i = 0; winograd_ && i < this->num_spatial_axes_; ++i) {
+    winograd_ = kernel_shape[i] == 3 && stride[i] == 1 && dilation[i] == 1 &&
+        pad[i] <= 2;
+  }
+  if (!winograd_) {
+    LOG(INFO) << "Layer " << this->layer_param_.name() << " is not a 3x3 "
+              << "stride 1 convolution, falling back from WINOGRAD.";
+    return;
+  }
+  weight_versions_.Clear();
+  transform_weights();
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerWinograd<Dtype, MItype, MOtype>::transform_weights() {
+  if (!weight_versions_.Changed(this->blobs_)) {
+    return;
+  }
+  weight_versions_.Update(this->blobs_);
+  backward_weights_transformed_ = false;
+  const Blob<Dtype>& weights = *this->blobs_[0];
+  const Dtype* weight = weights.cpu_data();
+  const int_tp out_channels = weights.shape(0);
+  const int_tp in_channels = weights.shape(1);
+  transformed_weights_.resize(kWinogradPositions * out_channels *
+                              in_channels);
+  Dtype u[kWinogradPositions];
+  for (int_tp o = 0; o < out_channels; ++o) {
+    for (int_tp c = 0; c < in_channels; ++c) {
+      winograd_filter_transform(weight + (o * in_channels + c) * 9, 3, 1, u);
+      for (int_tp xi = 0; xi < kWinogradPositions; ++xi) {
+        transformed_weights_[(xi * out_channels + o) * in_channels + c] =
+            u[xi];
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerWinograd<Dtype, MItype, MOtype>::
+    transform_backward_weights() {
+  transform_weights();
+  if (backward_weights_transformed_) {
+    return;
+  }
+  // The bottom gradient correlates the top gradient with the filters
+  // rotated by 180 degrees, from the output to the input channels of each
+  // group.
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const int_tp out_channels = this->blobs_[0]->shape(0);
+  const int_tp group_in_channels = this->blobs_[0]->shape(1);
+  const int_tp group_out_channels = out_channels / this->group_;
+  const int_tp in_channels = group_in_channels * this->group_;
+  transformed_backward_weights_.resize(kWinogradPositions * in_channels *
+                                       group_out_channels);
+  Dtype u[kWinogradPositions];
+  for (int_tp g = 0; g < this->group_; ++g) {
+    for (int_tp c = 0; c < group_in_channels; ++c) {
+      for (int_tp o = 0; o < group_out_channels; ++o) {
+        const Dtype* g_oc = weight +
+            ((g * group_out_channels + o) * group_in_channels + c) * 9;
+        winograd_filter_transform(g_oc + 8, -3, -1, u);
+        const int_tp row = g * group_in_channels + c;
+        for (int_tp xi = 0; xi < kWinogradPositions; ++xi) {
+          transformed_backward_weights_[(xi * in_channels + row) *
+                                        group_out_channels + o] = u[xi];
+        }
+      }
+    }
+  }
+  backward_weights_transformed_ = true;
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerWinograd<Dtype, MItype, MOtype>::winograd_cpu(
+    const int_tp num, const Dtype* input, const int_tp in_channels,
+    const int_tp height, const int_tp width, const int_tp pad_h,
+    const int_tp pad_w, const Dtype* transformed_weights,
+    const int_tp out_channels, Dtype* output) {
+  const int_tp output_h = height + 2 * pad_h - 2;
+  const int_tp output_w = width + 2 * pad_w - 2;
+  const int_tp tiles_h = (output_h + kWinogradOutputTile - 1) /
+      kWinogradOutputTile;
+  const int_tp tiles_w = (output_w + kWinogradOutputTile - 1) /
+      kWinogradOutputTile;
+  const int_tp image_tiles = tiles_h * tiles_w;
+  const int_tp tiles = num * image_tiles;
+  const int_tp group_in_channels = in_channels / this->group_;
+  const int_tp group_out_channels = out_channels / this->group_;
+  // Tiles are batched across images, so that small late layers still make
+  // GEMMs wide enough to be efficient.
+  const int_tp block_tiles = std::max(int_tp(16), kWinogradBlockBytes /
+      static_cast<int_tp>(kWinogradPositions * (in_channels + out_channels) *
+                          sizeof(Dtype)));
+  transformed_input_.resize(kWinogradPositions * in_channels *
+                            std::min(block_tiles, tiles));
+  transformed_output_.resize(kWinogradPositions * out_channels *
+                             std::min(block_tiles, tiles));
+  Dtype d[kWinogradPositions];
+  Dtype v[kWinogradPositions];
+  Dtype y[kWinogradOutputTile * kWinogradOutputTile];
+  for (int_tp t0 = 0; t0 < tiles; t0 += block_tiles) {
+    const int_tp tb = std::min(block_tiles, tiles - t0);
+    Dtype* transformed_input = &transformed_input_[0];
+    Dtype* transformed_output = &transformed_output_[0];
+    // Channels outermost, so that the 36 transformed values of consecutive
+    // tiles go to 36 contiguous rows.
+    for (int_tp c = 0; c < in_channels; ++c) {
+      for (int_tp j = 0; j < tb; ++j) {
+        const int_tp n = (t0 + j) / image_tiles;
+        const int_tp tile = (t0 + j) % image_tiles;
+        const int_tp h0 = (tile / tiles_w) * kWinogradOutputTile - pad_h;
+        const int_tp w0 = (tile % tiles_w) * kWinogradOutputTile - pad_w;
+        const Dtype* image = input + (n * in_channels + c) * height * width;
+        for (int_tp i = 0; i < kWinogradTile; ++i) {
+          const int_tp h = h0 + i;
+          for (int_tp k = 0; k < kWinogradTile; ++k) {
+            const int_tp w = w0 + k;
+            d[i * kWinogradTile + k] =
+                (h >= 0 && h < height && w >= 0 && w < width) ?
+                image[h * width + w] : Dtype(0);
+          }
+        }
+        winograd_input_transform(d, v);
+        for (int_tp xi = 0; xi < kWinogradPositions; ++xi) {
+          transformed_input[(xi * in_channels + c) * tb + j] = v[xi];
+        }
+      }
+    }
+    for (int_tp xi = 0; xi < kWinogradPositions; ++xi) {
+      for (int_tp g = 0; g < this->group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, group_out_channels,
+            tb, group_in_channels, Dtype(1),
+            transformed_weights + (xi * out_channels + g * group_out_channels)
+                * group_in_channels,
+            transformed_input + (xi * in_channels + g * group_in_channels)
+                * tb,
+            Dtype(0),
+            transformed_output + (xi * out_channels + g * group_out_channels)
+                * tb);
+      }
+    }
+    for (int_tp o = 0; o < out_channels; ++o) {
+      for (int_tp j = 0; j < tb; ++j) {
+        const int_tp n = (t0 + j) / image_tiles;
+        const int_tp tile = (t0 + j) % image_tiles;
+        const int_tp h0 = (tile / tiles_w) * kWinogradOutputTile;
+        const int_tp w0 = (tile % tiles_w) * kWinogradOutputTile;
+        const int_tp rows = std::min(kWinogradOutputTile, output_h - h0);
+        const int_tp cols = std::min(kWinogradOutputTile, output_w - w0);
+        for (int_tp xi = 0; xi < kWinogradPositions; ++xi) {
+          d[xi] = transformed_output[(xi * out_channels + o) * tb + j];
+        }
+        winograd_output_transform(d, y);
+        Dtype* out = output + ((n * out_channels + o) * output_h + h0) *
+            output_w + w0;
+        for (int_tp i = 0; i < rows; ++i) {
+          for (int_tp k = 0; k < cols; ++k) {
+            out[i * output_w + k] = y[i * kWinogradOutputTile + k];
+          }
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerWinograd<Dtype, MItype, MOtype>::Forward_cpu(
+      const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  if (!winograd_) {
+    ConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  transform_weights();
+  const int_tp* pad = this->pad_.cpu_data();
+  const int_tp height = this->conv_input_shape_.cpu_data()[1];
+  const int_tp width = this->conv_input_shape_.cpu_data()[2];
+  for (int_tp i = 0; i < bottom.size(); ++i) {
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    winograd_cpu(this->num_, bottom[i]->cpu_data(), this->channels_, height,
+                 width, pad[0], pad[1], &transformed_weights_[0],
+                 this->num_output_, top_data);
+    if (this->bias_term_) {
+      const Dtype* bias = this->blobs_[1]->cpu_data();
+      for (int_tp n = 0; n < this->num_; ++n) {
+        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ConvolutionLayerWinograd<Dtype, MItype, MOtype>::Backward_cpu(
+      const vector<Blob<MOtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<MItype>*>& bottom) {
+  if (!winograd_) {
+    ConvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(top,
+        propagate_down, bottom);
+    return;
+  }
+  const int_tp* pad = this->pad_.cpu_data();
+  Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  for (int_tp i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int_tp n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    // Gradient w.r.t. weight. Note that we will accumulate diffs.
+    if (this->param_propagate_down_[0]) {
+      for (int_tp n = 0; n < this->num_; ++n) {
+        this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
+                              top_diff + n * this->top_dim_, weight_diff);
+      }
+    }
+    // Gradient w.r.t. bottom data, a full correlation of the top gradient
+    // with the rotated filters.
+    if (propagate_down[i]) {
+      transform_backward_weights();
+      winograd_cpu(this->num_, top_diff, this->num_output_,
+                   this->output_shape_[0], this->output_shape_[1],
+                   2 - pad[0], 2 - pad[1], &transformed_backward_weights_[0],
+                   this->channels_, bottom[i]->mutable_cpu_diff());
+    }
+  }
+}
+
+INSTANTIATE_CLASS_3T(ConvolutionLayerWinograd);
+
+}  // namespace caffe
@@ -1,8 +1,8 @@
-#include <cfloat>
 #include <vector>
 
 #include "caffe/layers/eltwise_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -51,60 +51,66 @@ void EltwiseLayer<Dtype, MItype, MOtype>::Reshape(
 
 template<typename Dtype, typename MItype, typename MOtype>
 void EltwiseLayer<Dtype, MItype, MOtype>::Forward_cpu(
+    const vector<Blob<MItype>*>& bottom,
     const vector<Blob<MOtype>*>& top) {
-  int_tp* mask = NULL;
-  const Dtype* bottom_data_a = NULL;
-  const Dtype* bottom_data_b = NULL;
   const int_tp count = top[0]->count();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype maxVal = FLT_MAX;
-  if (std::is_same<Dtype, half_float::half>::value)
-    maxVal = HALF_MAX;
-  switch (op_) {
-  case EltwiseParameter_EltwiseOp_PROD:
-    caffe_mul(count, bottom[0]->cpu_data(), bottom[1]->cpu_data(), top_data);
-    for (int_tp i = 2; i < bottom.size(); ++i) {
-      caffe_mul(count, top_data, bottom[i]->cpu_data(), top_data);
-    }
-    break;
-  case EltwiseParameter_EltwiseOp_SUM:
-    caffe_set(count, Dtype(0), top_data);
-    // TODO(shelhamer) does BLAS optimize to sum for coeff = 1?
-    for (int_tp i = 0; i < bottom.size(); ++i) {
-      caffe_axpy(count, coeffs_[i], bottom[i]->cpu_data(), top_data);
-    }
-    break;
-  case EltwiseParameter_EltwiseOp_MAX:
-    // Initialize
-    mask = max_idx_.mutable_cpu_data();
-    caffe_set(count, (int_tp)-1, mask);
-    caffe_set(count, Dtype(-maxVal), top_data);
-    // bottom 0 & 1
-    bottom_data_a = bottom[0]->cpu_data();
-    bottom_data_b = bottom[1]->cpu_data();
-    for (int_tp idx = 0; idx < count; ++idx) {
-      if (bottom_data_a[idx] > bottom_data_b[idx]) {
-        top_data[idx] = bottom_data_a[idx];  // maxval
-        mask[idx] = 0;  // maxid
-      } else {
-        top_data[idx] = bottom_data_b[idx];  // maxval
-        mask[idx] = 1;  // maxid
+  int_tp* mask = op_ == EltwiseParameter_EltwiseOp_MAX ?
+      max_idx_.mutable_cpu_data() : NULL;
+  vector<const Dtype*> bottom_data(bottom.size());
+  for (int_tp i = 0; i < bottom.size(); ++i) {
+    bottom_data[i] = bottom[i]->cpu_data();
+  }
+  // Each chunk of elements goes through all bottoms at once.
+  Caffe::thread_pool().parallel_for(0, count, kParallelElementGrain,
+      [&](int_tp begin, int_tp end) {
+    switch (op_) {
+    case EltwiseParameter_EltwiseOp_PROD:
+      for (int_tp idx = begin; idx < end; ++idx) {
+        top_data[idx] = bottom_data[0][idx] * bottom_data[1][idx];
       }
-    }
-    // bottom 2++
-    for (int_tp blob_idx = 2; blob_idx < bottom.size(); ++blob_idx) {
-      bottom_data_b = bottom[blob_idx]->cpu_data();
-      for (int_tp idx = 0; idx < count; ++idx) {
-        if (bottom_data_b[idx] > top_data[idx]) {
-          top_data[idx] = bottom_data_b[idx];  // maxval
-          mask[idx] = blob_idx;  // maxid
+      for (int_tp i = 2; i < bottom.size(); ++i) {
+        for (int_tp idx = begin; idx < end; ++idx) {
+          top_data[idx] *= bottom_data[i][idx];
+        }
+      }
+      break;
+    case EltwiseParameter_EltwiseOp_SUM:
+      for (int_tp idx = begin; idx < end; ++idx) {
+        top_data[idx] = coeffs_[0] * bottom_data[0][idx];
+      }
+      for (int_tp i = 1; i < bottom.size(); ++i) {
+        const Dtype coeff = coeffs_[i];
+        for (int_tp idx = begin; idx < end; ++idx) {
+          top_data[idx] += coeff * bottom_data[i][idx];
+        }
+      }
+      break;
+    case EltwiseParameter_EltwiseOp_MAX:
+      // bottom 0 & 1
+      for (int_tp idx = begin; idx < end; ++idx) {
+        if (bottom_data[0][idx] > bottom_data[1][idx]) {
+          top_data[idx] = bottom_data[0][idx];  // maxval
+          mask[idx] = 0;  // maxid
+        } else {
+          top_data[idx] = bottom_data[1][idx];  // maxval
+          mask[idx] = 1;  // maxid
         }
       }
+      // bottom 2++
+      for (int_tp blob_idx = 2; blob_idx < bottom.size(); ++blob_idx) {
+        for (int_tp idx = begin; idx < end; ++idx) {
+          if (bottom_data[blob_idx][idx] > top_data[idx]) {
+            top_data[idx] = bottom_data[blob_idx][idx];  // maxval
+            mask[idx] = blob_idx;  // maxid
+          }
+        }
+      }
+      break;
+    default:
+      LOG(FATAL) << "Unknown elementwise operation.";
     }
-    break;
-  default:
-    LOG(FATAL) << "Unknown elementwise operation.";
-  }
+  });
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -2,9 +2,14 @@
 #include <vector>
 
 #include "caffe/layers/elu_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
+// Elements per block of the vectorized exponentials.
+const int_tp kELUBlock = 1024;
+
 template<typename Dtype, typename MItype, typename MOtype>
 void ELULayer<Dtype, MItype, MOtype>::Reshape(
                             const vector<Blob<MItype>*>& bottom,
@@ -22,12 +27,25 @@ void ELULayer<Dtype, MItype, MOtype>::Forward_cpu(
                                     const vector<Blob<MOtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int count = bottom[0]->count();
+  const int_tp count = bottom[0]->count();
   Dtype alpha = this->layer_param_.elu_param().alpha();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = std::max(bottom_data[i], Dtype(0))
-        + alpha * (exp(std::min(bottom_data[i], Dtype(0))) - Dtype(1));
-  }
+  // Blocks of exp(min(x, 0)), which also keep in place computation correct.
+  Caffe::thread_pool().parallel_for(0, (count + kELUBlock - 1) / kELUBlock,
+      kParallelElementGrain / kELUBlock, [&](int_tp begin, int_tp end) {
+    for (int_tp b = begin; b < end; ++b) {
+      const int_tp block = b * kELUBlock;
+      const int_tp block_size = std::min(kELUBlock, count - block);
+      Dtype expval[kELUBlock];
+      for (int_tp i = 0; i < block_size; ++i) {
+        expval[i] = std::min(bottom_data[block + i], Dtype(0));
+      }
+      caffe_exp(block_size, expval, expval);
+      for (int_tp i = 0; i < block_size; ++i) {
+        top_data[block + i] = std::max(bottom_data[block + i], Dtype(0))
+            + alpha * (expval[i] - Dtype(1));
+      }
+    }
+  });
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -40,12 +58,15 @@ void ELULayer<Dtype, MItype, MOtype>::Backward_cpu(
     const Dtype* top_data = top[0]->cpu_data();
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    const int count = bottom[0]->count();
+    const int_tp count = bottom[0]->count();
     Dtype alpha = this->layer_param_.elu_param().alpha();
-    for (int i = 0; i < count; ++i) {
-      bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
-          + (alpha + top_data[i]) * (bottom_data[i] <= 0));
-    }
+    Caffe::thread_pool().parallel_for(0, count, kParallelElementGrain,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp i = begin; i < end; ++i) {
+        bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
+            + (alpha + top_data[i]) * (bottom_data[i] <= 0));
+      }
+    });
   }
 }
 
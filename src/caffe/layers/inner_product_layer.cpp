@@ -53,6 +53,29 @@ void InnerProductLayer<Dtype, MItype, MOtype>::LayerSetUp(const vector<Blob<MIty
     }
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  quantized_ = this->layer_param_.compute_data_type() == INT8_QUANTIZED;
+  if (quantized_) {
+    CHECK_EQ(this->phase_, TEST)
+        << "INT8_QUANTIZED inner product is only supported for inference.";
+    CHECK_NE(this->layer_param_.top_data_type(), INT8_QUANTIZED)
+        << "INT8_QUANTIZED inner product outputs dequantized values.";
+  }
+  binary_ = IsPackedBinary(this->layer_param_.compute_data_type());
+  if (binary_) {
+    CHECK_EQ(this->phase_, TEST)
+        << "Binary inner product is only supported for inference.";
+    CHECK(!transpose_)
+        << "Binary inner product does not support transposed weights.";
+    CHECK(this->layer_param_.top_data_type() == FLOAT ||
+          this->layer_param_.top_data_type() == DOUBLE)
+        << "Binary inner product outputs real values.";
+    CHECK(!IsPackedBinary(this->layer_param_.bottom_data_type()) || axis == 1)
+        << "Packed binary inputs are packed along axis 1.";
+    // The signs are packed along the channel axis, not the flattened one,
+    // to match the packing of convolution outputs by the Quantizer.
+    binary_channels_ = axis < bottom[0]->num_axes() ?
+        bottom[0]->shape(axis) : 1;
+  }
   copied_weight_data_ = NULL;
 
   test_only_ = this->phase_ == TEST;
@@ -87,6 +110,14 @@ void InnerProductLayer<Dtype, MItype, MOtype>::Reshape(const vector<Blob<MItype>
 template<typename Dtype, typename MItype, typename MOtype>
 void InnerProductLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MItype>*>& bottom,
                                            const vector<Blob<MOtype>*>& top) {
+  if (quantized_) {
+    Forward_cpu_quantized(bottom, top);
+    return;
+  }
+  if (binary_) {
+    Forward_cpu_binary(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const Dtype* weight = this->blobs_[0]->cpu_data();
@@ -100,6 +131,80 @@ void InnerProductLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MIt
   }
 }
 
+template<typename Dtype, typename MItype, typename MOtype>
+void InnerProductLayer<Dtype, MItype, MOtype>::Forward_cpu_quantized(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  // Requantize whenever the weights changed, e.g. by a solver step or
+  // CopyTrainedLayersFrom.
+  if (quantized_versions_.Changed(this->blobs_)) {
+    quantized_weights_.Quantize(N_, K_, this->blobs_[0]->cpu_data(),
+                                transpose_);
+    quantized_versions_.Update(this->blobs_);
+  }
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  QuantizationParameter bottom_quantization;
+  GetBottomQuantization(this->layer_param_, M_ * K_, bottom_data,
+                        &bottom_quantization);
+  const bool is_code =
+      this->layer_param_.bottom_data_type() == INT8_QUANTIZED;
+  const float bottom_scale = ActivationScale(bottom_quantization);
+  const int32_t bottom_zero_point = ActivationZeroPoint(bottom_quantization);
+  // The bottom rows are already K_-contiguous, so they are quantized in place
+  // and the N_ x M_ result is transposed while dequantizing.
+  quantized_bottom_.resize(M_ * K_);
+  quantized_top_.resize(N_ * M_);
+  caffe_cpu_quantize_activations(M_ * K_, bottom_data, is_code,
+                                 bottom_quantization, &quantized_bottom_[0]);
+  caffe_cpu_gemm_s8u8s32(N_, M_, K_, quantized_weights_.data(),
+                         &quantized_bottom_[0], &quantized_top_[0]);
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int_tp n = 0; n < N_; ++n) {
+    const float scale = quantized_weights_.scale(n) * bottom_scale;
+    const int32_t offset = bottom_zero_point * quantized_weights_.row_sum(n);
+    const Dtype bias_n = bias ? bias[n] : Dtype(0);
+    for (int_tp m = 0; m < M_; ++m) {
+      top_data[m * N_ + n] = static_cast<Dtype>(
+          scale * (quantized_top_[n * M_ + m] - offset)) + bias_n;
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void InnerProductLayer<Dtype, MItype, MOtype>::Forward_cpu_binary(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  const int_tp inner = K_ / binary_channels_;
+  // Binarize again whenever the weights changed.
+  if (binary_versions_.Changed(this->blobs_)) {
+    binary_weights_.Binarize(N_, binary_channels_, inner,
+                             this->blobs_[0]->cpu_data());
+    binary_versions_.Update(this->blobs_);
+  }
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const int_tp row_words = binary_weights_.row_words();
+  binary_bottom_.resize(M_ * row_words);
+  binary_top_.resize(N_ * M_);
+  if (IsPackedBinary(this->layer_param_.bottom_data_type())) {
+    ReadPackedSigns(M_, binary_channels_, inner, bottom_data,
+                    &binary_bottom_[0]);
+  } else {
+    caffe_cpu_pack_signs(M_, binary_channels_, inner, bottom_data,
+                         &binary_bottom_[0]);
+  }
+  caffe_cpu_gemm_xor_popcount(N_, M_, row_words, binary_weights_.data(),
+                              &binary_bottom_[0], &binary_top_[0]);
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int_tp n = 0; n < N_; ++n) {
+    const float scale = binary_weights_.scale(n);
+    const Dtype bias_n = bias ? bias[n] : Dtype(0);
+    for (int_tp m = 0; m < M_; ++m) {
+      top_data[m * N_ + n] = static_cast<Dtype>(
+          scale * (K_ - 2 * binary_top_[n * M_ + m])) + bias_n;
+    }
+  }
+}
+
 template<typename Dtype, typename MItype, typename MOtype>
 void InnerProductLayer<Dtype, MItype, MOtype>::Backward_cpu(
     const vector<Blob<MOtype>*>& top, const vector<bool>& propagate_down,
@@ -1,10 +1,79 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layers/lrn_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
+using std::min;
+using std::max;
+
+// Pooled rows computed together by a thread of the fused forward pass. The
+// normalized rows shared by the windows of neighbouring bands are computed
+// twice.
+static const int_tp kFusedBandRows = 8;
+
+// Normalizes a row of width values of each of the channels of an image
+// across channels, sliding the sum of the squares of the channel window
+// along in sum. The channels of bottom, scale and top are bottom_stride,
+// scale_stride and top_stride apart.
+template<typename Dtype>
+static void CrossChannelRow(const Dtype* bottom, const int_tp bottom_stride,
+                            const int_tp channels, const int_tp width,
+                            const int_tp size, const Dtype alpha_over_size,
+                            const Dtype k, const Dtype beta,
+                            Dtype* scale, const int_tp scale_stride,
+                            Dtype* top, const int_tp top_stride,
+                            Dtype* sum) {
+  const int_tp pre_pad = (size - 1) / 2;
+  std::fill(sum, sum + width, Dtype(0));
+  for (int_tp c = 0; c < min(pre_pad, channels); ++c) {
+    const Dtype* head = bottom + c * bottom_stride;
+    for (int_tp w = 0; w < width; ++w) {
+      sum[w] += head[w] * head[w];
+    }
+  }
+  for (int_tp c = 0; c < channels; ++c) {
+    if (c + pre_pad < channels) {
+      const Dtype* head = bottom + (c + pre_pad) * bottom_stride;
+      for (int_tp w = 0; w < width; ++w) {
+        sum[w] += head[w] * head[w];
+      }
+    }
+    if (c - pre_pad - 1 >= 0) {
+      const Dtype* tail = bottom + (c - pre_pad - 1) * bottom_stride;
+      for (int_tp w = 0; w < width; ++w) {
+        sum[w] -= tail[w] * tail[w];
+      }
+    }
+    const Dtype* x = bottom + c * bottom_stride;
+    Dtype* s = scale + c * scale_stride;
+    Dtype* y = top + c * top_stride;
+    for (int_tp w = 0; w < width; ++w) {
+      s[w] = k + alpha_over_size * sum[w];
+    }
+    // The common exponents avoid pow, which does not vectorize.
+    if (beta == Dtype(0.75)) {
+      for (int_tp w = 0; w < width; ++w) {
+        const Dtype root = std::sqrt(s[w]);
+        y[w] = x[w] / (root * std::sqrt(root));
+      }
+    } else if (beta == Dtype(0.5)) {
+      for (int_tp w = 0; w < width; ++w) {
+        y[w] = x[w] / std::sqrt(s[w]);
+      }
+    } else {
+      for (int_tp w = 0; w < width; ++w) {
+        y[w] = x[w] * std::pow(s[w], -beta);
+      }
+    }
+  }
+}
+
 template<typename Dtype, typename MItype, typename MOtype>
 void LRNLayer<Dtype, MItype, MOtype>::LayerSetUp(
                                     const vector<Blob<MItype>*>& bottom,
@@ -64,6 +133,55 @@ void LRNLayer<Dtype, MItype, MOtype>::LayerSetUp(
     product_layer_.reset(new EltwiseLayer<Dtype, MItype, MOtype>(product_param));
     product_layer_->SetUp(product_bottom_vec_, top);
   }
+  const LRNParameter& lrn_param = this->layer_param_.lrn_param();
+  fuse_pool_max_ =
+      lrn_param.fuse_type() == LRNParameter_FuseType_FUSED_POOL_MAX;
+  if (fuse_pool_max_) {
+    CHECK_EQ(lrn_param.norm_region(), LRNParameter_NormRegion_ACROSS_CHANNELS)
+        << "LRN fuses pooling only for normalization across channels";
+    const PoolingParameter& pool_param = lrn_param.pooling_param();
+    CHECK_EQ(pool_param.pool(), PoolingParameter_PoolMethod_MAX)
+        << "LRN fuses max pooling only";
+    if (pool_param.has_kernel_h()) {
+      pool_kernel_h_ = pool_param.kernel_h();
+      pool_kernel_w_ = pool_param.kernel_w();
+    } else if (pool_param.kernel_size_size() > 0) {
+      pool_kernel_h_ = pool_param.kernel_size(0);
+      pool_kernel_w_ = pool_param.kernel_size(
+          pool_param.kernel_size_size() > 1 ? 1 : 0);
+    }
+    if (pool_param.has_stride_h()) {
+      pool_stride_h_ = pool_param.stride_h();
+      pool_stride_w_ = pool_param.stride_w();
+    } else if (pool_param.stride_size() > 0) {
+      pool_stride_h_ = pool_param.stride(0);
+      pool_stride_w_ = pool_param.stride(pool_param.stride_size() > 1 ? 1 : 0);
+    } else {
+      pool_stride_h_ = pool_stride_w_ = 1;
+    }
+    if (pool_param.has_pad_h()) {
+      pool_pad_h_ = pool_param.pad_h();
+      pool_pad_w_ = pool_param.pad_w();
+    } else if (pool_param.pad_size() > 0) {
+      pool_pad_h_ = pool_param.pad(0);
+      pool_pad_w_ = pool_param.pad(pool_param.pad_size() > 1 ? 1 : 0);
+    } else {
+      pool_pad_h_ = pool_pad_w_ = 0;
+    }
+    // Set up fused_pool_layer_ to pool the normalized input, which is
+    // stored in lrn_top_ unless the CPU computes both at once.
+    lrn_top_vec_.clear();
+    lrn_top_vec_.push_back(&lrn_top_);
+    lrn_top_.ReshapeLike(*bottom[0]);
+    LayerParameter pool_layer_param;
+    pool_layer_param.mutable_pooling_param()->CopyFrom(pool_param);
+    fused_pool_layer_.reset(
+        new PoolingLayer<Dtype, MItype, MOtype>(pool_layer_param));
+    fused_pool_layer_->SetUp(lrn_top_vec_, top);
+    fused_pool_top_vec_.clear();
+    fused_pool_top_vec_.push_back(&fused_pool_top_);
+    fused_pool_top_.ReshapeLike(*top[0]);
+  }
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -78,8 +196,18 @@ void LRNLayer<Dtype, MItype, MOtype>::Reshape(
   width_ = bottom[0]->width();
   switch (this->layer_param_.lrn_param().norm_region()) {
     case LRNParameter_NormRegion_ACROSS_CHANNELS:
-      top[0]->Reshape(num_, channels_, height_, width_);
       scale_.Reshape(num_, channels_, height_, width_);
+      if (fuse_pool_max_) {
+        if (this->layer_param_.lrn_param().pooling_param().global_pooling()) {
+          pool_kernel_h_ = height_;
+          pool_kernel_w_ = width_;
+        }
+        lrn_top_.Reshape(num_, channels_, height_, width_);
+        fused_pool_layer_->Reshape(lrn_top_vec_, top);
+        fused_pool_top_.ReshapeLike(*top[0]);
+      } else {
+        top[0]->Reshape(num_, channels_, height_, width_);
+      }
     break;
     case LRNParameter_NormRegion_WITHIN_CHANNEL:
       split_layer_->Reshape(bottom, split_top_vec_);
@@ -101,7 +229,11 @@ void LRNLayer<Dtype, MItype, MOtype>::Forward_cpu(
                                     const vector<Blob<MOtype>*>& top) {
   switch (this->layer_param_.lrn_param().norm_region()) {
     case LRNParameter_NormRegion_ACROSS_CHANNELS:
-      CrossChannelForward_cpu(bottom, top);
+      if (fuse_pool_max_) {
+        FusedPoolMaxForward_cpu(bottom, top);
+      } else {
+        CrossChannelForward_cpu(bottom, top);
+      }
       break;
     case LRNParameter_NormRegion_WITHIN_CHANNEL:
       WithinChannelForward(bottom, top);
@@ -118,46 +250,83 @@ void LRNLayer<Dtype, MItype, MOtype>::CrossChannelForward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int_tp i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_,
-                            this->device_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int_tp n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_, bottom_data + bottom[0]->offset(n),
-              padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int_tp c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-                        padded_square_data + padded_square.offset(0, c),
-                        scale_data + scale_.offset(n, 0));
+  const int_tp spatial_dim = height_ * width_;
+  const Dtype alpha_over_size = alpha_ / size_;
+  // One pass over the channels for each row of each image.
+  Caffe::thread_pool().parallel_for(0, num_ * height_, 1,
+      [&](int_tp begin, int_tp end) {
+    vector<Dtype> sum(width_);
+    for (int_tp i = begin; i < end; ++i) {
+      const int_tp offset = scale_.offset(i / height_, 0, i % height_);
+      CrossChannelRow(bottom_data + offset, spatial_dim, channels_, width_,
+                      size_, alpha_over_size, k_, beta_,
+                      scale_data + offset, spatial_dim,
+                      top_data + offset, spatial_dim, &sum[0]);
     }
-    for (int_tp c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_cpu_copy<Dtype>(height_ * width_,
-                        scale_data + scale_.offset(n, c - 1),
-                        scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(
-          height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-                        padded_square_data + padded_square.offset(0, c - 1),
-                        scale_data + scale_.offset(n, c));
-    }
-  }
+  });
+}
 
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
+template<typename Dtype, typename MItype, typename MOtype>
+void LRNLayer<Dtype, MItype, MOtype>::FusedPoolMaxForward_cpu(
+                                    const vector<Blob<MItype>*>& bottom,
+                                    const vector<Blob<MOtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  const int_tp pooled_height = top[0]->height();
+  const int_tp pooled_width = top[0]->width();
+  const int_tp spatial_dim = height_ * width_;
+  const Dtype alpha_over_size = alpha_ / size_;
+  const int_tp num_bands = (pooled_height + kFusedBandRows - 1)
+      / kFusedBandRows;
+  const int_tp band_height = (kFusedBandRows - 1) * pool_stride_h_
+      + pool_kernel_h_;
+  const int_tp band_dim = band_height * width_;
+  // Each chunk normalizes the input rows under a band of pooled rows into
+  // band, then pools them.
+  Caffe::thread_pool().parallel_for(0, num_ * num_bands, 1,
+      [&](int_tp begin, int_tp end) {
+    vector<Dtype> sum(width_);
+    vector<Dtype> scale(width_);
+    vector<Dtype> band(channels_ * band_dim);
+    for (int_tp i = begin; i < end; ++i) {
+      const int_tp n = i / num_bands;
+      const int_tp ph_begin = (i % num_bands) * kFusedBandRows;
+      const int_tp ph_end = min(ph_begin + kFusedBandRows, pooled_height);
+      const int_tp h_begin = max(ph_begin * pool_stride_h_ - pool_pad_h_,
+                                 int_tp(0));
+      const int_tp h_end = min((ph_end - 1) * pool_stride_h_ - pool_pad_h_
+                               + pool_kernel_h_, height_);
+      for (int_tp h = h_begin; h < h_end; ++h) {
+        CrossChannelRow(bottom_data + bottom[0]->offset(n, 0, h),
+                        spatial_dim, channels_, width_, size_,
+                        alpha_over_size, k_, beta_, &scale[0], int_tp(0),
+                        &band[(h - h_begin) * width_], band_dim, &sum[0]);
+      }
+      for (int_tp c = 0; c < channels_; ++c) {
+        const Dtype* band_data = &band[c * band_dim];
+        for (int_tp ph = ph_begin; ph < ph_end; ++ph) {
+          const int_tp hstart = max(ph * pool_stride_h_ - pool_pad_h_,
+                                    int_tp(0));
+          const int_tp hend = min(ph * pool_stride_h_ - pool_pad_h_
+                                  + pool_kernel_h_, height_);
+          Dtype* top_row = top_data + top[0]->offset(n, c, ph);
+          for (int_tp pw = 0; pw < pooled_width; ++pw) {
+            const int_tp wstart = max(pw * pool_stride_w_ - pool_pad_w_,
+                                      int_tp(0));
+            const int_tp wend = min(pw * pool_stride_w_ - pool_pad_w_
+                                    + pool_kernel_w_, width_);
+            Dtype value = -FLT_MAX;
+            for (int_tp h = hstart; h < hend; ++h) {
+              for (int_tp w = wstart; w < wend; ++w) {
+                value = max(value, band_data[(h - h_begin) * width_ + w]);
+              }
+            }
+            top_row[pw] = value;
+          }
+        }
+      }
+    }
+  });
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -178,7 +347,16 @@ void LRNLayer<Dtype, MItype, MOtype>::Backward_cpu(
                                     const vector<Blob<MItype>*>& bottom) {
   switch (this->layer_param_.lrn_param().norm_region()) {
     case LRNParameter_NormRegion_ACROSS_CHANNELS:
-      CrossChannelBackward_cpu(top, propagate_down, bottom);
+      if (fuse_pool_max_) {
+        // Recompute the normalized input and the pooling mask. The pooled
+        // values go to a scratch blob, as top may already be consumed.
+        CrossChannelForward_cpu(bottom, lrn_top_vec_);
+        fused_pool_layer_->Forward(lrn_top_vec_, fused_pool_top_vec_);
+        fused_pool_layer_->Backward(top, propagate_down, lrn_top_vec_);
+        CrossChannelBackward_cpu(lrn_top_vec_, propagate_down, bottom);
+      } else {
+        CrossChannelBackward_cpu(top, propagate_down, bottom);
+      }
       break;
     case LRNParameter_NormRegion_WITHIN_CHANNEL:
       WithinChannelBackward(top, propagate_down, bottom);
@@ -211,7 +211,12 @@ void LRNLayer<Dtype, MItype, MOtype>::Forward_gpu(
                                     const vector<Blob<MOtype>*>& top) {
   switch (this->layer_param_.lrn_param().norm_region()) {
     case LRNParameter_NormRegion_ACROSS_CHANNELS:
-      CrossChannelForward_gpu(bottom, top);
+      if (fuse_pool_max_) {
+        CrossChannelForward_gpu(bottom, lrn_top_vec_);
+        fused_pool_layer_->Forward(lrn_top_vec_, top);
+      } else {
+        CrossChannelForward_gpu(bottom, top);
+      }
       break;
     case LRNParameter_NormRegion_WITHIN_CHANNEL:
       WithinChannelForward(bottom, top);
@@ -294,7 +299,12 @@ void LRNLayer<Dtype, MItype, MOtype>::Backward_gpu(
                                    const vector<Blob<MItype>*>& bottom) {
 switch (this->layer_param_.lrn_param().norm_region()) {
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
-    CrossChannelBackward_gpu(top, propagate_down, bottom);
+    if (fuse_pool_max_) {
+      fused_pool_layer_->Backward(top, propagate_down, lrn_top_vec_);
+      CrossChannelBackward_gpu(lrn_top_vec_, propagate_down, bottom);
+    } else {
+      CrossChannelBackward_gpu(top, propagate_down, bottom);
+    }
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
     WithinChannelBackward(top, propagate_down, bottom);
@@ -4,12 +4,275 @@
 
 #include "caffe/layers/pooling_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
 using std::min;
 using std::max;
 
+// The 2D pooling geometry of a plane.
+struct PoolGeometry {
+  int_tp height, width, pooled_height, pooled_width;
+  int_tp kernel_h, kernel_w, stride_h, stride_w, pad_h, pad_w;
+};
+
+// The output columns [*pw_begin, *pw_end), whose windows lie inside the
+// plane in w and are computed a row at a time.
+static void InteriorColumns(const PoolGeometry& g, int_tp* pw_begin,
+                            int_tp* pw_end) {
+  *pw_begin = min((g.pad_w + g.stride_w - 1) / g.stride_w, g.pooled_width);
+  *pw_end = *pw_begin;
+  if (g.width + g.pad_w >= g.kernel_w) {
+    *pw_end = max(*pw_end, min((g.width + g.pad_w - g.kernel_w) / g.stride_w
+                               + 1, g.pooled_width));
+  }
+}
+
+// The max of one window, clipped to the plane, and its window relative index.
+template<typename Dtype, typename Itype>
+static void MaxPoolWindow(const PoolGeometry& g, const Dtype* bottom,
+                          const int_tp ph, const int_tp pw, const Dtype lowest,
+                          Dtype* top, Itype* idx) {
+  const int_tp hstart = ph * g.stride_h - g.pad_h;
+  const int_tp wstart = pw * g.stride_w - g.pad_w;
+  const int_tp kh_begin = max(-hstart, (int_tp)0);
+  const int_tp kw_begin = max(-wstart, (int_tp)0);
+  const int_tp kh_end = min(g.kernel_h, g.height - hstart);
+  const int_tp kw_end = min(g.kernel_w, g.width - wstart);
+  Dtype value = lowest;
+  Itype index = kh_begin * g.kernel_w + kw_begin;
+  for (int_tp kh = kh_begin; kh < kh_end; ++kh) {
+    for (int_tp kw = kw_begin; kw < kw_end; ++kw) {
+      const Dtype x = bottom[(hstart + kh) * g.width + wstart + kw];
+      if (x > value) {
+        value = x;
+        index = kh * g.kernel_w + kw;
+      }
+    }
+  }
+  *top = value;
+  *idx = index;
+}
+
+// The max over the window offsets [kh_begin, kh_end) x [0, KW) of n outputs
+// with the row of window origins src, SW apart. The comparisons are free of
+// branches and of loop carried dependencies between outputs, so that the
+// compiler vectorizes across the row; the constant kernel and stride
+// instances unroll the window.
+template<typename Dtype, typename Itype, int_tp KW, int_tp SW>
+static void MaxPoolRow(const Dtype* src, const int_tp width,
+                       const int_tp kh_begin, const int_tp kh_end,
+                       const int_tp n, const Dtype lowest, Dtype* top,
+                       Itype* idx) {
+  for (int_tp pw = 0; pw < n; ++pw) {
+    top[pw] = lowest;
+    idx[pw] = kh_begin * KW;
+  }
+  for (int_tp kh = kh_begin; kh < kh_end; ++kh) {
+    for (int_tp kw = 0; kw < KW; ++kw) {
+      const Dtype* row = src + kh * width + kw;
+      const Itype k = kh * KW + kw;
+      for (int_tp pw = 0; pw < n; ++pw) {
+        const Dtype x = row[pw * SW];
+        const bool greater = x > top[pw];
+        top[pw] = greater ? x : top[pw];
+        idx[pw] = greater ? k : idx[pw];
+      }
+    }
+  }
+}
+
+// The same for any kernel width and stride.
+template<typename Dtype, typename Itype>
+static void MaxPoolRow(const Dtype* src, const int_tp width,
+                       const int_tp kh_begin, const int_tp kh_end,
+                       const int_tp kernel_w, const int_tp stride_w,
+                       const int_tp n, const Dtype lowest, Dtype* top,
+                       Itype* idx) {
+  for (int_tp pw = 0; pw < n; ++pw) {
+    top[pw] = lowest;
+    idx[pw] = kh_begin * kernel_w;
+  }
+  for (int_tp kh = kh_begin; kh < kh_end; ++kh) {
+    for (int_tp kw = 0; kw < kernel_w; ++kw) {
+      const Dtype* row = src + kh * width + kw;
+      const Itype k = kh * kernel_w + kw;
+      for (int_tp pw = 0; pw < n; ++pw) {
+        const Dtype x = row[pw * stride_w];
+        const bool greater = x > top[pw];
+        top[pw] = greater ? x : top[pw];
+        idx[pw] = greater ? k : idx[pw];
+      }
+    }
+  }
+}
+
+// Max pools one plane into top, with the window relative index of each max
+// in idx. The first of equal maxima wins, in row major window order.
+template<typename Dtype, typename Itype>
+static void MaxPoolPlane(const PoolGeometry& g, const Dtype* bottom,
+                         const Dtype lowest, Dtype* top, Itype* idx) {
+  int_tp pw_begin, pw_end;
+  InteriorColumns(g, &pw_begin, &pw_end);
+  for (int_tp ph = 0; ph < g.pooled_height; ++ph) {
+    Dtype* top_row = top + ph * g.pooled_width;
+    Itype* idx_row = idx + ph * g.pooled_width;
+    for (int_tp pw = 0; pw < pw_begin; ++pw) {
+      MaxPoolWindow(g, bottom, ph, pw, lowest, top_row + pw, idx_row + pw);
+    }
+    const int_tp hstart = ph * g.stride_h - g.pad_h;
+    const int_tp kh_begin = max(-hstart, (int_tp)0);
+    const int_tp kh_end = min(g.kernel_h, g.height - hstart);
+    const Dtype* src = bottom + hstart * g.width + pw_begin * g.stride_w
+        - g.pad_w;
+    const int_tp n = pw_end - pw_begin;
+    if (g.kernel_w == 2 && g.stride_w == 2) {
+      MaxPoolRow<Dtype, Itype, 2, 2>(src, g.width, kh_begin, kh_end, n,
+          lowest, top_row + pw_begin, idx_row + pw_begin);
+    } else if (g.kernel_w == 3 && g.stride_w == 2) {
+      MaxPoolRow<Dtype, Itype, 3, 2>(src, g.width, kh_begin, kh_end, n,
+          lowest, top_row + pw_begin, idx_row + pw_begin);
+    } else {
+      MaxPoolRow(src, g.width, kh_begin, kh_end, g.kernel_w, g.stride_w, n,
+                 lowest, top_row + pw_begin, idx_row + pw_begin);
+    }
+    for (int_tp pw = pw_end; pw < g.pooled_width; ++pw) {
+      MaxPoolWindow(g, bottom, ph, pw, lowest, top_row + pw, idx_row + pw);
+    }
+  }
+}
+
+// The plane index of the window relative index of output (ph, pw).
+template<typename Itype>
+static inline int_tp PlaneIndex(const PoolGeometry& g, const int_tp ph,
+                                const int_tp pw, const Itype index) {
+  return (ph * g.stride_h - g.pad_h + index / g.kernel_w) * g.width
+      + pw * g.stride_w - g.pad_w + index % g.kernel_w;
+}
+
+// Average pools one plane. The windows are divided by their size including
+// the padding, a row of outputs at a time.
+template<typename Dtype>
+static void AvePoolPlane(const PoolGeometry& g, const Dtype* bottom,
+                         Dtype* top) {
+  int_tp pw_begin, pw_end;
+  InteriorColumns(g, &pw_begin, &pw_end);
+  for (int_tp ph = 0; ph < g.pooled_height; ++ph) {
+    const int_tp hstart = ph * g.stride_h - g.pad_h;
+    const int_tp pool_h = min(hstart + g.kernel_h, g.height + g.pad_h)
+        - hstart;
+    const int_tp kh_begin = max(-hstart, (int_tp)0);
+    const int_tp kh_end = min(g.kernel_h, g.height - hstart);
+    Dtype* top_row = top + ph * g.pooled_width;
+    for (int_tp pw = 0; pw < g.pooled_width; ++pw) {
+      if (pw == pw_begin && pw_end > pw_begin) {
+        // The interior windows, kernel_w wide.
+        const Dtype* src = bottom + hstart * g.width + pw * g.stride_w
+            - g.pad_w;
+        const int_tp n = pw_end - pw_begin;
+        for (int_tp i = 0; i < n; ++i) {
+          top_row[pw + i] = 0;
+        }
+        for (int_tp kh = kh_begin; kh < kh_end; ++kh) {
+          for (int_tp kw = 0; kw < g.kernel_w; ++kw) {
+            const Dtype* row = src + kh * g.width + kw;
+            for (int_tp i = 0; i < n; ++i) {
+              top_row[pw + i] += row[i * g.stride_w];
+            }
+          }
+        }
+        const int_tp pool_size = pool_h * g.kernel_w;
+        for (int_tp i = 0; i < n; ++i) {
+          top_row[pw + i] /= pool_size;
+        }
+        pw = pw_end - 1;
+        continue;
+      }
+      const int_tp wstart = pw * g.stride_w - g.pad_w;
+      const int_tp pool_size = pool_h *
+          (min(wstart + g.kernel_w, g.width + g.pad_w) - wstart);
+      const int_tp kw_begin = max(-wstart, (int_tp)0);
+      const int_tp kw_end = min(g.kernel_w, g.width - wstart);
+      Dtype sum = 0;
+      for (int_tp kh = kh_begin; kh < kh_end; ++kh) {
+        for (int_tp kw = kw_begin; kw < kw_end; ++kw) {
+          sum += bottom[(hstart + kh) * g.width + wstart + kw];
+        }
+      }
+      top_row[pw] = sum / pool_size;
+    }
+  }
+}
+
+// Stochastic pooling of one plane, without padding. In training the window
+// element is sampled in proportion to its activation by the uniform samples
+// in rand, in testing the output is the activations weighted by themselves.
+template<typename Dtype, typename Itype>
+static void StoPoolPlane(const PoolGeometry& g, const Dtype* bottom,
+                         const bool train, const Dtype* rand, Dtype* top,
+                         Itype* idx) {
+  for (int_tp ph = 0; ph < g.pooled_height; ++ph) {
+    for (int_tp pw = 0; pw < g.pooled_width; ++pw) {
+      const int_tp hstart = ph * g.stride_h;
+      const int_tp wstart = pw * g.stride_w;
+      const int_tp kh_end = min(g.kernel_h, g.height - hstart);
+      const int_tp kw_end = min(g.kernel_w, g.width - wstart);
+      const int_tp pool_index = ph * g.pooled_width + pw;
+      Dtype cumsum = 0;
+      Dtype cumvalues = 0;
+      for (int_tp kh = 0; kh < kh_end; ++kh) {
+        for (int_tp kw = 0; kw < kw_end; ++kw) {
+          const Dtype x = bottom[(hstart + kh) * g.width + wstart + kw];
+          cumsum += x;
+          cumvalues += x * x;
+        }
+      }
+      if (!train) {
+        top[pool_index] = cumsum > 0 ? cumvalues / cumsum : Dtype(0);
+        continue;
+      }
+      const Dtype thres = rand[pool_index] * cumsum;
+      // The last element of the window, should rounding miss the threshold.
+      Itype index = (kh_end - 1) * g.kernel_w + kw_end - 1;
+      bool found = false;
+      cumsum = 0;
+      for (int_tp kh = 0; kh < kh_end && !found; ++kh) {
+        for (int_tp kw = 0; kw < kw_end && !found; ++kw) {
+          cumsum += bottom[(hstart + kh) * g.width + wstart + kw];
+          if (cumsum >= thres) {
+            index = kh * g.kernel_w + kw;
+            found = true;
+          }
+        }
+      }
+      idx[pool_index] = index;
+      top[pool_index] = bottom[PlaneIndex(g, ph, pw, index)];
+    }
+  }
+}
+
+// Adds each top diff to the bottom element selected by the window relative
+// index of its output.
+template<typename Dtype, typename Itype>
+static void ScatterPoolPlane(const PoolGeometry& g, const Dtype* top_diff,
+                             const Itype* idx, Dtype* bottom_diff) {
+  for (int_tp ph = 0; ph < g.pooled_height; ++ph) {
+    for (int_tp pw = 0; pw < g.pooled_width; ++pw) {
+      const int_tp pool_index = ph * g.pooled_width + pw;
+      const int_tp h = ph * g.stride_h - g.pad_h
+          + idx[pool_index] / g.kernel_w;
+      const int_tp w = pw * g.stride_w - g.pad_w
+          + idx[pool_index] % g.kernel_w;
+      // A window past the end of the plane selects nothing.
+      if (h < g.height && w < g.width) {
+        bottom_diff[h * g.width + w] += top_diff[pool_index];
+      }
+    }
+  }
+}
+
+
 template<typename Dtype, typename MItype, typename MOtype>
 void PoolingLayer<Dtype, MItype, MOtype>::LayerSetUp(
                                         const vector<Blob<MItype>*>& bottom,
@@ -225,6 +488,22 @@ void PoolingLayer<Dtype, MItype, MOtype>::Reshape(
     rand_idx_.Reshape(top_shape);
   }
 
+  // The CPU keeps the max and stochastic indices relative to their window,
+  // in bytes unless a window has more elements. Blobs allocate on first use,
+  // so the mask of the other device costs no memory.
+  use_window_idx_ = num_spatial_axes_ == 2 &&
+      kernel_shape_data[0] * kernel_shape_data[1] <= 256;
+  if (this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX ||
+      this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_STOCHASTIC) {
+    if (use_window_idx_) {
+      window_idx_.Reshape(top_shape);
+    } else {
+      max_idx_.Reshape(top_shape);
+    }
+  }
+
   if (Caffe::mode() == Caffe::GPU && this->device_program_.get() == nullptr) {
     this->GenerateProgram<Dtype, MItype, MOtype>();
   }
@@ -234,24 +513,37 @@ template<typename Dtype, typename MItype, typename MOtype>
 void PoolingLayer<Dtype, MItype, MOtype>::Forward_cpu(
                                         const vector<Blob<MItype>*>& bottom,
                                         const vector<Blob<MOtype>*>& top) {
-  int_tp kernel_h_ = kernel_shape_.cpu_data()[0];
-  int_tp kernel_w_ = kernel_shape_.cpu_data()[1];
-  int_tp stride_h_ = stride_.cpu_data()[0];
-  int_tp stride_w_ = stride_.cpu_data()[1];
-  int_tp pad_h_ = pad_.cpu_data()[0];
-  int_tp pad_w_ = pad_.cpu_data()[1];
-  int_tp height_ = size_.cpu_data()[0];
-  int_tp width_ = size_.cpu_data()[1];
-  int_tp pooled_height_ = pooled_size_.cpu_data()[0];
-  int_tp pooled_width_ = pooled_size_.cpu_data()[1];
+  PoolGeometry g;
+  g.kernel_h = kernel_shape_.cpu_data()[0];
+  g.kernel_w = kernel_shape_.cpu_data()[1];
+  g.stride_h = stride_.cpu_data()[0];
+  g.stride_w = stride_.cpu_data()[1];
+  g.pad_h = pad_.cpu_data()[0];
+  g.pad_w = pad_.cpu_data()[1];
+  g.height = size_.cpu_data()[0];
+  g.width = size_.cpu_data()[1];
+  g.pooled_height = pooled_size_.cpu_data()[0];
+  g.pooled_width = pooled_size_.cpu_data()[1];
 
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int_tp top_count = top[0]->count();
+  const int_tp planes = bottom[0]->num() * channels_;
+  const int_tp bottom_plane = g.height * g.width;
+  const int_tp top_plane = g.pooled_height * g.pooled_width;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
-  int_tp* mask = NULL;  // suppress warnings about uninitalized variables
-  Dtype* top_mask = NULL;
+  // The window relative indices of the maxima or samples, as bytes where
+  // the windows allow it.
+  uint8_t* window_idx = NULL;
+  int_tp* mask = NULL;
+  if (this->layer_param_.pooling_param().pool() !=
+      PoolingParameter_PoolMethod_AVE) {
+    if (use_window_idx_) {
+      window_idx = window_idx_.mutable_cpu_data();
+    } else {
+      mask = max_idx_.mutable_cpu_data();
+    }
+  }
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
 
@@ -260,90 +552,68 @@ void PoolingLayer<Dtype, MItype, MOtype>::Forward_cpu(
     maxVal = HALF_MAX;
   }
   switch (this->layer_param_.pooling_param().pool()) {
-  case PoolingParameter_PoolMethod_MAX:
-    // Initialize
-    if (use_top_mask) {
-      top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
-    } else {
-      mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, (int_tp)-1, mask);
-    }
-    caffe_set(top_count, Dtype(-maxVal), top_data);
-    // The main loop
-    for (int_tp n = 0; n < bottom[0]->num(); ++n) {
-      for (int_tp c = 0; c < channels_; ++c) {
-        for (int_tp ph = 0; ph < pooled_height_; ++ph) {
-          for (int_tp pw = 0; pw < pooled_width_; ++pw) {
-            int_tp hstart = ph * stride_h_ - pad_h_;
-            int_tp wstart = pw * stride_w_ - pad_w_;
-            int_tp hend = min(hstart + kernel_h_, height_);
-            int_tp wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, (int_tp)0);
-            wstart = max(wstart, (int_tp)0);
-            const int_tp pool_index = ph * pooled_width_ + pw;
-            for (int_tp h = hstart; h < hend; ++h) {
-              for (int_tp w = wstart; w < wend; ++w) {
-                const int_tp index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
+  case PoolingParameter_PoolMethod_MAX: {
+    Dtype* top_mask = use_top_mask ? top[1]->mutable_cpu_data() : NULL;
+    // The planes are pooled independently.
+    Caffe::thread_pool().parallel_for(0, planes, 1,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp p = begin; p < end; ++p) {
+        const Dtype* bottom_slice = bottom_data + p * bottom_plane;
+        Dtype* top_slice = top_data + p * top_plane;
+        if (use_window_idx_) {
+          uint8_t* idx_slice = window_idx + p * top_plane;
+          MaxPoolPlane(g, bottom_slice, Dtype(-maxVal), top_slice, idx_slice);
+          if (use_top_mask) {
+            for (int_tp i = 0; i < top_plane; ++i) {
+              top_mask[p * top_plane + i] = static_cast<Dtype>(PlaneIndex(g,
+                  i / g.pooled_width, i % g.pooled_width, idx_slice[i]));
             }
           }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
         } else {
-          mask += top[0]->offset(0, 1);
+          int_tp* idx_slice = mask + p * top_plane;
+          MaxPoolPlane(g, bottom_slice, Dtype(-maxVal), top_slice, idx_slice);
+          if (use_top_mask) {
+            for (int_tp i = 0; i < top_plane; ++i) {
+              top_mask[p * top_plane + i] = static_cast<Dtype>(PlaneIndex(g,
+                  i / g.pooled_width, i % g.pooled_width, idx_slice[i]));
+            }
+          }
         }
       }
-    }
+    });
     break;
+  }
   case PoolingParameter_PoolMethod_AVE:
-    for (int_tp i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
+    Caffe::thread_pool().parallel_for(0, planes, 1,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp p = begin; p < end; ++p) {
+        AvePoolPlane(g, bottom_data + p * bottom_plane,
+                     top_data + p * top_plane);
+      }
+    });
+    break;
+  case PoolingParameter_PoolMethod_STOCHASTIC: {
+    const bool train = this->phase_ == TRAIN;
+    Dtype* rand = NULL;
+    if (train) {
+      rand = rand_idx_.mutable_cpu_data();
+      caffe_rng_uniform(top[0]->count(), Dtype(0), Dtype(1), rand);
     }
-    // The main loop
-    for (int_tp n = 0; n < bottom[0]->num(); ++n) {
-      for (int_tp c = 0; c < channels_; ++c) {
-        for (int_tp ph = 0; ph < pooled_height_; ++ph) {
-          for (int_tp pw = 0; pw < pooled_width_; ++pw) {
-            int_tp hstart = ph * stride_h_ - pad_h_;
-            int_tp wstart = pw * stride_w_ - pad_w_;
-            int_tp hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int_tp wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int_tp pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, (int_tp)0);
-            wstart = max(wstart, (int_tp)0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int_tp h = hstart; h < hend; ++h) {
-              for (int_tp w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
-            }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
-          }
+    Caffe::thread_pool().parallel_for(0, planes, 1,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp p = begin; p < end; ++p) {
+        const Dtype* rand_slice = train ? rand + p * top_plane : NULL;
+        if (use_window_idx_) {
+          StoPoolPlane(g, bottom_data + p * bottom_plane, train, rand_slice,
+                       top_data + p * top_plane, window_idx + p * top_plane);
+        } else {
+          StoPoolPlane(g, bottom_data + p * bottom_plane, train, rand_slice,
+                       top_data + p * top_plane, mask + p * top_plane);
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
       }
-    }
-    break;
-  case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
+    });
     break;
+  }
   default:
     LOG(FATAL) << "Unknown pooling method.";
   }
@@ -354,92 +624,92 @@ void PoolingLayer<Dtype, MItype, MOtype>::Backward_cpu(
                                         const vector<Blob<MOtype>*>& top,
                                         const vector<bool>& propagate_down,
                                         const vector<Blob<MItype>*>& bottom) {
-  int_tp kernel_h_ = kernel_shape_.cpu_data()[0];
-  int_tp kernel_w_ = kernel_shape_.cpu_data()[1];
-  int_tp stride_h_ = stride_.cpu_data()[0];
-  int_tp stride_w_ = stride_.cpu_data()[1];
-  int_tp pad_h_ = pad_.cpu_data()[0];
-  int_tp pad_w_ = pad_.cpu_data()[1];
-  int_tp height_ = size_.cpu_data()[0];
-  int_tp width_ = size_.cpu_data()[1];
-  int_tp pooled_height_ = pooled_size_.cpu_data()[0];
-  int_tp pooled_width_ = pooled_size_.cpu_data()[1];
-
   if (!propagate_down[0]) {
     return;
   }
+  PoolGeometry g;
+  g.kernel_h = kernel_shape_.cpu_data()[0];
+  g.kernel_w = kernel_shape_.cpu_data()[1];
+  g.stride_h = stride_.cpu_data()[0];
+  g.stride_w = stride_.cpu_data()[1];
+  g.pad_h = pad_.cpu_data()[0];
+  g.pad_w = pad_.cpu_data()[1];
+  g.height = size_.cpu_data()[0];
+  g.width = size_.cpu_data()[1];
+  g.pooled_height = pooled_size_.cpu_data()[0];
+  g.pooled_width = pooled_size_.cpu_data()[1];
+
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more codes.
-  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  const int_tp planes = top[0]->num() * channels_;
+  const int_tp bottom_plane = g.height * g.width;
+  const int_tp top_plane = g.pooled_height * g.pooled_width;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
-  const int_tp* mask = NULL;  // suppress warnings about uninitialized variables
+  const PoolingParameter_PoolMethod pool =
+      this->layer_param_.pooling_param().pool();
   const Dtype* top_mask = NULL;
-  switch (this->layer_param_.pooling_param().pool()) {
-  case PoolingParameter_PoolMethod_MAX:
-    // The main loop
+  const uint8_t* window_idx = NULL;
+  const int_tp* mask = NULL;
+  if (pool != PoolingParameter_PoolMethod_AVE) {
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
+    } else if (use_window_idx_) {
+      window_idx = window_idx_.cpu_data();
     } else {
       mask = max_idx_.cpu_data();
     }
-    for (int_tp n = 0; n < top[0]->num(); ++n) {
-      for (int_tp c = 0; c < channels_; ++c) {
-        for (int_tp ph = 0; ph < pooled_height_; ++ph) {
-          for (int_tp pw = 0; pw < pooled_width_; ++pw) {
-            const int_tp index = ph * pooled_width_ + pw;
-            const int_tp bottom_index =
-                use_top_mask ? int_tp(top_mask[index]) : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
+  }
+  // The planes are independent.
+  Caffe::thread_pool().parallel_for(0, planes, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int_tp p = begin; p < end; ++p) {
+      const Dtype* top_diff_slice = top_diff + p * top_plane;
+      Dtype* bottom_diff_slice = bottom_diff + p * bottom_plane;
+      caffe_set(bottom_plane, Dtype(0), bottom_diff_slice);
+      switch (pool) {
+      case PoolingParameter_PoolMethod_MAX:
+      case PoolingParameter_PoolMethod_STOCHASTIC:
+        if (top_mask) {
+          for (int_tp i = 0; i < top_plane; ++i) {
+            bottom_diff_slice[static_cast<int_tp>(top_mask[p * top_plane + i])]
+                += top_diff_slice[i];
           }
-        }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
+        } else if (window_idx) {
+          ScatterPoolPlane(g, top_diff_slice, window_idx + p * top_plane,
+                           bottom_diff_slice);
         } else {
-          mask += top[0]->offset(0, 1);
+          ScatterPoolPlane(g, top_diff_slice, mask + p * top_plane,
+                           bottom_diff_slice);
         }
-      }
-    }
-    break;
-  case PoolingParameter_PoolMethod_AVE:
-    // The main loop
-    for (int_tp n = 0; n < top[0]->num(); ++n) {
-      for (int_tp c = 0; c < channels_; ++c) {
-        for (int_tp ph = 0; ph < pooled_height_; ++ph) {
-          for (int_tp pw = 0; pw < pooled_width_; ++pw) {
-            int_tp hstart = ph * stride_h_ - pad_h_;
-            int_tp wstart = pw * stride_w_ - pad_w_;
-            int_tp hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int_tp wend = min(wstart + kernel_w_, width_ + pad_w_);
+        break;
+      case PoolingParameter_PoolMethod_AVE:
+        for (int_tp ph = 0; ph < g.pooled_height; ++ph) {
+          for (int_tp pw = 0; pw < g.pooled_width; ++pw) {
+            int_tp hstart = ph * g.stride_h - g.pad_h;
+            int_tp wstart = pw * g.stride_w - g.pad_w;
+            int_tp hend = min(hstart + g.kernel_h, g.height + g.pad_h);
+            int_tp wend = min(wstart + g.kernel_w, g.width + g.pad_w);
             int_tp pool_size = (hend - hstart) * (wend - wstart);
             hstart = max(hstart, (int_tp)0);
             wstart = max(wstart, (int_tp)0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
+            hend = min(hend, g.height);
+            wend = min(wend, g.width);
+            const Dtype gradient = top_diff_slice[ph * g.pooled_width + pw]
+                / pool_size;
             for (int_tp h = hstart; h < hend; ++h) {
               for (int_tp w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
+                bottom_diff_slice[h * g.width + w] += gradient;
               }
             }
           }
         }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
+        break;
+      default:
+        LOG(FATAL) << "Unknown pooling method.";
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
-    break;
-  default:
-    LOG(FATAL) << "Unknown pooling method.";
-  }
+  });
 }
 
 #ifdef CPU_ONLY
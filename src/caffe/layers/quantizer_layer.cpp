@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layers/quantizer_layer.hpp"
+#include "caffe/util/binarization.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantization.hpp"
+
+namespace caffe {
+
+template<typename Dtype, typename MItype, typename MOtype>
+void QuantizerLayer<Dtype, MItype, MOtype>::LayerSetUp(
+      const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  NeuronLayer<Dtype, MItype, MOtype>::LayerSetUp(bottom, top);
+  const LayerParameter& param = this->layer_param_;
+  bottom_quantized_ = param.bottom_data_type() == INT8_QUANTIZED;
+  top_quantized_ = param.top_data_type() == INT8_QUANTIZED;
+  bottom_binary_ = IsPackedBinary(param.bottom_data_type());
+  top_binary_ = IsPackedBinary(param.top_data_type());
+  if (bottom_binary_ || top_binary_) {
+    CHECK_GE(bottom[0]->num_axes(), 2)
+        << "Quantizer " << param.name() << " packs signs along axis 1.";
+  }
+  bottom_scale_ = Dtype(1);
+  top_scale_ = Dtype(1);
+  top_zero_point_ = 0;
+  if (bottom_quantized_) {
+    CHECK(param.has_bottom_quantization())
+        << "Quantizer " << param.name() << " needs a bottom_quantization.";
+    bottom_scale_ = ActivationScale(param.bottom_quantization());
+  }
+  if (top_quantized_) {
+    CHECK(param.has_top_quantization())
+        << "Quantizer " << param.name() << " needs a top_quantization.";
+    top_scale_ = ActivationScale(param.top_quantization());
+    top_zero_point_ = ActivationZeroPoint(param.top_quantization());
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void QuantizerLayer<Dtype, MItype, MOtype>::Forward_cpu(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  const int_tp count = bottom[0]->count();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  if (bottom_binary_ || top_binary_) {
+    const int_tp num = bottom[0]->shape(0);
+    const int_tp channels = bottom[0]->shape(1);
+    const int_tp inner = bottom[0]->count(2);
+    packed_signs_.resize(num * inner * BinaryWords(channels));
+    // The signs of quantized codes are those of the values they encode.
+    if (top_binary_) {
+      caffe_cpu_pack_signs(num, channels, inner, bottom_data,
+                           &packed_signs_[0]);
+      WritePackedSigns(num, channels, inner, &packed_signs_[0], top_data);
+      return;
+    }
+    ReadPackedSigns(num, channels, inner, bottom_data, &packed_signs_[0]);
+    caffe_cpu_unpack_signs(num, channels, inner, &packed_signs_[0], top_data);
+    bottom_data = top_data;
+  }
+  if (!top_quantized_) {
+    caffe_cpu_scale(count, bottom_scale_, bottom_data, top_data);
+    return;
+  }
+  // Centred codes range over [-zero_point, 255 - zero_point].
+  const Dtype scale = bottom_scale_ / top_scale_;
+  const Dtype min_code = -top_zero_point_;
+  const Dtype max_code = kQuantizedActivationMax - top_zero_point_;
+  for (int_tp i = 0; i < count; ++i) {
+    top_data[i] = std::min(max_code,
+        std::max(min_code, Dtype(std::nearbyint(bottom_data[i] * scale))));
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void QuantizerLayer<Dtype, MItype, MOtype>::Backward_cpu(
+    const vector<Blob<MOtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<MItype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  caffe_cpu_scale(bottom[0]->count(), bottom_scale_ / top_scale_,
+                  top[0]->cpu_diff(), bottom[0]->mutable_cpu_diff());
+}
+
+INSTANTIATE_CLASS_3T(QuantizerLayer);
+REGISTER_LAYER_CLASS(Quantizer);
+
+}  // namespace caffe
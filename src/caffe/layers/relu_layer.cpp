@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "caffe/layers/relu_layer.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -24,10 +25,13 @@ void ReLULayer<Dtype, MItype, MOtype>::Forward_cpu(
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int_tp count = bottom[0]->count();
   Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
-  for (int_tp i = 0; i < count; ++i) {
-    top_data[i] = std::max(bottom_data[i], Dtype(0))
-        + negative_slope * std::min(bottom_data[i], Dtype(0));
-  }
+  Caffe::thread_pool().parallel_for(0, count, kParallelElementGrain,
+      [&](int_tp begin, int_tp end) {
+    for (int_tp i = begin; i < end; ++i) {
+      top_data[i] = std::max(bottom_data[i], Dtype(0))
+          + negative_slope * std::min(bottom_data[i], Dtype(0));
+    }
+  });
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -41,10 +45,13 @@ void ReLULayer<Dtype, MItype, MOtype>::Backward_cpu(
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int_tp count = bottom[0]->count();
     Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
-    for (int_tp i = 0; i < count; ++i) {
-      bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
-          + negative_slope * (bottom_data[i] <= 0));
-    }
+    Caffe::thread_pool().parallel_for(0, count, kParallelElementGrain,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp i = begin; i < end; ++i) {
+        bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
+            + negative_slope * (bottom_data[i] <= 0));
+      }
+    });
   }
 }
 
@@ -0,0 +1,68 @@
+#include <vector>
+
+#include "caffe/layers/reorder_layer.hpp"
+#include "caffe/util/layout.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ReorderLayer<Dtype, MItype, MOtype>::Reshape(
+      const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  const LayerParameter& param = this->layer_param_;
+  const vector<int_tp> bottom_shape(bottom[0]->shape().begin(),
+                                    bottom[0]->shape().end());
+  const vector<int_tp> plain_shape = PlainShape(bottom_shape,
+                                                param.bottom_layout());
+  CHECK_GE(plain_shape.size(), 2)
+      << "Reorder " << param.name() << " needs a channel axis.";
+  num_ = plain_shape[0];
+  channels_ = plain_shape[1];
+  inner_ = bottom[0]->count() / (num_ * channels_);
+  top[0]->Reshape(LayoutShape(plain_shape, param.top_layout()));
+  if (param.bottom_layout() != NCHW && param.top_layout() != NCHW &&
+      param.bottom_layout() != param.top_layout()) {
+    plain_buffer_.resize(bottom[0]->count());
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ReorderLayer<Dtype, MItype, MOtype>::reorder(const Layout from,
+    const Layout to, const Dtype* x, Dtype* y) {
+  const int_tp count = num_ * channels_ * inner_;
+  if (from == to) {
+    caffe_copy(count, x, y);
+  } else if (from == NCHW) {
+    caffe_cpu_to_blocked(num_, channels_, inner_, LayoutBlock(to), x, y);
+  } else if (to == NCHW) {
+    caffe_cpu_from_blocked(num_, channels_, inner_, LayoutBlock(from), x, y);
+  } else {
+    caffe_cpu_from_blocked(num_, channels_, inner_, LayoutBlock(from), x,
+                           &plain_buffer_[0]);
+    caffe_cpu_to_blocked(num_, channels_, inner_, LayoutBlock(to),
+                         &plain_buffer_[0], y);
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ReorderLayer<Dtype, MItype, MOtype>::Forward_cpu(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  reorder(this->layer_param_.bottom_layout(), this->layer_param_.top_layout(),
+          bottom[0]->cpu_data(), top[0]->mutable_cpu_data());
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ReorderLayer<Dtype, MItype, MOtype>::Backward_cpu(
+    const vector<Blob<MOtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<MItype>*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  reorder(this->layer_param_.top_layout(), this->layer_param_.bottom_layout(),
+          top[0]->cpu_diff(), bottom[0]->mutable_cpu_diff());
+}
+
+INSTANTIATE_CLASS_3T(ReorderLayer);
+REGISTER_LAYER_CLASS(Reorder);
+
+}  // namespace caffe
@@ -2,14 +2,11 @@
 #include <vector>
 
 #include "caffe/layers/sigmoid_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
-template<typename Dtype, typename MItype, typename MOtype>
-inline Dtype sigmoid(Dtype X) {
-  return 0.5 * tanh(0.5 * X) + 0.5;
-}
-
 template<typename Dtype, typename MItype, typename MOtype>
 void SigmoidLayer<Dtype, MItype, MOtype>::Reshape(
                                         const vector<Blob<MItype>*>& bottom,
@@ -25,12 +22,10 @@ template<typename Dtype, typename MItype, typename MOtype>
 void SigmoidLayer<Dtype, MItype, MOtype>::Forward_cpu(
                                         const vector<Blob<MItype>*>& bottom,
                                         const vector<Blob<MOtype>*>& top) {
-  vptr<const Dtype> bottom_data = bottom[0]->cpu_data();
-  vptr<Dtype> top_data = top[0]->mutable_cpu_data();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
   const int_tp count = bottom[0]->count();
-  for (int_tp i = 0; i < count; ++i) {
-    top_data[i] = sigmoid(bottom_data[i]);
-  }
+  caffe_sigmoid(count, bottom_data, top_data);
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -39,14 +34,17 @@ void SigmoidLayer<Dtype, MItype, MOtype>::Backward_cpu(
                                         const vector<bool>& propagate_down,
                                         const vector<Blob<MItype>*>& bottom) {
   if (propagate_down[0]) {
-    vptr<const Dtype> top_data = top[0]->cpu_data();
-    vptr<const Dtype> top_diff = top[0]->cpu_diff();
-    vptr<Dtype> bottom_diff = bottom[0]->mutable_cpu_diff();
+    const Dtype* top_data = top[0]->cpu_data();
+    const Dtype* top_diff = top[0]->cpu_diff();
+    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int_tp count = bottom[0]->count();
-    for (int_tp i = 0; i < count; ++i) {
-      const Dtype sigmoid_x = top_data[i];
-      bottom_diff[i] = top_diff[i] * sigmoid_x * (1. - sigmoid_x);
-    }
+    Caffe::thread_pool().parallel_for(0, count, kParallelElementGrain,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp i = begin; i < end; ++i) {
+        const Dtype sigmoid_x = top_data[i];
+        bottom_diff[i] = top_diff[i] * sigmoid_x * (1. - sigmoid_x);
+      }
+    });
   }
 }
 
@@ -3,6 +3,7 @@
 
 #include "caffe/layers/softmax_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -41,34 +42,47 @@ void SoftmaxLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MItype>*
   Dtype* scale_data = scale_.mutable_cpu_data();
   int_tp channels = bottom[0]->shape(softmax_axis_);
   int_tp dim = bottom[0]->count() / outer_num_;
-  caffe_cpu_copy(bottom[0]->count(), bottom_data, top_data);
   // We need to subtract the max to avoid numerical issues, compute the exp,
-  // and then normalize.
-  for (int_tp i = 0; i < outer_num_; ++i) {
-    // initialize scale_data to the first plane
-    caffe_cpu_copy(inner_num_, bottom_data + i * dim, scale_data);
-    // start max after the first inner_num values
-    // (j=1) since they were just copied
-    for (int_tp j = 1; j < channels; j++) {
-      for (int_tp k = 0; k < inner_num_; k++) {
-        scale_data[k] = std::max(scale_data[k],
-            bottom_data[i * dim + j * inner_num_ + k]);
+  // and then normalize. The outer slices are independent, each with its own
+  // inner_num_ entries of scale_.
+  Caffe::thread_pool().parallel_for(0, outer_num_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int_tp i = begin; i < end; ++i) {
+      const Dtype* slice_bottom = bottom_data + i * dim;
+      Dtype* slice_top = top_data + i * dim;
+      Dtype* slice_scale = scale_data + i * inner_num_;
+      // initialize scale_data to the first plane
+      caffe_cpu_copy(inner_num_, slice_bottom, slice_scale);
+      // start max after the first inner_num values
+      // (j=1) since they were just copied
+      for (int_tp j = 1; j < channels; j++) {
+        for (int_tp k = 0; k < inner_num_; k++) {
+          slice_scale[k] = std::max(slice_scale[k],
+              slice_bottom[j * inner_num_ + k]);
+        }
+      }
+      // subtraction
+      for (int_tp j = 0; j < channels; j++) {
+        for (int_tp k = 0; k < inner_num_; k++) {
+          slice_top[j * inner_num_ + k] =
+              slice_bottom[j * inner_num_ + k] - slice_scale[k];
+        }
+      }
+      // exponentiation
+      caffe_exp<Dtype>(dim, slice_top, slice_top);
+      // sum after exp
+      caffe_set(inner_num_, Dtype(0), slice_scale);
+      for (int_tp j = 0; j < channels; j++) {
+        caffe_axpy(inner_num_, Dtype(1), slice_top + j * inner_num_,
+                   slice_scale);
+      }
+      // division
+      for (int_tp j = 0; j < channels; j++) {
+        caffe_div(inner_num_, slice_top + j * inner_num_, slice_scale,
+                  slice_top + j * inner_num_);
       }
     }
-    // subtraction
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, inner_num_,
-        1, -1., sum_multiplier_.cpu_data(), scale_data, 1., top_data);
-    // exponentiation
-    caffe_exp<Dtype>(dim, top_data, top_data);
-    // sum after exp
-    caffe_cpu_gemv<Dtype>(CblasTrans, channels, inner_num_, 1.,
-        top_data, sum_multiplier_.cpu_data(), 0., scale_data);
-    // division
-    for (int_tp j = 0; j < channels; j++) {
-      caffe_div(inner_num_, top_data, scale_data, top_data);
-      top_data += inner_num_;
-    }
-  }
+  });
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -4,6 +4,7 @@
 
 #include "caffe/layers/softmax_loss_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -55,6 +56,11 @@ void SoftmaxWithLossLayer<Dtype, MItype, MOtype>::Reshape(
     // softmax output
     top[1]->ReshapeLike(*bottom[0]);
   }
+  vector<uint_tp> location_shape(2);
+  location_shape[0] = outer_num_;
+  location_shape[1] = inner_num_;
+  max_.Reshape(location_shape);
+  sum_.Reshape(location_shape);
 
   if (Caffe::mode() == Caffe::GPU && this->device_program_.get() == nullptr) {
     this->GenerateProgram<Dtype, MItype, MOtype>();
@@ -95,31 +101,81 @@ template<typename Dtype, typename MItype, typename MOtype>
 void SoftmaxWithLossLayer<Dtype, MItype, MOtype>::Forward_cpu(
     const vector<Blob<MItype>*>& bottom,
     const vector<Blob<MOtype>*>& top) {
-  // The forward pass computes the softmax prob values.
-  softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
-  const Dtype* prob_data = prob_.cpu_data();
+  // The softmax and the loss are computed in one pass over each outer slice:
+  // the loss of a location is the log-sum-exp of its scores minus the score
+  // of its label, without reading the probabilities back.
+  const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* label = bottom[1]->cpu_data();
-  int_tp dim = prob_.count() / outer_num_;
-  int_tp count = 0;
-  Dtype loss = 0;
-  for (int_tp i = 0; i < outer_num_; ++i) {
-    for (int_tp j = 0; j < inner_num_; j++) {
-      const int_tp label_value = static_cast<int_tp>(label[i * inner_num_ + j]);
-      if (has_ignore_label_ && label_value == ignore_label_) {
-        continue;
+  Dtype* prob_data = prob_.mutable_cpu_data();
+  Dtype* max_data = max_.mutable_cpu_data();
+  Dtype* sum_data = sum_.mutable_cpu_data();
+  const int_tp channels = bottom[0]->shape(softmax_axis_);
+  const int_tp dim = prob_.count() / outer_num_;
+  Dtype min_value = FLT_MIN;
+  if (std::is_same<Dtype, half_float::half>::value) {
+    min_value = HALF_MIN;
+  }
+  // The loss of a location is capped as if its probability were min_value.
+  const Dtype max_loss = -log(min_value);
+  // The slices sum their loss separately, so that the total does not depend
+  // on the order of the threads.
+  vector<double> slice_loss(outer_num_, 0);
+  vector<int_tp> slice_count(outer_num_, 0);
+  Caffe::thread_pool().parallel_for(0, outer_num_, 1,
+      [&](int_tp begin, int_tp end) {
+    for (int_tp i = begin; i < end; ++i) {
+      const Dtype* slice_bottom = bottom_data + i * dim;
+      const Dtype* slice_label = label + i * inner_num_;
+      Dtype* slice_prob = prob_data + i * dim;
+      Dtype* slice_max = max_data + i * inner_num_;
+      Dtype* slice_sum = sum_data + i * inner_num_;
+      caffe_cpu_copy(inner_num_, slice_bottom, slice_max);
+      for (int_tp c = 1; c < channels; ++c) {
+        for (int_tp j = 0; j < inner_num_; ++j) {
+          slice_max[j] = std::max(slice_max[j],
+                                  slice_bottom[c * inner_num_ + j]);
+        }
+      }
+      for (int_tp c = 0; c < channels; ++c) {
+        for (int_tp j = 0; j < inner_num_; ++j) {
+          slice_prob[c * inner_num_ + j] =
+              slice_bottom[c * inner_num_ + j] - slice_max[j];
+        }
+      }
+      caffe_exp<Dtype>(dim, slice_prob, slice_prob);
+      caffe_set(inner_num_, Dtype(0), slice_sum);
+      for (int_tp c = 0; c < channels; ++c) {
+        for (int_tp j = 0; j < inner_num_; ++j) {
+          slice_sum[j] += slice_prob[c * inner_num_ + j];
+        }
+      }
+      for (int_tp j = 0; j < inner_num_; ++j) {
+        const int_tp label_value = static_cast<int_tp>(slice_label[j]);
+        if (!has_ignore_label_ || label_value != ignore_label_) {
+          DCHECK_GE(label_value, 0);
+          DCHECK_LT(label_value, channels);
+          slice_loss[i] += std::min(log(slice_sum[j]) -
+              (slice_bottom[label_value * inner_num_ + j] - slice_max[j]),
+              max_loss);
+          ++slice_count[i];
+        }
+        slice_sum[j] = Dtype(1) / slice_sum[j];
       }
-      DCHECK_GE(label_value, 0);
-      DCHECK_LT(label_value, prob_.shape(softmax_axis_));
-      Dtype min_value = FLT_MIN;
-      if (std::is_same<Dtype, half_float::half>::value) {
-        min_value = HALF_MIN;
+      for (int_tp c = 0; c < channels; ++c) {
+        for (int_tp j = 0; j < inner_num_; ++j) {
+          slice_prob[c * inner_num_ + j] *= slice_sum[j];
+        }
       }
-      loss -= log(std::max(prob_data[i * dim + label_value * inner_num_ + j],
-                           Dtype(min_value)));
-      ++count;
     }
+  });
+  int_tp count = 0;
+  double loss = 0;
+  for (int_tp i = 0; i < outer_num_; ++i) {
+    count += slice_count[i];
+    loss += slice_loss[i];
   }
-  top[0]->mutable_cpu_data()[0] = loss / get_normalizer(normalization_, count);
+  top[0]->mutable_cpu_data()[0] = Dtype(loss) /
+      get_normalizer(normalization_, count);
   if (top.size() == 2) {
     top[1]->ShareData(prob_);
   }
@@ -136,28 +192,43 @@ void SoftmaxWithLossLayer<Dtype, MItype, MOtype>::Backward_cpu(
   if (propagate_down[0]) {
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const Dtype* prob_data = prob_.cpu_data();
-    caffe_cpu_copy(prob_.count(), prob_data, bottom_diff);
     const Dtype* label = bottom[1]->cpu_data();
-    int_tp dim = prob_.count() / outer_num_;
-    int_tp count = 0;
-    for (int_tp i = 0; i < outer_num_; ++i) {
-      for (int_tp j = 0; j < inner_num_; ++j) {
-        const int_tp label_value = static_cast<int_tp>
-            (label[i * inner_num_ + j]);
-        if (has_ignore_label_ && label_value == ignore_label_) {
-          for (int_tp c = 0; c < bottom[0]->shape(softmax_axis_); ++c) {
-            bottom_diff[i * dim + c * inner_num_ + j] = 0;
+    const int_tp channels = bottom[0]->shape(softmax_axis_);
+    const int_tp dim = prob_.count() / outer_num_;
+    int_tp count = outer_num_ * inner_num_;
+    if (has_ignore_label_) {
+      for (int_tp i = 0; i < outer_num_ * inner_num_; ++i) {
+        count -= static_cast<int_tp>(label[i]) == ignore_label_;
+      }
+    }
+    const Dtype loss_weight = top[0]->cpu_diff()[0] /
+                              get_normalizer(normalization_, count);
+    // The gradient is written in one pass as the scaled prob - onehot(label),
+    // and 0 at the ignored locations.
+    Caffe::thread_pool().parallel_for(0, outer_num_, 1,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp i = begin; i < end; ++i) {
+        const Dtype* slice_prob = prob_data + i * dim;
+        const Dtype* slice_label = label + i * inner_num_;
+        Dtype* slice_diff = bottom_diff + i * dim;
+        for (int_tp c = 0; c < channels; ++c) {
+          for (int_tp j = 0; j < inner_num_; ++j) {
+            slice_diff[c * inner_num_ + j] =
+                loss_weight * slice_prob[c * inner_num_ + j];
+          }
+        }
+        for (int_tp j = 0; j < inner_num_; ++j) {
+          const int_tp label_value = static_cast<int_tp>(slice_label[j]);
+          if (has_ignore_label_ && label_value == ignore_label_) {
+            for (int_tp c = 0; c < channels; ++c) {
+              slice_diff[c * inner_num_ + j] = 0;
+            }
+          } else {
+            slice_diff[label_value * inner_num_ + j] -= loss_weight;
           }
-        } else {
-          bottom_diff[i * dim + label_value * inner_num_ + j] -= 1;
-          ++count;
         }
       }
-    }
-    // Scale gradient
-    Dtype loss_weight = top[0]->cpu_diff()[0] /
-                        get_normalizer(normalization_, count);
-    caffe_scal(prob_.count(), loss_weight, bottom_diff);
+    });
   }
 }
 
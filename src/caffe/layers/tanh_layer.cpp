@@ -1,6 +1,8 @@
 #include <vector>
 
 #include "caffe/layers/tanh_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -21,9 +23,7 @@ void TanHLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MItype>*>&
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int_tp count = bottom[0]->count();
-  for (int_tp i = 0; i < count; ++i) {
-    top_data[i] = tanh(bottom_data[i]);
-  }
+  caffe_tanh(count, bottom_data, top_data);
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -35,11 +35,13 @@ void TanHLayer<Dtype, MItype, MOtype>::Backward_cpu(const vector<Blob<MOtype>*>&
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int_tp count = bottom[0]->count();
-    Dtype tanhx;
-    for (int_tp i = 0; i < count; ++i) {
-      tanhx = top_data[i];
-      bottom_diff[i] = top_diff[i] * (1 - tanhx * tanhx);
-    }
+    Caffe::thread_pool().parallel_for(0, count, kParallelElementGrain,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp i = begin; i < end; ++i) {
+        const Dtype tanhx = top_data[i];
+        bottom_diff[i] = top_diff[i] * (1 - tanhx * tanhx);
+      }
+    });
   }
 }
 
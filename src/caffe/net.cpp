@@ -1,6 +1,10 @@
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iomanip>
 #include <map>
 #include <set>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -14,10 +18,12 @@
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fuse_layers.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/insert_conversions.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -54,6 +60,15 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  // Fold the layers following convolutions into them for inference. Only
+  // the CPU convolution fuses activations on every device.
+  folded_layers_.clear();
+  if (phase_ == TEST && in_param.state().fuse_layers()) {
+    NetParameter fused_param;
+    FuseLayers(filtered_param, Caffe::mode() == Caffe::CPU, &fused_param,
+               &folded_layers_);
+    filtered_param = fused_param;
+  }
   if (Caffe::root_solver()) {
     LOG(INFO) << "Initializing net from parameters: " << std::endl
               << filtered_param.DebugString();
@@ -65,8 +80,12 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // necessary.
   NetParameter converted_param;
   InsertConversions(splitted_param, &converted_param);
+  // Create a copy of converted_param with layout reorders added where
+  // necessary.
+  NetParameter reordered_param;
+  InsertReorders(converted_param, &reordered_param);
 
-  NetParameter param = converted_param;
+  NetParameter param = reordered_param;
 
   // Basically, build all the layers and set up its connections.
   name_ = param.name();
@@ -283,7 +302,26 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   ShareWeights();
+  SetNeedDiffs(phase_ == TRAIN || param.force_backward());
+  set_profile_memory(false);
   debug_info_ = param.debug_info();
+  plan_memory_ = phase_ == TEST && param.state().plan_memory();
+  if (plan_memory_ && Caffe::mode() != Caffe::CPU) {
+    LOG(WARNING) << "Memory is only planned for nets on the CPU.";
+    plan_memory_ = false;
+  }
+  PlanMemory();
+  concurrent_layers_ = param.state().concurrent_layers();
+  if (concurrent_layers_ && Caffe::mode() != Caffe::CPU) {
+    LOG(WARNING) << "Layers only run concurrently on the CPU.";
+    concurrent_layers_ = false;
+  }
+  if (concurrent_layers_ && plan_memory_) {
+    LOG(WARNING) << "Layers do not run concurrently in nets with planned "
+                 << "memory.";
+    concurrent_layers_ = false;
+  }
+  InitLayerDependencies();
   if (Caffe::root_solver()) {
     LOG(INFO) << "Network initialization done.";
     LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
@@ -560,21 +598,186 @@ void Net<Dtype>::AppendParam(const NetParameter& param, const int_tp layer_id,
   }
 }
 
+template<typename Dtype>
+void Net<Dtype>::InitLayerDependencies() {
+  layer_deps_.assign(layers_.size(), vector<int_tp>());
+  layer_dependents_.assign(layers_.size(), vector<int_tp>());
+  if (!concurrent_layers_) {
+    return;
+  }
+  // Blobs sharing their data, as the tops of in-place, Split and Reshape
+  // layers do, are one buffer, keyed by its memory.
+  map<const void*, int_tp> last_writer;
+  map<const void*, vector<int_tp> > readers;
+  map<int_tp, int_tp> last_param_user;
+  for (int_tp layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    vector<const void*> bottom_buffers;
+    vector<const void*> top_buffers;
+    for (int_tp i = 0; i < bottom_vecs_[layer_id].size(); ++i) {
+      const Blob<Dtype>* blob = bottom_vecs_[layer_id][i];
+      bottom_buffers.push_back(blob->count() > 0 ?
+          static_cast<const void*>(blob->data().get()) : blob);
+    }
+    for (int_tp i = 0; i < top_vecs_[layer_id].size(); ++i) {
+      const Blob<Dtype>* blob = top_vecs_[layer_id][i];
+      top_buffers.push_back(blob->count() > 0 ?
+          static_cast<const void*>(blob->data().get()) : blob);
+    }
+    set<int_tp> deps;
+    // A layer reads its bottoms after their last writer and overwrites its
+    // tops after their last writer and all layers reading them since.
+    for (int_tp i = 0; i < bottom_buffers.size(); ++i) {
+      if (last_writer.count(bottom_buffers[i])) {
+        deps.insert(last_writer[bottom_buffers[i]]);
+      }
+    }
+    for (int_tp i = 0; i < top_buffers.size(); ++i) {
+      if (last_writer.count(top_buffers[i])) {
+        deps.insert(last_writer[top_buffers[i]]);
+      }
+      const vector<int_tp>& buffer_readers = readers[top_buffers[i]];
+      deps.insert(buffer_readers.begin(), buffer_readers.end());
+    }
+    // Layers sharing a parameter accumulate into its diff in Backward.
+    for (int_tp i = 0; i < param_id_vecs_[layer_id].size(); ++i) {
+      const int_tp learnable_param_id =
+          learnable_param_ids_[param_id_vecs_[layer_id][i]];
+      if (last_param_user.count(learnable_param_id)) {
+        deps.insert(last_param_user[learnable_param_id]);
+      }
+      last_param_user[learnable_param_id] = layer_id;
+    }
+    deps.erase(layer_id);
+    for (int_tp i = 0; i < bottom_buffers.size(); ++i) {
+      readers[bottom_buffers[i]].push_back(layer_id);
+    }
+    for (int_tp i = 0; i < top_buffers.size(); ++i) {
+      last_writer[top_buffers[i]] = layer_id;
+      readers[top_buffers[i]].clear();
+    }
+    layer_deps_[layer_id].assign(deps.begin(), deps.end());
+    for (set<int_tp>::iterator it = deps.begin(); it != deps.end(); ++it) {
+      layer_dependents_[*it].push_back(layer_id);
+    }
+  }
+}
+
+template<typename Dtype>
+bool Net<Dtype>::RunsConcurrently() const {
+  // Callbacks, debug info and the memory profile expect the layers one at a
+  // time, in order: the layer-wise reduce of ProcessAllreduce and NCCL
+  // relies on this for its after_backward callback.
+  return concurrent_layers_ && Caffe::mode() == Caffe::CPU &&
+      !profile_memory_ && !debug_info_ && before_forward_.empty() &&
+      after_forward_.empty() && before_backward_.empty() &&
+      after_backward_.empty() && Caffe::thread_pool().num_threads() > 1;
+}
+
+template<typename Dtype>
+vector<Dtype> Net<Dtype>::RunLayersConcurrently(int_tp start, int_tp end,
+                                                const bool backward) {
+  const int_tp first = std::min(start, end);
+  const int_tp last = std::max(start, end);
+  const vector<vector<int_tp> >& deps =
+      backward ? layer_dependents_ : layer_deps_;
+  const vector<vector<int_tp> >& dependents =
+      backward ? layer_deps_ : layer_dependents_;
+  vector<Dtype> losses(layers_.size(), Dtype(0));
+  // The layers within the range each layer still waits for.
+  vector<std::atomic<int_tp> > waiting(last - first + 1);
+  vector<int_tp> ready;
+  for (int_tp i = first; i <= last; ++i) {
+    int_tp count = 0;
+    for (int_tp j = 0; j < deps[i].size(); ++j) {
+      count += deps[i][j] >= first && deps[i][j] <= last;
+    }
+    waiting[i - first] = count;
+    if (count == 0) {
+      ready.push_back(i);
+    }
+  }
+  std::atomic<int_tp> pending(last - first + 1);
+  ThreadPool& pool = Caffe::thread_pool();
+  // Layers run BLAS on several workers at once.
+  SerialBlasScope serial_blas;
+  // Pool threads keep their own Caffe state, so the layers take that of the
+  // calling thread. Each layer draws its random numbers from a seed taken
+  // from the generator of the calling thread in layer order, so that
+  // set_random_seed makes the pass reproducible in whatever order the
+  // layers run.
+  vector<size_t> seeds(last - first + 1);
+  for (int_tp i = 0; i < seeds.size(); ++i) {
+    seeds[i] = caffe_rng_rand();
+  }
+  const int solver_count = Caffe::solver_count();
+  const int solver_rank = Caffe::solver_rank();
+  const bool multiprocess = Caffe::multiprocess();
+  std::function<void(int_tp)> run = [&](int_tp layer_id) {
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_solver_count(solver_count);
+    Caffe::set_solver_rank(solver_rank);
+    Caffe::set_multiprocess(multiprocess);
+    // The calling thread also runs layers while it waits, and keeps its
+    // generator.
+    Caffe::RNG thread_rng(Caffe::rng_stream());
+    Caffe::rng_stream() = Caffe::RNG(seeds[layer_id - first]);
+    if (backward) {
+      BackwardLayer(layer_id);
+    } else {
+      losses[layer_id] = ForwardLayer(layer_id);
+    }
+    Caffe::rng_stream() = thread_rng;
+    for (int_tp i = 0; i < dependents[layer_id].size(); ++i) {
+      const int_tp dependent = dependents[layer_id][i];
+      if (dependent >= first && dependent <= last &&
+          --waiting[dependent - first] == 0) {
+        pool.Schedule([&run, dependent]() { run(dependent); });
+      }
+    }
+    pool.Done(&pending);
+  };
+  // The ready layers are found before any runs, as running layers make
+  // others ready and schedule them.
+  for (int_tp i = 0; i < ready.size(); ++i) {
+    const int_tp layer_id = ready[i];
+    pool.Schedule([&run, layer_id]() { run(layer_id); });
+  }
+  pool.Wait(pending);
+  return losses;
+}
+
+template<typename Dtype>
+Dtype Net<Dtype>::ForwardLayer(const int_tp layer_id) {
+  for (int_tp c = 0; c < before_forward_.size(); ++c) {
+    before_forward_[c]->run(layer_id);
+  }
+  LayerMemoryStart memory_start;
+  if (profile_memory_) { memory_start = StartLayerMemory(layer_id); }
+  Dtype layer_loss = layers_[layer_id]->Forward(bottom_vecs_[layer_id],
+                                                top_vecs_[layer_id]);
+  if (profile_memory_) { StopLayerMemory(layer_id, memory_start); }
+  if (debug_info_) { ForwardDebugInfo(layer_id); }
+  for (int_tp c = 0; c < after_forward_.size(); ++c) {
+    after_forward_[c]->run(layer_id);
+  }
+  return layer_loss;
+}
+
 template<typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int_tp start, int_tp end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
   Dtype loss = 0;
-  for (int_tp i = start; i <= end; ++i) {
-    for (int_tp c = 0; c < before_forward_.size(); ++c) {
-      before_forward_[c]->run(i);
-    }
-    Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
-    loss += layer_loss;
-    if (debug_info_) { ForwardDebugInfo(i); }
-    for (int_tp c = 0; c < after_forward_.size(); ++c) {
-      after_forward_[c]->run(i);
+  if (start <= end && RunsConcurrently()) {
+    // Summed in layer order, as the loss does not depend on the schedule.
+    const vector<Dtype> losses = RunLayersConcurrently(start, end, false);
+    for (int_tp i = start; i <= end; ++i) {
+      loss += losses[i];
     }
+    return loss;
+  }
+  for (int_tp i = start; i <= end; ++i) {
+    loss += ForwardLayer(i);
   }
   return loss;
 }
@@ -611,25 +814,53 @@ const vector<Blob<Dtype>*>& Net<Dtype>::Forward(
   return Forward(loss);
 }
 
+template<typename Dtype>
+void Net<Dtype>::PrepareBackward() {
+  if (backward_diffs_) {
+    return;
+  }
+  SetNeedDiffs(true);
+  // Layers share the diffs of their tops and bottoms in Reshape.
+  for (int_tp i = 0; i < layers_.size(); ++i) {
+    layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+  }
+}
+
 template<typename Dtype>
 void Net<Dtype>::BackwardFromTo(int_tp start, int_tp end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  CHECK(!plan_memory_) << "Backward needs the activations of Forward, which "
+      << "a net with plan_memory overwrites once they are dead.";
+  PrepareBackward();
+  if (start >= end && RunsConcurrently()) {
+    RunLayersConcurrently(start, end, true);
+    return;
+  }
   for (int_tp i = start; i >= end; --i) {
-    for (int_tp c = 0; c < before_backward_.size(); ++c) {
-      before_backward_[c]->run(i);
-    }
-    if (layer_need_backward_[i]) {
-      layers_[i]->Backward(top_vecs_[i], bottom_need_backward_[i],
-                           bottom_vecs_[i]);
-      if (debug_info_) {
-        BackwardDebugInfo(i);
-      }
-    }
-    for (int c = 0; c < after_backward_.size(); ++c) {
-      after_backward_[c]->run(i);
+    BackwardLayer(i);
+  }
+}
+
+template<typename Dtype>
+void Net<Dtype>::BackwardLayer(const int_tp layer_id) {
+  for (int_tp c = 0; c < before_backward_.size(); ++c) {
+    before_backward_[c]->run(layer_id);
+  }
+  if (layer_need_backward_[layer_id]) {
+    LayerMemoryStart memory_start;
+    if (profile_memory_) { memory_start = StartLayerMemory(layer_id); }
+    layers_[layer_id]->Backward(top_vecs_[layer_id],
+                                bottom_need_backward_[layer_id],
+                                bottom_vecs_[layer_id]);
+    if (profile_memory_) { StopLayerMemory(layer_id, memory_start); }
+    if (debug_info_) {
+      BackwardDebugInfo(layer_id);
     }
   }
+  for (int c = 0; c < after_backward_.size(); ++c) {
+    after_backward_[c]->run(layer_id);
+  }
 }
 
 template <typename Dtype>
@@ -723,6 +954,8 @@ void Net<Dtype>::UpdateDebugInfo(const int_tp param_id) {
 
 template<typename Dtype>
 void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
+  CHECK(folded_layers_.empty() && other->folded_layers_.empty())
+      << "Nets with folded layers do not share their weights.";
   int_tp num_source_layers = other->layers().size();
   for (int_tp i = 0; i < num_source_layers; ++i) {
     Layer<Dtype>* source_layer = other->layers()[i].get();
@@ -787,14 +1020,329 @@ void Net<Dtype>::Reshape() {
   for (int_tp i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  PlanMemory();
+}
+
+// The bytes of memory, if it has been allocated.
+static uint_tp AllocatedBytes(SyncedMemory* memory,
+                              set<SyncedMemory*>* counted) {
+  if (memory->head() == SyncedMemory::UNINITIALIZED ||
+      !counted->insert(memory).second) {
+    return 0;
+  }
+  return memory->size();
+}
+
+template<typename Dtype>
+static uint_tp BlobDataBytes(const Blob<Dtype>* blob,
+                             set<SyncedMemory*>* counted) {
+  return blob->count() ? AllocatedBytes(blob->data().get(), counted) : 0;
+}
+
+template<typename Dtype>
+static uint_tp BlobDiffBytes(const Blob<Dtype>* blob,
+                             set<SyncedMemory*>* counted) {
+  return blob->count() && blob->need_diff() ?
+      AllocatedBytes(blob->diff().get(), counted) : 0;
+}
+
+template<typename Dtype>
+uint_tp Net<Dtype>::LayerBlobBytes(const int_tp layer_id) const {
+  set<SyncedMemory*> counted;
+  uint_tp bytes = 0;
+  vector<Blob<Dtype>*> blobs(bottom_vecs_[layer_id]);
+  blobs.insert(blobs.end(), top_vecs_[layer_id].begin(),
+               top_vecs_[layer_id].end());
+  for (int_tp i = 0; i < layers_[layer_id]->blobs().size(); ++i) {
+    blobs.push_back(layers_[layer_id]->blobs()[i].get());
+  }
+  for (int_tp i = 0; i < blobs.size(); ++i) {
+    bytes += BlobDataBytes(blobs[i], &counted);
+    bytes += BlobDiffBytes(blobs[i], &counted);
+  }
+  return bytes;
+}
+
+template<typename Dtype>
+void Net<Dtype>::set_profile_memory(bool profile_memory) {
+  profile_memory_ = profile_memory;
+  layer_internal_memory_.assign(layers_.size(), 0);
+  layer_peak_memory_.assign(layers_.size(), 0);
+}
+
+template<typename Dtype>
+typename Net<Dtype>::LayerMemoryStart Net<Dtype>::StartLayerMemory(
+    const int_tp layer_id) {
+  LayerMemoryStart start;
+  start.blob_bytes = LayerBlobBytes(layer_id);
+  start.usage = device_->thread_memory_usage();
+  start.peak_usage = device_->thread_peak_memory_usage();
+  device_->reset_thread_peak_memory_usage();
+  return start;
+}
+
+template<typename Dtype>
+void Net<Dtype>::StopLayerMemory(const int_tp layer_id,
+                                 const LayerMemoryStart& start) {
+  const int_tp usage = device_->thread_memory_usage();
+  const int_tp peak_usage = device_->thread_peak_memory_usage();
+  // What the pass allocated beyond the blobs of the layer is internal.
+  const uint_tp blob_bytes = LayerBlobBytes(layer_id);
+  const uint_tp allocated = usage > start.usage ? usage - start.usage : 0;
+  const uint_tp blob_allocated = blob_bytes > start.blob_bytes ?
+      blob_bytes - start.blob_bytes : 0;
+  if (allocated > blob_allocated) {
+    layer_internal_memory_[layer_id] += allocated - blob_allocated;
+  }
+  layer_peak_memory_[layer_id] = std::max(layer_peak_memory_[layer_id],
+      static_cast<uint_tp>(peak_usage - start.usage));
+  device_->set_thread_peak_memory_usage(std::max(peak_usage,
+                                                 start.peak_usage));
+}
+
+template<typename Dtype>
+vector<typename Net<Dtype>::LayerMemory> Net<Dtype>::layer_memory() const {
+  vector<LayerMemory> layer_memory(layers_.size());
+  set<SyncedMemory*> counted;
+  for (int_tp layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    LayerMemory& memory = layer_memory[layer_id];
+    memory.top_data = 0;
+    memory.top_diff = 0;
+    memory.param_data = 0;
+    memory.param_diff = 0;
+    // The blobs first read by the layer, such as the net inputs, count as
+    // its tops.
+    for (int_tp i = 0; i < bottom_vecs_[layer_id].size(); ++i) {
+      memory.top_data += BlobDataBytes(bottom_vecs_[layer_id][i], &counted);
+      memory.top_diff += BlobDiffBytes(bottom_vecs_[layer_id][i], &counted);
+    }
+    for (int_tp i = 0; i < top_vecs_[layer_id].size(); ++i) {
+      memory.top_data += BlobDataBytes(top_vecs_[layer_id][i], &counted);
+      memory.top_diff += BlobDiffBytes(top_vecs_[layer_id][i], &counted);
+    }
+    const vector<shared_ptr<Blob<Dtype> > >& params =
+        layers_[layer_id]->blobs();
+    for (int_tp i = 0; i < params.size(); ++i) {
+      memory.param_data += BlobDataBytes(params[i].get(), &counted);
+      memory.param_diff += BlobDiffBytes(params[i].get(), &counted);
+    }
+    memory.internal = layer_internal_memory_[layer_id];
+    memory.peak = layer_peak_memory_[layer_id];
+  }
+  return layer_memory;
+}
+
+template<typename Dtype>
+string Net<Dtype>::MemoryReport() const {
+  const vector<LayerMemory> layer_memory = this->layer_memory();
+  vector<pair<uint_tp, int_tp> > layer_bytes;
+  uint_tp total_bytes = 0;
+  for (int_tp layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const LayerMemory& memory = layer_memory[layer_id];
+    const uint_tp bytes = memory.top_data + memory.top_diff +
+        memory.param_data + memory.param_diff + memory.internal;
+    layer_bytes.push_back(std::make_pair(bytes, layer_id));
+    total_bytes += bytes;
+  }
+  std::stable_sort(layer_bytes.begin(), layer_bytes.end(),
+                   std::greater<pair<uint_tp, int_tp> >());
+  std::ostringstream report;
+  report << std::setw(20) << "layer" << std::setw(12) << "total"
+         << std::setw(12) << "top data" << std::setw(12) << "top diff"
+         << std::setw(12) << "param data" << std::setw(12) << "param diff"
+         << std::setw(12) << "internal" << std::setw(12) << "peak"
+         << std::endl;
+  for (int_tp i = 0; i < layer_bytes.size(); ++i) {
+    const LayerMemory& memory = layer_memory[layer_bytes[i].second];
+    report << std::setw(20) << layer_names_[layer_bytes[i].second]
+           << std::setw(12) << layer_bytes[i].first
+           << std::setw(12) << memory.top_data
+           << std::setw(12) << memory.top_diff
+           << std::setw(12) << memory.param_data
+           << std::setw(12) << memory.param_diff
+           << std::setw(12) << memory.internal
+           << std::setw(12) << memory.peak << std::endl;
+  }
+  report << "Total: " << total_bytes << " bytes, device usage: "
+         << device_->memory_usage() << " bytes, device peak: "
+         << device_->peak_memory_usage() << " bytes";
+  return report.str();
+}
+
+template<typename Dtype>
+void Net<Dtype>::SetNeedDiffs(const bool backward) {
+  vector<bool> blob_need_diff(blobs_.size(), false);
+  for (int_tp layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    // Backward reads the top diffs of a layer and writes its bottom diffs.
+    // Loss layers keep their diffs without Backward, as the top diffs hold
+    // the loss weights and some use the bottom diffs as scratch in Forward.
+    bool need_diff = backward && layer_need_backward_[layer_id];
+    for (int_tp top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
+      need_diff |= layers_[layer_id]->loss(top_id) != Dtype(0);
+    }
+    if (!need_diff) {
+      continue;
+    }
+    for (int_tp top_id = 0; top_id < top_id_vecs_[layer_id].size();
+         ++top_id) {
+      blob_need_diff[top_id_vecs_[layer_id][top_id]] = true;
+    }
+    for (int_tp bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size();
+         ++bottom_id) {
+      blob_need_diff[bottom_id_vecs_[layer_id][bottom_id]] = true;
+    }
+  }
+  int_tp num_without_diff = 0;
+  for (int_tp blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    blobs_[blob_id]->set_need_diff(blob_need_diff[blob_id]);
+    num_without_diff += !blob_need_diff[blob_id];
+  }
+  backward_diffs_ = backward;
+  LOG_IF(INFO, Caffe::root_solver()) << num_without_diff << " of "
+      << blobs_.size() << " blobs need no diff";
+}
+
+template<typename Dtype>
+void Net<Dtype>::PlanMemory() {
+  if (!plan_memory_) {
+    return;
+  }
+  // Blobs sharing their data, like the tops of split layers, are placed
+  // together and live from the first layer that touches one of them to the
+  // last.
+  map<SyncedMemory*, int_tp> memory_to_group;
+  vector<shared_ptr<SyncedMemory> > group_memory;
+  vector<int_tp> blob_group(blobs_.size(), -1);
+  for (int_tp i = 0; i < blobs_.size(); ++i) {
+    // Empty blobs have no memory to place.
+    if (blobs_[i]->count() == 0) {
+      continue;
+    }
+    SyncedMemory* memory = blobs_[i]->data().get();
+    if (!memory_to_group.count(memory)) {
+      memory_to_group[memory] = group_memory.size();
+      group_memory.push_back(blobs_[i]->data());
+    }
+    blob_group[i] = memory_to_group[memory];
+  }
+  const int_tp num_groups = group_memory.size();
+  vector<int_tp> first_use(num_groups, layers_.size());
+  vector<int_tp> last_use(num_groups, -1);
+  vector<bool> pinned(num_groups, false);
+  for (int_tp i = 0; i < layers_.size(); ++i) {
+    vector<int_tp> blob_ids(bottom_id_vecs_[i]);
+    blob_ids.insert(blob_ids.end(), top_id_vecs_[i].begin(),
+                    top_id_vecs_[i].end());
+    for (int_tp j = 0; j < blob_ids.size(); ++j) {
+      const int_tp group = blob_group[blob_ids[j]];
+      if (group >= 0) {
+        first_use[group] = std::min(first_use[group], i);
+        last_use[group] = std::max(last_use[group], i);
+      }
+    }
+  }
+  // The inputs and outputs are read and written outside of Forward.
+  vector<int_tp> pinned_blobs(net_input_blob_indices_);
+  pinned_blobs.insert(pinned_blobs.end(), net_output_blob_indices_.begin(),
+                      net_output_blob_indices_.end());
+  for (int_tp i = 0; i < pinned_blobs.size(); ++i) {
+    if (blob_group[pinned_blobs[i]] >= 0) {
+      pinned[blob_group[pinned_blobs[i]]] = true;
+    }
+  }
+  // First fit of the groups, largest first, at the lowest offset that no
+  // group live at the same time overlaps.
+  const size_t kAlignment = 64;
+  vector<pair<size_t, int_tp> > planned;
+  size_t naive_bytes = 0, pinned_bytes = 0;
+  for (int_tp g = 0; g < num_groups; ++g) {
+    naive_bytes += group_memory[g]->size();
+    if (pinned[g] || last_use[g] < 0) {
+      pinned_bytes += group_memory[g]->size();
+    } else {
+      planned.push_back(make_pair(group_memory[g]->size(), g));
+    }
+  }
+  std::sort(planned.rbegin(), planned.rend());
+  vector<size_t> offset(num_groups, 0);
+  size_t arena_bytes = 0;
+  for (int_tp i = 0; i < planned.size(); ++i) {
+    const int_tp g = planned[i].second;
+    const size_t bytes = (planned[i].first + kAlignment - 1) / kAlignment
+        * kAlignment;
+    vector<pair<size_t, size_t> > taken;
+    for (int_tp j = 0; j < i; ++j) {
+      const int_tp other = planned[j].second;
+      if (first_use[other] <= last_use[g] && first_use[g] <= last_use[other]) {
+        taken.push_back(make_pair(offset[other],
+                                  offset[other] + planned[j].first));
+      }
+    }
+    std::sort(taken.begin(), taken.end());
+    size_t candidate = 0;
+    for (int_tp j = 0; j < taken.size(); ++j) {
+      if (candidate + bytes <= taken[j].first) {
+        break;
+      }
+      candidate = std::max(candidate, (taken[j].second + kAlignment - 1)
+                           / kAlignment * kAlignment);
+    }
+    offset[g] = candidate;
+    arena_bytes = std::max(arena_bytes, candidate + bytes);
+  }
+  shared_ptr<SyncedMemory> arena(new SyncedMemory(arena_bytes, device_));
+  vector<shared_ptr<SyncedMemory> > arena_memories;
+  set<SyncedMemory*> placed;
+  if (arena_bytes > 0) {
+    char* arena_data = static_cast<char*>(arena->mutable_cpu_data());
+    for (int_tp i = 0; i < planned.size(); ++i) {
+      const int_tp g = planned[i].second;
+      group_memory[g]->set_cpu_data(arena_data + offset[g]);
+      arena_memories.push_back(group_memory[g]);
+      placed.insert(group_memory[g].get());
+    }
+  }
+  // The memories of the previous arena that were not placed again, such as
+  // those of blobs that are empty now, would point into it once it is
+  // freed. They let go of it and allocate their own memory when next used.
+  for (int_tp i = 0; i < arena_memories_.size(); ++i) {
+    if (!placed.count(arena_memories_[i].get())) {
+      arena_memories_[i]->clear_data();
+    }
+  }
+  // Frees the previous arena.
+  memory_arena_ = arena;
+  arena_memories_ = arena_memories;
+  memory_used_ = (arena_bytes + pinned_bytes) / sizeof(Dtype);
+  if (Caffe::root_solver()) {
+    LOG(INFO) << "Planned memory for data: " << arena_bytes + pinned_bytes
+              << " instead of " << naive_bytes;
+  }
 }
 
 template<typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
+  set<string> folded_layer_names, copied_layers;
+  for (map<string, vector<LayerParameter> >::const_iterator it =
+       folded_layers_.begin(); it != folded_layers_.end(); ++it) {
+    for (int_tp i = 0; i < it->second.size(); ++i) {
+      folded_layer_names.insert(it->second[i].name());
+    }
+  }
+  map<string, vector<shared_ptr<Blob<Dtype> > > > folded_weights;
   int_tp num_source_layers = param.layer_size();
   for (int_tp i = 0; i < num_source_layers; ++i) {
     const LayerParameter& source_layer = param.layer(i);
     const string& source_layer_name = source_layer.name();
+    if (folded_layer_names.count(source_layer_name)) {
+      for (int_tp j = 0; j < source_layer.blobs_size(); ++j) {
+        folded_weights[source_layer_name].push_back(
+            shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+        folded_weights[source_layer_name].back()->FromProto(
+            source_layer.blobs(j), true);
+      }
+      continue;
+    }
     int_tp target_layer_id = 0;
     while (target_layer_id != layer_names_.size()
         && layer_names_[target_layer_id] != source_layer_name) {
@@ -807,9 +1355,17 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
     DLOG(INFO)<< "Copying source layer " << source_layer_name;
     vector<shared_ptr<Blob<Dtype> > >& target_blobs = layers_[target_layer_id]
         ->blobs();
-    CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
+    // Convolutions without a bias gain one when layers are folded into them.
+    const bool gained_bias = folded_layers_.count(source_layer_name) &&
+        target_blobs.size() == source_layer.blobs_size() + 1;
+    CHECK(target_blobs.size() == source_layer.blobs_size() || gained_bias)
         << "Incompatible number of blobs for layer " << source_layer_name;
-    for (int_tp j = 0; j < target_blobs.size(); ++j) {
+    if (gained_bias) {
+      caffe_set(target_blobs[1]->count(), Dtype(0),
+                target_blobs[1]->mutable_cpu_data());
+    }
+    copied_layers.insert(source_layer_name);
+    for (int_tp j = 0; j < source_layer.blobs_size(); ++j) {
       if (!target_blobs[j]->ShapeEquals(source_layer.blobs(j))) {
         Blob<Dtype> source_blob;
         const bool kReshape = true;
@@ -825,6 +1381,45 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
       target_blobs[j]->FromProto(source_layer.blobs(j), kReshape);
     }
   }
+  FoldTrainedLayers(copied_layers, folded_weights);
+}
+
+template<typename Dtype>
+void Net<Dtype>::FoldTrainedLayers(const set<string>& copied_layers,
+    const map<string, vector<shared_ptr<Blob<Dtype> > > >& folded_weights) {
+  for (map<string, vector<LayerParameter> >::const_iterator it =
+       folded_layers_.begin(); it != folded_layers_.end(); ++it) {
+    // Convolutions that kept their weights were folded before.
+    if (!copied_layers.count(it->first)) {
+      continue;
+    }
+    vector<shared_ptr<Blob<Dtype> > >& conv_blobs =
+        layers_[layer_names_index_[it->first]]->blobs();
+    const int_tp num_output = conv_blobs[0]->shape(0);
+    for (int_tp i = 0; i < it->second.size(); ++i) {
+      const LayerParameter& folded_layer = it->second[i];
+      typename map<string, vector<shared_ptr<Blob<Dtype> > > >::const_iterator
+          weights = folded_weights.find(folded_layer.name());
+      CHECK(weights != folded_weights.end())
+          << "No trained weights for layer " << folded_layer.name()
+          << ", which is folded into " << it->first;
+      vector<const Dtype*> weight_data;
+      for (int_tp j = 0; j < weights->second.size(); ++j) {
+        if (j < 2) {
+          CHECK_EQ(weights->second[j]->count(), num_output)
+              << "Cannot fold layer " << folded_layer.name() << " into "
+              << it->first << "; shape mismatch.";
+        }
+        weight_data.push_back(weights->second[j]->cpu_data());
+      }
+      FoldLayerWeights(folded_layer, weight_data, num_output,
+                       conv_blobs[0]->count(1),
+                       conv_blobs[0]->mutable_cpu_data(),
+                       conv_blobs[1]->mutable_cpu_data());
+    }
+    LOG_IF(INFO, Caffe::root_solver()) << "Folded " << it->second.size()
+        << " layers into the weights of " << it->first;
+  }
 }
 
 template<typename Dtype>
@@ -856,9 +1451,34 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
   hid_t data_hid = H5Gopen2(file_hid, "data", H5P_DEFAULT);
   CHECK_GE(data_hid, 0) << "Error reading weights from " << trained_filename;
+  set<string> folded_layer_names, copied_layers;
+  for (map<string, vector<LayerParameter> >::const_iterator it =
+       folded_layers_.begin(); it != folded_layers_.end(); ++it) {
+    for (int_tp i = 0; i < it->second.size(); ++i) {
+      folded_layer_names.insert(it->second[i].name());
+    }
+  }
+  map<string, vector<shared_ptr<Blob<Dtype> > > > folded_weights;
   int_tp num_layers = hdf5_get_num_links(data_hid);
   for (int_tp i = 0; i < num_layers; ++i) {
     string source_layer_name = hdf5_get_name_by_idx(data_hid, i);
+    if (folded_layer_names.count(source_layer_name)) {
+      hid_t layer_hid = H5Gopen2(data_hid, source_layer_name.c_str(),
+          H5P_DEFAULT);
+      CHECK_GE(layer_hid, 0)
+          << "Error reading weights from " << trained_filename;
+      int_tp num_source_params = hdf5_get_num_links(layer_hid);
+      for (int_tp j = 0; j < num_source_params; ++j) {
+        ostringstream oss;
+        oss << j;
+        folded_weights[source_layer_name].push_back(
+            shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+        hdf5_load_nd_dataset(layer_hid, oss.str().c_str(), 0, kMaxBlobAxes,
+            folded_weights[source_layer_name].back().get());
+      }
+      H5Gclose(layer_hid);
+      continue;
+    }
     if (!layer_names_index_.count(source_layer_name)) {
       LOG(INFO) << "Ignoring source layer " << source_layer_name;
       continue;
@@ -885,6 +1505,11 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
         if (param_owners_[target_net_param_id] != -1) {
           // ...but it's weight-shared in target, so that's fine.
           continue;
+        } else if (j == 1 && folded_layers_.count(source_layer_name)) {
+          // ...but it's the bias a convolution gained from folding.
+          caffe_set(target_blobs[j]->count(), Dtype(0),
+                    target_blobs[j]->mutable_cpu_data());
+          continue;
         } else {
           LOG(FATAL) << "Incompatible number of blobs for layer "
               << source_layer_name;
@@ -894,9 +1519,11 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
           target_blobs[j].get());
     }
     H5Gclose(layer_hid);
+    copied_layers.insert(source_layer_name);
   }
   H5Gclose(data_hid);
   H5Fclose(file_hid);
+  FoldTrainedLayers(copied_layers, folded_weights);
 #else
   LOG(FATAL) << "CopyTrainedLayersFromHDF5 requires hdf5;"
              << " compile with USE_HDF5.";
@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "caffe/net_pipeline.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template<typename Dtype>
+NetPipeline<Dtype>::NetPipeline(Net<Dtype>* net, int_tp num_stages,
+                                int_tp micro_batch,
+                                const vector<int_tp>& cpus)
+    : net_(net), micro_batch_(micro_batch), passes_(0),
+      num_micro_batches_(0), stages_finished_(0), stop_(false) {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU) << "Nets are pipelined on the CPU.";
+  CHECK_GT(micro_batch, 0);
+  CHECK_GT(net->num_inputs(), 0)
+      << "Pipelined nets are fed through their input blobs.";
+  InitStages(num_stages);
+  // The layers of net, already filtered and fused, without their weights,
+  // which the stages share.
+  NetParameter param;
+  net->ToProto(&param);
+  param.mutable_state()->set_phase(net->phase());
+  for (int_tp i = 0; i < param.layer_size(); ++i) {
+    param.mutable_layer(i)->clear_blobs();
+    param.mutable_layer(i)->clear_include();
+    param.mutable_layer(i)->clear_exclude();
+  }
+  if (!cpus.empty()) {
+    CHECK_GE(cpus.size(), num_stages) << "Fewer cores than stages.";
+  }
+  const int_tp stage_threads = cpus.empty() ?
+      std::max(Caffe::cpu_threads() / num_stages, int_tp(1)) :
+      cpus.size() / num_stages;
+  for (int_tp stage = 0; stage < num_stages; ++stage) {
+    shared_ptr<Net<Dtype> > stage_net(
+        new Net<Dtype>(param, Caffe::GetDefaultDevice()));
+    CHECK_EQ(stage_net->layers().size(), net->layers().size());
+    for (int_tp i = 0; i < net->layers().size(); ++i) {
+      const vector<shared_ptr<Blob<Dtype> > >& blobs =
+          net->layers()[i]->blobs();
+      for (int_tp j = 0; j < blobs.size(); ++j) {
+        stage_net->layers()[i]->blobs()[j]->ShareData(*blobs[j]);
+      }
+    }
+    stage_nets_.push_back(stage_net);
+    vector<int_tp> pool_cpus;
+    if (!cpus.empty()) {
+      pool_cpus.assign(cpus.begin() + stage * stage_threads,
+                       cpus.begin() + (stage + 1) * stage_threads);
+      stage_cpus_.push_back(pool_cpus[0]);
+    } else {
+      stage_cpus_.push_back(-1);
+    }
+    stage_pools_.push_back(shared_ptr<ThreadPool>(
+        new ThreadPool(stage_threads, pool_cpus)));
+  }
+  for (int_tp stage = 0; stage < num_stages; ++stage) {
+    stage_threads_.push_back(shared_ptr<boost::thread>(new boost::thread(
+        &NetPipeline<Dtype>::StageLoop, this, stage)));
+  }
+}
+
+template<typename Dtype>
+NetPipeline<Dtype>::~NetPipeline() {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (int_tp stage = 0; stage < stage_threads_.size(); ++stage) {
+    stage_threads_[stage]->join();
+  }
+}
+
+template<typename Dtype>
+void NetPipeline<Dtype>::InitStages(int_tp num_stages) {
+  const vector<shared_ptr<Layer<Dtype, Dtype, Dtype> > >& layers =
+      net_->layers();
+  const int_tp num_layers = layers.size();
+  CHECK_GE(num_stages, 1);
+  CHECK_LE(num_stages, num_layers) << "More stages than layers.";
+  // Layers estimating no flops are taken to cost an operation per top
+  // element.
+  vector<double> costs(num_layers);
+  double total_cost = 0;
+  for (int_tp i = 0; i < num_layers; ++i) {
+    double cost = layers[i]->ForwardFlops();
+    if (cost == 0) {
+      for (int_tp j = 0; j < net_->top_vecs()[i].size(); ++j) {
+        cost += net_->top_vecs()[i][j]->count();
+      }
+    }
+    costs[i] = cost;
+    total_cost += cost;
+  }
+  // A stage ends once the layers so far cost its share of the total, or
+  // when the remaining layers are needed for one stage each.
+  stage_starts_.assign(1, 0);
+  double cost = 0;
+  for (int_tp i = 0; i + 1 < num_layers; ++i) {
+    cost += costs[i];
+    const int_tp next_stage = stage_starts_.size();
+    if (next_stage < num_stages &&
+        (cost >= total_cost * next_stage / num_stages ||
+         num_layers - i - 1 == num_stages - next_stage)) {
+      stage_starts_.push_back(i + 1);
+    }
+  }
+  stage_ends_.clear();
+  for (int_tp stage = 0; stage < num_stages; ++stage) {
+    stage_ends_.push_back(stage + 1 < num_stages ?
+        stage_starts_[stage + 1] - 1 : num_layers - 1);
+  }
+
+  // The stages reading and writing each blob.
+  const int_tp num_blobs = net_->blobs().size();
+  vector<set<int_tp> > users(num_blobs);
+  vector<int_tp> last_writer(num_blobs, -1);
+  for (int_tp i = 0; i < net_->num_inputs(); ++i) {
+    users[net_->input_blob_indices()[i]].insert(0);
+  }
+  for (int_tp stage = 0; stage < num_stages; ++stage) {
+    for (int_tp i = stage_starts_[stage]; i <= stage_ends_[stage]; ++i) {
+      const vector<int_tp>& bottom_ids = net_->bottom_ids(i);
+      for (int_tp j = 0; j < bottom_ids.size(); ++j) {
+        users[bottom_ids[j]].insert(stage);
+      }
+      const vector<int_tp>& top_ids = net_->top_ids(i);
+      for (int_tp j = 0; j < top_ids.size(); ++j) {
+        users[top_ids[j]].insert(stage);
+        last_writer[top_ids[j]] = stage;
+      }
+    }
+  }
+  vector<bool> is_input(num_blobs, false);
+  for (int_tp i = 0; i < net_->num_inputs(); ++i) {
+    is_input[net_->input_blob_indices()[i]] = true;
+  }
+  // The net inputs and the blobs used by several stages are buffered.
+  stage_reads_.assign(num_stages, vector<int_tp>());
+  stage_writes_.assign(num_stages, vector<int_tp>());
+  stage_last_user_.clear();
+  for (int_tp stage = 0; stage < num_stages; ++stage) {
+    stage_last_user_.push_back(stage);
+  }
+  buffers_.assign(num_blobs, vector<shared_ptr<Blob<Dtype> > >());
+  for (int_tp blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (!is_input[blob_id] && users[blob_id].size() < 2) {
+      continue;
+    }
+    for (int_tp i = 0; i < 2; ++i) {
+      buffers_[blob_id].push_back(
+          shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    }
+    const int_tp last_user = *users[blob_id].rbegin();
+    for (set<int_tp>::iterator it = users[blob_id].begin();
+         it != users[blob_id].end(); ++it) {
+      stage_reads_[*it].push_back(blob_id);
+    }
+    // Stage 0 fills the buffers of the inputs, and every stage writing the
+    // blob for a later one those of its tops.
+    if (is_input[blob_id]) {
+      stage_last_user_[0] = std::max(stage_last_user_[0], last_user);
+    }
+    for (int_tp stage = 0; stage < num_stages; ++stage) {
+      bool writes = false;
+      for (int_tp i = stage_starts_[stage]; i <= stage_ends_[stage]; ++i) {
+        const vector<int_tp>& top_ids = net_->top_ids(i);
+        writes |= std::find(top_ids.begin(), top_ids.end(), blob_id) !=
+            top_ids.end();
+      }
+      if (writes && last_user > stage) {
+        stage_writes_[stage].push_back(blob_id);
+        stage_last_user_[stage] = std::max(stage_last_user_[stage],
+                                           last_user);
+      }
+    }
+  }
+  stage_outputs_.assign(num_stages, vector<int_tp>());
+  for (int_tp i = 0; i < net_->num_outputs(); ++i) {
+    stage_outputs_[last_writer[net_->output_blob_indices()[i]]].push_back(i);
+  }
+}
+
+template<typename Dtype>
+void NetPipeline<Dtype>::Reshape() {
+  for (int_tp stage = 0; stage < stage_nets_.size(); ++stage) {
+    Net<Dtype>* stage_net = stage_nets_[stage].get();
+    for (int_tp i = 0; i < net_->num_inputs(); ++i) {
+      vector<uint_tp> shape = net_->input_blobs()[i]->shape();
+      CHECK_GT(shape.size(), 0);
+      shape[0] = micro_batch_;
+      stage_net->input_blobs()[i]->Reshape(shape);
+    }
+    stage_net->Reshape();
+  }
+  for (int_tp blob_id = 0; blob_id < buffers_.size(); ++blob_id) {
+    for (int_tp i = 0; i < buffers_[blob_id].size(); ++i) {
+      buffers_[blob_id][i]->ReshapeLike(*stage_nets_[0]->blobs()[blob_id]);
+      buffers_[blob_id][i]->mutable_cpu_data();
+    }
+  }
+}
+
+template<typename Dtype>
+const vector<Blob<Dtype>*>& NetPipeline<Dtype>::Forward() {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU) << "Nets are pipelined on the CPU.";
+  const int_tp batch = net_->input_blobs()[0]->shape(0);
+  CHECK_EQ(batch % micro_batch_, 0)
+      << "The batch is not a multiple of the micro batch.";
+  const int_tp num_micro_batches = batch / micro_batch_;
+  net_->Reshape();
+  Reshape();
+  // Taken here, as the stages must not move the blobs of net_.
+  input_data_.clear();
+  for (int_tp i = 0; i < net_->num_inputs(); ++i) {
+    CHECK_EQ(net_->input_blobs()[i]->shape(0), batch)
+        << "The inputs differ in their batch.";
+    input_data_.push_back(net_->input_blobs()[i]->cpu_data());
+  }
+  output_data_.clear();
+  for (int_tp i = 0; i < net_->num_outputs(); ++i) {
+    CHECK_EQ(net_->output_blobs()[i]->count(),
+             stage_nets_[0]->output_blobs()[i]->count() * num_micro_batches)
+        << "Pipelined outputs must have the batch as their first axis.";
+    output_data_.push_back(net_->output_blobs()[i]->mutable_cpu_data());
+  }
+  // The stages run BLAS at once.
+  SerialBlasScope serial_blas;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stage_done_.assign(num_stages(), 0);
+    num_micro_batches_ = num_micro_batches;
+    stages_finished_ = 0;
+    ++passes_;
+  }
+  cond_.notify_all();
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (stages_finished_ < num_stages()) {
+      cond_.wait(lock);
+    }
+  }
+  return net_->output_blobs();
+}
+
+template<typename Dtype>
+void NetPipeline<Dtype>::StageLoop(int_tp stage) {
+  if (stage_cpus_[stage] >= 0) {
+    ThreadPool::PinCallingThread(stage_cpus_[stage]);
+  }
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_thread_pool(stage_pools_[stage].get());
+  int_tp passes = 0;
+  while (true) {
+    int_tp num_micro_batches;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!stop_ && passes_ == passes) {
+        cond_.wait(lock);
+      }
+      if (stop_) {
+        break;
+      }
+      passes = passes_;
+      num_micro_batches = num_micro_batches_;
+    }
+    RunStage(stage, num_micro_batches);
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      ++stages_finished_;
+    }
+    cond_.notify_all();
+  }
+  Caffe::set_thread_pool(NULL);
+}
+
+template<typename Dtype>
+void NetPipeline<Dtype>::RunStage(int_tp stage, int_tp num_micro_batches) {
+  Net<Dtype>* stage_net = stage_nets_[stage].get();
+  for (int_tp micro_batch = 0; micro_batch < num_micro_batches;
+       ++micro_batch) {
+    {
+      // The previous stage is done with the micro-batch, and the stages
+      // reading the buffers this stage fills are done with the micro-batch
+      // that last used them.
+      boost::mutex::scoped_lock lock(mutex_);
+      while ((stage > 0 && stage_done_[stage - 1] <= micro_batch) ||
+             stage_done_[stage_last_user_[stage]] < micro_batch - 1) {
+        cond_.wait(lock);
+      }
+    }
+    const int_tp buffer = micro_batch % 2;
+    if (stage == 0) {
+      for (int_tp i = 0; i < net_->num_inputs(); ++i) {
+        Blob<Dtype>* input =
+            buffers_[net_->input_blob_indices()[i]][buffer].get();
+        caffe_copy(input->count(), input_data_[i] + micro_batch *
+                   input->count(), input->mutable_cpu_data());
+      }
+    }
+    for (int_tp i = 0; i < stage_reads_[stage].size(); ++i) {
+      const int_tp blob_id = stage_reads_[stage][i];
+      stage_net->blobs()[blob_id]->ShareData(*buffers_[blob_id][buffer]);
+    }
+    stage_net->ForwardFromTo(stage_starts_[stage], stage_ends_[stage]);
+    // Layers sharing the data of their bottoms, such as Split and Reshape,
+    // leave their tops off the buffers.
+    for (int_tp i = 0; i < stage_writes_[stage].size(); ++i) {
+      const int_tp blob_id = stage_writes_[stage][i];
+      const Blob<Dtype>& top = *stage_net->blobs()[blob_id];
+      if (top.data() != buffers_[blob_id][buffer]->data()) {
+        buffers_[blob_id][buffer]->CopyFrom(top);
+      }
+    }
+    for (int_tp i = 0; i < stage_outputs_[stage].size(); ++i) {
+      const int_tp output = stage_outputs_[stage][i];
+      const Blob<Dtype>& top = *stage_net->output_blobs()[output];
+      caffe_copy(top.count(), top.cpu_data(),
+                 output_data_[output] + micro_batch * top.count());
+    }
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      ++stage_done_[stage];
+    }
+    cond_.notify_all();
+  }
+}
+
+INSTANTIATE_CLASS(NetPipeline);
+
+}  // namespace caffe
@@ -4,10 +4,20 @@
 
 #ifdef USE_CUDA
 #ifdef USE_NCCL
-
 #include <cuda_runtime.h>
+#endif  // USE_NCCL
+#endif  // USE_CUDA
+#ifndef _MSC_VER
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif  // !_MSC_VER
 #include <glog/logging.h>
 #include <stdio.h>
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -15,6 +25,7 @@
 #include "caffe/caffe.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/sgd_solvers.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -43,15 +54,21 @@ static void apply_buffers(const vector<Blob<Dtype>*>& blobs, Dtype* buffer,
       case replace_cpu:
         blobs[i]->data()->set_cpu_data(ptr);
         break;
-      case replace_gpu:
-        blobs[i]->data()->set_gpu_data(ptr);
-        break;
       case replace_cpu_diff:
         blobs[i]->diff()->set_cpu_data(ptr);
         break;
+#ifdef USE_CUDA
+#ifdef USE_NCCL
+      case replace_gpu:
+        blobs[i]->data()->set_gpu_data(ptr);
+        break;
       case replace_gpu_diff:
         blobs[i]->diff()->set_gpu_data(ptr);
         break;
+#endif  // USE_NCCL
+#endif  // USE_CUDA
+      default:
+        LOG(FATAL) << "Unsupported buffer operation " << op;
     }
     ptr += size;
   }
@@ -77,6 +94,499 @@ Params<Dtype>::Params(shared_ptr<Solver<Dtype> > root_solver)
     diff_() {
 }
 
+template<typename Dtype>
+CPUParams<Dtype>::CPUParams(shared_ptr<Solver<Dtype> > root_solver)
+  : Params<Dtype>(root_solver) {
+  data_ = new Dtype[size_];
+  // Copy blob values
+  const vector<Blob<Dtype>*>& net =
+    root_solver->net()->learnable_params();
+  apply_buffers(net, data_, size_, copy);
+
+  diff_ = new Dtype[size_];
+  caffe_set(size_, Dtype(0), diff_);
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::~CPUParams() {
+  delete[] data_;
+  delete[] diff_;
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::Configure(Solver<Dtype>* solver) const {
+  const vector<Blob<Dtype>*>& net =
+    solver->net()->learnable_params();
+  apply_buffers(net, data_, size_, replace_cpu);
+  apply_buffers(net, diff_, size_, replace_cpu_diff);
+}
+
+// Elements of a block of the host reduction, small enough for the block and
+// the gradients added to it to stay in the L1 or L2 cache.
+const uint_tp kHostReduceBlock = 4096;
+
+template<typename Dtype>
+HostAllreduce<Dtype>::HostAllreduce(shared_ptr<Solver<Dtype> > solver)
+  : CPUParams<Dtype>(solver),
+    solver_(solver), replicas_(), barrier_(), block_(kHostReduceBlock) {
+  this->Configure(solver.get());
+}
+
+template<typename Dtype>
+void HostAllreduce<Dtype>::set_replicas(
+    vector<HostAllreduce<Dtype>*>* replicas, boost::barrier* barrier) {
+  replicas_ = replicas;
+  barrier_ = barrier;
+}
+
+template<typename Dtype>
+void HostAllreduce<Dtype>::Broadcast() {
+  barrier_->wait();
+  if (Caffe::solver_rank() != 0) {
+    caffe_cpu_copy(size_, (*replicas_)[0]->data_, data_);
+  }
+  barrier_->wait();
+}
+
+template<typename Dtype>
+void HostAllreduce<Dtype>::on_gradients_ready() {
+  if (solver_->param().layer_wise_reduce()) {
+    LOG_FIRST_N(INFO, 1) << "Layer-wise reduce is not used on the CPU.";
+  }
+  const vector<HostAllreduce<Dtype>*>& replicas = *replicas_;
+  const uint_tp count = replicas.size();
+  const uint_tp rank = Caffe::solver_rank();
+  const Dtype scale = Dtype(1) / count;
+  // Wait for the gradients of all replicas
+  barrier_->wait();
+  // Reduce the slice of this rank, summing in rank order.
+  for (uint_tp begin = size_ * rank / count,
+       end = size_ * (rank + 1) / count; begin < end;
+       begin += kHostReduceBlock) {
+    const int_tp n = std::min(kHostReduceBlock, end - begin);
+    Dtype* sum = &block_[0];
+    caffe_cpu_copy(n, replicas[0]->diff_ + begin, sum);
+    for (uint_tp r = 1; r < count; ++r) {
+      caffe_axpy(n, Dtype(1), replicas[r]->diff_ + begin, sum);
+    }
+    caffe_scal(n, scale, sum);
+    caffe_cpu_copy(n, sum, diff_ + begin);
+  }
+  // Wait for all slices to be reduced, then gather the others.
+  barrier_->wait();
+  for (uint_tp r = 0; r < count; ++r) {
+    if (r != rank) {
+      const uint_tp begin = size_ * r / count;
+      const uint_tp end = size_ * (r + 1) / count;
+      caffe_cpu_copy(end - begin, replicas[r]->diff_ + begin, diff_ + begin);
+    }
+  }
+  // Keep the owners from overwriting their slices with the next gradients
+  // while they are read.
+  barrier_->wait();
+}
+
+template<typename Dtype>
+class HostWorker : public InternalThread {
+ public:
+  explicit HostWorker(shared_ptr<Solver<Dtype> > rank0, ThreadPool* pool,
+                      int_tp cpu, boost::barrier* barrier,
+                      vector<HostAllreduce<Dtype>*>* replicas,
+                      const char* restore)
+    : rank0_(rank0), pool_(pool), cpu_(cpu), barrier_(barrier),
+      replicas_(replicas), restore_(restore) {
+  }
+  virtual ~HostWorker() {}
+
+ protected:
+  void InternalThreadEntry() {
+    if (cpu_ >= 0) {
+      ThreadPool::PinCallingThread(cpu_);
+    }
+    Caffe::set_thread_pool(pool_);
+    // Create solver and install callbacks
+    SolverParameter param(rank0_->param());
+    param.set_type(rank0_->type());
+    shared_ptr<Solver<Dtype> > s(SolverRegistry<Dtype>::CreateSolver(param));
+    CHECK_EQ(s->type(), rank0_->type());
+    if (restore_) {
+      s->Restore(restore_);
+    }
+    HostAllreduce<Dtype> allreduce(s);
+    allreduce.set_replicas(replicas_, barrier_);
+    s->add_callback(&allreduce);
+    (*replicas_)[Caffe::solver_rank()] = &allreduce;
+    // Broadcast rank 0 state
+    allreduce.Broadcast();
+    // Solve
+    s->Step(param.max_iter() - s->iter());
+    barrier_->wait();
+    Caffe::set_thread_pool(NULL);
+  }
+  shared_ptr<Solver<Dtype> > rank0_;
+  ThreadPool* pool_;
+  int_tp cpu_;
+  boost::barrier* barrier_;
+  vector<HostAllreduce<Dtype>*>* replicas_;
+  const char* restore_;
+};
+
+template<typename Dtype>
+void HostAllreduce<Dtype>::Run(int_tp num_replicas, bool pin_threads,
+                               const char* restore) {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU);
+  CHECK_EQ(Caffe::solver_count(), num_replicas)
+    << "Create the solver with Caffe::set_solver_count(num_replicas).";
+  boost::barrier barrier(static_cast<int>(num_replicas));
+  vector<HostAllreduce<Dtype>*> replicas(num_replicas);
+  // Split the CPU threads among the replicas, each on cores of its own.
+  const int_tp threads = std::max(Caffe::cpu_threads() / num_replicas,
+                                  int_tp(1));
+  const int_tp num_cpus = std::max(boost::thread::hardware_concurrency(), 1u);
+  vector<shared_ptr<ThreadPool> > pools(num_replicas);
+  vector<int_tp> first_cpus(num_replicas, -1);
+  for (int_tp i = 0; i < num_replicas; ++i) {
+    vector<int_tp> cpus;
+    if (pin_threads) {
+      for (int_tp t = 0; t < threads; ++t) {
+        cpus.push_back((i * threads + t) % num_cpus);
+      }
+      first_cpus[i] = cpus[0];
+    }
+    pools[i].reset(new ThreadPool(threads, cpus));
+  }
+  // Create workers
+  vector<shared_ptr<HostWorker<Dtype> > > workers(num_replicas);
+  for (int_tp i = 1; i < num_replicas; ++i) {
+    Caffe::set_solver_rank(i);
+    HostWorker<Dtype>* w = new HostWorker<Dtype>(solver_, pools[i].get(),
+                                                 first_cpus[i], &barrier,
+                                                 &replicas, restore);
+    w->StartInternalThread(Caffe::GetDefaultDevice());
+    workers[i].reset(w);
+  }
+  Caffe::set_solver_rank(0);
+  if (pin_threads) {
+    ThreadPool::PinCallingThread(first_cpus[0]);
+  }
+  Caffe::set_thread_pool(pools[0].get());
+  set_replicas(&replicas, &barrier);
+  solver_->add_callback(this);
+  replicas[0] = this;
+  LOG(INFO) << "Training " << num_replicas << " replicas on " << threads
+            << " CPU threads each";
+  // The replicas run BLAS at once.
+  SerialBlasScope serial_blas;
+  // Run first solver on current thread
+  Broadcast();
+  solver_->Solve();
+  barrier.wait();
+  Caffe::set_thread_pool(NULL);
+  // Wait for shutdown
+  for (int_tp i = 1; i < num_replicas; ++i) {
+    workers[i]->StopInternalThread();
+  }
+}
+
+#ifndef _MSC_VER
+
+// Elements of the largest bucket of gradients reduced at once around the
+// ring, and of the chunks the weights are broadcast in.
+const uint_tp kProcessReduceBucket = 1 << 20;
+// Attempts to connect to the next rank, 100ms apart, before giving up.
+const int_tp kConnectAttempts = 600;
+
+static sockaddr_un socket_address(const string& dir, int_tp rank) {
+  ostringstream path;
+  path << dir << "/" << rank;
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));  // NOLINT(caffe/alt_fn)
+  address.sun_family = AF_UNIX;
+  CHECK_LT(path.str().size(), sizeof(address.sun_path))
+    << "Socket path too long: " << path.str();
+  strncpy(address.sun_path, path.str().c_str(), sizeof(address.sun_path) - 1);
+  return address;
+}
+
+// Sends send_bytes from send to send_fd while receiving recv_bytes from
+// recv_fd into recv, so that no rank of the ring blocks the others.
+static void send_recv(int send_fd, const void* send, size_t send_bytes,
+                      int recv_fd, void* recv, size_t recv_bytes) {
+  const char* send_ptr = reinterpret_cast<const char*>(send);
+  char* recv_ptr = reinterpret_cast<char*>(recv);
+  while (send_bytes > 0 || recv_bytes > 0) {
+    pollfd fds[2];
+    int num_fds = 0;
+    int send_index = -1;
+    int recv_index = -1;
+    if (send_bytes > 0) {
+      fds[num_fds].fd = send_fd;
+      fds[num_fds].events = POLLOUT;
+      send_index = num_fds++;
+    }
+    if (recv_bytes > 0) {
+      fds[num_fds].fd = recv_fd;
+      fds[num_fds].events = POLLIN;
+      recv_index = num_fds++;
+    }
+    if (poll(fds, num_fds, -1) < 0) {
+      CHECK_EQ(errno, EINTR) << "poll: " << strerror(errno);
+      continue;
+    }
+    if (send_index >= 0 && fds[send_index].revents) {
+#ifdef MSG_NOSIGNAL
+      const int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+      const int flags = MSG_DONTWAIT;
+#endif
+      const ssize_t n = ::send(send_fd, send_ptr, send_bytes, flags);
+      if (n < 0) {
+        CHECK(errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+          << "Sending to the next rank failed: " << strerror(errno);
+      } else {
+        send_ptr += n;
+        send_bytes -= n;
+      }
+    }
+    if (recv_index >= 0 && fds[recv_index].revents) {
+      const ssize_t n = ::recv(recv_fd, recv_ptr, recv_bytes, MSG_DONTWAIT);
+      if (n < 0) {
+        CHECK(errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+          << "Receiving from the previous rank failed: " << strerror(errno);
+      } else {
+        CHECK_GT(n, 0) << "The previous rank closed its connection.";
+        recv_ptr += n;
+        recv_bytes -= n;
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+ProcessAllreduce<Dtype>::ProcessAllreduce(shared_ptr<Solver<Dtype> > solver,
+                                          const string& dir)
+  : CPUParams<Dtype>(solver),
+    solver_(solver), rank_(Caffe::solver_rank()),
+    count_(Caffe::solver_count()), send_fd_(-1), recv_fd_(-1),
+    chunk_(std::min(size_, kProcessReduceBucket) / count_ + 1),
+    backward_passes_(0), previous_layer_(solver->net()->layers().size()),
+    ready_begin_(size_), queued_begin_(size_),
+    buckets_(), pending_(0), stop_(false), thread_() {
+  this->Configure(solver.get());
+  Caffe::set_multiprocess(true);
+  // Listen for the previous rank, then connect to the next one, which may
+  // not listen yet.
+  const sockaddr_un own = socket_address(dir, rank_);
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_GE(listen_fd, 0) << "socket: " << strerror(errno);
+  CHECK_EQ(bind(listen_fd, reinterpret_cast<const sockaddr*>(&own),
+                sizeof(own)), 0)
+    << "Cannot bind " << own.sun_path << ": " << strerror(errno);
+  CHECK_EQ(listen(listen_fd, 1), 0) << "listen: " << strerror(errno);
+  const sockaddr_un next = socket_address(dir, (rank_ + 1) % count_);
+  for (int_tp attempt = 0; ; ++attempt) {
+    send_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK_GE(send_fd_, 0) << "socket: " << strerror(errno);
+    if (connect(send_fd_, reinterpret_cast<const sockaddr*>(&next),
+                sizeof(next)) == 0) {
+      break;
+    }
+    CHECK(errno == ENOENT || errno == ECONNREFUSED)
+      << "Cannot connect to " << next.sun_path << ": " << strerror(errno);
+    CHECK_LT(attempt, kConnectAttempts)
+      << "Rank " << (rank_ + 1) % count_ << " did not start.";
+    close(send_fd_);
+    usleep(100000);
+  }
+  recv_fd_ = accept(listen_fd, NULL, NULL);
+  CHECK_GE(recv_fd_, 0) << "accept: " << strerror(errno);
+  close(listen_fd);
+  unlink(own.sun_path);
+  // Reduce the gradients of each layer once its backward is done, unless a
+  // layer adds to the gradients of the weights it shares with an earlier one.
+  if (solver_->param().layer_wise_reduce()) {
+    if (solver_->net()->params().size() ==
+        solver_->net()->learnable_params().size()) {
+      thread_.reset(new boost::thread(
+          &ProcessAllreduce<Dtype>::CommunicationEntry, this));
+    } else {
+      LOG(INFO) << "Layer-wise reduce is not supported for nets with shared "
+                << "weights, reducing after the backward.";
+    }
+  }
+}
+
+template<typename Dtype>
+ProcessAllreduce<Dtype>::~ProcessAllreduce() {
+  if (thread_) {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    thread_->join();
+  }
+  close(send_fd_);
+  close(recv_fd_);
+}
+
+template<typename Dtype>
+string ProcessAllreduce<Dtype>::new_dir() {
+  char dir[] = "/tmp/caffe_procs_XXXXXX";
+  CHECK(mkdtemp(dir)) << "Cannot create the socket directory: "
+                      << strerror(errno);
+  return dir;
+}
+
+template<typename Dtype>
+void ProcessAllreduce<Dtype>::Broadcast() {
+  // Each rank forwards a chunk to the next while receiving the following.
+  for (uint_tp begin = 0; begin < size_; begin += kProcessReduceBucket) {
+    const uint_tp n = std::min(kProcessReduceBucket, size_ - begin);
+    if (rank_ != 0) {
+      send_recv(send_fd_, NULL, 0, recv_fd_, data_ + begin, n * sizeof(Dtype));
+    }
+    if (rank_ + 1 < count_) {
+      send_recv(send_fd_, data_ + begin, n * sizeof(Dtype), recv_fd_, NULL, 0);
+    }
+  }
+}
+
+template<typename Dtype>
+void ProcessAllreduce<Dtype>::Run() {
+  solver_->add_callback(this);
+  if (thread_) {
+    solver_->net()->add_after_backward(this);
+  }
+  Broadcast();
+  solver_->Solve();
+}
+
+template<typename Dtype>
+void ProcessAllreduce<Dtype>::on_start() {
+  backward_passes_ = 0;
+  previous_layer_ = solver_->net()->layers().size();
+  ready_begin_ = size_;
+  queued_begin_ = size_;
+}
+
+template<typename Dtype>
+void ProcessAllreduce<Dtype>::run(int layer) {
+  // The layers run their backward in reverse order, so those done own the
+  // gradients from the first parameter of the last layer done on. Only the
+  // last backward of an iteration, with iter_size, completes them.
+  CHECK_LT(layer, previous_layer_)
+    << "The layer-wise reduce needs the backward of the layers one at a time, "
+    << "in reverse order.";
+  previous_layer_ = layer;
+  if (backward_passes_ == solver_->param().iter_size() - 1) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        solver_->net()->layers()[layer]->blobs();
+    if (blobs.size() > 0) {
+      ready_begin_ = std::min(ready_begin_,
+          static_cast<uint_tp>(blobs[0]->cpu_diff() - diff_));
+      if (queued_begin_ - ready_begin_ >= kProcessReduceBucket) {
+        Queue(ready_begin_, queued_begin_);
+        queued_begin_ = ready_begin_;
+      }
+    }
+  }
+  if (layer == 0) {
+    ++backward_passes_;
+    previous_layer_ = solver_->net()->layers().size();
+  }
+}
+
+template<typename Dtype>
+void ProcessAllreduce<Dtype>::on_gradients_ready() {
+  if (thread_) {
+    if (queued_begin_ > 0) {
+      Queue(0, queued_begin_);
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    while (pending_ > 0) {
+      cond_.wait(lock);
+    }
+  } else {
+    Allreduce(0, size_);
+  }
+}
+
+template<typename Dtype>
+void ProcessAllreduce<Dtype>::Queue(uint_tp begin, uint_tp end) {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    buckets_.push_back(std::make_pair(begin, end));
+    ++pending_;
+  }
+  cond_.notify_all();
+}
+
+template<typename Dtype>
+void ProcessAllreduce<Dtype>::CommunicationEntry() {
+  while (true) {
+    std::pair<uint_tp, uint_tp> bucket;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (buckets_.empty() && !stop_) {
+        cond_.wait(lock);
+      }
+      if (buckets_.empty()) {
+        return;
+      }
+      bucket = buckets_.front();
+      buckets_.pop_front();
+    }
+    Allreduce(bucket.first, bucket.second);
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      --pending_;
+    }
+    cond_.notify_all();
+  }
+}
+
+template<typename Dtype>
+void ProcessAllreduce<Dtype>::Allreduce(uint_tp begin, uint_tp end) {
+  const Dtype scale = Dtype(1) / count_;
+  for (; begin < end; begin += kProcessReduceBucket) {
+    const uint_tp n = std::min(kProcessReduceBucket, end - begin);
+    Dtype* bucket = diff_ + begin;
+    // Chunk c of the bucket starts at chunk_begin[c].
+    vector<uint_tp> chunk_begin(count_ + 1);
+    for (int_tp c = 0; c <= count_; ++c) {
+      chunk_begin[c] = n * c / count_;
+    }
+    // Sum each chunk around the ring, rank r summing chunk r + 1 last.
+    for (int_tp step = 0; step < count_ - 1; ++step) {
+      const int_tp send = (rank_ - step + count_) % count_;
+      const int_tp recv = (rank_ - step - 1 + count_) % count_;
+      const uint_tp recv_count = chunk_begin[recv + 1] - chunk_begin[recv];
+      send_recv(send_fd_, bucket + chunk_begin[send],
+                (chunk_begin[send + 1] - chunk_begin[send]) * sizeof(Dtype),
+                recv_fd_, &chunk_[0], recv_count * sizeof(Dtype));
+      caffe_axpy(recv_count, Dtype(1), &chunk_[0], bucket + chunk_begin[recv]);
+    }
+    const int_tp own = (rank_ + 1) % count_;
+    caffe_scal(chunk_begin[own + 1] - chunk_begin[own], scale,
+               bucket + chunk_begin[own]);
+    // Pass the averaged chunks around the ring.
+    for (int_tp step = 0; step < count_ - 1; ++step) {
+      const int_tp send = (rank_ + 1 - step + count_) % count_;
+      const int_tp recv = (rank_ - step + count_) % count_;
+      send_recv(send_fd_, bucket + chunk_begin[send],
+                (chunk_begin[send + 1] - chunk_begin[send]) * sizeof(Dtype),
+                recv_fd_, bucket + chunk_begin[recv],
+                (chunk_begin[recv + 1] - chunk_begin[recv]) * sizeof(Dtype));
+    }
+  }
+}
+
+#endif  // !_MSC_VER
+
+#ifdef USE_CUDA
+#ifdef USE_NCCL
+
 template<typename Dtype>
 GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
   : Params<Dtype>(root_solver) {
@@ -366,12 +876,20 @@ void NCCL<Dtype>::Run(const vector<int>& gpus, const char* restore) {
   }
 }
 
-INSTANTIATE_CLASS(Params);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(Worker);
 INSTANTIATE_CLASS(NCCL);
 
-}  // namespace caffe
-
 #endif  // USE_NCCL
 #endif  // USE_CUDA
+
+INSTANTIATE_CLASS(Params);
+INSTANTIATE_CLASS(CPUParams);
+INSTANTIATE_CLASS(HostWorker);
+INSTANTIATE_CLASS(HostAllreduce);
+#ifndef _MSC_VER
+INSTANTIATE_CLASS(ProcessAllreduce);
+#endif  // !_MSC_VER
+
+}  // namespace caffe
+
@@ -1,3 +1,5 @@
+#include <atomic>
+
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 
@@ -6,7 +8,18 @@
 
 namespace caffe {
 
+// The last version given to any SyncedMemory.
+static std::atomic<uint64_t> last_version_(0);
+
+uint64_t SyncedMemory::NextVersion() {
+  return last_version_.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
 SyncedMemory::~SyncedMemory() {
+  clear_data();
+}
+
+void SyncedMemory::clear_data() {
 #ifndef CPU_ONLY
   // Free device memory
   if (gpu_ptr_.get() && own_gpu_data_) {
@@ -22,8 +35,14 @@ SyncedMemory::~SyncedMemory() {
   // Free host memory
   if (cpu_ptr_ && own_cpu_data_ && !own_zero_copy_data_) {
     device_->FreeMemHost(cpu_ptr_);
-    cpu_ptr_ = nullptr;
   }
+  cpu_ptr_ = nullptr;
+  gpu_ptr_ = vptr<void>();
+  head_ = UNINITIALIZED;
+  own_cpu_data_ = false;
+  own_gpu_data_ = false;
+  own_zero_copy_data_ = false;
+  version_ = NextVersion();
 }
 
 inline void SyncedMemory::to_cpu() {
@@ -122,6 +141,7 @@ const void* SyncedMemory::cpu_data() {
 
 void SyncedMemory::set_cpu_data(void* data) {
   CHECK(data);
+  version_ = NextVersion();
   if (cpu_ptr_ && own_cpu_data_) {
     device_->FreeMemHost(cpu_ptr_);
   }
@@ -147,6 +167,7 @@ vptr<const void> SyncedMemory::gpu_data() {
 
 void SyncedMemory::set_gpu_data(vptr<void> data) {
 #ifndef CPU_ONLY
+  version_ = NextVersion();
   if (own_gpu_data_) {
     if (own_zero_copy_data_) {
       device_->FreeMemHost(cpu_ptr_);
@@ -168,6 +189,7 @@ void SyncedMemory::set_gpu_data(vptr<void> data) {
 }
 
 void* SyncedMemory::mutable_cpu_data() {
+  version_ = NextVersion();
   to_cpu();
   head_ = HEAD_AT_CPU;
   return cpu_ptr_;
@@ -175,6 +197,7 @@ void* SyncedMemory::mutable_cpu_data() {
 
 vptr<void> SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
+  version_ = NextVersion();
   to_gpu();
   head_ = HEAD_AT_GPU;
   return gpu_ptr_;
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/layers/quantizer_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/binarization.hpp"
+#include "caffe/util/insert_conversions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class BinarizationTest : public CPUDeviceTest<Dtype> {
+ protected:
+  BinarizationTest()
+      : blob_bottom_(new Blob<Dtype>(2, 70, 7, 6)),
+        blob_bottom_signs_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_ref_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    filler_param.set_min(-1);
+    filler_param.set_max(1);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_signs_->ReshapeLike(*blob_bottom_);
+    for (int_tp i = 0; i < blob_bottom_->count(); ++i) {
+      blob_bottom_signs_->mutable_cpu_data()[i] =
+          blob_bottom_->cpu_data()[i] >= 0 ? 1 : -1;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_bottom_signs_vec_.push_back(blob_bottom_signs_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_ref_vec_.push_back(blob_top_ref_);
+  }
+  virtual ~BinarizationTest() {
+    delete blob_bottom_;
+    delete blob_bottom_signs_;
+    delete blob_top_;
+    delete blob_top_ref_;
+  }
+
+  // Runs layer_param in INT64_PACKED_BINARY and checks it against a FLOAT
+  // layer on the signs of the input, with each row of weights replaced by
+  // its mean magnitude times its signs.
+  template <typename LayerType>
+  void CheckBinaryForward(LayerParameter layer_param) {
+    layer_param.set_phase(TEST);
+    LayerType float_layer(layer_param);
+    float_layer.SetUp(this->blob_bottom_signs_vec_, this->blob_top_ref_vec_);
+    layer_param.set_compute_data_type(INT64_PACKED_BINARY);
+    LayerType binary_layer(layer_param);
+    binary_layer.blobs() = float_layer.blobs();
+    binary_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    binary_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    CheckAgainstBinarizedWeights(&float_layer);
+  }
+
+  // Changes the weights shared by a FLOAT and an INT64_PACKED_BINARY layer
+  // after a forward, in place as a solver step or CopyTrainedLayersFrom does
+  // and by replacing them as ShareTrainedLayersWith does, and checks that
+  // the binary layer follows.
+  template <typename LayerType>
+  void CheckWeightChanges(LayerParameter layer_param) {
+    layer_param.set_phase(TEST);
+    LayerType float_layer(layer_param);
+    float_layer.SetUp(this->blob_bottom_signs_vec_, this->blob_top_ref_vec_);
+    layer_param.set_compute_data_type(INT64_PACKED_BINARY);
+    LayerType binary_layer(layer_param);
+    binary_layer.blobs() = float_layer.blobs();
+    binary_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    binary_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype>* weights = float_layer.blobs()[0].get();
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(weights);
+    binary_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    CheckAgainstBinarizedWeights(&float_layer);
+    Blob<Dtype> trained_weights(weights->shape());
+    filler.Fill(&trained_weights);
+    weights->ShareData(trained_weights);
+    binary_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    CheckAgainstBinarizedWeights(&float_layer);
+  }
+
+  // Replaces each row of the weights of float_layer by its mean magnitude
+  // times its signs, runs it on the signs of the input and checks the top
+  // of the binary layer against it. Binarizing the result again gives the
+  // same signs and scales.
+  template <typename LayerType>
+  void CheckAgainstBinarizedWeights(LayerType* float_layer) {
+    Blob<Dtype>* weights = float_layer->blobs()[0].get();
+    const int_tp rows = weights->shape(0);
+    const int_tp cols = weights->count(1);
+    Dtype* w = weights->mutable_cpu_data();
+    for (int_tp r = 0; r < rows; ++r) {
+      Dtype abs_sum = 0;
+      for (int_tp j = 0; j < cols; ++j) {
+        abs_sum += std::fabs(w[r * cols + j]);
+      }
+      for (int_tp j = 0; j < cols; ++j) {
+        w[r * cols + j] = (w[r * cols + j] >= 0 ? 1 : -1) * abs_sum / cols;
+      }
+    }
+    float_layer->Forward(this->blob_bottom_signs_vec_,
+                         this->blob_top_ref_vec_);
+    ASSERT_EQ(this->blob_top_->shape(), this->blob_top_ref_->shape());
+    for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+                  this->blob_top_ref_->cpu_data()[i], 1e-3);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_bottom_signs_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_ref_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_bottom_signs_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_top_ref_vec_;
+};
+
+// Layers are only instantiated for float and double.
+typedef ::testing::Types<float, double> BinarizationDtypes;
+TYPED_TEST_CASE(BinarizationTest, BinarizationDtypes);
+
+TYPED_TEST(BinarizationTest, TestGemmXorPopcount) {
+  const int_tp m = 5, n = 11, k = 13;
+  vector<uint64_t> a(m * k);
+  vector<uint64_t> b(n * k);
+  vector<int32_t> c(m * n);
+  for (int_tp i = 0; i < m * k; ++i) {
+    a[i] = (i + 1) * 0x9e3779b97f4a7c15ULL;
+  }
+  for (int_tp i = 0; i < n * k; ++i) {
+    b[i] = (i + 7) * 0xc2b2ae3d27d4eb4fULL;
+  }
+  caffe_cpu_gemm_xor_popcount(m, n, k, &a[0], &b[0], &c[0]);
+  for (int_tp i = 0; i < m; ++i) {
+    for (int_tp j = 0; j < n; ++j) {
+      int32_t expected = 0;
+      for (int_tp p = 0; p < k; ++p) {
+        for (uint64_t x = a[i * k + p] ^ b[j * k + p]; x; x &= x - 1) {
+          ++expected;
+        }
+      }
+      EXPECT_EQ(expected, c[i * n + j]);
+    }
+  }
+}
+
+TYPED_TEST(BinarizationTest, TestQuantizerRoundTrip) {
+  typedef TypeParam Dtype;
+  LayerParameter pack_param;
+  pack_param.set_top_data_type(INT64_PACKED_BINARY);
+  QuantizerLayer<Dtype, Dtype, Dtype> pack_layer(pack_param);
+  pack_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  pack_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  LayerParameter unpack_param;
+  unpack_param.set_bottom_data_type(INT64_PACKED_BINARY);
+  QuantizerLayer<Dtype, Dtype, Dtype> unpack_layer(unpack_param);
+  unpack_layer.SetUp(this->blob_top_vec_, this->blob_top_ref_vec_);
+  unpack_layer.Forward(this->blob_top_vec_, this->blob_top_ref_vec_);
+  for (int_tp i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_signs_->cpu_data()[i],
+              this->blob_top_ref_->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(BinarizationTest, TestBlobProtoRoundTrip) {
+  typedef TypeParam Dtype;
+  BlobProto proto;
+  BinaryBlobToProto(*this->blob_bottom_, &proto);
+  EXPECT_EQ(INT64_PACKED_BINARY, proto.data_type());
+  const int_tp outer = this->blob_bottom_->shape(0);
+  const int_tp inner = this->blob_bottom_->count(1);
+  EXPECT_EQ(outer * BinaryWords(inner) * 8, proto.packed_data().size());
+  ASSERT_EQ(outer, proto.quantization().scale_size());
+  Blob<Dtype> decoded;
+  decoded.FromProto(proto);
+  ASSERT_EQ(this->blob_bottom_->shape(), decoded.shape());
+  for (int_tp i = 0; i < decoded.count(); ++i) {
+    EXPECT_NEAR(this->blob_bottom_signs_->cpu_data()[i] *
+                proto.quantization().scale(i / inner),
+                decoded.cpu_data()[i], 1e-6);
+  }
+}
+
+TYPED_TEST(BinarizationTest, TestInnerProductForward) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  this->template CheckBinaryForward<InnerProductLayer<Dtype, Dtype, Dtype> >(
+      layer_param);
+}
+
+TYPED_TEST(BinarizationTest, TestConvolutionForward) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("uniform");
+  this->template CheckBinaryForward<ConvolutionLayer<Dtype, Dtype, Dtype> >(
+      layer_param);
+}
+
+TYPED_TEST(BinarizationTest, TestWeightsChangedBetweenForwards) {
+  typedef TypeParam Dtype;
+  LayerParameter inner_product_param;
+  inner_product_param.mutable_inner_product_param()->set_num_output(10);
+  inner_product_param.mutable_inner_product_param()->mutable_weight_filler()
+      ->set_type("gaussian");
+  this->template CheckWeightChanges<InnerProductLayer<Dtype, Dtype, Dtype> >(
+      inner_product_param);
+  LayerParameter convolution_param;
+  convolution_param.mutable_convolution_param()->add_kernel_size(3);
+  convolution_param.mutable_convolution_param()->add_pad(1);
+  convolution_param.mutable_convolution_param()->set_num_output(6);
+  convolution_param.mutable_convolution_param()->mutable_weight_filler()
+      ->set_type("gaussian");
+  this->template CheckWeightChanges<ConvolutionLayer<Dtype, Dtype, Dtype> >(
+      convolution_param);
+}
+
+TYPED_TEST(BinarizationTest, TestConvolutionPackedInput) {
+  typedef TypeParam Dtype;
+  // Pack the input ahead of the convolution, as an inserted Quantizer does.
+  LayerParameter pack_param;
+  pack_param.set_top_data_type(INT64_PACKED_BINARY);
+  QuantizerLayer<Dtype, Dtype, Dtype> pack_layer(pack_param);
+  Blob<Dtype> packed;
+  vector<Blob<Dtype>*> packed_vec(1, &packed);
+  pack_layer.SetUp(this->blob_bottom_vec_, packed_vec);
+  pack_layer.Forward(this->blob_bottom_vec_, packed_vec);
+
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  layer_param.set_compute_data_type(INT64_PACKED_BINARY);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  layer_param.set_bottom_data_type(INT64_PACKED_BINARY);
+  ConvolutionLayer<Dtype, Dtype, Dtype> packed_layer(layer_param);
+  packed_layer.blobs() = layer.blobs();
+  packed_layer.SetUp(packed_vec, this->blob_top_vec_);
+  packed_layer.Forward(packed_vec, this->blob_top_vec_);
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_EQ(this->blob_top_ref_->cpu_data()[i],
+              this->blob_top_->cpu_data()[i]);
+  }
+}
+
+TEST(BinaryInsertionTest, TestInsertion) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  bottom_data_type: INT64_PACKED_BINARY "
+      "  compute_data_type: INT64_PACKED_BINARY "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'data_conv_0_convert' "
+      "  type: 'Quantizer' "
+      "  bottom: 'data' "
+      "  top: 'data_conv_0_converted' "
+      "  bottom_data_type: FLOAT "
+      "  compute_data_type: FLOAT "
+      "  top_data_type: INT64_PACKED_BINARY "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data_conv_0_converted' "
+      "  top: 'conv' "
+      "  bottom_data_type: INT64_PACKED_BINARY "
+      "  compute_data_type: INT64_PACKED_BINARY "
+      "} ";
+  NetParameter input_param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      input_proto, &input_param));
+  NetParameter expected_output_param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      expected_output_proto, &expected_output_param));
+  NetParameter actual_output_param;
+  InsertConversions(input_param, &actual_output_param);
+  EXPECT_EQ(expected_output_param.DebugString(),
+      actual_output_param.DebugString());
+}
+
+}  // namespace caffe
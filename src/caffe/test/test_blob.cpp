@@ -61,6 +61,35 @@ TYPED_TEST(BlobSimpleTest, TestReshapeZero) {
   EXPECT_EQ(this->blob_->count(), 0);
 }
 
+TYPED_TEST(BlobSimpleTest, TestDataVersions) {
+  vector<shared_ptr<Blob<TypeParam> > > blobs;
+  blobs.push_back(shared_ptr<Blob<TypeParam> >(
+      new Blob<TypeParam>(2, 3, 4, 5)));
+  BlobDataVersions versions;
+  EXPECT_TRUE(versions.Changed(blobs));
+  versions.Update(blobs);
+  EXPECT_FALSE(versions.Changed(blobs));
+  // Reading the data does not change it, a mutable access may.
+  blobs[0]->cpu_data();
+  EXPECT_FALSE(versions.Changed(blobs));
+  blobs[0]->mutable_cpu_data();
+  EXPECT_TRUE(versions.Changed(blobs));
+  versions.Update(blobs);
+  // So does sharing the data of another blob, or adding a blob.
+  Blob<TypeParam> other(2, 3, 4, 5);
+  other.cpu_data();
+  blobs[0]->ShareData(other);
+  EXPECT_TRUE(versions.Changed(blobs));
+  versions.Update(blobs);
+  blobs.push_back(shared_ptr<Blob<TypeParam> >(
+      new Blob<TypeParam>(1, 1, 1, 5)));
+  EXPECT_TRUE(versions.Changed(blobs));
+  versions.Update(blobs);
+  EXPECT_FALSE(versions.Changed(blobs));
+  versions.Clear();
+  EXPECT_TRUE(versions.Changed(blobs));
+}
+
 TYPED_TEST(BlobSimpleTest, TestLegacyBlobProtoShapeEquals) {
   BlobProto blob_proto;
 
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +7,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/pooling_layer.hpp"
 
 #ifdef USE_CUDNN
 #include "caffe/layers/cudnn_conv_layer.hpp"
@@ -509,6 +511,193 @@ TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionGroup) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestDepthwiseConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_h(3);
+  convolution_param->set_kernel_w(2);
+  convolution_param->set_pad_h(2);
+  convolution_param->set_pad_w(1);
+  convolution_param->add_dilation(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  const Dtype delta = std::is_same<Dtype, half_float::half>::value ?
+                5e-2 : 1e-4;
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], delta);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestBatchedIm2colConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_col_buffer_budget(1 << 20);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  const Dtype delta = std::is_same<Dtype, half_float::half>::value ?
+                5e-2 : 1e-4;
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], delta);
+  }
+  caffe_conv(this->blob_bottom_2_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_2_));
+  top_data = this->blob_top_2_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], delta);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestFusedReLUConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_pad(1);
+    convolution_param->set_num_output(4);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    ConvolutionLayer<Dtype> unfused_layer(layer_param);
+    unfused_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    unfused_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> unfused_top;
+    unfused_top.CopyFrom(*this->blob_top_, false, true);
+    convolution_param->set_fuse_type(
+        ConvolutionParameter_FuseType_FUSED_CONV_RELU);
+    convolution_param->mutable_relu_param()->set_negative_slope(0.1);
+    ConvolutionLayer<Dtype> layer(layer_param);
+    layer.blobs() = unfused_layer.blobs();
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(this->blob_top_->shape(), unfused_top.shape());
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* unfused_data = unfused_top.cpu_data();
+    for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+      const Dtype expected = unfused_data[i] > 0 ? unfused_data[i] :
+          Dtype(0.1) * unfused_data[i];
+      EXPECT_NEAR(top_data[i], expected, 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestFusedEltwiseReLUConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_pad(1);
+    convolution_param->set_num_output(4);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    ConvolutionLayer<Dtype> unfused_layer(layer_param);
+    unfused_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    unfused_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> unfused_top;
+    unfused_top.CopyFrom(*this->blob_top_, false, true);
+    // The residual is the second bottom, shaped like the output.
+    Blob<Dtype> residual(unfused_top.shape());
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&residual);
+    this->blob_bottom_vec_.push_back(&residual);
+    convolution_param->set_fuse_type(
+        ConvolutionParameter_FuseType_FUSED_CONV_ELTWISE_RELU);
+    ConvolutionLayer<Dtype> layer(layer_param);
+    layer.blobs() = unfused_layer.blobs();
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(this->blob_top_->shape(), unfused_top.shape());
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* unfused_data = unfused_top.cpu_data();
+    const Dtype* residual_data = residual.cpu_data();
+    for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i],
+                  std::max(unfused_data[i] + residual_data[i], Dtype(0)),
+                  1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestFusedMaxPoolReLUConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_pad(1);
+    convolution_param->set_num_output(4);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    PoolingParameter* pooling_param =
+        convolution_param->mutable_pooling_param();
+    pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+    pooling_param->add_kernel_size(3);
+    pooling_param->add_stride(2);
+    // Reference: convolution, then max pooling, then ReLU.
+    ConvolutionLayer<Dtype> unfused_layer(layer_param);
+    Blob<Dtype> unfused_top, pooled_top;
+    vector<Blob<Dtype>*> unfused_top_vec(1, &unfused_top);
+    vector<Blob<Dtype>*> pooled_top_vec(1, &pooled_top);
+    unfused_layer.SetUp(this->blob_bottom_vec_, unfused_top_vec);
+    unfused_layer.Forward(this->blob_bottom_vec_, unfused_top_vec);
+    LayerParameter pool_param;
+    pool_param.mutable_pooling_param()->CopyFrom(*pooling_param);
+    PoolingLayer<Dtype> pool_layer(pool_param);
+    pool_layer.SetUp(unfused_top_vec, pooled_top_vec);
+    pool_layer.Forward(unfused_top_vec, pooled_top_vec);
+    convolution_param->set_fuse_type(
+        ConvolutionParameter_FuseType_FUSED_CONV_MAX_POOLING_RELU);
+    ConvolutionLayer<Dtype> layer(layer_param);
+    layer.blobs() = unfused_layer.blobs();
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(this->blob_top_->shape(), pooled_top.shape());
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* pooled_data = pooled_top.cpu_data();
+    for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], std::max(pooled_data[i], Dtype(0)), 1e-4);
+    }
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestSobelConvolution) {
   // Test separable convolution by computing the Sobel operator
   // as a single filter then comparing the result
@@ -827,6 +1016,46 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestGradientBatchedIm2col) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->set_col_buffer_budget(1 << 20);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradientDepthwise) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_h(3);
+  convolution_param->set_kernel_w(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_stride_h(1);
+  convolution_param->set_stride_w(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
@@ -0,0 +1,263 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_direct_layer.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/layout.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class ConvolutionLayerDirectTest : public CPUDeviceTest<Dtype> {
+ protected:
+  ConvolutionLayerDirectTest()
+      : blob_bottom_(new Blob<Dtype>(2, 16, 7, 9)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_ref_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    filler_param.set_value(1.);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_ref_vec_.push_back(blob_top_ref_);
+  }
+
+  virtual ~ConvolutionLayerDirectTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_ref_;
+  }
+
+  // Checks the forward pass and all gradients of the DIRECT engine against
+  // a CAFFE engine ConvolutionLayer with the same weights, reordering the
+  // blobs of the DIRECT layer into and out of its bottom_layout and
+  // top_layout.
+  void CheckAgainstCaffe(const LayerParameter& layer_param) {
+    const Layout bottom_layout = layer_param.bottom_layout();
+    const Layout top_layout = layer_param.top_layout();
+    const int_tp num = this->blob_bottom_->shape(0);
+    const int_tp channels = this->blob_bottom_->shape(1);
+    const int_tp inner = this->blob_bottom_->count(2);
+    const vector<int_tp> bottom_shape(this->blob_bottom_->shape().begin(),
+                                      this->blob_bottom_->shape().end());
+    Blob<Dtype> bottom;
+    bottom.Reshape(LayoutShape(bottom_shape, bottom_layout));
+    if (bottom_layout == NCHW) {
+      bottom.CopyFrom(*this->blob_bottom_);
+    } else {
+      caffe_cpu_to_blocked(num, channels, inner, LayoutBlock(bottom_layout),
+          this->blob_bottom_->cpu_data(), bottom.mutable_cpu_data());
+    }
+    vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+
+    ConvolutionLayerDirect<Dtype, Dtype, Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, this->blob_top_vec_);
+    ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(layer_param);
+    ref_layer.SetUp(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+    for (int_tp i = 0; i < layer.blobs().size(); ++i) {
+      ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    const int_tp out_channels = this->blob_top_ref_->shape(1);
+    const int_tp out_inner = this->blob_top_ref_->count(2);
+    const int_tp top_block = LayoutBlock(top_layout);
+    layer.Forward(bottom_vec, this->blob_top_vec_);
+    ref_layer.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+    ASSERT_EQ(this->blob_top_->count(), this->blob_top_ref_->count());
+    vector<Dtype> top(this->blob_top_->count());
+    caffe_cpu_from_blocked(num, out_channels, out_inner, top_block,
+                           this->blob_top_->cpu_data(), &top[0]);
+    for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top[i], this->blob_top_ref_->cpu_data()[i], 1e-4);
+    }
+
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_top_ref_);
+    caffe_copy(this->blob_top_ref_->count(), this->blob_top_ref_->cpu_data(),
+               this->blob_top_ref_->mutable_cpu_diff());
+    caffe_cpu_to_blocked(num, out_channels, out_inner, top_block,
+        this->blob_top_ref_->cpu_diff(), this->blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    for (int_tp i = 0; i < layer.blobs().size(); ++i) {
+      caffe_set(layer.blobs()[i]->count(), Dtype(0),
+                layer.blobs()[i]->mutable_cpu_diff());
+      caffe_set(ref_layer.blobs()[i]->count(), Dtype(0),
+                ref_layer.blobs()[i]->mutable_cpu_diff());
+    }
+    layer.Backward(this->blob_top_vec_, propagate_down, bottom_vec);
+    ref_layer.Backward(this->blob_top_ref_vec_, propagate_down,
+                       this->blob_bottom_vec_);
+    vector<Dtype> bottom_diff(bottom.count());
+    caffe_cpu_from_blocked(num, channels, inner, LayoutBlock(bottom_layout),
+                           bottom.cpu_diff(), &bottom_diff[0]);
+    for (int_tp i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(bottom_diff[i], this->blob_bottom_->cpu_diff()[i], 1e-3);
+    }
+    for (int_tp i = 0; i < layer.blobs().size(); ++i) {
+      for (int_tp j = 0; j < layer.blobs()[i]->count(); ++j) {
+        EXPECT_NEAR(layer.blobs()[i]->cpu_diff()[j],
+                    ref_layer.blobs()[i]->cpu_diff()[j], 1e-3);
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_ref_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_top_ref_vec_;
+};
+
+// Layers are only instantiated for float and double.
+typedef ::testing::Types<float, double> DirectDtypes;
+TYPED_TEST_CASE(ConvolutionLayerDirectTest, DirectDtypes);
+
+TYPED_TEST(ConvolutionLayerDirectTest, TestSetupBlocked) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_top_layout(NativeBlockedLayout());
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(16);
+  ConvolutionLayerDirect<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int_tp block = LayoutBlock(NativeBlockedLayout());
+  ASSERT_EQ(this->blob_top_->num_axes(), 5);
+  EXPECT_EQ(this->blob_top_->shape(0), 2);
+  EXPECT_EQ(this->blob_top_->shape(1), 16 / block);
+  EXPECT_EQ(this->blob_top_->shape(2), 7);
+  EXPECT_EQ(this->blob_top_->shape(3), 9);
+  EXPECT_EQ(this->blob_top_->shape(4), block);
+}
+
+TYPED_TEST(ConvolutionLayerDirectTest, TestForwardPlain) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckAgainstCaffe(layer_param);
+}
+
+TYPED_TEST(ConvolutionLayerDirectTest, TestForwardBlocked) {
+  LayerParameter layer_param;
+  layer_param.set_bottom_layout(NCHW8C);
+  layer_param.set_top_layout(NativeBlockedLayout());
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(32);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckAgainstCaffe(layer_param);
+}
+
+TYPED_TEST(ConvolutionLayerDirectTest, TestForwardStrideDilation) {
+  LayerParameter layer_param;
+  layer_param.set_bottom_layout(NativeBlockedLayout());
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_h(3);
+  convolution_param->set_kernel_w(2);
+  convolution_param->set_stride_h(2);
+  convolution_param->set_stride_w(1);
+  convolution_param->set_pad_h(2);
+  convolution_param->set_pad_w(1);
+  convolution_param->add_dilation(2);
+  convolution_param->set_num_output(7);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckAgainstCaffe(layer_param);
+}
+
+TYPED_TEST(ConvolutionLayerDirectTest, TestForward1x1) {
+  LayerParameter layer_param;
+  layer_param.set_bottom_layout(NativeBlockedLayout());
+  layer_param.set_top_layout(NativeBlockedLayout());
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(1);
+  convolution_param->set_num_output(16);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->set_bias_term(false);
+  this->CheckAgainstCaffe(layer_param);
+}
+
+TYPED_TEST(ConvolutionLayerDirectTest, TestForwardGroupFallback) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckAgainstCaffe(layer_param);
+}
+
+TYPED_TEST(ConvolutionLayerDirectTest, TestWeightsChanged) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  ConvolutionLayerDirect<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(layer_param);
+  ref_layer.SetUp(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  // Weights set after a forward pass, as by a solver update.
+  caffe_copy(layer.blobs()[0]->count(), ref_layer.blobs()[0]->cpu_data(),
+             layer.blobs()[0]->mutable_cpu_data());
+  caffe_copy(layer.blobs()[1]->count(), ref_layer.blobs()[1]->cpu_data(),
+             layer.blobs()[1]->mutable_cpu_data());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ref_layer.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+                this->blob_top_ref_->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerDirectTest, TestGradient) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_->Reshape(2, 3, 5, 6);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayerDirect<Dtype, Dtype, Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
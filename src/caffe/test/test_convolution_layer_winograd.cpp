@@ -0,0 +1,201 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/conv_winograd_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class ConvolutionLayerWinogradTest : public CPUDeviceTest<Dtype> {
+ protected:
+  ConvolutionLayerWinogradTest()
+      : blob_bottom_(new Blob<Dtype>(2, 4, 11, 9)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_ref_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    filler_param.set_value(1.);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_ref_vec_.push_back(blob_top_ref_);
+  }
+
+  virtual ~ConvolutionLayerWinogradTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_ref_;
+  }
+
+  // Checks the forward pass and the bottom gradient of the WINOGRAD engine
+  // against a CAFFE engine ConvolutionLayer with the same weights.
+  void CheckAgainstCaffe(const LayerParameter& layer_param) {
+    ConvolutionLayerWinograd<Dtype, Dtype, Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(layer_param);
+    ref_layer.SetUp(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+    for (int_tp i = 0; i < layer.blobs().size(); ++i) {
+      ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ref_layer.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+    ASSERT_EQ(this->blob_top_->shape(), this->blob_top_ref_->shape());
+    for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+                  this->blob_top_ref_->cpu_data()[i], 1e-4);
+    }
+
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_top_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+               this->blob_top_ref_->mutable_cpu_diff());
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+               this->blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    layer.Backward(this->blob_top_vec_, propagate_down,
+                   this->blob_bottom_vec_);
+    vector<Dtype> bottom_diff(this->blob_bottom_->cpu_diff(),
+        this->blob_bottom_->cpu_diff() + this->blob_bottom_->count());
+    ref_layer.Backward(this->blob_top_ref_vec_, propagate_down,
+                       this->blob_bottom_vec_);
+    for (int_tp i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(bottom_diff[i], this->blob_bottom_->cpu_diff()[i], 1e-4);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_ref_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_top_ref_vec_;
+};
+
+// Layers are only instantiated for float and double.
+typedef ::testing::Types<float, double> WinogradDtypes;
+TYPED_TEST_CASE(ConvolutionLayerWinogradTest, WinogradDtypes);
+
+TYPED_TEST(ConvolutionLayerWinogradTest, TestSetup) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  ConvolutionLayerWinograd<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 5);
+  EXPECT_EQ(this->blob_top_->height(), 11);
+  EXPECT_EQ(this->blob_top_->width(), 9);
+}
+
+TYPED_TEST(ConvolutionLayerWinogradTest, TestForward) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->set_num_output(5);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckAgainstCaffe(layer_param);
+}
+
+TYPED_TEST(ConvolutionLayerWinogradTest, TestForwardPad) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->set_pad_h(2);
+  convolution_param->set_pad_w(1);
+  convolution_param->set_num_output(5);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckAgainstCaffe(layer_param);
+}
+
+TYPED_TEST(ConvolutionLayerWinogradTest, TestForwardGroup) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->set_bias_term(false);
+  this->CheckAgainstCaffe(layer_param);
+}
+
+TYPED_TEST(ConvolutionLayerWinogradTest, TestForwardFallback) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckAgainstCaffe(layer_param);
+}
+
+TYPED_TEST(ConvolutionLayerWinogradTest, TestWeightsChanged) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  ConvolutionLayerWinograd<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(layer_param);
+  ref_layer.SetUp(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  // Weights set after the setup, as by loading a trained model.
+  caffe_copy(layer.blobs()[0]->count(), ref_layer.blobs()[0]->cpu_data(),
+             layer.blobs()[0]->mutable_cpu_data());
+  caffe_copy(layer.blobs()[1]->count(), ref_layer.blobs()[1]->cpu_data(),
+             layer.blobs()[1]->mutable_cpu_data());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ref_layer.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+                this->blob_top_ref_->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerWinogradTest, TestGradient) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_->Reshape(2, 4, 5, 6);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_group(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayerWinograd<Dtype, Dtype, Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
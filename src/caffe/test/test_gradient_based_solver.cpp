@@ -1,3 +1,8 @@
+#ifndef _MSC_VER
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
 #include <string>
 #include <utility>
@@ -12,6 +17,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/sgd_solvers.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -26,7 +32,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), processes_(false) {
         input_file_ = new string(
         ABS_TEST_DATA_DIR "/solver_data_list.txt");
       }
@@ -38,12 +44,18 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   shared_ptr<SGDSolver<Dtype> > solver_;
 #ifdef USE_NCCL
   shared_ptr<NCCL<Dtype> > nccl_;
+#endif
+  shared_ptr<HostAllreduce<Dtype> > host_allreduce_;
+#ifndef _MSC_VER
+  shared_ptr<ProcessAllreduce<Dtype> > process_allreduce_;
 #endif
   int seed_;
   // Dimensions are determined by generate_sample_data.py
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  // Whether the replicas on the CPU train in forked processes, not threads.
+  bool processes_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -200,6 +212,52 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+#ifndef _MSC_VER
+    } else if (Caffe::mode() == Caffe::CPU && processes_) {
+      LOG(INFO)<< "Multi-process CPU test on " << devices << " processes";
+      Caffe::set_solver_count(devices);
+      const string dir = ProcessAllreduce<Dtype>::new_dir();
+      vector<pid_t> children;
+      for (int rank = 1; rank < devices; ++rank) {
+        const pid_t pid = fork();
+        CHECK_GE(pid, 0) << "fork: " << strerror(errno);
+        if (pid == 0) {
+          // The threads of the thread pools do not survive the fork.
+          ThreadPool pool(1, vector<int_tp>());
+          Caffe::set_thread_pool(&pool);
+          Caffe::set_solver_rank(rank);
+          Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+          this->InitSolverFromProtoString(proto.str());
+          if (from_snapshot) {
+            this->solver_->Restore(from_snapshot);
+            for (int i = 0; i < this->solver_->iter(); ++i) {
+              this->solver_->net()->Forward();
+            }
+          }
+          ProcessAllreduce<Dtype>(this->solver_, dir).Run();
+          _exit(0);
+        }
+        children.push_back(pid);
+      }
+      this->process_allreduce_.reset(
+          new ProcessAllreduce<Dtype>(this->solver_, dir));
+      this->process_allreduce_->Run();
+      for (int i = 0; i < children.size(); ++i) {
+        int status;
+        CHECK_EQ(children[i], waitpid(children[i], &status, 0));
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            << "Rank " << i + 1 << " failed.";
+      }
+      rmdir(dir.c_str());
+      Caffe::set_solver_count(1);
+      Caffe::set_multiprocess(false);
+#endif  // !_MSC_VER
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO)<< "Multi-replica CPU test on " << devices << " replicas";
+      Caffe::set_solver_count(devices);
+      this->host_allreduce_.reset(new HostAllreduce<Dtype>(this->solver_));
+      this->host_allreduce_->Run(devices, false, from_snapshot);
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO)<< "Multi-GPU test on " << devices << " devices";
       vector<Device*> gpus;
@@ -493,6 +551,10 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
 #endif  // USE_NCCL
 #endif  // USE_CUDA
+    if (Caffe::mode() == Caffe::CPU) {
+      // Replicas of the solver in threads, or processes.
+      available_devices = 3;
+    }
     // Takes a while to test all sizes for each test so sparse
     vector<int> sizes;
     sizes.push_back(1);
@@ -687,6 +749,39 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverything) {
   }
 }
 
+#ifndef _MSC_VER
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingProcesses) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->processes_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingProcessesShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->processes_ = true;
+  this->share_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+#endif  // !_MSC_VER
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -143,6 +143,49 @@ TYPED_TEST(Im2colLayerTest, TestDilatedGradientForceND) {
                                   this->blob_top_vec_);
 }
 
+TYPED_TEST(Im2colLayerTest, TestPaddedMatchesForceND) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Padding as wide as the kernel puts whole output rows of the column
+  // matrix in the padding, for both the unit and the strided copies.
+  for (int_tp stride = 1; stride <= 2; ++stride) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_pad(3);
+    convolution_param->add_stride(stride);
+    Im2colLayer<Dtype> layer(layer_param);
+    convolution_param->set_force_nd_im2col(true);
+    Im2colLayer<Dtype> layer_nd(layer_param);
+    Blob<Dtype> top_nd;
+    vector<Blob<Dtype>*> top_nd_vec(1, &top_nd);
+    Blob<Dtype> bottom_nd(this->blob_bottom_->shape());
+    bottom_nd.CopyFrom(*this->blob_bottom_);
+    vector<Blob<Dtype>*> bottom_nd_vec(1, &bottom_nd);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer_nd.SetUp(bottom_nd_vec, top_nd_vec);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer_nd.Forward(bottom_nd_vec, top_nd_vec);
+    ASSERT_EQ(this->blob_top_->count(), top_nd.count());
+    for (int_tp i = 0; i < top_nd.count(); ++i) {
+      EXPECT_EQ(top_nd.cpu_data()[i], this->blob_top_->cpu_data()[i]);
+    }
+    // col2im of the column matrix sums every input once per kernel offset
+    // that reads it.
+    caffe_copy(top_nd.count(), top_nd.cpu_data(),
+               this->blob_top_->mutable_cpu_diff());
+    caffe_copy(top_nd.count(), top_nd.cpu_data(), top_nd.mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    layer.Backward(this->blob_top_vec_, propagate_down,
+                   this->blob_bottom_vec_);
+    layer_nd.Backward(top_nd_vec, propagate_down, bottom_nd_vec);
+    for (int_tp i = 0; i < bottom_nd.count(); ++i) {
+      EXPECT_NEAR(bottom_nd.cpu_diff()[i], this->blob_bottom_->cpu_diff()[i],
+                  1e-5);
+    }
+  }
+}
+
 TYPED_TEST(Im2colLayerTest, TestRect) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -203,6 +203,49 @@ TYPED_TEST(LRNLayerTest, TestGradientAcrossChannelsLargeRegion) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(LRNLayerTest, TestForwardAcrossChannelsFusePoolMax) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Enough rows for several bands of the fused CPU forward.
+  this->blob_bottom_->Reshape(2, 7, 37, 13);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  for (int_tp pad = 0; pad < 2; ++pad) {
+    LayerParameter layer_param;
+    LRNLayer<Dtype> layer(layer_param);
+    Blob<Dtype> lrn_top;
+    vector<Blob<Dtype>*> lrn_top_vec(1, &lrn_top);
+    layer.SetUp(this->blob_bottom_vec_, lrn_top_vec);
+    layer.Forward(this->blob_bottom_vec_, lrn_top_vec);
+    LayerParameter pooling_param;
+    PoolingParameter* pool_param = pooling_param.mutable_pooling_param();
+    pool_param->set_pool(PoolingParameter_PoolMethod_MAX);
+    pool_param->add_kernel_size(3);
+    pool_param->add_stride(2);
+    pool_param->add_pad(pad);
+    PoolingLayer<Dtype> pooling_layer(pooling_param);
+    Blob<Dtype> top_reference;
+    vector<Blob<Dtype>*> top_reference_vec(1, &top_reference);
+    pooling_layer.SetUp(lrn_top_vec, top_reference_vec);
+    pooling_layer.Forward(lrn_top_vec, top_reference_vec);
+
+    LayerParameter fused_layer_param;
+    fused_layer_param.set_phase(TEST);
+    fused_layer_param.mutable_lrn_param()->
+        set_fuse_type(LRNParameter_FuseType_FUSED_POOL_MAX);
+    fused_layer_param.mutable_lrn_param()->mutable_pooling_param()->
+        CopyFrom(*pool_param);
+    LRNLayer<Dtype> fused_layer(fused_layer_param);
+    fused_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    fused_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(top_reference.shape(), this->blob_top_->shape());
+    for (int_tp i = 0; i < top_reference.count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i],
+                  this->epsilon_);
+    }
+  }
+}
+
 TYPED_TEST(LRNLayerTest, TestSetupWithinChannel) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -1,7 +1,10 @@
 #include <stdint.h>  // for uint32_t & uint64_t
 #include <time.h>
 #include <cmath>  // for std::fabs
+#include <limits>
+#include <vector>
 
+#include "boost/math/special_functions/next.hpp"
 #include "gtest/gtest.h"
 
 #include "caffe/blob.hpp"
@@ -124,6 +127,121 @@ TYPED_TEST(CPUMathFunctionsTest, TestCopy) {
   }
 }
 
+TYPED_TEST(CPUMathFunctionsTest, TestGemm) {
+  // Odd sizes so that every blocked kernel also runs its edge tiles.
+  const int_tp m = 19, n = 37, k = 41;
+  Blob<TypeParam> a(1, 1, m, k);
+  Blob<TypeParam> b(1, 1, k, n);
+  Blob<TypeParam> c(1, 1, m, n);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&a);
+  filler.Fill(&b);
+  filler.Fill(&c);
+  const TypeParam* a_data = a.cpu_data();
+  const TypeParam* b_data = b.cpu_data();
+  const double tolerance = sizeof(TypeParam) == 2 ? 5e-2 : 1e-4;
+  for (int_tp trans = 0; trans < 4; ++trans) {
+    const CBLAS_TRANSPOSE trans_a = (trans & 1) ? CblasTrans : CblasNoTrans;
+    const CBLAS_TRANSPOSE trans_b = (trans & 2) ? CblasTrans : CblasNoTrans;
+    vector<TypeParam> c_init(c.cpu_data(), c.cpu_data() + m * n);
+    caffe_cpu_gemm<TypeParam>(trans_a, trans_b, m, n, k, TypeParam(0.5),
+        a_data, b_data, TypeParam(2), c.mutable_cpu_data());
+    const TypeParam* c_data = c.cpu_data();
+    for (int_tp i = 0; i < m; ++i) {
+      for (int_tp j = 0; j < n; ++j) {
+        double acc = 0;
+        for (int_tp p = 0; p < k; ++p) {
+          // The blobs are reinterpreted as k x m and n x k when transposed.
+          const double a_ip = (trans_a == CblasNoTrans) ?
+              a_data[i * k + p] : a_data[p * m + i];
+          const double b_pj = (trans_b == CblasNoTrans) ?
+              b_data[p * n + j] : b_data[j * k + p];
+          acc += a_ip * b_pj;
+        }
+        const double expected = 0.5 * acc + 2.0 * c_init[i * n + j];
+        EXPECT_NEAR(expected, c_data[i * n + j],
+                    tolerance * std::max(1.0, std::fabs(expected)));
+      }
+    }
+  }
+}
+
+// The units in the last place between the result and the double precision
+// reference.
+template <typename Dtype>
+static double UlpError(const Dtype result, const double reference) {
+  return std::fabs(boost::math::float_distance(result,
+                                               static_cast<Dtype>(reference)));
+}
+
+// The vectorized functions are checked on a grid of n points in [lo, hi],
+// with n large enough to split into threads and to leave a vector tail.
+static const int_tp kTranscendentalN = 100003;
+
+static double GridPoint(const int_tp i, const double lo, const double hi) {
+  return lo + (hi - lo) * i / (kTranscendentalN - 1);
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestExp) {
+  vector<TypeParam> x(kTranscendentalN), y(kTranscendentalN);
+  for (int_tp i = 0; i < kTranscendentalN; ++i) {
+    // Up to just below ln(FLT_MAX), where 2^128 scales the result.
+    x[i] = GridPoint(i, -87., 88.72);
+  }
+  caffe_exp<TypeParam>(kTranscendentalN, &x[0], &y[0]);
+  for (int_tp i = 0; i < kTranscendentalN; ++i) {
+    EXPECT_LE(UlpError(y[i], std::exp(static_cast<double>(x[i]))), 2.)
+        << "x = " << x[i];
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestLog) {
+  vector<TypeParam> x(kTranscendentalN), y(kTranscendentalN);
+  for (int_tp i = 0; i < kTranscendentalN; ++i) {
+    // Spans the subnormals up to large floats.
+    x[i] = std::exp(GridPoint(i, -100., 80.));
+  }
+  caffe_log<TypeParam>(kTranscendentalN, &x[0], &y[0]);
+  for (int_tp i = 0; i < kTranscendentalN; ++i) {
+    EXPECT_LE(UlpError(y[i], std::log(static_cast<double>(x[i]))), 2.)
+        << "x = " << x[i];
+  }
+  const TypeParam special[3] = {TypeParam(0), TypeParam(-1),
+      std::numeric_limits<TypeParam>::infinity()};
+  TypeParam special_log[3];
+  caffe_log<TypeParam>(3, special, special_log);
+  EXPECT_EQ(-std::numeric_limits<TypeParam>::infinity(), special_log[0]);
+  EXPECT_TRUE(std::isnan(special_log[1]));
+  EXPECT_EQ(std::numeric_limits<TypeParam>::infinity(), special_log[2]);
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestTanh) {
+  vector<TypeParam> x(kTranscendentalN), y(kTranscendentalN);
+  for (int_tp i = 0; i < kTranscendentalN; ++i) {
+    x[i] = GridPoint(i, -12., 12.);
+  }
+  caffe_tanh<TypeParam>(kTranscendentalN, &x[0], &y[0]);
+  for (int_tp i = 0; i < kTranscendentalN; ++i) {
+    EXPECT_LE(UlpError(y[i], std::tanh(static_cast<double>(x[i]))), 3.)
+        << "x = " << x[i];
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestSigmoid) {
+  vector<TypeParam> x(kTranscendentalN), y(kTranscendentalN);
+  for (int_tp i = 0; i < kTranscendentalN; ++i) {
+    x[i] = GridPoint(i, -80., 80.);
+  }
+  // In place, as the neuron layers may run.
+  y = x;
+  caffe_sigmoid<TypeParam>(kTranscendentalN, &y[0], &y[0]);
+  for (int_tp i = 0; i < kTranscendentalN; ++i) {
+    const double reference = 1. / (1. + std::exp(-static_cast<double>(x[i])));
+    EXPECT_LE(UlpError(y[i], reference), 3.) << "x = " << x[i];
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
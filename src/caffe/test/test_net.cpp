@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <utility>
 #include <vector>
@@ -840,6 +842,246 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoFileWithState(proto, phase, level, stages);
   }
 
+  virtual void InitConvBatchNormNet(const bool fuse_layers) {
+    string proto =
+        "name: 'ConvBatchNormNet' "
+        "state { phase: TEST fuse_layers: " +
+        string(fuse_layers ? "true" : "false") + " } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape { dim: 2 dim: 4 dim: 6 dim: 5 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    bias_term: false "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'bn1' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'scale1' "
+        "  type: 'Scale' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "  scale_param { bias_term: true } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "  relu_param { negative_slope: 0.1 } "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'bn2' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'conv2' "
+        "  top: 'bn2' "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv1' "
+        "  bottom: 'bn2' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'relu2' "
+        "  type: 'ReLU' "
+        "  bottom: 'sum' "
+        "  top: 'sum' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitLRNPoolNet(const bool fuse_layers) {
+    string proto =
+        "name: 'LRNPoolNet' "
+        "state { phase: TEST fuse_layers: " +
+        string(fuse_layers ? "true" : "false") + " } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape { dim: 2 dim: 6 dim: 11 dim: 9 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'norm1' "
+        "  type: 'LRN' "
+        "  bottom: 'data' "
+        "  top: 'norm1' "
+        "  lrn_param { local_size: 3 alpha: 0.5 } "
+        "} "
+        "layer { "
+        "  name: 'pool1' "
+        "  type: 'Pooling' "
+        "  bottom: 'norm1' "
+        "  top: 'pool1' "
+        "  pooling_param { pool: MAX kernel_size: 3 stride: 2 } "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitPlannedMemoryNet(const bool plan_memory) {
+    string proto =
+        "name: 'PlannedMemoryNet' "
+        "state { phase: TEST plan_memory: " +
+        string(plan_memory ? "true" : "false") + " } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape { dim: 2 dim: 16 } "
+        "  } "
+        "} ";
+    const char* layers[][3] = {{"ip1", "data", "ip1"}, {"ip2", "ip1", "ip2"},
+        {"ip3", "ip2", "ip3"}, {"ip4", "ip3", "ip4"}};
+    for (int_tp i = 0; i < 4; ++i) {
+      proto += string("layer { "
+          "  name: '") + layers[i][0] + "' "
+          "  type: 'InnerProduct' "
+          "  bottom: '" + layers[i][1] + "' "
+          "  top: '" + layers[i][2] + "' "
+          "  inner_product_param { "
+          "    num_output: 16 "
+          "    weight_filler { type: 'gaussian' std: 0.3 } "
+          "    bias_filler { type: 'gaussian' } "
+          "  } "
+          "} ";
+      if (i == 0) {
+        proto += "layer { name: 'relu1' type: 'ReLU' bottom: 'ip1' "
+            "top: 'ip1' } ";
+      }
+    }
+    // ip2 is split between ip3 and the sum, so it stays live to the end.
+    proto += "layer { name: 'sum' type: 'Eltwise' bottom: 'ip2' "
+        "bottom: 'ip4' top: 'sum' } ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitBranchNet(const bool concurrent_layers,
+                             const bool dropout = false) {
+    string proto =
+        "name: 'BranchNet' "
+        "force_backward: true "
+        "state { phase: TRAIN concurrent_layers: " +
+        string(concurrent_layers ? "true" : "false") + " } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  top: 'target' "
+        "  input_param { "
+        "    shape { dim: 2 dim: 16 } "
+        "    shape { dim: 2 dim: 32 } "
+        "  } "
+        "} ";
+    // Four branches of the data, with in-place ReLUs, or Dropouts if
+    // dropout, the middle two sharing their weights.
+    const char* branches[][3] = {{"ip0", "relu0", ""},
+        {"ip1", "relu1", "shared"}, {"ip2", "relu2", "shared"},
+        {"ip3", "relu3", ""}};
+    for (int_tp i = 0; i < 4; ++i) {
+      const string branch = branches[i][0];
+      const char* params = branches[i][2];
+      proto += "layer { "
+          "  name: '" + branch + "' "
+          "  type: 'InnerProduct' "
+          "  bottom: 'data' "
+          "  top: '" + branch + "' ";
+      if (params[0]) {
+        proto += string("  param { name: '") + params + "_w' } "
+            "  param { name: '" + params + "_b' } ";
+      }
+      proto += string("  inner_product_param { "
+          "    num_output: 8 "
+          "    weight_filler { type: 'gaussian' std: 0.3 } "
+          "    bias_filler { type: 'gaussian' } "
+          "  } "
+          "} "
+          "layer { name: '") + branches[i][1] + "' type: '" +
+          (dropout ? "Dropout" : "ReLU") + "' "
+          "bottom: '" + branch + "' top: '" + branch + "' } ";
+    }
+    proto +=
+        "layer { name: 'concat' type: 'Concat' bottom: 'ip0' bottom: 'ip1' "
+        "bottom: 'ip2' bottom: 'ip3' top: 'concat' } "
+        "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'concat' "
+        "bottom: 'target' top: 'loss' } ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitFrozenNet(const Phase phase) {
+    string proto =
+        "name: 'FrozenNet' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { dim: 4 dim: 8 } "
+        "    data_filler { type: 'gaussian' } "
+        "    shape { dim: 4 } "
+        "    data_filler { type: 'constant' value: 0 } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'label' "
+        "} ";
+    // ip1 and ip2 are frozen, only ip3 is trained.
+    const char* layers[][3] = {{"ip1", "data", "ip1"}, {"ip2", "ip1", "ip2"},
+        {"ip3", "ip2", "ip3"}};
+    for (int_tp i = 0; i < 3; ++i) {
+      const string lr_mult = i < 2 ? "0" : "1";
+      proto += string("layer { "
+          "  name: '") + layers[i][0] + "' "
+          "  type: 'InnerProduct' "
+          "  bottom: '" + layers[i][1] + "' "
+          "  top: '" + layers[i][2] + "' "
+          "  param { lr_mult: " + lr_mult + " } "
+          "  param { lr_mult: " + lr_mult + " } "
+          "  inner_product_param { "
+          "    num_output: 8 "
+          "    weight_filler { type: 'gaussian' std: 0.3 } "
+          "    bias_filler { type: 'gaussian' } "
+          "  } "
+          "} ";
+    }
+    proto += "layer { name: 'loss' type: 'SoftmaxWithLoss' bottom: 'ip3' "
+        "bottom: 'label' top: 'loss' } ";
+    InitNetFromProtoFileWithState(proto, phase);
+  }
+
   int_tp seed_;
   shared_ptr<Net<Dtype> > net_;
 };
@@ -2612,4 +2854,277 @@ TYPED_TEST(NetTest, TestAllInOneNetDeploy) {
   ASSERT_TRUE(found_data);
 }
 
+TYPED_TEST(NetTest, TestFuseLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+  this->InitConvBatchNormNet(false);
+  // Trained statistics, with the moving average factor of BatchNorm.
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> gaussian_filler(filler_param);
+  filler_param.set_min(0.5);
+  filler_param.set_max(2);
+  UniformFiller<Dtype> uniform_filler(filler_param);
+  const char* batch_norm_names[] = {"bn1", "bn2"};
+  for (int_tp i = 0; i < 2; ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        this->net_->layer_by_name(batch_norm_names[i])->blobs();
+    gaussian_filler.Fill(blobs[0].get());
+    uniform_filler.Fill(blobs[1].get());
+    blobs[2]->mutable_cpu_data()[0] = 2;
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& scale_blobs =
+      this->net_->layer_by_name("scale1")->blobs();
+  uniform_filler.Fill(scale_blobs[0].get());
+  gaussian_filler.Fill(scale_blobs[1].get());
+  Blob<Dtype> data;
+  data.ReshapeLike(*this->net_->blob_by_name("data"));
+  gaussian_filler.Fill(&data);
+  this->net_->blob_by_name("data")->CopyFrom(data);
+  this->net_->Forward();
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->net_->blob_by_name("sum"), false, true);
+  NetParameter trained_param;
+  this->net_->ToProto(&trained_param);
+
+  // The fused net folds the weights of the BatchNorm and Scale layers in
+  // while copying them.
+  this->InitConvBatchNormNet(true);
+  EXPECT_FALSE(this->net_->has_layer("bn1"));
+  EXPECT_FALSE(this->net_->has_layer("scale1"));
+  EXPECT_FALSE(this->net_->has_layer("bn2"));
+  if (Caffe::mode() == Caffe::CPU) {
+    EXPECT_FALSE(this->net_->has_layer("relu1"));
+    EXPECT_FALSE(this->net_->has_layer("sum"));
+    EXPECT_FALSE(this->net_->has_layer("relu2"));
+  }
+  this->net_->CopyTrainedLayersFrom(trained_param);
+  this->net_->blob_by_name("data")->CopyFrom(data);
+  this->net_->Forward();
+  const Blob<Dtype>* actual = this->net_->blob_by_name("sum").get();
+  ASSERT_EQ(expected.shape(), actual->shape());
+  const Dtype delta = std::is_same<Dtype, half_float::half>::value ?
+                5e-2 : 1e-4;
+  for (int_tp i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], actual->cpu_data()[i],
+                delta * std::max(Dtype(1), std::fabs(expected.cpu_data()[i])));
+  }
+}
+
+TYPED_TEST(NetTest, TestFuseLRNPoolMax) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+  this->InitLRNPoolNet(false);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data;
+  data.ReshapeLike(*this->net_->blob_by_name("data"));
+  filler.Fill(&data);
+  this->net_->blob_by_name("data")->CopyFrom(data);
+  this->net_->Forward();
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->net_->blob_by_name("pool1"), false, true);
+
+  // The CPU computes the pooling within the LRN layer.
+  this->InitLRNPoolNet(true);
+  EXPECT_EQ(Caffe::mode() != Caffe::CPU, this->net_->has_layer("pool1"));
+  this->net_->blob_by_name("data")->CopyFrom(data);
+  this->net_->Forward();
+  const Blob<Dtype>* actual = this->net_->blob_by_name("pool1").get();
+  ASSERT_EQ(expected.shape(), actual->shape());
+  const Dtype delta = std::is_same<Dtype, half_float::half>::value ?
+                5e-2 : 1e-5;
+  for (int_tp i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], actual->cpu_data()[i], delta);
+  }
+}
+
+TYPED_TEST(NetTest, TestPlanMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+    this->InitPlannedMemoryNet(false);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    Blob<Dtype> data;
+    data.ReshapeLike(*this->net_->blob_by_name("data"));
+    filler.Fill(&data);
+    this->net_->blob_by_name("data")->CopyFrom(data);
+    this->net_->Forward();
+    Blob<Dtype> expected;
+    expected.CopyFrom(*this->net_->blob_by_name("sum"), false, true);
+    const uint_tp naive_memory = this->net_->memory_used();
+    NetParameter trained_param;
+    this->net_->ToProto(&trained_param);
+
+    // ip1 and ip3 are never live at the same time and share memory.
+    this->InitPlannedMemoryNet(true);
+    EXPECT_LT(this->net_->memory_used(), naive_memory);
+    this->net_->CopyTrainedLayersFrom(trained_param);
+    for (int_tp pass = 0; pass < 2; ++pass) {
+      this->net_->blob_by_name("data")->CopyFrom(data);
+      this->net_->Forward();
+      const Blob<Dtype>* actual = this->net_->blob_by_name("sum").get();
+      for (int_tp i = 0; i < expected.count(); ++i) {
+        EXPECT_EQ(expected.cpu_data()[i], actual->cpu_data()[i]);
+      }
+      // Planned again after reshaping.
+      this->net_->Reshape();
+    }
+    // Emptied blobs are not planned and must not keep pointing into the
+    // freed arena.
+    vector<uint_tp> empty_shape(data.shape());
+    empty_shape[0] = 0;
+    this->net_->blob_by_name("data")->Reshape(empty_shape);
+    this->net_->Reshape();
+    EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+              this->net_->blob_by_name("ip1")->data()->head());
+    this->net_->blob_by_name("data")->Reshape(data.shape());
+    this->net_->Reshape();
+    this->net_->blob_by_name("data")->CopyFrom(data);
+    this->net_->Forward();
+    const Blob<Dtype>* actual = this->net_->blob_by_name("sum").get();
+    for (int_tp i = 0; i < expected.count(); ++i) {
+      EXPECT_EQ(expected.cpu_data()[i], actual->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestConcurrentLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    const int_tp cpu_threads = Caffe::cpu_threads();
+    Caffe::set_cpu_threads(4);
+    Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+    this->InitBranchNet(false);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    Blob<Dtype> data;
+    Blob<Dtype> target;
+    data.ReshapeLike(*this->net_->blob_by_name("data"));
+    target.ReshapeLike(*this->net_->blob_by_name("target"));
+    filler.Fill(&data);
+    filler.Fill(&target);
+    this->net_->blob_by_name("data")->CopyFrom(data);
+    this->net_->blob_by_name("target")->CopyFrom(target);
+    this->net_->ClearParamDiffs();
+    const Dtype expected_loss = this->net_->ForwardBackward();
+    Blob<Dtype> expected_diff;
+    expected_diff.CopyFrom(*this->net_->blob_by_name("data"), true, true);
+    const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+    vector<shared_ptr<Blob<Dtype> > > expected_param_diffs;
+    for (int_tp i = 0; i < params.size(); ++i) {
+      expected_param_diffs.push_back(shared_ptr<Blob<Dtype> >(
+          new Blob<Dtype>()));
+      expected_param_diffs[i]->CopyFrom(*params[i], true, true);
+    }
+    NetParameter trained_param;
+    this->net_->ToProto(&trained_param);
+
+    this->InitBranchNet(true);
+    this->net_->CopyTrainedLayersFrom(trained_param);
+    for (int_tp pass = 0; pass < 2; ++pass) {
+      this->net_->blob_by_name("data")->CopyFrom(data);
+      this->net_->blob_by_name("target")->CopyFrom(target);
+      this->net_->ClearParamDiffs();
+      EXPECT_NEAR(expected_loss, this->net_->ForwardBackward(), 1e-5);
+      const Blob<Dtype>* data_diff = this->net_->blob_by_name("data").get();
+      for (int_tp i = 0; i < expected_diff.count(); ++i) {
+        EXPECT_NEAR(expected_diff.cpu_diff()[i], data_diff->cpu_diff()[i],
+                    1e-5);
+      }
+      // The shared weights get the gradients of both of their layers.
+      const vector<Blob<Dtype>*>& actual_params =
+          this->net_->learnable_params();
+      ASSERT_EQ(expected_param_diffs.size(), actual_params.size());
+      for (int_tp i = 0; i < actual_params.size(); ++i) {
+        for (int_tp j = 0; j < actual_params[i]->count(); ++j) {
+          EXPECT_NEAR(expected_param_diffs[i]->cpu_diff()[j],
+                      actual_params[i]->cpu_diff()[j], 1e-5);
+        }
+      }
+    }
+    Caffe::set_cpu_threads(cpu_threads);
+  }
+}
+
+TYPED_TEST(NetTest, TestMemoryProfile) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    this->InitPlannedMemoryNet(false);
+    this->net_->set_profile_memory(true);
+    this->net_->Forward();
+    const vector<typename Net<Dtype>::LayerMemory> layer_memory =
+        this->net_->layer_memory();
+    ASSERT_EQ(layer_memory.size(), this->net_->layers().size());
+    for (int_tp i = 0; i < layer_memory.size(); ++i) {
+      if (this->net_->layers()[i]->type() != string("InnerProduct")) {
+        continue;
+      }
+      const typename Net<Dtype>::LayerMemory& memory = layer_memory[i];
+      EXPECT_EQ(memory.top_data, 2 * 16 * sizeof(Dtype));
+      EXPECT_EQ(memory.top_diff, 0);
+      EXPECT_EQ(memory.param_data, (16 * 16 + 16) * sizeof(Dtype));
+      // The top is allocated by the first Forward.
+      EXPECT_GE(memory.peak, memory.top_data);
+    }
+    EXPECT_NE(this->net_->MemoryReport().find("ip4"), string::npos);
+  }
+}
+
+TYPED_TEST(NetTest, TestConcurrentLayersRandomSeed) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    const int_tp cpu_threads = Caffe::cpu_threads();
+    Caffe::set_cpu_threads(4);
+    this->InitBranchNet(true, true);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->net_->blob_by_name("data").get());
+    filler.Fill(this->net_->blob_by_name("target").get());
+    // The Dropouts running on the pool draw the same masks for a seed.
+    Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+    this->net_->Forward();
+    Blob<Dtype> expected;
+    expected.CopyFrom(*this->net_->blob_by_name("concat"), false, true);
+    for (int_tp pass = 0; pass < 2; ++pass) {
+      Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+      this->net_->Forward();
+      const Blob<Dtype>* concat = this->net_->blob_by_name("concat").get();
+      for (int_tp i = 0; i < expected.count(); ++i) {
+        EXPECT_EQ(expected.cpu_data()[i], concat->cpu_data()[i]);
+      }
+    }
+    Caffe::set_cpu_threads(cpu_threads);
+  }
+}
+
+TYPED_TEST(NetTest, TestNeedDiffs) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Only the blobs read or written by the Backward of ip3 and the loss have
+  // diffs in the TRAIN phase.
+  this->InitFrozenNet(caffe::TRAIN);
+  EXPECT_FALSE(this->net_->blob_by_name("data")->need_diff());
+  EXPECT_FALSE(this->net_->blob_by_name("ip1")->need_diff());
+  EXPECT_TRUE(this->net_->blob_by_name("ip2")->need_diff());
+  EXPECT_TRUE(this->net_->blob_by_name("ip3")->need_diff());
+  EXPECT_TRUE(this->net_->blob_by_name("label")->need_diff());
+  this->net_->ForwardBackward();
+  const Blob<Dtype>* weights =
+      this->net_->layer_by_name("ip3")->blobs()[0].get();
+  EXPECT_GT(weights->asum_diff(), 0);
+
+  // Only the loss layer has diffs in the TEST phase, until Backward.
+  this->InitFrozenNet(caffe::TEST);
+  EXPECT_FALSE(this->net_->blob_by_name("ip2")->need_diff());
+  EXPECT_TRUE(this->net_->blob_by_name("ip3")->need_diff());
+  this->net_->Forward();
+  this->net_->Backward();
+  EXPECT_TRUE(this->net_->blob_by_name("ip2")->need_diff());
+  EXPECT_FALSE(this->net_->blob_by_name("ip1")->need_diff());
+  // A blob without a diff allocates one when it is accessed.
+  Blob<Dtype>* ip1 = this->net_->blob_by_name("ip1").get();
+  EXPECT_TRUE(ip1->mutable_cpu_diff());
+  EXPECT_TRUE(ip1->cpu_diff());
+}
+
 }  // namespace caffe
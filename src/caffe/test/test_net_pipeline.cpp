@@ -0,0 +1,171 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/net_pipeline.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Records the thread pool each layer of a net runs its Forward on.
+template <typename Dtype>
+class ThreadPoolRecorder : public Net<Dtype>::Callback {
+ public:
+  vector<ThreadPool*> pools;
+
+ protected:
+  void run(int layer) {
+    pools.push_back(&Caffe::thread_pool());
+  }
+};
+
+template <typename TypeParam>
+class NetPipelineTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  NetPipelineTest() : seed_(1701) {}
+
+  // A convolution tower and a skip branch of the data, summed.
+  virtual void InitNet() {
+    const string proto =
+        "name: 'PipelinedNet' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { shape { dim: 8 dim: 3 dim: 8 dim: 8 } } "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "} "
+        "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+        "layer { "
+        "  name: 'pool1' "
+        "  type: 'Pooling' "
+        "  bottom: 'conv1' "
+        "  top: 'pool1' "
+        "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'pool1' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'skip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'data' "
+        "  top: 'skip' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { name: 'sum' type: 'Eltwise' bottom: 'ip1' bottom: 'skip' "
+        "top: 'sum' } "
+        "layer { name: 'prob' type: 'Softmax' bottom: 'sum' top: 'prob' } ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    net_.reset(new Net<Dtype>(param, Caffe::GetDefaultDevice()));
+  }
+
+  int_tp seed_;
+  shared_ptr<Net<Dtype> > net_;
+};
+
+TYPED_TEST_CASE(NetPipelineTest, TestDtypesAndDevices);
+
+TYPED_TEST(NetPipelineTest, TestStages) {
+  if (Caffe::mode() == Caffe::CPU) {
+    this->InitNet();
+    NetPipeline<typename TypeParam::Dtype> pipeline(this->net_.get(), 3, 2,
+                                                    vector<int_tp>());
+    ASSERT_EQ(3, pipeline.num_stages());
+    EXPECT_EQ(0, pipeline.stage_starts()[0]);
+    EXPECT_LT(pipeline.stage_starts()[0], pipeline.stage_starts()[1]);
+    EXPECT_LT(pipeline.stage_starts()[1], pipeline.stage_starts()[2]);
+    EXPECT_LT(pipeline.stage_starts()[2], this->net_->layers().size());
+  }
+}
+
+TYPED_TEST(NetPipelineTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+    this->InitNet();
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->net_->input_blobs()[0]);
+    this->net_->Forward();
+    Blob<Dtype> expected;
+    expected.CopyFrom(*this->net_->output_blobs()[0], false, true);
+    for (int_tp num_stages = 1; num_stages <= 4; ++num_stages) {
+      NetPipeline<Dtype> pipeline(this->net_.get(), num_stages, 2,
+                                  vector<int_tp>());
+      caffe_set(this->net_->output_blobs()[0]->count(), Dtype(0),
+                this->net_->output_blobs()[0]->mutable_cpu_data());
+      // Twice, as the buffers are reused.
+      for (int_tp pass = 0; pass < 2; ++pass) {
+        const vector<Blob<Dtype>*>& outputs = pipeline.Forward();
+        ASSERT_EQ(1, outputs.size());
+        ASSERT_EQ(expected.count(), outputs[0]->count());
+        for (int_tp i = 0; i < expected.count(); ++i) {
+          EXPECT_NEAR(expected.cpu_data()[i], outputs[0]->cpu_data()[i],
+                      1e-5);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetPipelineTest, TestStagePools) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    this->InitNet();
+    NetPipeline<Dtype> pipeline(this->net_.get(), 3, 2, vector<int_tp>());
+    vector<ThreadPoolRecorder<Dtype> > recorders(pipeline.num_stages());
+    for (int_tp stage = 0; stage < pipeline.num_stages(); ++stage) {
+      pipeline.stage_net(stage)->add_before_forward(&recorders[stage]);
+    }
+    // The stage threads keep their pools over the passes.
+    for (int_tp pass = 0; pass < 3; ++pass) {
+      pipeline.Forward();
+      for (int_tp stage = 0; stage < pipeline.num_stages(); ++stage) {
+        ASSERT_FALSE(recorders[stage].pools.empty());
+        for (int_tp i = 0; i < recorders[stage].pools.size(); ++i) {
+          EXPECT_EQ(pipeline.stage_pool(stage), recorders[stage].pools[i])
+              << "Stage " << stage << " in pass " << pass;
+        }
+        recorders[stage].pools.clear();
+      }
+    }
+    EXPECT_NE(pipeline.stage_pool(0), &Caffe::thread_pool());
+  }
+}
+
+}  // namespace caffe
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -456,6 +457,41 @@ TYPED_TEST(PoolingLayerTest, TestForwardMaxTopMask) {
   this->TestForwardRectWide();
 }
 
+TYPED_TEST(PoolingLayerTest, TestForwardBackwardMaxGlobal) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Windows of 5 x 5 and of 17 x 17 elements, the latter too many for the
+  // byte indices of the CPU.
+  const int_tp sizes[2] = {5, 17};
+  for (int_tp k = 0; k < 2; ++k) {
+    LayerParameter layer_param;
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->set_global_pooling(true);
+    pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+    this->blob_bottom_->Reshape(2, 3, sizes[k], sizes[k]);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    PoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_set(this->blob_top_->count(), Dtype(1),
+              this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+                   this->blob_bottom_vec_);
+    const int_tp plane = this->blob_bottom_->count(2);
+    for (int_tp p = 0; p < this->blob_top_->count(); ++p) {
+      const Dtype* bottom_data = this->blob_bottom_->cpu_data() + p * plane;
+      const Dtype* bottom_diff = this->blob_bottom_->cpu_diff() + p * plane;
+      const int_tp argmax =
+          std::max_element(bottom_data, bottom_data + plane) - bottom_data;
+      EXPECT_EQ(bottom_data[argmax], this->blob_top_->cpu_data()[p]);
+      for (int_tp i = 0; i < plane; ++i) {
+        EXPECT_EQ(i == argmax ? Dtype(1) : Dtype(0), bottom_diff[i]);
+      }
+    }
+  }
+}
+
 TYPED_TEST(PoolingLayerTest, TestGradientMax) {
   typedef typename TypeParam::Dtype Dtype;
   for (int_tp kernel_h = 3; kernel_h <= 4; kernel_h++) {
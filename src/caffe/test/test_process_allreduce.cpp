@@ -0,0 +1,191 @@
+#ifndef _MSC_VER
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/sgd_solvers.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+using std::ostringstream;
+
+namespace caffe {
+
+// Exposes the reduction of a range of the gradients.
+template <typename Dtype>
+class TestProcessAllreduce : public ProcessAllreduce<Dtype> {
+ public:
+  TestProcessAllreduce(shared_ptr<Solver<Dtype> > solver, const string& dir)
+      : ProcessAllreduce<Dtype>(solver, dir) {}
+  using ProcessAllreduce<Dtype>::Allreduce;
+};
+
+template <typename Dtype>
+class ProcessAllreduceTest : public CPUDeviceTest<Dtype> {
+ protected:
+  ProcessAllreduceTest() : dir_(ProcessAllreduce<Dtype>::new_dir()) {}
+  virtual ~ProcessAllreduceTest() {
+    rmdir(dir_.c_str());
+    Caffe::set_solver_count(1);
+    Caffe::set_solver_rank(0);
+    Caffe::set_multiprocess(false);
+  }
+
+  // Runs body with the rank of each of count processes: rank 0 in this one,
+  // the others in forked ones, which exit with the failures of their body.
+  void RunRanks(int_tp count, const std::function<void(int_tp)>& body) {
+    Caffe::set_solver_count(count);
+    vector<pid_t> children;
+    for (int_tp rank = 1; rank < count; ++rank) {
+      const pid_t pid = fork();
+      ASSERT_GE(pid, 0) << "fork: " << strerror(errno);
+      if (pid == 0) {
+        // The threads of the thread pools do not survive the fork.
+        ThreadPool pool(1, vector<int_tp>());
+        Caffe::set_thread_pool(&pool);
+        Caffe::set_solver_rank(rank);
+        body(rank);
+        _exit(::testing::Test::HasFailure() ? 1 : 0);
+      }
+      children.push_back(pid);
+    }
+    Caffe::set_solver_rank(0);
+    body(0);
+    for (int_tp i = 0; i < children.size(); ++i) {
+      int status;
+      ASSERT_EQ(children[i], waitpid(children[i], &status, 0));
+      EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+          << "Rank " << i + 1 << " failed.";
+    }
+  }
+
+  // A solver of an inner product with num_input inputs and one output, so
+  // num_input + 1 parameters.
+  shared_ptr<Solver<Dtype> > NewSolver(int_tp num_input) {
+    ostringstream proto;
+    proto <<
+        "base_lr: 0.01 "
+        "solver_mode: CPU "
+        "net_param { "
+        "  layer { "
+        "    name: 'data' "
+        "    type: 'DummyData' "
+        "    top: 'data' "
+        "    dummy_data_param { "
+        "      shape { dim: 1 dim: " << num_input << " } "
+        "    } "
+        "  } "
+        "  layer { "
+        "    name: 'ip' "
+        "    type: 'InnerProduct' "
+        "    bottom: 'data' "
+        "    top: 'ip' "
+        "    inner_product_param { "
+        "      num_output: 1 "
+        "    } "
+        "  } "
+        "} ";
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(), &param));
+    return shared_ptr<Solver<Dtype> >(new SGDSolver<Dtype>(param,
+        Caffe::GetDefaultDevice()));
+  }
+
+  // Numbers of processes, and sizes of the parameters that do not divide
+  // evenly among them. The largest spans two buckets, the second of which
+  // holds fewer elements than there are processes.
+  static const int_tp kNumCounts = 2;
+  static const int_tp kNumSizes = 3;
+  static int_tp count(int_tp i) { return i + 2; }
+  static int_tp size(int_tp i) {
+    const int_tp sizes[kNumSizes] = {5, 11, (1 << 20) + 2};
+    return sizes[i];
+  }
+
+  string dir_;
+};
+
+// The allreduce is only instantiated for float and double.
+typedef ::testing::Types<float, double> ProcessAllreduceDtypes;
+TYPED_TEST_CASE(ProcessAllreduceTest, ProcessAllreduceDtypes);
+
+TYPED_TEST(ProcessAllreduceTest, TestBroadcast) {
+  for (int_tp c = 0; c < this->kNumCounts; ++c) {
+    for (int_tp s = 0; s < this->kNumSizes; ++s) {
+      const int_tp size = this->size(s);
+      this->RunRanks(this->count(c), [&](int_tp rank) {
+        TestProcessAllreduce<TypeParam> allreduce(this->NewSolver(size - 1),
+                                                  this->dir_);
+        ASSERT_EQ(size, allreduce.size());
+        TypeParam* data = allreduce.data();
+        for (int_tp i = 0; i < size; ++i) {
+          data[i] = rank * 1000 + i % 7;
+        }
+        allreduce.Broadcast();
+        for (int_tp i = 0; i < size; ++i) {
+          ASSERT_EQ(TypeParam(i % 7), data[i]) << "Rank " << rank << " at "
+                                                << i;
+        }
+      });
+    }
+  }
+}
+
+TYPED_TEST(ProcessAllreduceTest, TestAllreduce) {
+  for (int_tp c = 0; c < this->kNumCounts; ++c) {
+    const int_tp count = this->count(c);
+    for (int_tp s = 0; s < this->kNumSizes; ++s) {
+      const int_tp size = this->size(s);
+      this->RunRanks(count, [&](int_tp rank) {
+        TestProcessAllreduce<TypeParam> allreduce(this->NewSolver(size - 1),
+                                                  this->dir_);
+        ASSERT_EQ(size, allreduce.size());
+        TypeParam* diff = allreduce.diff();
+        for (int_tp i = 0; i < size; ++i) {
+          diff[i] = (rank + 1) * (i % 13);
+        }
+        allreduce.Allreduce(0, size);
+        // The mean of 1, ..., count times i % 13.
+        for (int_tp i = 0; i < size; ++i) {
+          ASSERT_NEAR((i % 13) * (count + 1) / TypeParam(2), diff[i], 1e-4)
+              << "Rank " << rank << " at " << i;
+        }
+      });
+    }
+  }
+}
+
+TYPED_TEST(ProcessAllreduceTest, TestAllreduceRange) {
+  const int_tp count = 3;
+  const int_tp size = 101;
+  const int_tp begin = 13;
+  const int_tp end = 83;
+  this->RunRanks(count, [&](int_tp rank) {
+    TestProcessAllreduce<TypeParam> allreduce(this->NewSolver(size - 1),
+                                              this->dir_);
+    TypeParam* diff = allreduce.diff();
+    for (int_tp i = 0; i < size; ++i) {
+      diff[i] = rank * 3;
+    }
+    allreduce.Allreduce(begin, end);
+    for (int_tp i = 0; i < size; ++i) {
+      ASSERT_NEAR(i >= begin && i < end ? 3 : rank * 3, diff[i], 1e-4)
+          << "Rank " << rank << " at " << i;
+    }
+  });
+}
+
+}  // namespace caffe
+#endif  // !_MSC_VER
@@ -0,0 +1,422 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/layers/quantizer_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/insert_conversions.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantization.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class QuantizationTest : public CPUDeviceTest<Dtype> {
+ protected:
+  QuantizationTest()
+      : blob_bottom_(new Blob<Dtype>(2, 4, 7, 6)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_ref_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    filler_param.set_min(-1);
+    filler_param.set_max(3);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_ref_vec_.push_back(blob_top_ref_);
+  }
+  virtual ~QuantizationTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_ref_;
+  }
+
+  // Runs layer_param in FLOAT and in INT8_QUANTIZED with the same weights
+  // and checks that the results agree up to the quantization error.
+  template <typename LayerType>
+  void CheckQuantizedForward(LayerParameter layer_param) {
+    layer_param.set_phase(TEST);
+    LayerType float_layer(layer_param);
+    float_layer.SetUp(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+    float_layer.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+    layer_param.set_compute_data_type(INT8_QUANTIZED);
+    LayerType quantized_layer(layer_param);
+    quantized_layer.blobs() = float_layer.blobs();
+    quantized_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    quantized_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    CheckTopsAgree();
+  }
+
+  // Changes the weights shared by a FLOAT and an INT8_QUANTIZED layer after
+  // a forward, in place as a solver step or CopyTrainedLayersFrom does and
+  // by replacing them as ShareTrainedLayersWith does, and checks that the
+  // quantized layer follows.
+  template <typename LayerType>
+  void CheckWeightChanges(LayerParameter layer_param) {
+    layer_param.set_phase(TEST);
+    LayerType float_layer(layer_param);
+    float_layer.SetUp(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+    layer_param.set_compute_data_type(INT8_QUANTIZED);
+    LayerType quantized_layer(layer_param);
+    quantized_layer.blobs() = float_layer.blobs();
+    quantized_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    quantized_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype>* weights = float_layer.blobs()[0].get();
+    caffe_scal(weights->count(), Dtype(-2), weights->mutable_cpu_data());
+    float_layer.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+    quantized_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    CheckTopsAgree();
+    Blob<Dtype> trained_weights(weights->shape());
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&trained_weights);
+    weights->ShareData(trained_weights);
+    float_layer.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+    quantized_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    CheckTopsAgree();
+  }
+
+  // Checks that the top agrees with the reference top up to the
+  // quantization error.
+  void CheckTopsAgree() {
+    ASSERT_EQ(this->blob_top_->shape(), this->blob_top_ref_->shape());
+    const Dtype* top = this->blob_top_->cpu_data();
+    const Dtype* top_ref = this->blob_top_ref_->cpu_data();
+    Dtype max_abs = 0;
+    for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+      max_abs = std::max(max_abs, std::fabs(top_ref[i]));
+    }
+    for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top[i], top_ref[i], 0.02 * max_abs);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_ref_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_top_ref_vec_;
+};
+
+// Layers are only instantiated for float and double.
+typedef ::testing::Types<float, double> QuantizationDtypes;
+TYPED_TEST_CASE(QuantizationTest, QuantizationDtypes);
+
+TYPED_TEST(QuantizationTest, TestGemmS8U8S32) {
+  const int_tp m = 7, n = 9, k = 45;
+  vector<int8_t> a(m * k);
+  vector<uint8_t> b(n * k);
+  vector<int32_t> c(m * n);
+  for (int_tp i = 0; i < m * k; ++i) {
+    a[i] = static_cast<int8_t>((i * 37) % 255 - 127);
+  }
+  for (int_tp i = 0; i < n * k; ++i) {
+    b[i] = static_cast<uint8_t>((i * 91) % 256);
+  }
+  caffe_cpu_gemm_s8u8s32(m, n, k, &a[0], &b[0], &c[0]);
+  for (int_tp i = 0; i < m; ++i) {
+    for (int_tp j = 0; j < n; ++j) {
+      int32_t expected = 0;
+      for (int_tp p = 0; p < k; ++p) {
+        expected += a[i * k + p] * b[j * k + p];
+      }
+      EXPECT_EQ(expected, c[i * n + j]);
+    }
+  }
+}
+
+TYPED_TEST(QuantizationTest, TestBlobProtoRoundTrip) {
+  typedef TypeParam Dtype;
+  BlobProto proto;
+  QuantizedBlobToProto(*this->blob_bottom_, &proto);
+  EXPECT_EQ(INT8_QUANTIZED, proto.data_type());
+  EXPECT_EQ(this->blob_bottom_->count(), proto.packed_data().size());
+  ASSERT_EQ(this->blob_bottom_->shape(0), proto.quantization().scale_size());
+  Blob<Dtype> decoded;
+  decoded.FromProto(proto);
+  ASSERT_EQ(this->blob_bottom_->shape(), decoded.shape());
+  const int_tp inner = this->blob_bottom_->count(1);
+  for (int_tp i = 0; i < decoded.count(); ++i) {
+    EXPECT_NEAR(this->blob_bottom_->cpu_data()[i], decoded.cpu_data()[i],
+                proto.quantization().scale(i / inner) / 2 + 1e-6);
+  }
+}
+
+TYPED_TEST(QuantizationTest, TestQuantizerRoundTrip) {
+  typedef TypeParam Dtype;
+  LayerParameter quantize_param;
+  quantize_param.set_top_data_type(INT8_QUANTIZED);
+  ComputeActivationQuantization(-1, 3,
+                                quantize_param.mutable_top_quantization());
+  QuantizerLayer<Dtype, Dtype, Dtype> quantize_layer(quantize_param);
+  quantize_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  quantize_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  LayerParameter dequantize_param;
+  dequantize_param.set_bottom_data_type(INT8_QUANTIZED);
+  dequantize_param.mutable_bottom_quantization()->CopyFrom(
+      quantize_param.top_quantization());
+  QuantizerLayer<Dtype, Dtype, Dtype> dequantize_layer(dequantize_param);
+  dequantize_layer.SetUp(this->blob_top_vec_, this->blob_top_ref_vec_);
+  dequantize_layer.Forward(this->blob_top_vec_, this->blob_top_ref_vec_);
+  const float scale = ActivationScale(quantize_param.top_quantization());
+  for (int_tp i = 0; i < this->blob_bottom_->count(); ++i) {
+    const Dtype code = this->blob_top_->cpu_data()[i];
+    EXPECT_EQ(code, std::floor(code));
+    EXPECT_NEAR(this->blob_bottom_->cpu_data()[i],
+                this->blob_top_ref_->cpu_data()[i], scale / 2 + 1e-6);
+  }
+}
+
+TYPED_TEST(QuantizationTest, TestInnerProductForward) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  this->template CheckQuantizedForward<InnerProductLayer<Dtype, Dtype, Dtype> >(
+      layer_param);
+  inner_product_param->set_transpose(true);
+  this->template CheckQuantizedForward<InnerProductLayer<Dtype, Dtype, Dtype> >(
+      layer_param);
+}
+
+TYPED_TEST(QuantizationTest, TestConvolutionForward) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("uniform");
+  this->template CheckQuantizedForward<ConvolutionLayer<Dtype, Dtype, Dtype> >(
+      layer_param);
+}
+
+TYPED_TEST(QuantizationTest, TestWeightsChangedBetweenForwards) {
+  typedef TypeParam Dtype;
+  LayerParameter inner_product_param;
+  inner_product_param.mutable_inner_product_param()->set_num_output(10);
+  inner_product_param.mutable_inner_product_param()->mutable_weight_filler()
+      ->set_type("gaussian");
+  this->template CheckWeightChanges<InnerProductLayer<Dtype, Dtype, Dtype> >(
+      inner_product_param);
+  LayerParameter convolution_param;
+  convolution_param.mutable_convolution_param()->add_kernel_size(3);
+  convolution_param.mutable_convolution_param()->set_num_output(6);
+  convolution_param.mutable_convolution_param()->mutable_weight_filler()
+      ->set_type("gaussian");
+  this->template CheckWeightChanges<ConvolutionLayer<Dtype, Dtype, Dtype> >(
+      convolution_param);
+}
+
+TYPED_TEST(QuantizationTest, TestConvolutionQuantizedInput) {
+  typedef TypeParam Dtype;
+  // Quantize the input ahead of the convolution, as an inserted Quantizer
+  // does, and check that the padding still reads as zero.
+  LayerParameter quantize_param;
+  quantize_param.set_top_data_type(INT8_QUANTIZED);
+  ComputeActivationQuantization(-1, 3,
+                                quantize_param.mutable_top_quantization());
+  QuantizerLayer<Dtype, Dtype, Dtype> quantize_layer(quantize_param);
+  Blob<Dtype> codes;
+  vector<Blob<Dtype>*> codes_vec(1, &codes);
+  quantize_layer.SetUp(this->blob_bottom_vec_, codes_vec);
+  quantize_layer.Forward(this->blob_bottom_vec_, codes_vec);
+
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype, Dtype, Dtype> float_layer(layer_param);
+  float_layer.SetUp(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  float_layer.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  layer_param.set_bottom_data_type(INT8_QUANTIZED);
+  layer_param.set_compute_data_type(INT8_QUANTIZED);
+  layer_param.mutable_bottom_quantization()->CopyFrom(
+      quantize_param.top_quantization());
+  ConvolutionLayer<Dtype, Dtype, Dtype> quantized_layer(layer_param);
+  quantized_layer.blobs() = float_layer.blobs();
+  quantized_layer.SetUp(codes_vec, this->blob_top_vec_);
+  quantized_layer.Forward(codes_vec, this->blob_top_vec_);
+  Dtype max_abs = 0;
+  for (int_tp i = 0; i < this->blob_top_ref_->count(); ++i) {
+    max_abs = std::max(max_abs, std::fabs(this->blob_top_ref_->cpu_data()[i]));
+  }
+  for (int_tp i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+                this->blob_top_ref_->cpu_data()[i], 0.02 * max_abs);
+  }
+}
+
+TYPED_TEST(QuantizationTest, TestHistogramThresholds) {
+  typedef TypeParam Dtype;
+  // The quantiles of an exponential distribution, a long-tailed non-negative
+  // input like the output of a ReLU.
+  vector<Dtype> x(100000);
+  for (int_tp i = 0; i < x.size(); ++i) {
+    x[i] = -std::log(1 - (i + 0.5) / x.size());
+  }
+  ActivationHistogram histogram;
+  histogram.Add(static_cast<int_tp>(x.size()), &x[0]);
+  EXPECT_EQ(x.size(), histogram.count());
+  EXPECT_FALSE(histogram.has_negative());
+  const float percentile = histogram.PercentileThreshold(99.9);
+  EXPECT_NEAR(std::log(1000.), percentile, 0.05);
+  const float kl = histogram.KLThreshold(256);
+  EXPECT_GT(kl, percentile);
+  EXPECT_LE(kl, x.back());
+  QuantizationParameter param;
+  histogram.GetQuantization(percentile, &param);
+  EXPECT_EQ(0, ActivationZeroPoint(param));
+  EXPECT_NEAR(percentile / kQuantizedActivationMax, ActivationScale(param),
+              1e-6);
+}
+
+class QuantizerInsertionTest : public ::testing::Test {
+ protected:
+  void RunInsertionTest(
+      const string& input_param_string, const string& output_param_string) {
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    InsertConversions(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+    // Also test idempotence.
+    NetParameter double_convert_insert_param;
+    InsertConversions(actual_output_param, &double_convert_insert_param);
+    EXPECT_EQ(actual_output_param.DebugString(),
+       double_convert_insert_param.DebugString());
+  }
+};
+
+TEST_F(QuantizerInsertionTest, TestNoInsertion) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'innerprod' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'innerprod' "
+      "  compute_data_type: INT8_QUANTIZED "
+      "} ";
+  this->RunInsertionTest(input_proto, input_proto);
+}
+
+TEST_F(QuantizerInsertionTest, TestInsertion) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  bottom_data_type: INT8_QUANTIZED "
+      "  compute_data_type: INT8_QUANTIZED "
+      "  bottom_quantization { scale: 0.5 zero_point: 10 } "
+      "} "
+      "layer { "
+      "  name: 'quantize' "
+      "  type: 'Quantizer' "
+      "  bottom: 'conv' "
+      "  top: 'conv_codes' "
+      "  top_data_type: INT8_QUANTIZED "
+      "  top_quantization { scale: 0.25 } "
+      "} "
+      "layer { "
+      "  name: 'sigmoid' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'conv_codes' "
+      "  top: 'conv_codes' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'data_conv_0_convert' "
+      "  type: 'Quantizer' "
+      "  bottom: 'data' "
+      "  top: 'data_conv_0_converted' "
+      "  bottom_data_type: FLOAT "
+      "  compute_data_type: FLOAT "
+      "  top_data_type: INT8_QUANTIZED "
+      "  top_quantization { scale: 0.5 zero_point: 10 } "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data_conv_0_converted' "
+      "  top: 'conv' "
+      "  bottom_data_type: INT8_QUANTIZED "
+      "  compute_data_type: INT8_QUANTIZED "
+      "  bottom_quantization { scale: 0.5 zero_point: 10 } "
+      "} "
+      "layer { "
+      "  name: 'quantize' "
+      "  type: 'Quantizer' "
+      "  bottom: 'conv' "
+      "  top: 'conv_codes' "
+      "  top_data_type: INT8_QUANTIZED "
+      "  top_quantization { scale: 0.25 } "
+      "} "
+      "layer { "
+      "  name: 'conv_codes_sigmoid_0_convert' "
+      "  type: 'Quantizer' "
+      "  bottom: 'conv_codes' "
+      "  top: 'conv_codes_sigmoid_0_converted' "
+      "  bottom_data_type: INT8_QUANTIZED "
+      "  compute_data_type: FLOAT "
+      "  top_data_type: FLOAT "
+      "  bottom_quantization { scale: 0.25 } "
+      "} "
+      "layer { "
+      "  name: 'sigmoid' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'conv_codes_sigmoid_0_converted' "
+      "  top: 'conv_codes_sigmoid_0_converted' "
+      "} ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
+}  // namespace caffe
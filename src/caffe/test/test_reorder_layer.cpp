@@ -0,0 +1,306 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/reorder_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/insert_conversions.hpp"
+#include "caffe/util/layout.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class ReorderLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  ReorderLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 16, 3, 5)),
+        blob_middle_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_middle_vec_.push_back(blob_middle_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+
+  virtual ~ReorderLayerTest() {
+    delete blob_bottom_;
+    delete blob_middle_;
+    delete blob_top_;
+  }
+
+  // Reorders the bottom from NCHW into the layouts in turn and back into
+  // NCHW, forward and backward, which must reproduce it exactly.
+  void CheckRoundTrip(const Layout first, const Layout second) {
+    LayerParameter to_param;
+    to_param.set_top_layout(first);
+    LayerParameter between_param;
+    between_param.set_bottom_layout(first);
+    between_param.set_top_layout(second);
+    LayerParameter from_param;
+    from_param.set_bottom_layout(second);
+    ReorderLayer<Dtype, Dtype, Dtype> to_layer(to_param);
+    ReorderLayer<Dtype, Dtype, Dtype> between_layer(between_param);
+    ReorderLayer<Dtype, Dtype, Dtype> from_layer(from_param);
+    Blob<Dtype> blob_second;
+    vector<Blob<Dtype>*> blob_second_vec(1, &blob_second);
+    to_layer.SetUp(this->blob_bottom_vec_, this->blob_middle_vec_);
+    between_layer.SetUp(this->blob_middle_vec_, blob_second_vec);
+    from_layer.SetUp(blob_second_vec, this->blob_top_vec_);
+    EXPECT_EQ(this->blob_bottom_->shape(), this->blob_top_->shape());
+    to_layer.Forward(this->blob_bottom_vec_, this->blob_middle_vec_);
+    between_layer.Forward(this->blob_middle_vec_, blob_second_vec);
+    from_layer.Forward(blob_second_vec, this->blob_top_vec_);
+    for (int_tp i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_EQ(this->blob_bottom_->cpu_data()[i],
+                this->blob_top_->cpu_data()[i]);
+    }
+    caffe_copy(this->blob_top_->count(), this->blob_bottom_->cpu_data(),
+               this->blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    from_layer.Backward(this->blob_top_vec_, propagate_down,
+                        blob_second_vec);
+    between_layer.Backward(blob_second_vec, propagate_down,
+                           this->blob_middle_vec_);
+    to_layer.Backward(this->blob_middle_vec_, propagate_down,
+                      this->blob_bottom_vec_);
+    for (int_tp i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_EQ(this->blob_bottom_->cpu_data()[i],
+                this->blob_bottom_->cpu_diff()[i]);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_middle_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_middle_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+// Layers are only instantiated for float and double.
+typedef ::testing::Types<float, double> ReorderDtypes;
+TYPED_TEST_CASE(ReorderLayerTest, ReorderDtypes);
+
+TYPED_TEST(ReorderLayerTest, TestSetup) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_top_layout(NCHW8C);
+  ReorderLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ASSERT_EQ(this->blob_top_->num_axes(), 5);
+  EXPECT_EQ(this->blob_top_->shape(0), 2);
+  EXPECT_EQ(this->blob_top_->shape(1), 2);
+  EXPECT_EQ(this->blob_top_->shape(2), 3);
+  EXPECT_EQ(this->blob_top_->shape(3), 5);
+  EXPECT_EQ(this->blob_top_->shape(4), 8);
+}
+
+TYPED_TEST(ReorderLayerTest, TestForwardBlocked) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_top_layout(NCHW8C);
+  ReorderLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int_tp n = 0; n < 2; ++n) {
+    for (int_tp c = 0; c < 16; ++c) {
+      for (int_tp h = 0; h < 3; ++h) {
+        for (int_tp w = 0; w < 5; ++w) {
+          EXPECT_EQ(this->blob_bottom_->data_at(n, c, h, w),
+                    this->blob_top_->cpu_data()[
+                        (((n * 2 + c / 8) * 3 + h) * 5 + w) * 8 + c % 8]);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(ReorderLayerTest, TestRoundTrip) {
+  this->CheckRoundTrip(NCHW8C, NCHW8C);
+  this->CheckRoundTrip(NCHW16C, NCHW);
+}
+
+TYPED_TEST(ReorderLayerTest, TestRoundTripBetweenBlocks) {
+  this->CheckRoundTrip(NCHW8C, NCHW16C);
+  this->CheckRoundTrip(NCHW16C, NCHW8C);
+}
+
+class ReorderInsertionTest : public ::testing::Test {
+ protected:
+  ReorderInsertionTest() {
+    Caffe::set_mode(Caffe::CPU);
+  }
+
+  void RunInsertionTest(
+      const string& input_param_string, const string& output_param_string) {
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    InsertReorders(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+    // Also test idempotence.
+    NetParameter double_reorder_insert_param;
+    InsertReorders(actual_output_param, &double_reorder_insert_param);
+    EXPECT_EQ(actual_output_param.DebugString(),
+       double_reorder_insert_param.DebugString());
+  }
+};
+
+TEST_F(ReorderInsertionTest, TestNoInsertion) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  convolution_param { num_output: 16 kernel_size: 3 } "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} ";
+  this->RunInsertionTest(input_proto, input_proto);
+}
+
+TEST_F(ReorderInsertionTest, TestInsertion) {
+  const string native = Layout_Name(NativeBlockedLayout());
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { num_output: 16 kernel_size: 3 engine: DIRECT } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  bottom: 'conv1' "
+      "  top: 'conv2' "
+      "  convolution_param { num_output: 16 kernel_size: 3 engine: DIRECT } "
+      "} "
+      "layer { "
+      "  name: 'pool' "
+      "  type: 'Pooling' "
+      "  bottom: 'conv2' "
+      "  top: 'pool' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  bottom_layout: NCHW "
+      "  top_layout: " + native + " "
+      "  convolution_param { num_output: 16 kernel_size: 3 engine: DIRECT } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "  bottom_layout: " + native + " "
+      "  top_layout: " + native + " "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  bottom: 'conv1' "
+      "  top: 'conv2' "
+      "  bottom_layout: " + native + " "
+      "  top_layout: " + native + " "
+      "  convolution_param { num_output: 16 kernel_size: 3 engine: DIRECT } "
+      "} "
+      "layer { "
+      "  name: 'conv2_pool_0_reorder' "
+      "  type: 'Reorder' "
+      "  bottom: 'conv2' "
+      "  top: 'conv2_pool_0_reordered' "
+      "  bottom_layout: " + native + " "
+      "  top_layout: NCHW "
+      "} "
+      "layer { "
+      "  name: 'pool' "
+      "  type: 'Pooling' "
+      "  bottom: 'conv2_pool_0_reordered' "
+      "  top: 'pool' "
+      "} ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(ReorderInsertionTest, TestNetOutputIsPlain) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  convolution_param { num_output: 16 kernel_size: 3 engine: DIRECT } "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  bottom_layout: NCHW "
+      "  convolution_param { num_output: 16 kernel_size: 3 engine: DIRECT } "
+      "} ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
+}  // namespace caffe
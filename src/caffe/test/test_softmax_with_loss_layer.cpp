@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
 #include <vector>
 
@@ -61,6 +63,50 @@ TYPED_TEST(SoftmaxWithLossLayerTest, TestGradient) {
       this->blob_top_vec_, 0);
 }
 
+TYPED_TEST(SoftmaxWithLossLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_loss_param()->set_normalize(false);
+  Blob<Dtype> prob;
+  this->blob_top_vec_.push_back(&prob);
+  // One location far from its label, where the loss saturates.
+  this->blob_bottom_data_->mutable_cpu_data()[0] = -1000;
+  this->blob_bottom_label_->mutable_cpu_data()[0] = 0;
+  SoftmaxWithLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Compare against the softmax and loss computed separately in double.
+  const Dtype* data = this->blob_bottom_data_->cpu_data();
+  const Dtype* label = this->blob_bottom_label_->cpu_data();
+  const int_tp channels = this->blob_bottom_data_->channels();
+  const int_tp spatial = this->blob_bottom_data_->count(2);
+  double expected_loss = 0;
+  for (int_tp n = 0; n < this->blob_bottom_data_->num(); ++n) {
+    for (int_tp j = 0; j < spatial; ++j) {
+      double max_value = data[n * channels * spatial + j];
+      for (int_tp c = 1; c < channels; ++c) {
+        max_value = std::max(max_value,
+            static_cast<double>(data[(n * channels + c) * spatial + j]));
+      }
+      double sum = 0;
+      for (int_tp c = 0; c < channels; ++c) {
+        sum += std::exp(data[(n * channels + c) * spatial + j] - max_value);
+      }
+      for (int_tp c = 0; c < channels; ++c) {
+        const int_tp index = (n * channels + c) * spatial + j;
+        const double expected_prob = std::exp(data[index] - max_value) / sum;
+        EXPECT_NEAR(expected_prob, prob.cpu_data()[index], 1e-4);
+        if (c == static_cast<int_tp>(label[n * spatial + j])) {
+          expected_loss -= std::log(std::max(expected_prob,
+                                             static_cast<double>(FLT_MIN)));
+        }
+      }
+    }
+  }
+  const Dtype loss = this->blob_top_loss_->cpu_data()[0];
+  EXPECT_NEAR(expected_loss, loss, 1e-4 * expected_loss);
+}
+
 TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardIgnoreLabel) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
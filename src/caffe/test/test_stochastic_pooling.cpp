@@ -66,6 +66,86 @@ TYPED_TEST(CPUStochasticPoolingLayerTest, TestSetup) {
   EXPECT_EQ(this->blob_top_->width(), 2);
 }
 
+TYPED_TEST(CPUStochasticPoolingLayerTest, TestStochastic) {
+  LayerParameter layer_param;
+  layer_param.set_phase(TRAIN);
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->add_kernel_size(3);
+  pooling_param->add_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_STOCHASTIC);
+  PoolingLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  // Check if the output is correct - it should do random sampling
+  const TypeParam* bottom_data = this->blob_bottom_->cpu_data();
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  TypeParam total = 0;
+  for (int_tp n = 0; n < this->blob_top_->num(); ++n) {
+    for (int_tp c = 0; c < this->blob_top_->channels(); ++c) {
+      for (int_tp ph = 0; ph < this->blob_top_->height(); ++ph) {
+        for (int_tp pw = 0; pw < this->blob_top_->width(); ++pw) {
+          TypeParam pooled = top_data[this->blob_top_->offset(n, c, ph, pw)];
+          total += pooled;
+          int_tp hstart = ph * 2;
+          int_tp hend = min(hstart + 3, int_tp(this->blob_bottom_->height()));
+          int_tp wstart = pw * 2;
+          int_tp wend = min(wstart + 3, int_tp(this->blob_bottom_->width()));
+          bool has_equal = false;
+          for (int_tp h = hstart; h < hend; ++h) {
+            for (int_tp w = wstart; w < wend; ++w) {
+              has_equal |= (pooled == bottom_data[this->blob_bottom_->
+                  offset(n, c, h, w)]);
+            }
+          }
+          EXPECT_TRUE(has_equal);
+        }
+      }
+    }
+  }
+  // When we are doing stochastic pooling, the average we get should be higher
+  // than the simple data average since we are weighting more on higher-valued
+  // ones.
+  EXPECT_GE(total / this->blob_top_->count(), 0.55);
+}
+
+TYPED_TEST(CPUStochasticPoolingLayerTest, TestStochasticTestPhase) {
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->add_kernel_size(3);
+  pooling_param->add_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_STOCHASTIC);
+  PoolingLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  // Check if the output is correct - it should do random sampling
+  const TypeParam* bottom_data = this->blob_bottom_->cpu_data();
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  for (int_tp n = 0; n < this->blob_top_->num(); ++n) {
+    for (int_tp c = 0; c < this->blob_top_->channels(); ++c) {
+      for (int_tp ph = 0; ph < this->blob_top_->height(); ++ph) {
+        for (int_tp pw = 0; pw < this->blob_top_->width(); ++pw) {
+          TypeParam pooled = top_data[this->blob_top_->offset(n, c, ph, pw)];
+          int_tp hstart = ph * 2;
+          int_tp hend = min(hstart + 3, int_tp(this->blob_bottom_->height()));
+          int_tp wstart = pw * 2;
+          int_tp wend = min(wstart + 3, int_tp(this->blob_bottom_->width()));
+          bool smaller_than_max = false;
+          for (int_tp h = hstart; h < hend; ++h) {
+            for (int_tp w = wstart; w < wend; ++w) {
+              smaller_than_max |= (pooled <= bottom_data[this->blob_bottom_->
+                  offset(n, c, h, w)]);
+            }
+          }
+          EXPECT_TRUE(smaller_than_max);
+        }
+      }
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
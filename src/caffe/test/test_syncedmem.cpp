@@ -1,9 +1,11 @@
 #include <vector>
 
+#include <boost/thread.hpp>
 
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/device_alternate.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -48,6 +50,88 @@ TEST_F(SyncedMemoryTest, TestAllocationCPU) {
   EXPECT_TRUE(mem.mutable_cpu_data());
 }
 
+TEST_F(SyncedMemoryTest, TestHostAllocatorReuse) {
+  HostAllocator* allocator = HostAllocator::Get();
+  allocator->set_cache_limit(uint_tp(1024) << 20);
+  EXPECT_EQ(allocator->class_bytes(1), CAFFE_MALLOC_PAGE_ALIGN);
+  EXPECT_EQ(allocator->class_bytes(3 * CAFFE_MALLOC_PAGE_ALIGN),
+            3 * CAFFE_MALLOC_PAGE_ALIGN);
+  EXPECT_EQ(allocator->class_bytes(9 * CAFFE_MALLOC_PAGE_ALIGN),
+            10 * CAFFE_MALLOC_PAGE_ALIGN);
+  // Large allocations are rounded to pages only.
+  EXPECT_EQ(allocator->class_bytes(2000 * CAFFE_MALLOC_PAGE_ALIGN + 1),
+            2001 * CAFFE_MALLOC_PAGE_ALIGN);
+  void* ptr = allocator->Allocate(10000);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % CAFFE_MALLOC_PAGE_ALIGN, 0);
+  memset(ptr, 1, 10000);
+  HostAllocator::Stats stats = allocator->stats();
+  EXPECT_EQ(allocator->Free(ptr), uint_tp(10000));
+  EXPECT_EQ(allocator->stats().cached_bytes,
+            stats.cached_bytes + allocator->class_bytes(10000));
+  // A block of the same size class is served from the cache.
+  void* reused_ptr = allocator->Allocate(9000);
+  EXPECT_EQ(reused_ptr, ptr);
+  EXPECT_EQ(allocator->stats().hits, stats.hits + 1);
+  EXPECT_EQ(allocator->stats().misses, stats.misses);
+  allocator->Free(reused_ptr);
+  // A cached large block is reused for a slightly smaller allocation only.
+  const uint_tp large_size = 2000 * CAFFE_MALLOC_PAGE_ALIGN;
+  ptr = allocator->Allocate(large_size);
+  EXPECT_EQ(HostAllocator::size(ptr), large_size);
+  allocator->Free(ptr);
+  reused_ptr = allocator->Allocate(large_size - 100 * CAFFE_MALLOC_PAGE_ALIGN);
+  EXPECT_EQ(reused_ptr, ptr);
+  allocator->Free(reused_ptr);
+  void* large_ptr = allocator->Allocate(large_size / 2);
+  EXPECT_NE(large_ptr, ptr);
+  allocator->Free(large_ptr);
+  allocator->EmptyCache();
+  EXPECT_EQ(allocator->stats().cached_bytes, 0);
+  // Without a cache, blocks go back to the system.
+  allocator->set_cache_limit(0);
+  ptr = allocator->Allocate(10000);
+  allocator->Free(ptr);
+  EXPECT_EQ(allocator->stats().cached_bytes, 0);
+  allocator->set_cache_limit(uint_tp(1024) << 20);
+}
+
+TEST_F(SyncedMemoryTest, TestHostMemoryUsage) {
+  Device* dc = Caffe::GetCPUDevice();
+  const uint_tp memory_usage = dc->memory_usage();
+  const uint_tp requested_bytes = dc->host_memory_stats().requested_bytes;
+  {
+    SyncedMemory mem(10000, dc, dtypeof<float>());
+    mem.mutable_cpu_data();
+    EXPECT_EQ(dc->memory_usage(), memory_usage + 10000);
+    EXPECT_GE(dc->peak_memory_usage(), dc->memory_usage());
+    EXPECT_EQ(dc->host_memory_stats().requested_bytes,
+              requested_bytes + 10000);
+  }
+  EXPECT_EQ(dc->memory_usage(), memory_usage);
+  EXPECT_EQ(dc->host_memory_stats().requested_bytes, requested_bytes);
+}
+
+static void AllocateHostMemory(Device* dc, uint_tp size) {
+  SyncedMemory mem(size, dc, dtypeof<float>());
+  mem.mutable_cpu_data();
+}
+
+TEST_F(SyncedMemoryTest, TestThreadMemoryUsage) {
+  Device* dc = Caffe::GetCPUDevice();
+  const int_tp memory_usage = dc->thread_memory_usage();
+  dc->reset_thread_peak_memory_usage();
+  {
+    SyncedMemory mem(10000, dc, dtypeof<float>());
+    mem.mutable_cpu_data();
+    // The memory of other threads is not counted.
+    boost::thread thread(&AllocateHostMemory, dc, 50000);
+    thread.join();
+    EXPECT_EQ(dc->thread_memory_usage(), memory_usage + 10000);
+  }
+  EXPECT_EQ(dc->thread_memory_usage(), memory_usage);
+  EXPECT_EQ(dc->thread_peak_memory_usage(), memory_usage + 10000);
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestAllocationGPU) {
@@ -0,0 +1,63 @@
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {};
+
+TEST_F(ThreadPoolTest, TestParallelForCoversRange) {
+  const int_tp thread_counts[] = {1, 2, 5};
+  for (int_tp t = 0; t < 3; ++t) {
+    ThreadPool pool(thread_counts[t], vector<int_tp>());
+    EXPECT_EQ(thread_counts[t], pool.num_threads());
+    const int_tp grains[] = {1, 7, 1000};
+    for (int_tp g = 0; g < 3; ++g) {
+      vector<int_tp> visits(1003, 0);
+      pool.parallel_for(2, 1001, grains[g], [&](int_tp begin, int_tp end) {
+        EXPECT_LT(begin, end);
+        for (int_tp i = begin; i < end; ++i) {
+          ++visits[i];
+        }
+      });
+      for (int_tp i = 0; i < visits.size(); ++i) {
+        EXPECT_EQ(i >= 2 && i < 1001 ? 1 : 0, visits[i]);
+      }
+    }
+  }
+}
+
+TEST_F(ThreadPoolTest, TestNestedParallelFor) {
+  ThreadPool pool(4, vector<int_tp>());
+  std::atomic<int_tp> sum(0);
+  pool.parallel_for(0, 16, 1, [&](int_tp begin, int_tp end) {
+    for (int_tp i = begin; i < end; ++i) {
+      pool.parallel_for(0, 100, 1, [&](int_tp inner_begin, int_tp inner_end) {
+        sum += inner_end - inner_begin;
+      });
+    }
+  });
+  EXPECT_EQ(1600, sum);
+}
+
+TEST_F(ThreadPoolTest, TestScheduleAndWait) {
+  ThreadPool pool(3, vector<int_tp>());
+  std::atomic<int_tp> pending(50);
+  std::atomic<int_tp> sum(0);
+  for (int_tp i = 0; i < 50; ++i) {
+    pool.Schedule([&pool, &sum, &pending, i]() {
+      sum += i;
+      pool.Done(&pending);
+    });
+  }
+  pool.Wait(pending);
+  EXPECT_EQ(49 * 50 / 2, sum);
+}
+
+}  // namespace caffe
@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CAFFE_BGEMM_AVX2
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512F__)
+#define CAFFE_BGEMM_VPOPCNTDQ
+#endif
+#endif
+
+#include "caffe/common.hpp"
+#include "caffe/util/binarization.hpp"
+
+namespace caffe {
+
+// Register and cache blocking of the binary GEMM, as for the int8 GEMM:
+// kBgemmMR x kBgemmNR popcount sums per micro-kernel call, with panels of
+// kBgemmNC rows of b kept in L2.
+const int_tp kBgemmMR = 2;
+const int_tp kBgemmNR = 4;
+const int_tp kBgemmNC = 128;
+
+static inline int32_t popcount64(uint64_t x) {
+#if defined(__GNUC__)
+  return __builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return static_cast<int32_t>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+#if defined(CAFFE_BGEMM_AVX2) && !defined(CAFFE_BGEMM_VPOPCNTDQ)
+// Per 64-bit lane popcount: the bytes are counted by looking up both
+// nibbles with vpshufb and summed into the lanes by vpsadbw.
+static inline __m256i bgemm_popcount_epi64(const __m256i v) {
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  const __m256i low = _mm256_and_si256(v, low_mask);
+  const __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  const __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low),
+                                        _mm256_shuffle_epi8(lookup, high));
+  return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+}
+
+static inline int32_t bgemm_hsum(const __m256i v) {
+  const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v),
+                                  _mm256_extracti128_si256(v, 1));
+  return static_cast<int32_t>(_mm_cvtsi128_si64(s) +
+                              _mm_extract_epi64(s, 1));
+}
+#endif
+
+// Computes the MR x NR block c[i][j] = popcount(a_i ^ b_j).
+template<int_tp MR, int_tp NR>
+static void bgemm_micro_kernel(const int_tp k, const uint64_t* a,
+                               const uint64_t* b, int32_t* c,
+                               const int_tp ldc) {
+  int_tp p = 0;
+  int32_t acc[MR][NR];
+#if defined(CAFFE_BGEMM_VPOPCNTDQ)
+  __m512i vacc[MR][NR];
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      vacc[i][j] = _mm512_setzero_si512();
+    }
+  }
+  for (; p + 8 <= k; p += 8) {
+    __m512i va[MR];
+    for (int_tp i = 0; i < MR; ++i) {
+      va[i] = _mm512_loadu_si512(a + i * k + p);
+    }
+    for (int_tp j = 0; j < NR; ++j) {
+      const __m512i vb = _mm512_loadu_si512(b + j * k + p);
+      for (int_tp i = 0; i < MR; ++i) {
+        vacc[i][j] = _mm512_add_epi64(vacc[i][j],
+            _mm512_popcnt_epi64(_mm512_xor_si512(va[i], vb)));
+      }
+    }
+  }
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      acc[i][j] = static_cast<int32_t>(_mm512_reduce_add_epi64(vacc[i][j]));
+    }
+  }
+#elif defined(CAFFE_BGEMM_AVX2)
+  __m256i vacc[MR][NR];
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      vacc[i][j] = _mm256_setzero_si256();
+    }
+  }
+  for (; p + 4 <= k; p += 4) {
+    __m256i va[MR];
+    for (int_tp i = 0; i < MR; ++i) {
+      va[i] = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(a + i * k + p));
+    }
+    for (int_tp j = 0; j < NR; ++j) {
+      const __m256i vb = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(b + j * k + p));
+      for (int_tp i = 0; i < MR; ++i) {
+        vacc[i][j] = _mm256_add_epi64(vacc[i][j],
+            bgemm_popcount_epi64(_mm256_xor_si256(va[i], vb)));
+      }
+    }
+  }
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      acc[i][j] = bgemm_hsum(vacc[i][j]);
+    }
+  }
+#else
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      acc[i][j] = 0;
+    }
+  }
+#endif
+  for (; p < k; ++p) {
+    for (int_tp i = 0; i < MR; ++i) {
+      for (int_tp j = 0; j < NR; ++j) {
+        acc[i][j] += popcount64(a[i * k + p] ^ b[j * k + p]);
+      }
+    }
+  }
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      c[i * ldc + j] = acc[i][j];
+    }
+  }
+}
+
+void caffe_cpu_gemm_xor_popcount(const int_tp m, const int_tp n,
+                                 const int_tp k, const uint64_t* a,
+                                 const uint64_t* b, int32_t* c) {
+  for (int_tp jc = 0; jc < n; jc += kBgemmNC) {
+    const int_tp nc = std::min(kBgemmNC, n - jc);
+    int_tp i = 0;
+    for (; i + kBgemmMR <= m; i += kBgemmMR) {
+      int_tp j = jc;
+      for (; j + kBgemmNR <= jc + nc; j += kBgemmNR) {
+        bgemm_micro_kernel<kBgemmMR, kBgemmNR>(k, a + i * k, b + j * k,
+                                               c + i * n + j, n);
+      }
+      for (; j < jc + nc; ++j) {
+        bgemm_micro_kernel<kBgemmMR, 1>(k, a + i * k, b + j * k,
+                                        c + i * n + j, n);
+      }
+    }
+    for (; i < m; ++i) {
+      int_tp j = jc;
+      for (; j + kBgemmNR <= jc + nc; j += kBgemmNR) {
+        bgemm_micro_kernel<1, kBgemmNR>(k, a + i * k, b + j * k,
+                                        c + i * n + j, n);
+      }
+      for (; j < jc + nc; ++j) {
+        bgemm_micro_kernel<1, 1>(k, a + i * k, b + j * k, c + i * n + j, n);
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+void caffe_cpu_pack_signs(const int_tp outer, const int_tp channels,
+                          const int_tp inner, const Dtype* x, uint64_t* y) {
+  const int_tp words = BinaryWords(channels);
+  std::fill(y, y + outer * inner * words, uint64_t(0));
+  for (int_tp o = 0; o < outer; ++o) {
+    for (int_tp c = 0; c < channels; ++c) {
+      const uint64_t bit = uint64_t(1) << (c % kBinaryWordBits);
+      const Dtype* x_c = x + (o * channels + c) * inner;
+      uint64_t* y_c = y + o * inner * words + c / kBinaryWordBits;
+      for (int_tp i = 0; i < inner; ++i) {
+        if (x_c[i] >= Dtype(0)) {
+          y_c[i * words] |= bit;
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+void caffe_cpu_unpack_signs(const int_tp outer, const int_tp channels,
+                            const int_tp inner, const uint64_t* x, Dtype* y) {
+  const int_tp words = BinaryWords(channels);
+  for (int_tp o = 0; o < outer; ++o) {
+    for (int_tp c = 0; c < channels; ++c) {
+      const int_tp shift = c % kBinaryWordBits;
+      const uint64_t* x_c = x + o * inner * words + c / kBinaryWordBits;
+      Dtype* y_c = y + (o * channels + c) * inner;
+      for (int_tp i = 0; i < inner; ++i) {
+        y_c[i] = ((x_c[i * words] >> shift) & 1) ? Dtype(1) : Dtype(-1);
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+static int_tp PackedSignsSlotBytes(const int_tp channels,
+                                   const int_tp inner) {
+  const int_tp bytes = inner * BinaryWords(channels) * sizeof(uint64_t);
+  CHECK_LE(bytes, channels * inner * static_cast<int_tp>(sizeof(Dtype)))
+      << "Too few channels to store packed signs in place.";
+  return bytes;
+}
+
+// The words are copied with memcpy, since the slots of a float blob are not
+// necessarily 8 byte aligned.
+template<typename Dtype>
+void WritePackedSigns(const int_tp num, const int_tp channels,
+                      const int_tp inner, const uint64_t* words, Dtype* data) {
+  const int_tp bytes = PackedSignsSlotBytes<Dtype>(channels, inner);
+  const int_tp words_per_slot = bytes / sizeof(uint64_t);
+  for (int_tp n = 0; n < num; ++n) {
+    std::memcpy(data + n * channels * inner, words + n * words_per_slot,
+                bytes);
+  }
+}
+
+template<typename Dtype>
+void ReadPackedSigns(const int_tp num, const int_tp channels,
+                     const int_tp inner, const Dtype* data, uint64_t* words) {
+  const int_tp bytes = PackedSignsSlotBytes<Dtype>(channels, inner);
+  const int_tp words_per_slot = bytes / sizeof(uint64_t);
+  for (int_tp n = 0; n < num; ++n) {
+    std::memcpy(words + n * words_per_slot, data + n * channels * inner,
+                bytes);
+  }
+}
+
+void caffe_cpu_im2col_binary(const uint64_t* data_im, const int_tp words,
+                             const int_tp height, const int_tp width,
+                             const int_tp kernel_h, const int_tp kernel_w,
+                             const int_tp pad_h, const int_tp pad_w,
+                             const int_tp stride_h, const int_tp stride_w,
+                             const int_tp dilation_h,
+                             const int_tp dilation_w, uint64_t* data_col) {
+  const int_tp output_h = (height + 2 * pad_h -
+      (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int_tp output_w = (width + 2 * pad_w -
+      (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  for (int_tp output_row = 0; output_row < output_h; ++output_row) {
+    for (int_tp output_col = 0; output_col < output_w; ++output_col) {
+      for (int_tp kernel_row = 0; kernel_row < kernel_h; ++kernel_row) {
+        const int_tp input_row = output_row * stride_h - pad_h +
+            kernel_row * dilation_h;
+        for (int_tp kernel_col = 0; kernel_col < kernel_w; ++kernel_col) {
+          const int_tp input_col = output_col * stride_w - pad_w +
+              kernel_col * dilation_w;
+          if (input_row >= 0 && input_row < height &&
+              input_col >= 0 && input_col < width) {
+            const uint64_t* src =
+                data_im + (input_row * width + input_col) * words;
+            std::copy(src, src + words, data_col);
+          } else {
+            std::fill(data_col, data_col + words, uint64_t(0));
+          }
+          data_col += words;
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+void BinaryWeights::Binarize(const int_tp rows, const int_tp channels,
+                             const int_tp inner, const Dtype* w) {
+  CHECK_GT(rows, 0);
+  rows_ = rows;
+  channels_ = channels;
+  inner_ = inner;
+  const int_tp words = BinaryWords(channels);
+  data_.resize(rows * inner * words);
+  scales_.resize(rows);
+  popcounts_.resize(rows * inner);
+  caffe_cpu_pack_signs(rows, channels, inner, w, &data_[0]);
+  const int_tp cols = channels * inner;
+  for (int_tp r = 0; r < rows; ++r) {
+    double abs_sum = 0;
+    for (int_tp j = 0; j < cols; ++j) {
+      abs_sum += std::fabs(static_cast<double>(w[r * cols + j]));
+    }
+    scales_[r] = static_cast<float>(abs_sum / cols);
+    for (int_tp i = 0; i < inner; ++i) {
+      const uint64_t* row_words = &data_[(r * inner + i) * words];
+      int32_t count = 0;
+      for (int_tp j = 0; j < words; ++j) {
+        count += popcount64(row_words[j]);
+      }
+      popcounts_[r * inner + i] = count;
+    }
+  }
+}
+
+template<typename Dtype>
+void BinaryBlobToProto(const Blob<Dtype>& blob, BlobProto* proto) {
+  proto->Clear();
+  for (int_tp i = 0; i < blob.num_axes(); ++i) {
+    proto->mutable_shape()->add_dim(blob.shape(i));
+  }
+  proto->set_data_type(INT64_PACKED_BINARY);
+  const int_tp count = blob.count();
+  if (count == 0) {
+    return;
+  }
+  const int_tp outer = blob.num_axes() > 0 ? blob.shape(0) : 1;
+  const int_tp inner = count / outer;
+  BinaryWeights weights;
+  weights.Binarize(outer, inner, 1, blob.cpu_data());
+  // Serialize the words little endian, so that sign i of a row is bit i % 8
+  // of byte i / 8 of the row.
+  const int_tp row_words = weights.row_words();
+  const int_tp word_bytes = sizeof(uint64_t);
+  string packed(outer * row_words * word_bytes, '\0');
+  for (int_tp i = 0; i < outer * row_words; ++i) {
+    for (int_tp b = 0; b < word_bytes; ++b) {
+      packed[i * word_bytes + b] =
+          static_cast<char>((weights.data()[i] >> (8 * b)) & 0xff);
+    }
+  }
+  proto->set_packed_data(packed);
+  for (int_tp o = 0; o < outer; ++o) {
+    proto->mutable_quantization()->add_scale(weights.scale(o));
+  }
+}
+
+template<typename Dtype>
+void BinaryBlobFromProto(const BlobProto& proto, const int_tp count,
+                         Dtype* data) {
+  CHECK(IsPackedBinary(proto.data_type()));
+  if (count == 0) {
+    return;
+  }
+  const QuantizationParameter& param = proto.quantization();
+  const int_tp outer = param.scale_size();
+  CHECK_GT(outer, 0) << "Packed binary blob without scales.";
+  CHECK_EQ(count % outer, 0) << "Binary scales must divide the blob evenly.";
+  const int_tp inner = count / outer;
+  const int_tp word_bits = 8 << (proto.data_type() - INT8_PACKED_BINARY);
+  const int_tp row_bytes = (inner + word_bits - 1) / word_bits * word_bits / 8;
+  CHECK_EQ(outer * row_bytes, proto.packed_data().size())
+      << "Packed binary blob needs one bit per element, with rows padded to "
+      << word_bits << " bits.";
+  const uint8_t* bytes =
+      reinterpret_cast<const uint8_t*>(proto.packed_data().data());
+  for (int_tp o = 0; o < outer; ++o) {
+    const Dtype scale = static_cast<Dtype>(param.scale(o));
+    const uint8_t* row = bytes + o * row_bytes;
+    for (int_tp i = 0; i < inner; ++i) {
+      data[o * inner + i] = ((row[i / 8] >> (i % 8)) & 1) ? scale : -scale;
+    }
+  }
+}
+
+#define INSTANTIATE_BINARIZATION(Dtype) \
+  template void caffe_cpu_pack_signs<Dtype>(const int_tp outer, \
+      const int_tp channels, const int_tp inner, const Dtype* x, \
+      uint64_t* y); \
+  template void caffe_cpu_unpack_signs<Dtype>(const int_tp outer, \
+      const int_tp channels, const int_tp inner, const uint64_t* x, \
+      Dtype* y); \
+  template void WritePackedSigns<Dtype>(const int_tp num, \
+      const int_tp channels, const int_tp inner, const uint64_t* words, \
+      Dtype* data); \
+  template void ReadPackedSigns<Dtype>(const int_tp num, \
+      const int_tp channels, const int_tp inner, const Dtype* data, \
+      uint64_t* words); \
+  template void BinaryWeights::Binarize<Dtype>(const int_tp rows, \
+      const int_tp channels, const int_tp inner, const Dtype* w); \
+  template void BinaryBlobToProto<Dtype>(const Blob<Dtype>& blob, \
+      BlobProto* proto);
+
+INSTANTIATE_BINARIZATION(float);
+INSTANTIATE_BINARIZATION(double);
+
+template void BinaryBlobFromProto<float>(const BlobProto& proto,
+    const int_tp count, float* data);
+template void BinaryBlobFromProto<double>(const BlobProto& proto,
+    const int_tp count, double* data);
+template void BinaryBlobFromProto<int_tp>(const BlobProto& proto,
+    const int_tp count, int_tp* data);
+template void BinaryBlobFromProto<uint_tp>(const BlobProto& proto,
+    const int_tp count, uint_tp* data);
+
+}  // namespace caffe
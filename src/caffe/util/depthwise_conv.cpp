@@ -0,0 +1,229 @@
+#include <algorithm>
+
+#include "caffe/util/depthwise_conv.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// The outputs [*begin, *end) of a row of outputs whose input at
+// output * stride + offset lies inside [0, size).
+inline void depthwise_valid_outputs(const int_tp offset, const int_tp stride,
+                                    const int_tp outputs, const int_tp size,
+                                    int_tp* begin, int_tp* end) {
+  const int_tp first = offset >= 0 ? 0 : (stride - 1 - offset) / stride;
+  const int_tp last = size - 1 - offset < 0 ? 0 :
+      (size - 1 - offset) / stride + 1;
+  *begin = std::min(first, outputs);
+  *end = std::max(*begin, std::min(last, outputs));
+}
+
+// y[i * incy] += a * x[i * incx] for i < n. The unit stride loop is kept
+// separate so that the compiler vectorizes it across the row.
+template<typename Dtype>
+inline void depthwise_axpy(const int_tp n, const Dtype a, const Dtype* x,
+                           const int_tp incx, Dtype* y, const int_tp incy) {
+  if (incx == 1 && incy == 1) {
+    for (int_tp i = 0; i < n; ++i) {
+      y[i] += a * x[i];
+    }
+  } else {
+    for (int_tp i = 0; i < n; ++i) {
+      y[i * incy] += a * x[i * incx];
+    }
+  }
+}
+
+// The sum of x[i * incx] * y[i] for i < n.
+template<typename Dtype>
+inline Dtype depthwise_dot(const int_tp n, const Dtype* x, const int_tp incx,
+                           const Dtype* y) {
+  Dtype sum = 0;
+  if (incx == 1) {
+    for (int_tp i = 0; i < n; ++i) {
+      sum += x[i] * y[i];
+    }
+  } else {
+    for (int_tp i = 0; i < n; ++i) {
+      sum += x[i * incx] * y[i];
+    }
+  }
+  return sum;
+}
+
+template<typename Dtype>
+void depthwise_conv_cpu(const Dtype* data_im, const int_tp num,
+                        const int_tp channels, const int_tp height,
+                        const int_tp width, const int_tp kernel_h,
+                        const int_tp kernel_w, const int_tp pad_h,
+                        const int_tp pad_w, const int_tp stride_h,
+                        const int_tp stride_w, const int_tp dilation_h,
+                        const int_tp dilation_w, const Dtype* weights,
+                        const Dtype* bias, Dtype* data_out) {
+  const int_tp output_h = (height + 2 * pad_h -
+      (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int_tp output_w = (width + 2 * pad_w -
+      (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  Caffe::thread_pool().parallel_for(0, num * channels, 1,
+      [&](int_tp first, int_tp last) {
+    for (int_tp image = first; image < last; ++image) {
+      const int_tp channel = image % channels;
+      const Dtype* in = data_im + image * height * width;
+      const Dtype* weight = weights + channel * kernel_h * kernel_w;
+      const Dtype bias_value = bias ? bias[channel] : Dtype(0);
+      for (int_tp output_row = 0; output_row < output_h; ++output_row) {
+        Dtype* out = data_out + (image * output_h + output_row) * output_w;
+        std::fill(out, out + output_w, bias_value);
+        for (int_tp kernel_row = 0; kernel_row < kernel_h; ++kernel_row) {
+          const int_tp input_row =
+              output_row * stride_h - pad_h + kernel_row * dilation_h;
+          if (input_row < 0 || input_row >= height) {
+            continue;
+          }
+          for (int_tp kernel_col = 0; kernel_col < kernel_w; ++kernel_col) {
+            const int_tp offset = kernel_col * dilation_w - pad_w;
+            int_tp begin, end;
+            depthwise_valid_outputs(offset, stride_w, output_w, width, &begin,
+                                    &end);
+            depthwise_axpy(end - begin, weight[kernel_row * kernel_w +
+                           kernel_col], in + input_row * width + begin *
+                           stride_w + offset, stride_w, out + begin, 1);
+          }
+        }
+      }
+    }
+  });
+}
+
+template void depthwise_conv_cpu<float>(const float* data_im,
+    const int_tp num, const int_tp channels, const int_tp height,
+    const int_tp width, const int_tp kernel_h, const int_tp kernel_w,
+    const int_tp pad_h, const int_tp pad_w, const int_tp stride_h,
+    const int_tp stride_w, const int_tp dilation_h, const int_tp dilation_w,
+    const float* weights, const float* bias, float* data_out);
+template void depthwise_conv_cpu<double>(const double* data_im,
+    const int_tp num, const int_tp channels, const int_tp height,
+    const int_tp width, const int_tp kernel_h, const int_tp kernel_w,
+    const int_tp pad_h, const int_tp pad_w, const int_tp stride_h,
+    const int_tp stride_w, const int_tp dilation_h, const int_tp dilation_w,
+    const double* weights, const double* bias, double* data_out);
+
+template<typename Dtype>
+void depthwise_conv_backward_cpu(const Dtype* diff_out, const int_tp num,
+                                 const int_tp channels, const int_tp height,
+                                 const int_tp width, const int_tp kernel_h,
+                                 const int_tp kernel_w, const int_tp pad_h,
+                                 const int_tp pad_w, const int_tp stride_h,
+                                 const int_tp stride_w,
+                                 const int_tp dilation_h,
+                                 const int_tp dilation_w,
+                                 const Dtype* weights, Dtype* diff_im) {
+  const int_tp output_h = (height + 2 * pad_h -
+      (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int_tp output_w = (width + 2 * pad_w -
+      (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  Caffe::thread_pool().parallel_for(0, num * channels, 1,
+      [&](int_tp first, int_tp last) {
+    for (int_tp image = first; image < last; ++image) {
+      const int_tp channel = image % channels;
+      Dtype* in_diff = diff_im + image * height * width;
+      const Dtype* weight = weights + channel * kernel_h * kernel_w;
+      std::fill(in_diff, in_diff + height * width, Dtype(0));
+      for (int_tp output_row = 0; output_row < output_h; ++output_row) {
+        const Dtype* out_diff =
+            diff_out + (image * output_h + output_row) * output_w;
+        for (int_tp kernel_row = 0; kernel_row < kernel_h; ++kernel_row) {
+          const int_tp input_row =
+              output_row * stride_h - pad_h + kernel_row * dilation_h;
+          if (input_row < 0 || input_row >= height) {
+            continue;
+          }
+          for (int_tp kernel_col = 0; kernel_col < kernel_w; ++kernel_col) {
+            const int_tp offset = kernel_col * dilation_w - pad_w;
+            int_tp begin, end;
+            depthwise_valid_outputs(offset, stride_w, output_w, width, &begin,
+                                    &end);
+            depthwise_axpy(end - begin, weight[kernel_row * kernel_w +
+                           kernel_col], out_diff + begin, 1, in_diff +
+                           input_row * width + begin * stride_w + offset,
+                           stride_w);
+          }
+        }
+      }
+    }
+  });
+}
+
+template void depthwise_conv_backward_cpu<float>(const float* diff_out,
+    const int_tp num, const int_tp channels, const int_tp height,
+    const int_tp width, const int_tp kernel_h, const int_tp kernel_w,
+    const int_tp pad_h, const int_tp pad_w, const int_tp stride_h,
+    const int_tp stride_w, const int_tp dilation_h, const int_tp dilation_w,
+    const float* weights, float* diff_im);
+template void depthwise_conv_backward_cpu<double>(const double* diff_out,
+    const int_tp num, const int_tp channels, const int_tp height,
+    const int_tp width, const int_tp kernel_h, const int_tp kernel_w,
+    const int_tp pad_h, const int_tp pad_w, const int_tp stride_h,
+    const int_tp stride_w, const int_tp dilation_h, const int_tp dilation_w,
+    const double* weights, double* diff_im);
+
+template<typename Dtype>
+void depthwise_conv_weight_cpu(const Dtype* data_im, const Dtype* diff_out,
+                               const int_tp num, const int_tp channels,
+                               const int_tp height, const int_tp width,
+                               const int_tp kernel_h, const int_tp kernel_w,
+                               const int_tp pad_h, const int_tp pad_w,
+                               const int_tp stride_h, const int_tp stride_w,
+                               const int_tp dilation_h,
+                               const int_tp dilation_w, Dtype* weights_diff) {
+  const int_tp output_h = (height + 2 * pad_h -
+      (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int_tp output_w = (width + 2 * pad_w -
+      (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  // Each channel's weights only see the images of that channel, so the
+  // channels are independent.
+  Caffe::thread_pool().parallel_for(0, channels, 1,
+      [&](int_tp first, int_tp last) {
+    for (int_tp channel = first; channel < last; ++channel) {
+      Dtype* weight_diff = weights_diff + channel * kernel_h * kernel_w;
+      for (int_tp n = 0; n < num; ++n) {
+        const int_tp image = n * channels + channel;
+        const Dtype* in = data_im + image * height * width;
+        for (int_tp output_row = 0; output_row < output_h; ++output_row) {
+          const Dtype* out_diff =
+              diff_out + (image * output_h + output_row) * output_w;
+          for (int_tp kernel_row = 0; kernel_row < kernel_h; ++kernel_row) {
+            const int_tp input_row =
+                output_row * stride_h - pad_h + kernel_row * dilation_h;
+            if (input_row < 0 || input_row >= height) {
+              continue;
+            }
+            for (int_tp kernel_col = 0; kernel_col < kernel_w; ++kernel_col) {
+              const int_tp offset = kernel_col * dilation_w - pad_w;
+              int_tp begin, end;
+              depthwise_valid_outputs(offset, stride_w, output_w, width,
+                                      &begin, &end);
+              weight_diff[kernel_row * kernel_w + kernel_col] +=
+                  depthwise_dot(end - begin, in + input_row * width + begin *
+                                stride_w + offset, stride_w, out_diff + begin);
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+template void depthwise_conv_weight_cpu<float>(const float* data_im,
+    const float* diff_out, const int_tp num, const int_tp channels,
+    const int_tp height, const int_tp width, const int_tp kernel_h,
+    const int_tp kernel_w, const int_tp pad_h, const int_tp pad_w,
+    const int_tp stride_h, const int_tp stride_w, const int_tp dilation_h,
+    const int_tp dilation_w, float* weights_diff);
+template void depthwise_conv_weight_cpu<double>(const double* data_im,
+    const double* diff_out, const int_tp num, const int_tp channels,
+    const int_tp height, const int_tp width, const int_tp kernel_h,
+    const int_tp kernel_w, const int_tp pad_h, const int_tp pad_w,
+    const int_tp stride_h, const int_tp stride_w, const int_tp dilation_h,
+    const int_tp dilation_w, double* weights_diff);
+
+}  // namespace caffe
@@ -1,4 +1,15 @@
 #ifdef USE_FFT
+#include <boost/thread.hpp>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "caffe/common.hpp"
 #include "caffe/util/fft.hpp"
 
 namespace caffe {
@@ -72,6 +83,27 @@ void* caffe_cpu_fft_plan_many_dft_r2c<double>(int rank, const int *n,
       flags)));
 }
 
+template <>
+void* caffe_cpu_fft_plan_many_dft_c2r<float>(int rank, const int *n,
+    int howmany, std::complex<float> *in, const int *inembed, int istride,
+    int idist, float *out, const int *onembed, int ostride, int odist,
+    unsigned flags) {
+  return (reinterpret_cast<void *>(
+      fftwf_plan_many_dft_c2r(rank, n, howmany,
+      reinterpret_cast<fftwf_complex *> (in), inembed, istride, idist, out,
+      onembed, ostride, odist, flags)));
+}
+template <>
+void* caffe_cpu_fft_plan_many_dft_c2r<double>(int rank, const int *n,
+    int howmany, std::complex<double> *in, const int *inembed, int istride,
+    int idist, double *out, const int *onembed, int ostride, int odist,
+    unsigned flags) {
+  return (reinterpret_cast<void *>(
+      fftw_plan_many_dft_c2r(rank, n, howmany,
+      reinterpret_cast<fftw_complex*> (in), inembed, istride, idist, out,
+      onembed, ostride, odist, flags)));
+}
+
 template <>
 void caffe_cpu_fft_destroy_plan<float>(void* plan) {
   fftwf_destroy_plan((fftwf_plan)plan);
@@ -114,5 +146,153 @@ void caffe_cpu_fft_execute_dft_c2r<double>(const void* plan,
       reinterpret_cast<fftw_complex*> (in),  out);
 }
 
+// The float and double FFTW libraries keep separate planner state, wisdom
+// and thread settings.
+template <typename Dtype> void fft_init_threads(int threads);
+template <typename Dtype> bool fft_import_wisdom(const string& filename);
+template <typename Dtype> bool fft_export_wisdom(const string& filename);
+template <typename Dtype> const char* fft_wisdom_name();
+
+template <>
+void fft_init_threads<float>(int threads) {
+#ifdef USE_FFTW_THREADS
+  CHECK(fftwf_init_threads()) << "Failed to initialize FFTW threads";
+  fftwf_plan_with_nthreads(threads);
+#endif
+}
+template <>
+void fft_init_threads<double>(int threads) {
+#ifdef USE_FFTW_THREADS
+  CHECK(fftw_init_threads()) << "Failed to initialize FFTW threads";
+  fftw_plan_with_nthreads(threads);
+#endif
+}
+
+template <>
+bool fft_import_wisdom<float>(const string& filename) {
+  return fftwf_import_wisdom_from_filename(filename.c_str());
+}
+template <>
+bool fft_import_wisdom<double>(const string& filename) {
+  return fftw_import_wisdom_from_filename(filename.c_str());
+}
+
+template <>
+bool fft_export_wisdom<float>(const string& filename) {
+  return fftwf_export_wisdom_to_filename(filename.c_str());
+}
+template <>
+bool fft_export_wisdom<double>(const string& filename) {
+  return fftw_export_wisdom_to_filename(filename.c_str());
+}
+
+template <> const char* fft_wisdom_name<float>() { return "fftwf_wisdom"; }
+template <> const char* fft_wisdom_name<double>() { return "fftw_wisdom"; }
+
+// Process wide cache of batched 2D real transform plans for one Dtype. The
+// FFTW planner is not thread safe, so planning holds the lock; running the
+// plans does not need it.
+template <typename Dtype>
+class FFTPlanCache {
+ public:
+  static FFTPlanCache& Get() {
+    static FFTPlanCache cache;
+    return cache;
+  }
+
+  void* Plan(const bool r2c, const int n0, const int n1, const int howmany,
+             const bool in_place) {
+    vector<int> key;
+    key.push_back(r2c);
+    key.push_back(n0);
+    key.push_back(n1);
+    key.push_back(howmany);
+    key.push_back(in_place);
+    boost::mutex::scoped_lock lock(mutex_);
+    typename std::map<vector<int>, void*>::iterator it = plans_.find(key);
+    if (it != plans_.end()) {
+      return it->second;
+    }
+    void* plan = Create(r2c, n0, n1, howmany, in_place);
+    plans_[key] = plan;
+    if (!wisdom_file_.empty()) {
+      LOG_IF(WARNING, !fft_export_wisdom<Dtype>(wisdom_file_))
+          << "Failed to save FFTW wisdom to " << wisdom_file_;
+    }
+    return plan;
+  }
+
+ private:
+  FFTPlanCache() {
+#ifdef _OPENMP
+    fft_init_threads<Dtype>(omp_get_max_threads());
+#else
+    fft_init_threads<Dtype>(boost::thread::hardware_concurrency());
+#endif
+    const char* wisdom_dir = std::getenv("CAFFE_FFTW_WISDOM");
+    if (wisdom_dir) {
+      wisdom_file_ = string(wisdom_dir) + "/" + fft_wisdom_name<Dtype>();
+      if (fft_import_wisdom<Dtype>(wisdom_file_)) {
+        LOG(INFO) << "Loaded FFTW wisdom from " << wisdom_file_;
+      }
+    }
+  }
+
+  // Plans on scratch buffers, since FFTW_MEASURE overwrites its arrays.
+  void* Create(const bool r2c, const int n0, const int n1, const int howmany,
+               const bool in_place) {
+    const int complex_n1 = n1 / 2 + 1;
+    const int real_n1 = in_place ? 2 * complex_n1 : n1;
+    const int real_dist = n0 * real_n1;
+    const int complex_dist = n0 * complex_n1;
+    const int n[2] = { n0, n1 };
+    const int real_embed[2] = { n0, real_n1 };
+    const int complex_embed[2] = { n0, complex_n1 };
+    Dtype* real = reinterpret_cast<Dtype*>(caffe_cpu_fft_malloc<Dtype>(
+        howmany * real_dist * sizeof(Dtype)));
+    std::complex<Dtype>* complex = in_place ?
+        reinterpret_cast<std::complex<Dtype>*>(real) :
+        reinterpret_cast<std::complex<Dtype>*>(caffe_cpu_fft_malloc<Dtype>(
+            howmany * complex_dist * sizeof(std::complex<Dtype>)));
+    void* plan = r2c ?
+        caffe_cpu_fft_plan_many_dft_r2c<Dtype>(2, n, howmany, real,
+            real_embed, 1, real_dist, complex, complex_embed, 1,
+            complex_dist, FFTW_MEASURE) :
+        caffe_cpu_fft_plan_many_dft_c2r<Dtype>(2, n, howmany, complex,
+            complex_embed, 1, complex_dist, real, real_embed, 1, real_dist,
+            FFTW_MEASURE);
+    CHECK(plan) << "FFTW could not plan " << howmany << " transforms of "
+                << n0 << " x " << n1;
+    if (!in_place) {
+      caffe_cpu_fft_free<Dtype>(complex);
+    }
+    caffe_cpu_fft_free<Dtype>(real);
+    return plan;
+  }
+
+  boost::mutex mutex_;
+  std::map<vector<int>, void*> plans_;
+  string wisdom_file_;
+};
+
+template <typename Dtype>
+void* caffe_cpu_fft_cached_plan_r2c(int n0, int n1, int howmany,
+                                    bool in_place) {
+  return FFTPlanCache<Dtype>::Get().Plan(true, n0, n1, howmany, in_place);
+}
+template void* caffe_cpu_fft_cached_plan_r2c<float>(int n0, int n1,
+    int howmany, bool in_place);
+template void* caffe_cpu_fft_cached_plan_r2c<double>(int n0, int n1,
+    int howmany, bool in_place);
+
+template <typename Dtype>
+void* caffe_cpu_fft_cached_plan_c2r(int n0, int n1, int howmany) {
+  return FFTPlanCache<Dtype>::Get().Plan(false, n0, n1, howmany, false);
+}
+template void* caffe_cpu_fft_cached_plan_c2r<float>(int n0, int n1,
+    int howmany);
+template void* caffe_cpu_fft_cached_plan_c2r<double>(int n0, int n1,
+    int howmany);
+
 }  // namespace caffe
 #endif  // USE_FFT
@@ -0,0 +1,252 @@
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+namespace caffe {
+
+static bool Reads(const LayerParameter& layer_param, const string& blob_name) {
+  for (int_tp i = 0; i < layer_param.bottom_size(); ++i) {
+    if (layer_param.bottom(i) == blob_name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool Writes(const LayerParameter& layer_param,
+                   const string& blob_name) {
+  for (int_tp i = 0; i < layer_param.top_size(); ++i) {
+    if (layer_param.top(i) == blob_name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether the value of blob_name that the layers before consumer_id left
+// is read by consumer_id only, so that the consumer can be folded into the
+// layer producing it.
+static bool OnlyConsumer(const NetParameter& param, const int_tp consumer_id,
+                         const string& blob_name) {
+  if (Writes(param.layer(consumer_id), blob_name)) {
+    return true;
+  }
+  for (int_tp i = consumer_id + 1; i < param.layer_size(); ++i) {
+    if (Reads(param.layer(i), blob_name)) {
+      return false;
+    }
+    if (Writes(param.layer(i), blob_name)) {
+      return true;
+    }
+  }
+  return true;
+}
+
+// Whether layer_id computes per element on the output of conv_param alone,
+// in the same data type.
+static bool CanFold(const NetParameter& param, const int_tp layer_id,
+                    const LayerParameter& conv_param,
+                    const string& blob_name) {
+  if (layer_id >= param.layer_size()) {
+    return false;
+  }
+  const LayerParameter& layer_param = param.layer(layer_id);
+  return layer_param.bottom_size() == 1 && layer_param.top_size() == 1 &&
+      layer_param.bottom(0) == blob_name &&
+      layer_param.loss_weight_size() == 0 &&
+      layer_param.bottom_data_type() == conv_param.top_data_type() &&
+      layer_param.top_data_type() == conv_param.top_data_type() &&
+      OnlyConsumer(param, layer_id, blob_name);
+}
+
+static bool IsFoldableBatchNorm(const LayerParameter& layer_param) {
+  const BatchNormParameter& bn_param = layer_param.batch_norm_param();
+  return layer_param.type() == "BatchNorm" &&
+      (!bn_param.has_use_global_stats() || bn_param.use_global_stats()) &&
+      !bn_param.fused_relu();
+}
+
+static bool IsFoldableScale(const LayerParameter& layer_param) {
+  const ScaleParameter& scale_param = layer_param.scale_param();
+  return layer_param.type() == "Scale" && scale_param.axis() == 1 &&
+      scale_param.num_axes() == 1;
+}
+
+// The summand of a two bottom Eltwise other than blob_name.
+static string Residual(const LayerParameter& eltwise_param,
+                       const string& blob_name) {
+  return eltwise_param.bottom(0) == blob_name ?
+      eltwise_param.bottom(1) : eltwise_param.bottom(0);
+}
+
+// The convolutions that can take a fuse_type: the CPU engine, if the net
+// runs on the CPU, and the Intel spatial engine.
+static bool CanFuseActivations(const LayerParameter& conv_param,
+                               const bool fuse_activations) {
+  const ConvolutionParameter_Engine engine =
+      conv_param.convolution_param().engine();
+  return engine == ConvolutionParameter_Engine_INTEL_SPATIAL ||
+      (fuse_activations && (engine == ConvolutionParameter_Engine_DEFAULT ||
+                            engine == ConvolutionParameter_Engine_CAFFE));
+}
+
+// Whether layer_id is an LRN across channels that the CPU computes fused
+// with the max pooling following it.
+static bool CanFusePoolMax(const NetParameter& param, const int_tp layer_id,
+                           const bool fuse_activations) {
+  const LayerParameter& layer_param = param.layer(layer_id);
+  const LRNParameter& lrn_param = layer_param.lrn_param();
+  if (!fuse_activations || layer_param.type() != "LRN" ||
+      layer_param.bottom_size() != 1 || layer_param.top_size() != 1 ||
+      lrn_param.norm_region() != LRNParameter_NormRegion_ACROSS_CHANNELS ||
+      lrn_param.fuse_type() != LRNParameter_FuseType_UNFUSED ||
+      !CanFold(param, layer_id + 1, layer_param, layer_param.top(0))) {
+    return false;
+  }
+  const LayerParameter& pool_param = param.layer(layer_id + 1);
+  return pool_param.type() == "Pooling" &&
+      pool_param.pooling_param().pool() == PoolingParameter_PoolMethod_MAX;
+}
+
+void FuseLayers(const NetParameter& param, const bool fuse_activations,
+                NetParameter* param_fused,
+                map<string, vector<LayerParameter> >* folded_layers) {
+  // Initialize by copying from the input NetParameter.
+  param_fused->CopyFrom(param);
+  param_fused->clear_layer();
+  folded_layers->clear();
+  for (int_tp i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    LayerParameter* fused_param = param_fused->add_layer();
+    fused_param->CopyFrom(layer_param);
+    if (CanFusePoolMax(param, i, fuse_activations)) {
+      const LayerParameter& pool_param = param.layer(i + 1);
+      LRNParameter* lrn_param = fused_param->mutable_lrn_param();
+      lrn_param->set_fuse_type(LRNParameter_FuseType_FUSED_POOL_MAX);
+      lrn_param->mutable_pooling_param()->CopyFrom(
+          pool_param.pooling_param());
+      fused_param->set_top(0, pool_param.top(0));
+      LOG_IF(INFO, Caffe::root_solver()) << "Fused " << pool_param.name()
+          << " into " << layer_param.name();
+      ++i;
+      continue;
+    }
+    if (layer_param.type() != "Convolution" ||
+        layer_param.bottom_size() != 1 || layer_param.top_size() != 1 ||
+        layer_param.convolution_param().fuse_type() !=
+        ConvolutionParameter_FuseType_UNFUSED) {
+      continue;
+    }
+    // The layers after the convolution are folded in order, each reading the
+    // output of the previous one, which nothing else reads.
+    string top = layer_param.top(0);
+    int_tp next = i + 1;
+    vector<LayerParameter>& folded = (*folded_layers)[layer_param.name()];
+    while (CanFold(param, next, layer_param, top) &&
+           (IsFoldableBatchNorm(param.layer(next)) ||
+            IsFoldableScale(param.layer(next)))) {
+      folded.push_back(param.layer(next));
+      top = param.layer(next).top(0);
+      ++next;
+    }
+    if (folded.empty()) {
+      folded_layers->erase(layer_param.name());
+    } else {
+      fused_param->mutable_convolution_param()->set_bias_term(true);
+    }
+    if (CanFuseActivations(layer_param, fuse_activations) &&
+        next < param.layer_size()) {
+      const LayerParameter& next_param = param.layer(next);
+      ConvolutionParameter* conv_param =
+          fused_param->mutable_convolution_param();
+      if (CanFold(param, next, layer_param, top) &&
+          next_param.type() == "ReLU") {
+        conv_param->set_fuse_type(
+            ConvolutionParameter_FuseType_FUSED_CONV_RELU);
+        conv_param->mutable_relu_param()->CopyFrom(next_param.relu_param());
+        top = next_param.top(0);
+        ++next;
+      } else if (next_param.type() == "Eltwise" &&
+                 next_param.bottom_size() == 2 &&
+                 next_param.bottom(0) != next_param.bottom(1) &&
+                 next_param.top_size() == 1 &&
+                 next_param.eltwise_param().operation() ==
+                 EltwiseParameter_EltwiseOp_SUM &&
+                 next_param.eltwise_param().coeff_size() == 0 &&
+                 next_param.loss_weight_size() == 0 &&
+                 next_param.top_data_type() == layer_param.top_data_type() &&
+                 Reads(next_param, top) && OnlyConsumer(param, next, top) &&
+                 CanFold(param, next + 1, layer_param, next_param.top(0)) &&
+                 param.layer(next + 1).type() == "ReLU" &&
+                 !Writes(param.layer(next + 1), Residual(next_param, top))) {
+        // The other summand becomes the residual bottom of the convolution.
+        fused_param->add_bottom(Residual(next_param, top));
+        conv_param->set_fuse_type(
+            ConvolutionParameter_FuseType_FUSED_CONV_ELTWISE_RELU);
+        conv_param->mutable_eltwise_param()->CopyFrom(
+            next_param.eltwise_param());
+        conv_param->mutable_relu_param()->CopyFrom(
+            param.layer(next + 1).relu_param());
+        top = param.layer(next + 1).top(0);
+        next += 2;
+      }
+      if (conv_param->fuse_type() != ConvolutionParameter_FuseType_UNFUSED &&
+          conv_param->engine() == ConvolutionParameter_Engine_DEFAULT) {
+        conv_param->set_engine(ConvolutionParameter_Engine_CAFFE);
+      }
+    }
+    if (next > i + 1) {
+      fused_param->set_top(0, top);
+      LOG_IF(INFO, Caffe::root_solver()) << "Fused " << next - i - 1
+          << " layers following " << layer_param.name() << " into it";
+    }
+    i = next - 1;
+  }
+}
+
+template<typename Dtype>
+void FoldLayerWeights(const LayerParameter& folded_layer,
+    const vector<const Dtype*>& folded_weights, const int_tp num_output,
+    const int_tp weight_dim, Dtype* conv_weights, Dtype* conv_bias) {
+  // Both layers compute scale[c] * x + shift[c] for each channel c.
+  vector<Dtype> scale(num_output), shift(num_output, Dtype(0));
+  if (folded_layer.type() == "BatchNorm") {
+    CHECK_EQ(folded_weights.size(), 3);
+    // The statistics are stored multiplied by the moving average factor.
+    const Dtype factor = folded_weights[2][0] == 0 ?
+        Dtype(0) : Dtype(1) / folded_weights[2][0];
+    const Dtype eps = folded_layer.batch_norm_param().eps();
+    for (int_tp c = 0; c < num_output; ++c) {
+      scale[c] = Dtype(1) / std::sqrt(folded_weights[1][c] * factor + eps);
+      shift[c] = -folded_weights[0][c] * factor * scale[c];
+    }
+  } else {
+    CHECK_EQ(folded_layer.type(), "Scale");
+    CHECK_GE(folded_weights.size(), 1);
+    for (int_tp c = 0; c < num_output; ++c) {
+      scale[c] = folded_weights[0][c];
+      if (folded_layer.scale_param().bias_term()) {
+        shift[c] = folded_weights[1][c];
+      }
+    }
+  }
+  for (int_tp c = 0; c < num_output; ++c) {
+    for (int_tp j = 0; j < weight_dim; ++j) {
+      conv_weights[c * weight_dim + j] *= scale[c];
+    }
+    conv_bias[c] = scale[c] * conv_bias[c] + shift[c];
+  }
+}
+
+template void FoldLayerWeights<float>(const LayerParameter& folded_layer,
+    const vector<const float*>& folded_weights, const int_tp num_output,
+    const int_tp weight_dim, float* conv_weights, float* conv_bias);
+template void FoldLayerWeights<double>(const LayerParameter& folded_layer,
+    const vector<const double*>& folded_weights, const int_tp num_output,
+    const int_tp weight_dim, double* conv_weights, double* conv_bias);
+
+}  // namespace caffe
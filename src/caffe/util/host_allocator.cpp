@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#if !defined(_MSC_VER) && !defined(USE_MKL)
+#include <sys/mman.h>
+#endif
+
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+static const uint_tp kPageBytes = CAFFE_MALLOC_PAGE_ALIGN;
+static const uint_tp kHugePageBytes = 2 * 1024 * 1024;
+// Allocations beyond kLargeBytes are not rounded to a size class.
+static const uint_tp kLargeBytes = 1024 * 1024;
+
+static uint_tp Pages(uint_tp size) {
+  return std::max((size + kPageBytes - 1) / kPageBytes, uint_tp(1));
+}
+
+// Size classes 0 to 3 are of 1 to 4 pages, the next ones of 5, 6, 7, 8,
+// then 10, 12, 14, 16 pages and so on, four per power of two.
+static int_tp SizeClass(uint_tp size) {
+  if (size > kLargeBytes) {
+    return -1;
+  }
+  const uint_tp pages = Pages(size);
+  if (pages <= 4) {
+    return pages - 1;
+  }
+  int_tp exponent = 2;
+  while ((uint_tp(1) << (exponent + 1)) < pages) {
+    ++exponent;
+  }
+  const uint_tp step = uint_tp(1) << (exponent - 2);
+  return 4 * (exponent - 1) + (pages + step - 1) / step - 5;
+}
+
+static uint_tp SizeClassBytes(int_tp size_class) {
+  if (size_class < 4) {
+    return (size_class + 1) * kPageBytes;
+  }
+  const int_tp exponent = size_class / 4 + 1;
+  return ((size_class % 4 + 5) * kPageBytes) << (exponent - 2);
+}
+
+static int_tp NumClasses() {
+  return SizeClass(kLargeBytes) + 1;
+}
+
+static uint_tp BlockBytes(uint_tp size) {
+  const int_tp size_class = SizeClass(size);
+  return size_class >= 0 ? SizeClassBytes(size_class) :
+      Pages(size) * kPageBytes;
+}
+
+HostAllocator* HostAllocator::Get() {
+  // Never destroyed, as blocks may be freed during static destruction.
+  static HostAllocator* allocator = new HostAllocator();
+  return allocator;
+}
+
+HostAllocator::HostAllocator()
+    : global_blocks_(NumClasses()), cache_limit_(uint_tp(1024) << 20),
+      huge_pages_(false), hits_(0), misses_(0), requested_bytes_(0),
+      allocated_bytes_(0), peak_allocated_bytes_(0), cached_bytes_(0) {
+  if (std::getenv("CAFFE_HOST_CACHE_LIMIT")) {
+    cache_limit_ = static_cast<uint_tp>(
+        std::atol(std::getenv("CAFFE_HOST_CACHE_LIMIT"))) << 20;
+  }
+  if (std::getenv("CAFFE_HOST_HUGE_PAGES")) {
+    huge_pages_ = std::atoi(std::getenv("CAFFE_HOST_HUGE_PAGES")) != 0;
+  }
+}
+
+HostAllocator::ThreadCache::~ThreadCache() {
+  HostAllocator::Get()->ReleaseToGlobal(this);
+}
+
+HostAllocator::ThreadCache* HostAllocator::thread_cache() {
+  ThreadCache* cache = thread_cache_.get();
+  if (!cache) {
+    cache = new ThreadCache();
+    cache->blocks.resize(NumClasses());
+    thread_cache_.reset(cache);
+  }
+  return cache;
+}
+
+void HostAllocator::ReleaseToGlobal(ThreadCache* cache) {
+  boost::mutex::scoped_lock lock(mutex_);
+  for (int_tp i = 0; i < cache->blocks.size(); ++i) {
+    global_blocks_[i].insert(global_blocks_[i].end(),
+                             cache->blocks[i].begin(), cache->blocks[i].end());
+    cache->blocks[i].clear();
+  }
+}
+
+HostAllocator::BlockTable* HostAllocator::block_table(void* ptr) {
+  return &block_tables_[(reinterpret_cast<uintptr_t>(ptr) / kPageBytes)
+                        % kNumBlockTables];
+}
+
+void* HostAllocator::SystemAllocate(uint_tp bytes) {
+  const bool huge_pages = huge_pages_ && bytes >= kHugePageBytes;
+  const uint_tp alignment = huge_pages ? kHugePageBytes : kPageBytes;
+  void* block = nullptr;
+#ifdef USE_MKL
+  block = mkl_malloc(bytes, alignment);
+#else
+#ifdef _MSC_VER
+  block = _aligned_malloc(bytes, alignment);
+#else
+  CHECK_EQ(0, posix_memalign(&block, alignment, bytes))
+      << "Host memory allocation error of size: " << bytes << " b";
+#ifdef MADV_HUGEPAGE
+  if (huge_pages) {
+    // Advisory only, the kernel falls back to regular pages. The tail of the
+    // block short of a whole huge page keeps regular pages.
+    madvise(block, bytes & ~(kHugePageBytes - 1), MADV_HUGEPAGE);
+  }
+#endif  // MADV_HUGEPAGE
+#endif  // _MSC_VER
+#endif  // USE_MKL
+  CHECK(block) << "Host allocation of size " << bytes << " failed";
+  return block;
+}
+
+void HostAllocator::SystemFree(void* ptr) {
+#ifdef USE_MKL
+  mkl_free(ptr);
+#else
+#ifdef _MSC_VER
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif  // _MSC_VER
+#endif  // USE_MKL
+}
+
+void* HostAllocator::Allocate(uint_tp size) {
+  const int_tp size_class = SizeClass(size);
+  uint_tp bytes = BlockBytes(size);
+  void* ptr = nullptr;
+  if (size_class >= 0) {
+    ThreadCache* cache = thread_cache();
+    if (!cache->blocks[size_class].empty()) {
+      ptr = cache->blocks[size_class].back();
+      cache->blocks[size_class].pop_back();
+    } else {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (!global_blocks_[size_class].empty()) {
+        ptr = global_blocks_[size_class].back();
+        global_blocks_[size_class].pop_back();
+      }
+    }
+  } else {
+    boost::mutex::scoped_lock lock(mutex_);
+    std::multimap<uint_tp, void*>::iterator it =
+        large_blocks_.lower_bound(bytes);
+    if (it != large_blocks_.end() && it->first <= bytes + bytes / 8) {
+      bytes = it->first;
+      ptr = it->second;
+      large_blocks_.erase(it);
+    }
+  }
+  if (ptr) {
+    ++hits_;
+    cached_bytes_ -= bytes;
+  } else {
+    ++misses_;
+    ptr = SystemAllocate(bytes);
+  }
+  Block block;
+  block.size_class = size_class;
+  block.size = size;
+  block.bytes = bytes;
+  BlockTable* table = block_table(ptr);
+  {
+    boost::mutex::scoped_lock lock(table->mutex);
+    table->blocks[ptr] = block;
+  }
+  requested_bytes_ += size;
+  const uint_tp allocated = (allocated_bytes_ += bytes);
+  uint_tp peak = peak_allocated_bytes_;
+  while (allocated > peak &&
+         !peak_allocated_bytes_.compare_exchange_weak(peak, allocated)) {
+  }
+  return ptr;
+}
+
+uint_tp HostAllocator::Free(void* ptr) {
+  Block block;
+  BlockTable* table = block_table(ptr);
+  {
+    boost::mutex::scoped_lock lock(table->mutex);
+    std::unordered_map<void*, Block>::iterator it = table->blocks.find(ptr);
+    CHECK(it != table->blocks.end()) << "Freeing unknown host memory";
+    block = it->second;
+    table->blocks.erase(it);
+  }
+  const int_tp size_class = block.size_class;
+  const uint_tp bytes = block.bytes;
+  requested_bytes_ -= block.size;
+  allocated_bytes_ -= bytes;
+  if ((cached_bytes_ += bytes) > cache_limit_) {
+    cached_bytes_ -= bytes;
+    SystemFree(ptr);
+    return block.size;
+  }
+  if (size_class < 0) {
+    boost::mutex::scoped_lock lock(mutex_);
+    large_blocks_.insert(std::make_pair(bytes, ptr));
+    return block.size;
+  }
+  ThreadCache* cache = thread_cache();
+  if (cache->blocks[size_class].size() < kThreadCacheBlocks) {
+    cache->blocks[size_class].push_back(ptr);
+  } else {
+    boost::mutex::scoped_lock lock(mutex_);
+    global_blocks_[size_class].push_back(ptr);
+  }
+  return block.size;
+}
+
+void HostAllocator::EmptyCache() {
+  ReleaseToGlobal(thread_cache());
+  boost::mutex::scoped_lock lock(mutex_);
+  for (int_tp i = 0; i < global_blocks_.size(); ++i) {
+    for (int_tp j = 0; j < global_blocks_[i].size(); ++j) {
+      SystemFree(global_blocks_[i][j]);
+      cached_bytes_ -= SizeClassBytes(i);
+    }
+    global_blocks_[i].clear();
+  }
+  for (std::multimap<uint_tp, void*>::iterator it = large_blocks_.begin();
+       it != large_blocks_.end(); ++it) {
+    SystemFree(it->second);
+    cached_bytes_ -= it->first;
+  }
+  large_blocks_.clear();
+}
+HostAllocator::Stats HostAllocator::stats() const {
+  Stats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.requested_bytes = requested_bytes_;
+  stats.allocated_bytes = allocated_bytes_;
+  stats.peak_allocated_bytes = peak_allocated_bytes_;
+  stats.cached_bytes = cached_bytes_;
+  return stats;
+}
+
+void HostAllocator::set_cache_limit(uint_tp bytes) {
+  cache_limit_ = bytes;
+}
+
+void HostAllocator::set_huge_pages(bool huge_pages) {
+  huge_pages_ = huge_pages;
+}
+
+uint_tp HostAllocator::class_bytes(uint_tp size) {
+  return BlockBytes(size);
+}
+
+uint_tp HostAllocator::size(void* ptr) {
+  BlockTable* table = Get()->block_table(ptr);
+  boost::mutex::scoped_lock lock(table->mutex);
+  std::unordered_map<void*, Block>::iterator it = table->blocks.find(ptr);
+  CHECK(it != table->blocks.end()) << "Unknown host memory";
+  return it->second.size;
+}
+
+}  // namespace caffe
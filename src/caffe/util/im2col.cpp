@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -15,6 +17,67 @@ inline bool is_a_ge_zero_and_a_lt_b(int_tp a, int_tp b) {
   return static_cast<unsigned>(a) < static_cast<unsigned>(b);
 }
 
+// The outputs [*begin, *end) of a row of outputs whose input at
+// output * stride + offset lies inside [0, size).
+inline void im2col_valid_outputs(const int_tp offset, const int_tp stride,
+                                 const int_tp outputs, const int_tp size,
+                                 int_tp* begin, int_tp* end) {
+  const int_tp first = offset >= 0 ? 0 : (stride - 1 - offset) / stride;
+  const int_tp last = size - 1 - offset < 0 ? 0 :
+      (size - 1 - offset) / stride + 1;
+  *begin = std::min(first, outputs);
+  *end = std::max(*begin, std::min(last, outputs));
+}
+
+// im2col_cpu with the rows of the column matrix col_stride values apart.
+// Each row of the column matrix (one channel and kernel offset) is written
+// by one thread. Within an output row, only the padding at either end is
+// zeroed, and stride 1 rows are copied from the image with memcpy.
+template<typename Dtype>
+static void im2col_cpu_strided(const Dtype* data_im, const int_tp channels,
+                               const int_tp height, const int_tp width,
+                               const int_tp kernel_h, const int_tp kernel_w,
+                               const int_tp pad_h, const int_tp pad_w,
+                               const int_tp stride_h, const int_tp stride_w,
+                               const int_tp dilation_h, const int_tp dilation_w,
+                               const int_tp col_stride, Dtype* data_col) {
+  const int_tp output_h = (height + 2 * pad_h
+      - (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int_tp output_w =
+      (width + 2 * pad_w - (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  const int_tp kernel_size = kernel_h * kernel_w;
+  Caffe::thread_pool().parallel_for(0, channels * kernel_size, 1,
+      [&](int_tp first, int_tp last) {
+    for (int_tp c_col = first; c_col < last; ++c_col) {
+      const int_tp kernel_row = c_col / kernel_w % kernel_h;
+      const int_tp kernel_col = c_col % kernel_w;
+      const Dtype* im = data_im + c_col / kernel_size * height * width;
+      Dtype* col = data_col + c_col * col_stride;
+      const int_tp offset = kernel_col * dilation_w - pad_w;
+      int_tp begin, end;
+      im2col_valid_outputs(offset, stride_w, output_w, width, &begin, &end);
+      int_tp input_row = kernel_row * dilation_h - pad_h;
+      for (int_tp output_row = 0; output_row < output_h;
+           ++output_row, input_row += stride_h, col += output_w) {
+        if (!is_a_ge_zero_and_a_lt_b(input_row, height) || begin == end) {
+          std::fill(col, col + output_w, Dtype(0));
+          continue;
+        }
+        const Dtype* in = im + input_row * width + begin * stride_w + offset;
+        std::fill(col, col + begin, Dtype(0));
+        if (stride_w == 1) {
+          std::copy(in, in + end - begin, col + begin);
+        } else {
+          for (int_tp output_col = begin; output_col < end; ++output_col) {
+            col[output_col] = in[(output_col - begin) * stride_w];
+          }
+        }
+        std::fill(col + end, col + output_w, Dtype(0));
+      }
+    }
+  });
+}
+
 template<typename Dtype>
 void im2col_cpu(const Dtype* data_im, const int_tp channels,
                 const int_tp height, const int_tp width, const int_tp kernel_h,
@@ -26,32 +89,9 @@ void im2col_cpu(const Dtype* data_im, const int_tp channels,
       - (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
   const int_tp output_w =
       (width + 2 * pad_w - (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
-  const int_tp channel_size = height * width;
-  for (int_tp channel = channels; channel--; data_im += channel_size) {
-    for (int_tp kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
-      for (int_tp kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int_tp input_row = -pad_h + kernel_row * dilation_h;
-        for (int_tp output_rows = output_h; output_rows; output_rows--) {
-          if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            for (int_tp output_cols = output_w; output_cols; output_cols--) {
-              *(data_col++) = 0;
-            }
-          } else {
-            int_tp input_col = -pad_w + kernel_col * dilation_w;
-            for (int_tp output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                *(data_col++) = data_im[input_row * width + input_col];
-              } else {
-                *(data_col++) = 0;
-              }
-              input_col += stride_w;
-            }
-          }
-          input_row += stride_h;
-        }
-      }
-    }
-  }
+  im2col_cpu_strided(data_im, channels, height, width, kernel_h, kernel_w,
+                     pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+                     output_h * output_w, data_col);
 }
 
 // Explicit instantiation
@@ -79,6 +119,9 @@ template void im2col_cpu<double>(const double* data_im, const int_tp channels,
                                  const int_tp dilation_h,
                                  const int_tp dilation_w, double* data_col);
 
+// The rows of the column matrix are split over threads. For im2col every
+// row is independent; for col2im all rows of a channel scatter into the
+// same image plane, so whole channels are handed out instead.
 template<typename Dtype>
 inline void im2col_nd_core_cpu(const Dtype* data_input, const bool im2col,
                                const int_tp num_spatial_axes,
@@ -86,70 +129,77 @@ inline void im2col_nd_core_cpu(const Dtype* data_input, const bool im2col,
                                const int_tp* kernel_shape, const int_tp* pad,
                                const int_tp* stride, const int_tp* dilation,
                                Dtype* data_output) {
-  if (!im2col) {
-    int_tp im_size = im_shape[0];
-    for (int_tp i = 0; i < num_spatial_axes; ++i) {
-      im_size *= im_shape[1 + i];
-    }
-    caffe_set(im_size, Dtype(0), data_output);
+  int_tp channel_size = 1;
+  for (int_tp i = 0; i < num_spatial_axes; ++i) {
+    channel_size *= im_shape[1 + i];
   }
   int_tp kernel_size = 1;
   for (int_tp i = 0; i < num_spatial_axes; ++i) {
     kernel_size *= kernel_shape[i];
   }
   const int_tp channels_col = col_shape[0];
-  vector<int_tp> d_offset(num_spatial_axes, 0);
-  vector<int_tp> d_iter(num_spatial_axes, 0);
-  for (int_tp c_col = 0; c_col < channels_col; ++c_col) {
-    // Loop over spatial axes in reverse order to compute a per-axis offset.
-    int_tp offset = c_col;
-    for (int_tp d_i = num_spatial_axes - 1; d_i >= 0; --d_i) {
-      if (d_i < num_spatial_axes - 1) {
-        offset /= kernel_shape[d_i + 1];
+  const int_tp rows_per_task = im2col ? 1 : kernel_size;
+  Caffe::thread_pool().parallel_for(0, channels_col / rows_per_task, 1,
+      [&](int_tp first, int_tp last) {
+    for (int_tp task = first; task < last; ++task) {
+      if (!im2col) {
+        caffe_set(channel_size, Dtype(0), data_output + task * channel_size);
       }
-      d_offset[d_i] = offset % kernel_shape[d_i];
-    }
-    for (bool incremented = true; incremented;) {
-      // Loop over spatial axes in forward order to compute the indices in the
-      // image and column, and whether the index lies in the padding.
-      int_tp index_col = c_col;
-      int_tp index_im = c_col / kernel_size;
-      bool is_padding = false;
-      for (int_tp d_i = 0; d_i < num_spatial_axes; ++d_i) {
-        const int_tp d = d_iter[d_i];
-        const int_tp d_im = d * stride[d_i] - pad[d_i]
-            + d_offset[d_i] * dilation[d_i];
-        is_padding |= d_im < 0 || d_im >= im_shape[d_i + 1];
-        index_col *= col_shape[d_i + 1];
-        index_col += d;
-        index_im *= im_shape[d_i + 1];
-        index_im += d_im;
-      }
-      if (im2col) {
-        if (is_padding) {
-          data_output[index_col] = 0;
-        } else {
-          data_output[index_col] = data_input[index_im];
-        }
-      } else if (!is_padding) {  // col2im
-        data_output[index_im] += data_input[index_col];
-      }
-      // Loop over spatial axes in reverse order to choose an index,
-      // like counting.
-      incremented = false;
-      for (int_tp d_i = num_spatial_axes - 1; d_i >= 0; --d_i) {
-        const int_tp d_max = col_shape[d_i + 1];
-        DCHECK_LT(d_iter[d_i], d_max);
-        if (d_iter[d_i] == d_max - 1) {
-          d_iter[d_i] = 0;
-        } else {  // d_iter[d_i] < d_max - 1
-          ++d_iter[d_i];
-          incremented = true;
-          break;
+      vector<int_tp> d_offset(num_spatial_axes, 0);
+      vector<int_tp> d_iter(num_spatial_axes, 0);
+      for (int_tp c_col = task * rows_per_task;
+           c_col < (task + 1) * rows_per_task; ++c_col) {
+        // Loop over spatial axes in reverse order to compute a per-axis offset.
+        int_tp offset = c_col;
+        for (int_tp d_i = num_spatial_axes - 1; d_i >= 0; --d_i) {
+          if (d_i < num_spatial_axes - 1) {
+            offset /= kernel_shape[d_i + 1];
+          }
+          d_offset[d_i] = offset % kernel_shape[d_i];
         }
-      }
-    }  // while(incremented) {
-  }  // for (int_tp c = 0; c < channels_col; ++c) {
+        for (bool incremented = true; incremented;) {
+          // Loop over spatial axes in forward order to compute the indices in
+          // the image and column, and whether the index lies in the padding.
+          int_tp index_col = c_col;
+          int_tp index_im = c_col / kernel_size;
+          bool is_padding = false;
+          for (int_tp d_i = 0; d_i < num_spatial_axes; ++d_i) {
+            const int_tp d = d_iter[d_i];
+            const int_tp d_im = d * stride[d_i] - pad[d_i]
+                + d_offset[d_i] * dilation[d_i];
+            is_padding |= d_im < 0 || d_im >= im_shape[d_i + 1];
+            index_col *= col_shape[d_i + 1];
+            index_col += d;
+            index_im *= im_shape[d_i + 1];
+            index_im += d_im;
+          }
+          if (im2col) {
+            if (is_padding) {
+              data_output[index_col] = 0;
+            } else {
+              data_output[index_col] = data_input[index_im];
+            }
+          } else if (!is_padding) {  // col2im
+            data_output[index_im] += data_input[index_col];
+          }
+          // Loop over spatial axes in reverse order to choose an index,
+          // like counting.
+          incremented = false;
+          for (int_tp d_i = num_spatial_axes - 1; d_i >= 0; --d_i) {
+            const int_tp d_max = col_shape[d_i + 1];
+            DCHECK_LT(d_iter[d_i], d_max);
+            if (d_iter[d_i] == d_max - 1) {
+              d_iter[d_i] = 0;
+            } else {  // d_iter[d_i] < d_max - 1
+              ++d_iter[d_i];
+              incremented = true;
+              break;
+            }
+          }
+        }  // while(incremented) {
+      }  // for (int_tp c_col = ...; c_col < ...; ++c_col) {
+    }  // for (int_tp task = first; task < ...; ++task) {
+  });
 }
 
 template<typename Dtype>
@@ -188,41 +238,72 @@ template void im2col_nd_cpu<double>(const double* data_im,
                                     const int_tp* pad, const int_tp* stride,
                                     const int_tp* dilation, double* data_col);
 
+// col2im_cpu with the rows of the column matrix col_stride values apart.
+// The channels are accumulated in parallel: every column row of a channel
+// only scatters into that channel's image plane, so each thread owns its
+// plane and no two threads write to the same values.
 template<typename Dtype>
-void col2im_cpu(const Dtype* data_col, const int_tp channels,
-                const int_tp height, const int_tp width, const int_tp kernel_h,
-                const int_tp kernel_w, const int_tp pad_h, const int_tp pad_w,
-                const int_tp stride_h, const int_tp stride_w,
-                const int_tp dilation_h, const int_tp dilation_w,
-                Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
+static void col2im_cpu_strided(const Dtype* data_col, const int_tp channels,
+                               const int_tp height, const int_tp width,
+                               const int_tp kernel_h, const int_tp kernel_w,
+                               const int_tp pad_h, const int_tp pad_w,
+                               const int_tp stride_h, const int_tp stride_w,
+                               const int_tp dilation_h, const int_tp dilation_w,
+                               const int_tp col_stride, Dtype* data_im) {
   const int_tp output_h = (height + 2 * pad_h -
     (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
   const int_tp output_w = (width + 2 * pad_w -
     (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
-  const int_tp channel_size = height * width;
-  for (int_tp channel = channels; channel--; data_im += channel_size) {
-    for (int_tp kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
-      for (int_tp kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int_tp input_row = -pad_h + kernel_row * dilation_h;
-        for (int_tp output_rows = output_h; output_rows; output_rows--) {
-          if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            data_col += output_w;
-          } else {
-            int_tp input_col = -pad_w + kernel_col * dilation_w;
-            for (int_tp output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                data_im[input_row * width + input_col] += *data_col;
+  Caffe::thread_pool().parallel_for(0, channels, 1,
+      [&](int_tp first, int_tp last) {
+    for (int_tp channel = first; channel < last; ++channel) {
+      Dtype* im = data_im + channel * height * width;
+      std::fill(im, im + height * width, Dtype(0));
+      for (int_tp kernel_row = 0; kernel_row < kernel_h; ++kernel_row) {
+        for (int_tp kernel_col = 0; kernel_col < kernel_w; ++kernel_col) {
+          const Dtype* col = data_col + ((channel * kernel_h + kernel_row)
+              * kernel_w + kernel_col) * col_stride;
+          const int_tp offset = kernel_col * dilation_w - pad_w;
+          int_tp begin, end;
+          im2col_valid_outputs(offset, stride_w, output_w, width, &begin, &end);
+          int_tp input_row = kernel_row * dilation_h - pad_h;
+          for (int_tp output_row = 0; output_row < output_h;
+               ++output_row, input_row += stride_h, col += output_w) {
+            if (!is_a_ge_zero_and_a_lt_b(input_row, height) || begin == end) {
+              continue;
+            }
+            Dtype* out = im + input_row * width + begin * stride_w + offset;
+            const Dtype* in = col + begin;
+            if (stride_w == 1) {
+              for (int_tp i = 0; i < end - begin; ++i) {
+                out[i] += in[i];
+              }
+            } else {
+              for (int_tp i = 0; i < end - begin; ++i) {
+                out[i * stride_w] += in[i];
               }
-              data_col++;
-              input_col += stride_w;
             }
           }
-          input_row += stride_h;
         }
       }
     }
-  }
+  });
+}
+
+template<typename Dtype>
+void col2im_cpu(const Dtype* data_col, const int_tp channels,
+                const int_tp height, const int_tp width, const int_tp kernel_h,
+                const int_tp kernel_w, const int_tp pad_h, const int_tp pad_w,
+                const int_tp stride_h, const int_tp stride_w,
+                const int_tp dilation_h, const int_tp dilation_w,
+                Dtype* data_im) {
+  const int_tp output_h = (height + 2 * pad_h -
+    (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int_tp output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  col2im_cpu_strided(data_col, channels, height, width, kernel_h, kernel_w,
+                     pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+                     output_h * output_w, data_im);
 }
 
 // Explicit instantiation
@@ -286,4 +367,86 @@ template void col2im_nd_cpu<double>(const double* data_col,
                                     const int_tp* pad, const int_tp* stride,
                                     const int_tp* dilation, double* data_im);
 
+template<typename Dtype>
+void im2col_batch_cpu(const Dtype* data_im, const int_tp num,
+                      const int_tp channels, const int_tp height,
+                      const int_tp width, const int_tp kernel_h,
+                      const int_tp kernel_w, const int_tp pad_h,
+                      const int_tp pad_w, const int_tp stride_h,
+                      const int_tp stride_w, const int_tp dilation_h,
+                      const int_tp dilation_w, Dtype* data_col) {
+  const int_tp output_h = (height + 2 * pad_h
+      - (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int_tp output_w =
+      (width + 2 * pad_w - (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  const int_tp output_size = output_h * output_w;
+  for (int_tp n = 0; n < num; ++n) {
+    im2col_cpu_strided(data_im + n * channels * height * width, channels,
+                       height, width, kernel_h, kernel_w, pad_h, pad_w,
+                       stride_h, stride_w, dilation_h, dilation_w,
+                       num * output_size, data_col + n * output_size);
+  }
+}
+
+// Explicit instantiation
+#ifdef USE_GPU_HALF
+template void im2col_batch_cpu<half>(const half* data_im, const int_tp num,
+    const int_tp channels, const int_tp height, const int_tp width,
+    const int_tp kernel_h, const int_tp kernel_w, const int_tp pad_h,
+    const int_tp pad_w, const int_tp stride_h, const int_tp stride_w,
+    const int_tp dilation_h, const int_tp dilation_w, half* data_col);
+#endif
+template void im2col_batch_cpu<float>(const float* data_im, const int_tp num,
+    const int_tp channels, const int_tp height, const int_tp width,
+    const int_tp kernel_h, const int_tp kernel_w, const int_tp pad_h,
+    const int_tp pad_w, const int_tp stride_h, const int_tp stride_w,
+    const int_tp dilation_h, const int_tp dilation_w, float* data_col);
+template void im2col_batch_cpu<double>(const double* data_im,
+    const int_tp num, const int_tp channels, const int_tp height,
+    const int_tp width, const int_tp kernel_h, const int_tp kernel_w,
+    const int_tp pad_h, const int_tp pad_w, const int_tp stride_h,
+    const int_tp stride_w, const int_tp dilation_h, const int_tp dilation_w,
+    double* data_col);
+
+template<typename Dtype>
+void col2im_batch_cpu(const Dtype* data_col, const int_tp num,
+                      const int_tp channels, const int_tp height,
+                      const int_tp width, const int_tp kernel_h,
+                      const int_tp kernel_w, const int_tp pad_h,
+                      const int_tp pad_w, const int_tp stride_h,
+                      const int_tp stride_w, const int_tp dilation_h,
+                      const int_tp dilation_w, Dtype* data_im) {
+  const int_tp output_h = (height + 2 * pad_h -
+    (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int_tp output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  const int_tp output_size = output_h * output_w;
+  for (int_tp n = 0; n < num; ++n) {
+    col2im_cpu_strided(data_col + n * output_size, channels, height, width,
+                       kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+                       dilation_h, dilation_w, num * output_size,
+                       data_im + n * channels * height * width);
+  }
+}
+
+// Explicit instantiation
+#ifdef USE_GPU_HALF
+template void col2im_batch_cpu<half>(const half* data_col, const int_tp num,
+    const int_tp channels, const int_tp height, const int_tp width,
+    const int_tp kernel_h, const int_tp kernel_w, const int_tp pad_h,
+    const int_tp pad_w, const int_tp stride_h, const int_tp stride_w,
+    const int_tp dilation_h, const int_tp dilation_w, half* data_im);
+#endif
+template void col2im_batch_cpu<float>(const float* data_col, const int_tp num,
+    const int_tp channels, const int_tp height, const int_tp width,
+    const int_tp kernel_h, const int_tp kernel_w, const int_tp pad_h,
+    const int_tp pad_w, const int_tp stride_h, const int_tp stride_w,
+    const int_tp dilation_h, const int_tp dilation_w, float* data_im);
+template void col2im_batch_cpu<double>(const double* data_col,
+    const int_tp num, const int_tp channels, const int_tp height,
+    const int_tp width, const int_tp kernel_h, const int_tp kernel_w,
+    const int_tp pad_h, const int_tp pad_w, const int_tp stride_h,
+    const int_tp stride_w, const int_tp dilation_h, const int_tp dilation_w,
+    double* data_im);
+
 }  // namespace caffe
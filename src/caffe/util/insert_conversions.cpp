@@ -0,0 +1,285 @@
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/binarization.hpp"
+#include "caffe/util/insert_conversions.hpp"
+#include "caffe/util/layout.hpp"
+
+namespace caffe {
+
+// Blobs are typed by the net, so only conversions from and to quantized
+// codes or packed signs change the values of a blob. All *_PACKED_BINARY
+// types share the same in-memory layout.
+static bool NeedsConversion(const DataType from, const DataType to) {
+  if (IsPackedBinary(from) && IsPackedBinary(to)) {
+    return false;
+  }
+  return from != to && (from == INT8_QUANTIZED || to == INT8_QUANTIZED ||
+                        IsPackedBinary(from) || IsPackedBinary(to));
+}
+
+void InsertConversions(const NetParameter& param,
+                       NetParameter* param_convert) {
+  // Initialize by copying from the input NetParameter.
+  param_convert->CopyFrom(param);
+  param_convert->clear_layer();
+  // The layer whose top_data_type and top_quantization describe each blob.
+  map<string, const LayerParameter*> blob_name_to_producer;
+  // Blobs consumed in-place after a conversion continue under the name of
+  // the converted blob.
+  map<string, string> blob_name_to_converted_name;
+  for (int_tp i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    LayerParameter converted_layer_param(layer_param);
+    for (int_tp j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& blob_name = layer_param.bottom(j);
+      if (blob_name_to_converted_name.find(blob_name) !=
+          blob_name_to_converted_name.end()) {
+        converted_layer_param.set_bottom(j,
+            blob_name_to_converted_name[blob_name]);
+      }
+      const LayerParameter* producer = blob_name_to_producer[blob_name];
+      // Split layers pass their input through in whatever type it is in.
+      if (producer == NULL || layer_param.type() == "Split" ||
+          !NeedsConversion(producer->top_data_type(),
+                           layer_param.bottom_data_type())) {
+        continue;
+      }
+      const string bottom_name = converted_layer_param.bottom(j);
+      ConfigureConvertLayer(*producer, layer_param, bottom_name, j,
+                            param_convert->add_layer());
+      converted_layer_param.set_bottom(j,
+          ConvertBlobName(layer_param.name(), bottom_name, j));
+    }
+    for (int_tp j = 0; j < layer_param.top_size(); ++j) {
+      const string& blob_name = layer_param.top(j);
+      for (int_tp k = 0; k < layer_param.bottom_size(); ++k) {
+        if (layer_param.bottom(k) == blob_name &&
+            converted_layer_param.bottom(k) != blob_name) {
+          converted_layer_param.set_top(j, converted_layer_param.bottom(k));
+          blob_name_to_converted_name[blob_name] =
+              converted_layer_param.bottom(k);
+        }
+      }
+      if (layer_param.type() == "Split") {
+        blob_name_to_producer[blob_name] =
+            blob_name_to_producer[layer_param.bottom(0)];
+      } else {
+        blob_name_to_producer[blob_name] = &layer_param;
+      }
+    }
+    param_convert->add_layer()->CopyFrom(converted_layer_param);
+  }
+}
+
+void ConfigureConvertLayer(const LayerParameter& producer_param,
+    const LayerParameter& consumer_param, const string& blob_name,
+    const int_tp blob_idx, LayerParameter* convert_layer_param) {
+  convert_layer_param->Clear();
+  convert_layer_param->add_bottom(blob_name);
+  convert_layer_param->add_top(
+      ConvertBlobName(consumer_param.name(), blob_name, blob_idx));
+  convert_layer_param->set_name(
+      ConvertLayerName(consumer_param.name(), blob_name, blob_idx));
+  convert_layer_param->set_type("Quantizer");
+  convert_layer_param->set_bottom_data_type(producer_param.top_data_type());
+  convert_layer_param->set_compute_data_type(FLOAT);
+  convert_layer_param->set_top_data_type(consumer_param.bottom_data_type());
+  if (producer_param.has_top_quantization()) {
+    convert_layer_param->mutable_bottom_quantization()->CopyFrom(
+        producer_param.top_quantization());
+  }
+  if (consumer_param.has_bottom_quantization()) {
+    convert_layer_param->mutable_top_quantization()->CopyFrom(
+        consumer_param.bottom_quantization());
+  }
+  if (consumer_param.has_phase()) {
+    convert_layer_param->set_phase(consumer_param.phase());
+  }
+}
+
+string ConvertLayerName(const string& layer_name, const string& blob_name,
+    const int_tp blob_idx) {
+  ostringstream convert_layer_name;
+  convert_layer_name << blob_name << "_" << layer_name << "_" << blob_idx
+      << "_convert";
+  return convert_layer_name.str();
+}
+
+string ConvertBlobName(const string& layer_name, const string& blob_name,
+    const int_tp blob_idx) {
+  ostringstream convert_blob_name;
+  convert_blob_name << blob_name << "_" << layer_name << "_" << blob_idx
+      << "_converted";
+  return convert_blob_name.str();
+}
+
+// Layers computing elementwise, which work on blobs in any layout.
+static bool IsElementwise(const LayerParameter& layer_param) {
+  static const char* const types[] = {"AbsVal", "BNLL", "Dropout", "ELU",
+      "Exp", "Log", "Power", "ReLU", "Sigmoid", "TanH"};
+  if (layer_param.bottom_size() != 1) {
+    return false;
+  }
+  for (int_tp i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+    if (layer_param.type() == types[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool IsDirectConvolution(const LayerParameter& layer_param) {
+  return layer_param.type() == "Convolution" &&
+      layer_param.convolution_param().engine() ==
+      ConvolutionParameter_Engine_DIRECT;
+}
+
+// Whether a DIRECT convolution takes the direct path, i.e. runs on the CPU,
+// is ungrouped, 2D and computes in floating point, and so accepts blocked
+// bottoms.
+static bool DirectConvolutionSupported(const LayerParameter& layer_param) {
+  const ConvolutionParameter& conv_param = layer_param.convolution_param();
+  return Caffe::mode() == Caffe::CPU && conv_param.group() == 1 &&
+      conv_param.kernel_size_size() <= 2 && conv_param.pad_size() <= 2 &&
+      conv_param.stride_size() <= 2 && conv_param.dilation_size() <= 2 &&
+      !conv_param.force_nd_im2col() && conv_param.axis() == 1 &&
+      !NeedsConversion(FLOAT, layer_param.bottom_data_type()) &&
+      !NeedsConversion(FLOAT, layer_param.compute_data_type());
+}
+
+// Whether a DIRECT convolution can compute its top in the
+// NativeBlockedLayout, which needs whole channel blocks.
+static bool DirectConvolutionBlocks(const LayerParameter& layer_param) {
+  return DirectConvolutionSupported(layer_param) &&
+      layer_param.convolution_param().num_output() %
+      LayoutBlock(NativeBlockedLayout()) == 0;
+}
+
+void InsertReorders(const NetParameter& param, NetParameter* param_reorder) {
+  param_reorder->CopyFrom(param);
+  param_reorder->clear_layer();
+  // Net outputs, the blobs not consumed after they were last produced.
+  map<string, bool> blob_name_to_consumed;
+  for (int_tp i = 0; i < param.layer_size(); ++i) {
+    for (int_tp j = 0; j < param.layer(i).bottom_size(); ++j) {
+      blob_name_to_consumed[param.layer(i).bottom(j)] = true;
+    }
+    for (int_tp j = 0; j < param.layer(i).top_size(); ++j) {
+      blob_name_to_consumed[param.layer(i).top(j)] = false;
+    }
+  }
+  set<string> outputs;
+  for (map<string, bool>::const_iterator it = blob_name_to_consumed.begin();
+       it != blob_name_to_consumed.end(); ++it) {
+    if (!it->second) {
+      outputs.insert(it->first);
+    }
+  }
+  // The layout each blob was last produced in, NCHW if not listed.
+  map<string, Layout> blob_name_to_layout;
+  map<string, string> blob_name_to_reordered_name;
+  for (int_tp i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    LayerParameter reordered_layer_param(layer_param);
+    bool top_is_output = false;
+    for (int_tp j = 0; j < layer_param.top_size(); ++j) {
+      top_is_output |= outputs.count(layer_param.top(j)) > 0;
+    }
+    const Layout input_layout = layer_param.bottom_size() > 0 ?
+        blob_name_to_layout[layer_param.bottom(0)] : NCHW;
+    if (IsDirectConvolution(layer_param) &&
+        DirectConvolutionSupported(layer_param)) {
+      if (!layer_param.has_bottom_layout()) {
+        reordered_layer_param.set_bottom_layout(input_layout);
+      }
+      if (!layer_param.has_top_layout() && !top_is_output &&
+          DirectConvolutionBlocks(layer_param)) {
+        reordered_layer_param.set_top_layout(NativeBlockedLayout());
+      }
+    } else if (IsElementwise(layer_param) && !top_is_output) {
+      if (!layer_param.has_bottom_layout()) {
+        reordered_layer_param.set_bottom_layout(input_layout);
+      }
+      if (!layer_param.has_top_layout()) {
+        reordered_layer_param.set_top_layout(
+            reordered_layer_param.bottom_layout());
+      }
+    }
+    for (int_tp j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& blob_name = layer_param.bottom(j);
+      if (blob_name_to_reordered_name.find(blob_name) !=
+          blob_name_to_reordered_name.end()) {
+        reordered_layer_param.set_bottom(j,
+            blob_name_to_reordered_name[blob_name]);
+      }
+      const Layout layout = blob_name_to_layout[blob_name];
+      // Split layers pass their input through in whatever layout it is in.
+      if (layer_param.type() == "Split" ||
+          layout == reordered_layer_param.bottom_layout()) {
+        continue;
+      }
+      const string bottom_name = reordered_layer_param.bottom(j);
+      ConfigureReorderLayer(layout, reordered_layer_param, bottom_name, j,
+                            param_reorder->add_layer());
+      reordered_layer_param.set_bottom(j,
+          ReorderBlobName(layer_param.name(), bottom_name, j));
+    }
+    for (int_tp j = 0; j < layer_param.top_size(); ++j) {
+      const string& blob_name = layer_param.top(j);
+      for (int_tp k = 0; k < layer_param.bottom_size(); ++k) {
+        if (layer_param.bottom(k) == blob_name &&
+            reordered_layer_param.bottom(k) != blob_name) {
+          reordered_layer_param.set_top(j, reordered_layer_param.bottom(k));
+          blob_name_to_reordered_name[blob_name] =
+              reordered_layer_param.bottom(k);
+        }
+      }
+      if (layer_param.type() == "Split") {
+        blob_name_to_layout[blob_name] =
+            blob_name_to_layout[layer_param.bottom(0)];
+      } else {
+        blob_name_to_layout[blob_name] = reordered_layer_param.top_layout();
+      }
+    }
+    param_reorder->add_layer()->CopyFrom(reordered_layer_param);
+  }
+}
+
+void ConfigureReorderLayer(const Layout from,
+    const LayerParameter& consumer_param, const string& blob_name,
+    const int_tp blob_idx, LayerParameter* reorder_layer_param) {
+  reorder_layer_param->Clear();
+  reorder_layer_param->add_bottom(blob_name);
+  reorder_layer_param->add_top(
+      ReorderBlobName(consumer_param.name(), blob_name, blob_idx));
+  reorder_layer_param->set_name(
+      ReorderLayerName(consumer_param.name(), blob_name, blob_idx));
+  reorder_layer_param->set_type("Reorder");
+  reorder_layer_param->set_bottom_layout(from);
+  reorder_layer_param->set_top_layout(consumer_param.bottom_layout());
+  if (consumer_param.has_phase()) {
+    reorder_layer_param->set_phase(consumer_param.phase());
+  }
+}
+
+string ReorderLayerName(const string& layer_name, const string& blob_name,
+    const int_tp blob_idx) {
+  ostringstream reorder_layer_name;
+  reorder_layer_name << blob_name << "_" << layer_name << "_" << blob_idx
+      << "_reorder";
+  return reorder_layer_name.str();
+}
+
+string ReorderBlobName(const string& layer_name, const string& blob_name,
+    const int_tp blob_idx) {
+  ostringstream reorder_blob_name;
+  reorder_blob_name << blob_name << "_" << layer_name << "_" << blob_idx
+      << "_reordered";
+  return reorder_blob_name.str();
+}
+
+}  // namespace caffe
@@ -0,0 +1,85 @@
+#include <vector>
+
+#include "caffe/util/layout.hpp"
+
+namespace caffe {
+
+Layout NativeBlockedLayout() {
+#if defined(__AVX512F__)
+  return NCHW16C;
+#else
+  return NCHW8C;
+#endif
+}
+
+vector<int_tp> LayoutShape(const vector<int_tp>& shape, const Layout layout) {
+  const int_tp block = LayoutBlock(layout);
+  if (block == 1) {
+    return shape;
+  }
+  CHECK_GE(shape.size(), 2) << "Blocked layouts need a channel axis.";
+  CHECK_EQ(shape[1] % block, 0) << "Blocked layouts need the channels, "
+      << shape[1] << ", to be a multiple of " << block << ".";
+  vector<int_tp> blocked_shape(shape);
+  blocked_shape[1] /= block;
+  blocked_shape.push_back(block);
+  return blocked_shape;
+}
+
+vector<int_tp> PlainShape(const vector<int_tp>& shape, const Layout layout) {
+  const int_tp block = LayoutBlock(layout);
+  if (block == 1) {
+    return shape;
+  }
+  CHECK_GE(shape.size(), 3) << "Blocked blobs have a block axis.";
+  CHECK_EQ(shape.back(), block) << "Blob is not blocked by " << block << ".";
+  vector<int_tp> plain_shape(shape.begin(), shape.end() - 1);
+  plain_shape[1] *= block;
+  return plain_shape;
+}
+
+template<typename Dtype>
+void caffe_cpu_to_blocked(const int_tp num, const int_tp channels,
+                          const int_tp inner, const int_tp block,
+                          const Dtype* x, Dtype* y) {
+  for (int_tp n = 0; n < num * channels / block; ++n) {
+    const Dtype* x_block = x + n * block * inner;
+    Dtype* y_block = y + n * inner * block;
+    for (int_tp i = 0; i < inner; ++i) {
+      for (int_tp b = 0; b < block; ++b) {
+        y_block[i * block + b] = x_block[b * inner + i];
+      }
+    }
+  }
+}
+
+template void caffe_cpu_to_blocked<float>(const int_tp num,
+    const int_tp channels, const int_tp inner, const int_tp block,
+    const float* x, float* y);
+template void caffe_cpu_to_blocked<double>(const int_tp num,
+    const int_tp channels, const int_tp inner, const int_tp block,
+    const double* x, double* y);
+
+template<typename Dtype>
+void caffe_cpu_from_blocked(const int_tp num, const int_tp channels,
+                            const int_tp inner, const int_tp block,
+                            const Dtype* x, Dtype* y) {
+  for (int_tp n = 0; n < num * channels / block; ++n) {
+    const Dtype* x_block = x + n * inner * block;
+    Dtype* y_block = y + n * block * inner;
+    for (int_tp b = 0; b < block; ++b) {
+      for (int_tp i = 0; i < inner; ++i) {
+        y_block[b * inner + i] = x_block[i * block + b];
+      }
+    }
+  }
+}
+
+template void caffe_cpu_from_blocked<float>(const int_tp num,
+    const int_tp channels, const int_tp inner, const int_tp block,
+    const float* x, float* y);
+template void caffe_cpu_from_blocked<double>(const int_tp num,
+    const int_tp channels, const int_tp inner, const int_tp block,
+    const double* x, double* y);
+
+}  // namespace caffe
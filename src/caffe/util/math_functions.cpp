@@ -1,11 +1,23 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <limits>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#if defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+#define CAFFE_HGEMM_AVX2
+#endif
 
 #include "caffe/common.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -18,6 +30,160 @@ void caffe_add_scalar(const int_tp n, const half_float::half alpha,
   }
 }
 
+// Blocking parameters of the packed half precision GEMM. The micro-kernel
+// keeps a kHgemmMR x kHgemmNR tile of C in FP32 registers; the A and B panels
+// are widened to FP32 once while packing, so the inner loop never converts.
+// kHgemmMC and kHgemmNC must be multiples of kHgemmMR and kHgemmNR.
+const int_tp kHgemmMR = 6;
+const int_tp kHgemmNR = 16;
+const int_tp kHgemmMC = 96;
+const int_tp kHgemmKC = 256;
+const int_tp kHgemmNC = 1024;
+
+// Packs an mc x kc block of op(A) into kHgemmMR-row panels (k-major inside
+// each panel), zero-padding the last panel.
+static void hgemm_pack_a(const CBLAS_TRANSPOSE trans_a,
+                         const half_float::half* a, const int_tp lda,
+                         const int_tp mc, const int_tp kc, float* a_pack) {
+  for (int_tp i = 0; i < mc; i += kHgemmMR) {
+    const int_tp mr = std::min(kHgemmMR, mc - i);
+    for (int_tp p = 0; p < kc; ++p) {
+      for (int_tp ir = 0; ir < mr; ++ir) {
+        a_pack[ir] = static_cast<float>((trans_a == CblasNoTrans) ?
+            a[(i + ir) * lda + p] : a[p * lda + i + ir]);
+      }
+      for (int_tp ir = mr; ir < kHgemmMR; ++ir) {
+        a_pack[ir] = 0.0f;
+      }
+      a_pack += kHgemmMR;
+    }
+  }
+}
+
+// Packs a kc x nc block of op(B) into kHgemmNR-column panels (k-major inside
+// each panel), zero-padding the last panel.
+static void hgemm_pack_b(const CBLAS_TRANSPOSE trans_b,
+                         const half_float::half* b, const int_tp ldb,
+                         const int_tp kc, const int_tp nc, float* b_pack) {
+  for (int_tp j = 0; j < nc; j += kHgemmNR) {
+    const int_tp nr = std::min(kHgemmNR, nc - j);
+    for (int_tp p = 0; p < kc; ++p) {
+#ifdef CAFFE_HGEMM_AVX2
+      if (trans_b == CblasNoTrans && nr == kHgemmNR) {
+        const __m128i* src =
+            reinterpret_cast<const __m128i*>(b + p * ldb + j);
+        _mm256_storeu_ps(b_pack, _mm256_cvtph_ps(_mm_loadu_si128(src)));
+        _mm256_storeu_ps(b_pack + 8,
+                         _mm256_cvtph_ps(_mm_loadu_si128(src + 1)));
+        b_pack += kHgemmNR;
+        continue;
+      }
+#endif  // CAFFE_HGEMM_AVX2
+      for (int_tp jr = 0; jr < nr; ++jr) {
+        b_pack[jr] = static_cast<float>((trans_b == CblasNoTrans) ?
+            b[p * ldb + j + jr] : b[(j + jr) * ldb + p]);
+      }
+      for (int_tp jr = nr; jr < kHgemmNR; ++jr) {
+        b_pack[jr] = 0.0f;
+      }
+      b_pack += kHgemmNR;
+    }
+  }
+}
+
+// Accumulates the product of one packed A panel and one packed B panel into
+// the mr x nr FP32 tile at c (leading dimension ldc).
+static void hgemm_micro_kernel(const int_tp kc, const float* a, const float* b,
+                               float* c, const int_tp ldc, const int_tp mr,
+                               const int_tp nr) {
+  float tile[kHgemmMR * kHgemmNR];
+#ifdef CAFFE_HGEMM_AVX2
+  __m256 acc_lo[kHgemmMR];
+  __m256 acc_hi[kHgemmMR];
+  for (int_tp ir = 0; ir < kHgemmMR; ++ir) {
+    acc_lo[ir] = _mm256_setzero_ps();
+    acc_hi[ir] = _mm256_setzero_ps();
+  }
+  for (int_tp p = 0; p < kc; ++p) {
+    const __m256 b_lo = _mm256_loadu_ps(b);
+    const __m256 b_hi = _mm256_loadu_ps(b + 8);
+    for (int_tp ir = 0; ir < kHgemmMR; ++ir) {
+      const __m256 a_ir = _mm256_broadcast_ss(a + ir);
+      acc_lo[ir] = _mm256_fmadd_ps(a_ir, b_lo, acc_lo[ir]);
+      acc_hi[ir] = _mm256_fmadd_ps(a_ir, b_hi, acc_hi[ir]);
+    }
+    a += kHgemmMR;
+    b += kHgemmNR;
+  }
+  if (mr == kHgemmMR && nr == kHgemmNR) {
+    for (int_tp ir = 0; ir < kHgemmMR; ++ir) {
+      float* c_ir = c + ir * ldc;
+      _mm256_storeu_ps(c_ir, _mm256_add_ps(_mm256_loadu_ps(c_ir), acc_lo[ir]));
+      _mm256_storeu_ps(c_ir + 8,
+                       _mm256_add_ps(_mm256_loadu_ps(c_ir + 8), acc_hi[ir]));
+    }
+    return;
+  }
+  for (int_tp ir = 0; ir < kHgemmMR; ++ir) {
+    _mm256_storeu_ps(tile + ir * kHgemmNR, acc_lo[ir]);
+    _mm256_storeu_ps(tile + ir * kHgemmNR + 8, acc_hi[ir]);
+  }
+#else
+  for (int_tp i = 0; i < kHgemmMR * kHgemmNR; ++i) {
+    tile[i] = 0.0f;
+  }
+  for (int_tp p = 0; p < kc; ++p) {
+    for (int_tp ir = 0; ir < kHgemmMR; ++ir) {
+      const float a_ir = a[ir];
+      float* tile_ir = tile + ir * kHgemmNR;
+      for (int_tp jr = 0; jr < kHgemmNR; ++jr) {
+        tile_ir[jr] += a_ir * b[jr];
+      }
+    }
+    a += kHgemmMR;
+    b += kHgemmNR;
+  }
+#endif  // CAFFE_HGEMM_AVX2
+  for (int_tp ir = 0; ir < mr; ++ir) {
+    for (int_tp jr = 0; jr < nr; ++jr) {
+      c[ir * ldc + jr] += tile[ir * kHgemmNR + jr];
+    }
+  }
+}
+
+// Writes back one nc wide column block: c = alpha * acc + beta * c.
+static void hgemm_store_c(const int_tp m, const int_tp nc, const float alpha,
+                          const float* acc, const float beta,
+                          half_float::half* c, const int_tp ldc) {
+  for (int_tp i = 0; i < m; ++i) {
+    const float* acc_i = acc + i * nc;
+    half_float::half* c_i = c + i * ldc;
+    int_tp j = 0;
+#ifdef CAFFE_HGEMM_AVX2
+    const __m256 alpha_v = _mm256_set1_ps(alpha);
+    const __m256 beta_v = _mm256_set1_ps(beta);
+    for (; j + 8 <= nc; j += 8) {
+      __m128i* c_ij = reinterpret_cast<__m128i*>(c_i + j);
+      __m256 v = _mm256_mul_ps(alpha_v, _mm256_loadu_ps(acc_i + j));
+      if (beta != 0.0f) {
+        v = _mm256_fmadd_ps(beta_v, _mm256_cvtph_ps(_mm_loadu_si128(c_ij)), v);
+      }
+      _mm_storeu_si128(c_ij, _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif  // CAFFE_HGEMM_AVX2
+    for (; j < nc; ++j) {
+      float v = alpha * acc_i[j];
+      if (beta != 0.0f) {
+        v += beta * static_cast<float>(c_i[j]);
+      }
+      c_i[j] = v;
+    }
+  }
+}
+
+// Cache-blocked GEMM on half precision storage. Operands are widened to FP32
+// while packing and all products are accumulated in FP32; C is rounded back to
+// half precision once per column block.
 template<>
 void caffe_cpu_gemm<half_float::half>(const CBLAS_TRANSPOSE trans_a,
                           const CBLAS_TRANSPOSE trans_b, const int_tp m,
@@ -26,25 +192,42 @@ void caffe_cpu_gemm<half_float::half>(const CBLAS_TRANSPOSE trans_a,
                           const half_float::half* a, const half_float::half* b,
                           const half_float::half beta,
                           half_float::half* c) {
-  int_tp inc_a = (trans_a == CblasNoTrans) ? 1 : m;
-  int_tp inc_b = (trans_b == CblasNoTrans) ? n : 1;
-  for (int_tp m = 0; m < m; m++) {
-    for (int_tp n = 0; n < n; n++) {
-      half_float::half acc = 0;
-      int_tp b_index = trans_b == CblasNoTrans ?
-                       n : k * n;
-      int_tp a_index = trans_a == CblasNoTrans ?
-                       k * m : m;
-      for (int_tp k = 0; k < k; k++) {
-        acc += a[a_index] * b[b_index];
-        a_index += inc_a;
-        b_index += inc_b;
+  if (m <= 0 || n <= 0) {
+    return;
+  }
+  const int_tp lda = (trans_a == CblasNoTrans) ? k : m;
+  const int_tp ldb = (trans_b == CblasNoTrans) ? n : k;
+  const int_tp nc_max = std::min(n, kHgemmNC);
+  vector<float> a_pack(kHgemmMC * kHgemmKC);
+  vector<float> b_pack(kHgemmKC * kHgemmNC);
+  vector<float> acc(m * nc_max);
+  for (int_tp jc = 0; jc < n; jc += kHgemmNC) {
+    const int_tp nc = std::min(kHgemmNC, n - jc);
+    std::fill(acc.begin(), acc.begin() + m * nc, 0.0f);
+    for (int_tp pc = 0; pc < k; pc += kHgemmKC) {
+      const int_tp kc = std::min(kHgemmKC, k - pc);
+      hgemm_pack_b(trans_b,
+                   b + ((trans_b == CblasNoTrans) ? pc * ldb + jc
+                                                  : jc * ldb + pc),
+                   ldb, kc, nc, &b_pack[0]);
+      for (int_tp ic = 0; ic < m; ic += kHgemmMC) {
+        const int_tp mc = std::min(kHgemmMC, m - ic);
+        hgemm_pack_a(trans_a,
+                     a + ((trans_a == CblasNoTrans) ? ic * lda + pc
+                                                    : pc * lda + ic),
+                     lda, mc, kc, &a_pack[0]);
+        for (int_tp jr = 0; jr < nc; jr += kHgemmNR) {
+          for (int_tp ir = 0; ir < mc; ir += kHgemmMR) {
+            hgemm_micro_kernel(kc, &a_pack[ir * kc], &b_pack[jr * kc],
+                               &acc[(ic + ir) * nc + jr], nc,
+                               std::min(kHgemmMR, mc - ir),
+                               std::min(kHgemmNR, nc - jr));
+          }
+        }
       }
-      if (beta != 0)
-        c[m * n + n] = acc * alpha + beta * c[m * n + n];
-      else
-        c[m * n + n] = acc * alpha;
     }
+    hgemm_store_c(m, nc, static_cast<float>(alpha), &acc[0],
+                  static_cast<float>(beta), c + jc, n);
   }
 }
 
@@ -170,30 +353,6 @@ void caffe_sqr<half_float::half>(const int_tp n, const half_float::half* a,
   vhSqr(n, a, Y);
 }
 
-void vhExp(const int_tp n, const half_float::half* a, half_float::half* Y) {
-  for (int i = 0; i < n; i++) {
-    Y[i] = exp(a[i]);
-  }
-}
-
-template<>
-void caffe_exp<half_float::half>(const int_tp n, const half_float::half* a,
-                                 half_float::half* Y) {
-  vhExp(n, a, Y);
-}
-
-void vhLn(const int_tp n, const half_float::half* a, half_float::half* Y) {
-  for (int i = 0; i < n; i++) {
-    Y[i] = log(a[i]);
-  }
-}
-
-template<>
-void caffe_log<half_float::half>(const int_tp n, const half_float::half* a,
-                                 half_float::half* Y) {
-  vhLn(n, a, Y);
-}
-
 void vhAbs(const int_tp n, const half_float::half *a, half_float::half* Y) {
   for (int i = 0; i < n; i++) {
     Y[i] = fabs(a[i]);
@@ -521,17 +680,6 @@ void caffe_div<double>(const int_tp n, const double* a, const double* b,
   vdDiv(n, a, b, Y);
 }
 
-template<>
-void caffe_powx<float>(const int_tp n, const float* a, const float b,
-                       float* Y) {
-  vsPowx(n, a, b, Y);
-}
-
-template<>
-void caffe_powx<double>(const int_tp n, const double* a, const double b,
-                        double* Y) {
-  vdPowx(n, a, b, Y);
-}
 
 template<>
 void caffe_sqr<float>(const int_tp n, const float* a, float* Y) {
@@ -553,26 +701,6 @@ void caffe_sqrt<double>(const int_tp n, const double* a, double* Y) {
   vdSqrt(n, a, Y);
 }
 
-template <>
-void caffe_exp<float>(const int_tp n, const float* a, float* Y) {
-  vsExp(n, a, Y);
-}
-
-template<>
-void caffe_exp<double>(const int_tp n, const double* a, double* Y) {
-  vdExp(n, a, Y);
-}
-
-template<>
-void caffe_log<float>(const int_tp n, const float* a, float* Y) {
-  vsLn(n, a, Y);
-}
-
-template<>
-void caffe_log<double>(const int_tp n, const double* a, double* Y) {
-  vdLn(n, a, Y);
-}
-
 template<>
 void caffe_abs<float>(const int_tp n, const float* a, float* Y) {
   vsAbs(n, a, Y);
@@ -768,4 +896,518 @@ void caffe_cpu_scale<double>(const int_tp n, const double alpha,
   cblas_dscal(n, alpha, Y, 1);
 }
 
+// Vectorized transcendental functions. The polynomial approximations are the
+// ones of the Cephes library, evaluated on kVecWidth floats at a time with
+// AVX-512 or AVX2 and FMA, or on one float at a time otherwise, so that every
+// build computes the same approximation.
+#if defined(__AVX512F__)
+typedef __m512 vecf;
+typedef __m512i veci;
+typedef __mmask16 vecm;
+const int_tp kVecWidth = 16;
+static inline vecf vec_set(const float a) { return _mm512_set1_ps(a); }
+static inline vecf vec_load(const float* p) { return _mm512_loadu_ps(p); }
+static inline void vec_store(float* p, const vecf a) {
+  _mm512_storeu_ps(p, a);
+}
+static inline vecf vec_add(const vecf a, const vecf b) {
+  return _mm512_add_ps(a, b);
+}
+static inline vecf vec_sub(const vecf a, const vecf b) {
+  return _mm512_sub_ps(a, b);
+}
+static inline vecf vec_mul(const vecf a, const vecf b) {
+  return _mm512_mul_ps(a, b);
+}
+static inline vecf vec_div(const vecf a, const vecf b) {
+  return _mm512_div_ps(a, b);
+}
+static inline vecf vec_fmadd(const vecf a, const vecf b, const vecf c) {
+  return _mm512_fmadd_ps(a, b, c);
+}
+static inline vecf vec_min(const vecf a, const vecf b) {
+  return _mm512_min_ps(a, b);
+}
+static inline vecf vec_max(const vecf a, const vecf b) {
+  return _mm512_max_ps(a, b);
+}
+static inline vecf vec_round(const vecf a) {
+  return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT);
+}
+static inline veci vec_to_int(const vecf a) { return _mm512_cvtps_epi32(a); }
+static inline vecf vec_to_float(const veci a) { return _mm512_cvtepi32_ps(a); }
+static inline veci vec_bits(const vecf a) { return _mm512_castps_si512(a); }
+static inline vecf vec_from_bits(const veci a) {
+  return _mm512_castsi512_ps(a);
+}
+static inline veci vec_iset(const int32_t a) { return _mm512_set1_epi32(a); }
+static inline veci vec_iadd(const veci a, const veci b) {
+  return _mm512_add_epi32(a, b);
+}
+static inline veci vec_isub(const veci a, const veci b) {
+  return _mm512_sub_epi32(a, b);
+}
+static inline veci vec_iand(const veci a, const veci b) {
+  return _mm512_and_si512(a, b);
+}
+static inline veci vec_ior(const veci a, const veci b) {
+  return _mm512_or_si512(a, b);
+}
+static inline veci vec_shl(const veci a, const int shift) {
+  return _mm512_sll_epi32(a, _mm_cvtsi32_si128(shift));
+}
+static inline veci vec_shr(const veci a, const int shift) {
+  return _mm512_sra_epi32(a, _mm_cvtsi32_si128(shift));
+}
+static inline vecm vec_lt(const vecf a, const vecf b) {
+  return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+}
+static inline vecm vec_eq(const vecf a, const vecf b) {
+  return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ);
+}
+// mask ? a : b
+static inline vecf vec_select(const vecm mask, const vecf a, const vecf b) {
+  return _mm512_mask_blend_ps(mask, b, a);
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+typedef __m256 vecf;
+typedef __m256i veci;
+typedef __m256 vecm;
+const int_tp kVecWidth = 8;
+static inline vecf vec_set(const float a) { return _mm256_set1_ps(a); }
+static inline vecf vec_load(const float* p) { return _mm256_loadu_ps(p); }
+static inline void vec_store(float* p, const vecf a) {
+  _mm256_storeu_ps(p, a);
+}
+static inline vecf vec_add(const vecf a, const vecf b) {
+  return _mm256_add_ps(a, b);
+}
+static inline vecf vec_sub(const vecf a, const vecf b) {
+  return _mm256_sub_ps(a, b);
+}
+static inline vecf vec_mul(const vecf a, const vecf b) {
+  return _mm256_mul_ps(a, b);
+}
+static inline vecf vec_div(const vecf a, const vecf b) {
+  return _mm256_div_ps(a, b);
+}
+static inline vecf vec_fmadd(const vecf a, const vecf b, const vecf c) {
+  return _mm256_fmadd_ps(a, b, c);
+}
+static inline vecf vec_min(const vecf a, const vecf b) {
+  return _mm256_min_ps(a, b);
+}
+static inline vecf vec_max(const vecf a, const vecf b) {
+  return _mm256_max_ps(a, b);
+}
+static inline vecf vec_round(const vecf a) {
+  return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+static inline veci vec_to_int(const vecf a) { return _mm256_cvtps_epi32(a); }
+static inline vecf vec_to_float(const veci a) { return _mm256_cvtepi32_ps(a); }
+static inline veci vec_bits(const vecf a) { return _mm256_castps_si256(a); }
+static inline vecf vec_from_bits(const veci a) {
+  return _mm256_castsi256_ps(a);
+}
+static inline veci vec_iset(const int32_t a) { return _mm256_set1_epi32(a); }
+static inline veci vec_iadd(const veci a, const veci b) {
+  return _mm256_add_epi32(a, b);
+}
+static inline veci vec_isub(const veci a, const veci b) {
+  return _mm256_sub_epi32(a, b);
+}
+static inline veci vec_iand(const veci a, const veci b) {
+  return _mm256_and_si256(a, b);
+}
+static inline veci vec_ior(const veci a, const veci b) {
+  return _mm256_or_si256(a, b);
+}
+static inline veci vec_shl(const veci a, const int shift) {
+  return _mm256_sll_epi32(a, _mm_cvtsi32_si128(shift));
+}
+static inline veci vec_shr(const veci a, const int shift) {
+  return _mm256_sra_epi32(a, _mm_cvtsi32_si128(shift));
+}
+static inline vecm vec_lt(const vecf a, const vecf b) {
+  return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+static inline vecm vec_eq(const vecf a, const vecf b) {
+  return _mm256_cmp_ps(a, b, _CMP_EQ_OQ);
+}
+// mask ? a : b
+static inline vecf vec_select(const vecm mask, const vecf a, const vecf b) {
+  return _mm256_blendv_ps(b, a, mask);
+}
+#else
+typedef float vecf;
+typedef int32_t veci;
+typedef bool vecm;
+const int_tp kVecWidth = 1;
+static inline vecf vec_set(const float a) { return a; }
+static inline vecf vec_load(const float* p) { return *p; }
+static inline void vec_store(float* p, const vecf a) { *p = a; }
+static inline vecf vec_add(const vecf a, const vecf b) { return a + b; }
+static inline vecf vec_sub(const vecf a, const vecf b) { return a - b; }
+static inline vecf vec_mul(const vecf a, const vecf b) { return a * b; }
+static inline vecf vec_div(const vecf a, const vecf b) { return a / b; }
+static inline vecf vec_fmadd(const vecf a, const vecf b, const vecf c) {
+  return std::fma(a, b, c);
+}
+static inline vecf vec_min(const vecf a, const vecf b) {
+  return a < b ? a : b;
+}
+static inline vecf vec_max(const vecf a, const vecf b) {
+  return a > b ? a : b;
+}
+static inline vecf vec_round(const vecf a) { return std::nearbyint(a); }
+static inline veci vec_to_int(const vecf a) {
+  return static_cast<veci>(std::nearbyint(a));
+}
+static inline vecf vec_to_float(const veci a) { return static_cast<vecf>(a); }
+static inline veci vec_bits(const vecf a) {
+  veci bits;
+  memcpy(&bits, &a, sizeof(bits));
+  return bits;
+}
+static inline vecf vec_from_bits(const veci a) {
+  vecf value;
+  memcpy(&value, &a, sizeof(value));
+  return value;
+}
+static inline veci vec_iset(const int32_t a) { return a; }
+static inline veci vec_iadd(const veci a, const veci b) { return a + b; }
+static inline veci vec_isub(const veci a, const veci b) { return a - b; }
+static inline veci vec_iand(const veci a, const veci b) { return a & b; }
+static inline veci vec_ior(const veci a, const veci b) { return a | b; }
+static inline veci vec_shl(const veci a, const int shift) {
+  return static_cast<veci>(static_cast<uint32_t>(a) << shift);
+}
+static inline veci vec_shr(const veci a, const int shift) {
+  return a >> shift;
+}
+static inline vecm vec_lt(const vecf a, const vecf b) { return a < b; }
+static inline vecm vec_eq(const vecf a, const vecf b) { return a == b; }
+// mask ? a : b
+static inline vecf vec_select(const vecm mask, const vecf a, const vecf b) {
+  return mask ? a : b;
+}
+#endif
+
+// NaN where x is NaN, y elsewhere.
+static inline vecf vec_keep_nan(const vecf x, const vecf y) {
+  return vec_select(vec_eq(x, x), y, x);
+}
+
+static inline vecf vec_abs(const vecf a) {
+  return vec_from_bits(vec_iand(vec_bits(a), vec_iset(0x7fffffff)));
+}
+
+// 2^n for integers n in [-126, 127].
+static inline vecf vec_pow2(const veci n) {
+  return vec_from_bits(vec_shl(vec_iadd(n, vec_iset(127)), 23));
+}
+
+// exp(x), within 2 ulp of the exact result for x in [-87.33, 88.72], and
+// NaN for NaN. Above ln(FLT_MAX) the result is infinity. Below ln(FLT_MIN),
+// where the exact result is subnormal, it is flushed to 0.
+static inline vecf vec_exp(const vecf x) {
+  const vecf lo = vec_set(-87.3365447505f);
+  const vecf hi = vec_set(88.7228391117f);
+  const vecf y = vec_min(vec_max(x, lo), hi);
+  // exp(y) = 2^n * exp(r), with r = y - n * ln(2) in [-ln(2)/2, ln(2)/2].
+  const vecf n = vec_round(vec_mul(y, vec_set(1.44269504089f)));
+  vecf r = vec_fmadd(n, vec_set(-0.693359375f), y);
+  r = vec_fmadd(n, vec_set(2.12194440e-4f), r);
+  vecf p = vec_set(1.9875691500e-4f);
+  p = vec_fmadd(p, r, vec_set(1.3981999507e-3f));
+  p = vec_fmadd(p, r, vec_set(8.3334519073e-3f));
+  p = vec_fmadd(p, r, vec_set(4.1665795894e-2f));
+  p = vec_fmadd(p, r, vec_set(1.6666665459e-1f));
+  p = vec_fmadd(p, r, vec_set(5.0000001201e-1f));
+  p = vec_fmadd(p, vec_mul(r, r), r);
+  p = vec_add(p, vec_set(1.0f));
+  // 2^n is applied in two halves, as n reaches 128 near hi, beyond the
+  // exponents of floats.
+  const veci n_int = vec_to_int(n);
+  const veci n_half = vec_shr(n_int, 1);
+  p = vec_mul(vec_mul(p, vec_pow2(n_half)),
+              vec_pow2(vec_isub(n_int, n_half)));
+  p = vec_select(vec_lt(x, lo), vec_set(0.0f), p);
+  p = vec_select(vec_lt(hi, x),
+                 vec_set(std::numeric_limits<float>::infinity()), p);
+  return vec_keep_nan(x, p);
+}
+
+// log(x), within 2 ulp of the exact result for positive x. The result is
+// -infinity for 0, infinity for infinity and NaN for negative x and NaN.
+static inline vecf vec_log(const vecf x) {
+  // Scale the subnormals into the normal range.
+  const vecm subnormal = vec_lt(x, vec_set(std::numeric_limits<float>::min()));
+  vecf y = vec_select(subnormal, vec_mul(x, vec_set(8388608.0f)), x);
+  vecf e = vec_select(subnormal, vec_set(-23.0f), vec_set(0.0f));
+  // y = m * 2^e with m in [0.5, 1).
+  const veci bits = vec_bits(y);
+  e = vec_add(e, vec_to_float(vec_isub(vec_shr(bits, 23), vec_iset(126))));
+  vecf m = vec_from_bits(vec_ior(vec_iand(bits, vec_iset(0x007fffff)),
+                                 vec_iset(0x3f000000)));
+  // Move m to [sqrt(1/2), sqrt(2)) and take log(1 + m) for m - 1.
+  const vecm small = vec_lt(m, vec_set(0.707106781186547524f));
+  e = vec_select(small, vec_sub(e, vec_set(1.0f)), e);
+  m = vec_sub(vec_select(small, vec_add(m, m), m), vec_set(1.0f));
+  const vecf z = vec_mul(m, m);
+  vecf p = vec_set(7.0376836292e-2f);
+  p = vec_fmadd(p, m, vec_set(-1.1514610310e-1f));
+  p = vec_fmadd(p, m, vec_set(1.1676998740e-1f));
+  p = vec_fmadd(p, m, vec_set(-1.2420140846e-1f));
+  p = vec_fmadd(p, m, vec_set(1.4249322787e-1f));
+  p = vec_fmadd(p, m, vec_set(-1.6668057665e-1f));
+  p = vec_fmadd(p, m, vec_set(2.0000714765e-1f));
+  p = vec_fmadd(p, m, vec_set(-2.4999993993e-1f));
+  p = vec_fmadd(p, m, vec_set(3.3333331174e-1f));
+  p = vec_mul(vec_mul(p, m), z);
+  p = vec_fmadd(e, vec_set(-2.12194440e-4f), p);
+  p = vec_fmadd(z, vec_set(-0.5f), p);
+  y = vec_add(m, p);
+  y = vec_fmadd(e, vec_set(0.693359375f), y);
+  const vecf inf = vec_set(std::numeric_limits<float>::infinity());
+  y = vec_select(vec_eq(x, inf), inf, y);
+  y = vec_select(vec_lt(x, vec_set(0.0f)),
+                 vec_set(std::numeric_limits<float>::quiet_NaN()), y);
+  y = vec_select(vec_eq(x, vec_set(0.0f)), vec_sub(vec_set(0.0f), inf), y);
+  return vec_keep_nan(x, y);
+}
+
+// tanh(x), within 3 ulp of the exact result.
+static inline vecf vec_tanh(const vecf x) {
+  const vecf ax = vec_abs(x);
+  // An odd polynomial for |x| < 0.625, 1 - 2 / (exp(2|x|) + 1) beyond.
+  const vecf z = vec_mul(x, x);
+  vecf p = vec_set(-5.70498872745e-3f);
+  p = vec_fmadd(p, z, vec_set(2.06390887954e-2f));
+  p = vec_fmadd(p, z, vec_set(-5.37397155531e-2f));
+  p = vec_fmadd(p, z, vec_set(1.33314422036e-1f));
+  p = vec_fmadd(p, z, vec_set(-3.33332819422e-1f));
+  p = vec_fmadd(vec_mul(p, z), x, x);
+  const vecf e = vec_exp(vec_add(ax, ax));
+  vecf q = vec_sub(vec_set(1.0f),
+                   vec_div(vec_set(2.0f), vec_add(e, vec_set(1.0f))));
+  // Restore the sign of x.
+  q = vec_from_bits(vec_ior(vec_bits(q),
+      vec_iand(vec_bits(x), vec_iset(0x80000000))));
+  return vec_keep_nan(x, vec_select(vec_lt(ax, vec_set(0.625f)), p, q));
+}
+
+// 1 / (1 + exp(-x)), within 3 ulp of the exact result for x above -87.3.
+static inline vecf vec_sigmoid(const vecf x) {
+  return vec_div(vec_set(1.0f),
+                 vec_add(vec_set(1.0f), vec_exp(vec_sub(vec_set(0.0f), x))));
+}
+
+// The functions on float vectors and on scalar doubles.
+struct VecExp {
+  static inline vecf apply(const vecf x) { return vec_exp(x); }
+  static inline double apply(const double x) { return std::exp(x); }
+};
+
+struct VecLog {
+  static inline vecf apply(const vecf x) { return vec_log(x); }
+  static inline double apply(const double x) { return std::log(x); }
+};
+
+struct VecTanh {
+  static inline vecf apply(const vecf x) { return vec_tanh(x); }
+  static inline double apply(const double x) { return std::tanh(x); }
+};
+
+struct VecSigmoid {
+  static inline vecf apply(const vecf x) { return vec_sigmoid(x); }
+  static inline double apply(const double x) {
+    return 1. / (1. + std::exp(-x));
+  }
+};
+
+// The elements per chunk of the vector functions on the thread pool.
+const int_tp kVecGrain = 16384;
+
+// Y = Op(X) on the calling thread.
+template<typename Op>
+static void caffe_cpu_vec_apply_serial(const int_tp n, const float* X,
+                                       float* Y) {
+  int_tp i = 0;
+  for (; i + kVecWidth <= n; i += kVecWidth) {
+    vec_store(Y + i, Op::apply(vec_load(X + i)));
+  }
+  if (i < n) {
+    float tail[kVecWidth];
+    std::fill(tail, tail + kVecWidth, 1.0f);
+    std::copy(X + i, X + n, tail);
+    vec_store(tail, Op::apply(vec_load(tail)));
+    std::copy(tail, tail + (n - i), Y + i);
+  }
+}
+
+// Y = Op(X), in chunks of at least kVecGrain elements split across
+// Caffe::thread_pool().
+template<typename Op>
+static void caffe_cpu_vec_apply(const int_tp n, const float* X, float* Y) {
+  Caffe::thread_pool().parallel_for(0, n, kVecGrain,
+      [&](int_tp begin, int_tp end) {
+    caffe_cpu_vec_apply_serial<Op>(end - begin, X + begin, Y + begin);
+  });
+}
+
+#ifdef USE_GPU_HALF
+// Half precision is computed in float, kVecGrain elements at a time.
+template<typename Op>
+static void caffe_cpu_vec_apply(const int_tp n, const half_float::half* X,
+                                half_float::half* Y) {
+  Caffe::thread_pool().parallel_for(0, n, kVecGrain,
+      [&](int_tp begin, int_tp end) {
+    vector<float> buffer(kVecGrain);
+    for (int_tp chunk = begin; chunk < end; chunk += kVecGrain) {
+      const int_tp chunk_size = std::min(kVecGrain, end - chunk);
+      std::copy(X + chunk, X + chunk + chunk_size, buffer.begin());
+      caffe_cpu_vec_apply_serial<Op>(chunk_size, &buffer[0], &buffer[0]);
+      std::copy(buffer.begin(), buffer.begin() + chunk_size, Y + chunk);
+    }
+  });
+}
+#endif  // USE_GPU_HALF
+
+// double has no vector kernels, only the threads.
+template<typename Op>
+static void caffe_cpu_vec_apply(const int_tp n, const double* X, double* Y) {
+  Caffe::thread_pool().parallel_for(0, n, kVecGrain,
+      [&](int_tp begin, int_tp end) {
+    for (int_tp i = begin; i < end; ++i) {
+      Y[i] = Op::apply(X[i]);
+    }
+  });
+}
+
+template<>
+void caffe_exp<float>(const int_tp n, const float* a, float* Y) {
+#ifdef USE_MKL
+  vsExp(n, a, Y);
+#else
+  caffe_cpu_vec_apply<VecExp>(n, a, Y);
+#endif  // USE_MKL
+}
+
+template<>
+void caffe_exp<double>(const int_tp n, const double* a, double* Y) {
+#ifdef USE_MKL
+  vdExp(n, a, Y);
+#else
+  caffe_cpu_vec_apply<VecExp>(n, a, Y);
+#endif  // USE_MKL
+}
+
+template<>
+void caffe_log<float>(const int_tp n, const float* a, float* Y) {
+#ifdef USE_MKL
+  vsLn(n, a, Y);
+#else
+  caffe_cpu_vec_apply<VecLog>(n, a, Y);
+#endif  // USE_MKL
+}
+
+template<>
+void caffe_log<double>(const int_tp n, const double* a, double* Y) {
+#ifdef USE_MKL
+  vdLn(n, a, Y);
+#else
+  caffe_cpu_vec_apply<VecLog>(n, a, Y);
+#endif  // USE_MKL
+}
+
+// pow(a, b) computed as exp(b * log(a)) loses precision with the magnitude
+// of b * log(a), so only the common exponents get exact shortcuts.
+template<typename Dtype>
+static void caffe_cpu_powx(const int_tp n, const Dtype* a, const Dtype b,
+                           Dtype* Y) {
+  if (b == Dtype(1)) {
+    if (a != Y) {
+      std::copy(a, a + n, Y);
+    }
+  } else if (b == Dtype(2)) {
+    Caffe::thread_pool().parallel_for(0, n, kVecGrain,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp i = begin; i < end; ++i) {
+        Y[i] = a[i] * a[i];
+      }
+    });
+  } else if (b == Dtype(0.5)) {
+    Caffe::thread_pool().parallel_for(0, n, kVecGrain,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp i = begin; i < end; ++i) {
+        Y[i] = std::sqrt(a[i]);
+      }
+    });
+  } else {
+    // pow is slow enough for smaller chunks.
+    Caffe::thread_pool().parallel_for(0, n, kVecGrain / 16,
+        [&](int_tp begin, int_tp end) {
+      for (int_tp i = begin; i < end; ++i) {
+        Y[i] = std::pow(a[i], b);
+      }
+    });
+  }
+}
+
+template<>
+void caffe_powx<float>(const int_tp n, const float* a, const float b,
+                       float* Y) {
+#ifdef USE_MKL
+  vsPowx(n, a, b, Y);
+#else
+  caffe_cpu_powx(n, a, b, Y);
+#endif  // USE_MKL
+}
+
+template<>
+void caffe_powx<double>(const int_tp n, const double* a, const double b,
+                        double* Y) {
+#ifdef USE_MKL
+  vdPowx(n, a, b, Y);
+#else
+  caffe_cpu_powx(n, a, b, Y);
+#endif  // USE_MKL
+}
+
+template<typename Dtype>
+void caffe_tanh(const int_tp n, const Dtype* a, Dtype* Y) {
+  caffe_cpu_vec_apply<VecTanh>(n, a, Y);
+}
+
+template<typename Dtype>
+void caffe_sigmoid(const int_tp n, const Dtype* a, Dtype* Y) {
+  caffe_cpu_vec_apply<VecSigmoid>(n, a, Y);
+}
+
+#ifdef USE_GPU_HALF
+template<>
+void caffe_exp<half_float::half>(const int_tp n, const half_float::half* a,
+                                 half_float::half* Y) {
+  caffe_cpu_vec_apply<VecExp>(n, a, Y);
+}
+
+template<>
+void caffe_log<half_float::half>(const int_tp n, const half_float::half* a,
+                                 half_float::half* Y) {
+  caffe_cpu_vec_apply<VecLog>(n, a, Y);
+}
+
+template void caffe_tanh<half_float::half>(const int_tp n,
+    const half_float::half* a, half_float::half* Y);
+template void caffe_sigmoid<half_float::half>(const int_tp n,
+    const half_float::half* a, half_float::half* Y);
+#endif  // USE_GPU_HALF
+
+template void caffe_tanh<float>(const int_tp n, const float* a, float* Y);
+template void caffe_tanh<double>(const int_tp n, const double* a, double* Y);
+template void caffe_sigmoid<float>(const int_tp n, const float* a, float* Y);
+template void caffe_sigmoid<double>(const int_tp n, const double* a,
+                                    double* Y);
+
 }  // namespace caffe
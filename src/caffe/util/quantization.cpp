@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CAFFE_QGEMM_AVX2
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+#define CAFFE_QGEMM_VNNI
+#endif
+#endif
+
+#include "caffe/common.hpp"
+#include "caffe/util/quantization.hpp"
+
+namespace caffe {
+
+// Register blocking of the int8 GEMM: every micro-kernel call computes
+// kQgemmMR x kQgemmNR inner products, reusing each loaded row of a across
+// kQgemmNR rows of b. Columns of c are processed in panels of kQgemmNC rows
+// of b, which stay in L2 while all rows of a stream past them.
+const int_tp kQgemmMR = 2;
+const int_tp kQgemmNR = 4;
+const int_tp kQgemmNC = 128;
+
+#ifdef CAFFE_QGEMM_AVX2
+static inline int32_t qgemm_hsum(__m256i v) {
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v),
+                            _mm256_extracti128_si256(v, 1));
+  s = _mm_hadd_epi32(s, s);
+  s = _mm_hadd_epi32(s, s);
+  return _mm_cvtsi128_si32(s);
+}
+#endif  // CAFFE_QGEMM_AVX2
+
+// Computes the MR x NR block c[i][j] = a_i . b_j.
+template<int_tp MR, int_tp NR>
+static void qgemm_micro_kernel(const int_tp k, const int8_t* a,
+                               const uint8_t* b, int32_t* c,
+                               const int_tp ldc) {
+  int_tp p = 0;
+  int32_t acc[MR][NR];
+#ifdef CAFFE_QGEMM_AVX2
+  __m256i vacc[MR][NR];
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      vacc[i][j] = _mm256_setzero_si256();
+    }
+  }
+#ifdef CAFFE_QGEMM_VNNI
+  for (; p + 32 <= k; p += 32) {
+    __m256i va[MR];
+    for (int_tp i = 0; i < MR; ++i) {
+      va[i] = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(a + i * k + p));
+    }
+    for (int_tp j = 0; j < NR; ++j) {
+      const __m256i vb = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(b + j * k + p));
+      for (int_tp i = 0; i < MR; ++i) {
+        vacc[i][j] = _mm256_dpbusd_epi32(vacc[i][j], vb, va[i]);
+      }
+    }
+  }
+#else
+  // Without VNNI, widen both operands to int16 before multiplying: unlike
+  // _mm256_maddubs_epi16, _mm256_madd_epi16 cannot saturate on the
+  // products of the full [0, 255] x [-127, 127] code ranges.
+  for (; p + 16 <= k; p += 16) {
+    __m256i va[MR];
+    for (int_tp i = 0; i < MR; ++i) {
+      va[i] = _mm256_cvtepi8_epi16(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(a + i * k + p)));
+    }
+    for (int_tp j = 0; j < NR; ++j) {
+      const __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(b + j * k + p)));
+      for (int_tp i = 0; i < MR; ++i) {
+        vacc[i][j] = _mm256_add_epi32(vacc[i][j],
+                                      _mm256_madd_epi16(va[i], vb));
+      }
+    }
+  }
+#endif  // CAFFE_QGEMM_VNNI
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      acc[i][j] = qgemm_hsum(vacc[i][j]);
+    }
+  }
+#else
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      acc[i][j] = 0;
+    }
+  }
+#endif  // CAFFE_QGEMM_AVX2
+  for (; p < k; ++p) {
+    for (int_tp i = 0; i < MR; ++i) {
+      for (int_tp j = 0; j < NR; ++j) {
+        acc[i][j] += static_cast<int32_t>(a[i * k + p]) * b[j * k + p];
+      }
+    }
+  }
+  for (int_tp i = 0; i < MR; ++i) {
+    for (int_tp j = 0; j < NR; ++j) {
+      c[i * ldc + j] = acc[i][j];
+    }
+  }
+}
+
+void caffe_cpu_gemm_s8u8s32(const int_tp m, const int_tp n, const int_tp k,
+                            const int8_t* a, const uint8_t* b, int32_t* c) {
+  for (int_tp jc = 0; jc < n; jc += kQgemmNC) {
+    const int_tp nc = std::min(kQgemmNC, n - jc);
+    int_tp i = 0;
+    for (; i + kQgemmMR <= m; i += kQgemmMR) {
+      int_tp j = jc;
+      for (; j + kQgemmNR <= jc + nc; j += kQgemmNR) {
+        qgemm_micro_kernel<kQgemmMR, kQgemmNR>(k, a + i * k, b + j * k,
+                                               c + i * n + j, n);
+      }
+      for (; j < jc + nc; ++j) {
+        qgemm_micro_kernel<kQgemmMR, 1>(k, a + i * k, b + j * k,
+                                        c + i * n + j, n);
+      }
+    }
+    for (; i < m; ++i) {
+      int_tp j = jc;
+      for (; j + kQgemmNR <= jc + nc; j += kQgemmNR) {
+        qgemm_micro_kernel<1, kQgemmNR>(k, a + i * k, b + j * k,
+                                        c + i * n + j, n);
+      }
+      for (; j < jc + nc; ++j) {
+        qgemm_micro_kernel<1, 1>(k, a + i * k, b + j * k, c + i * n + j, n);
+      }
+    }
+  }
+}
+
+void ComputeActivationQuantization(float min_value, float max_value,
+                                   QuantizationParameter* param) {
+  min_value = std::min(min_value, 0.0f);
+  max_value = std::max(max_value, 0.0f);
+  float scale = (max_value - min_value) / kQuantizedActivationMax;
+  if (!(scale > 0)) {
+    scale = 1;
+  }
+  const int_tp zero_point = std::min(kQuantizedActivationMax,
+      std::max(static_cast<int_tp>(0),
+               static_cast<int_tp>(std::lrint(-min_value / scale))));
+  param->Clear();
+  param->add_scale(scale);
+  param->add_zero_point(zero_point);
+}
+
+float ActivationScale(const QuantizationParameter& param) {
+  CHECK_EQ(param.scale_size(), 1)
+      << "Activations need exactly one quantization scale.";
+  CHECK_GT(param.scale(0), 0);
+  return param.scale(0);
+}
+
+int_tp ActivationZeroPoint(const QuantizationParameter& param) {
+  CHECK_LE(param.zero_point_size(), 1)
+      << "Activations need at most one quantization zero point.";
+  const int_tp zero_point = param.zero_point_size() ? param.zero_point(0) : 0;
+  CHECK_GE(zero_point, 0);
+  CHECK_LE(zero_point, kQuantizedActivationMax);
+  return zero_point;
+}
+
+template<typename Dtype>
+void GetBottomQuantization(const LayerParameter& param, const int_tp n,
+                           const Dtype* x,
+                           QuantizationParameter* quantization) {
+  if (param.has_bottom_quantization()) {
+    quantization->CopyFrom(param.bottom_quantization());
+    return;
+  }
+  CHECK_NE(param.bottom_data_type(), INT8_QUANTIZED)
+      << "Layer " << param.name() << " needs a bottom_quantization to "
+      << "interpret its quantized input.";
+  float min_value = 0;
+  float max_value = 0;
+  for (int_tp i = 0; i < n; ++i) {
+    min_value = std::min(min_value, static_cast<float>(x[i]));
+    max_value = std::max(max_value, static_cast<float>(x[i]));
+  }
+  ComputeActivationQuantization(min_value, max_value, quantization);
+}
+
+static inline uint8_t quantize_activation(const float value,
+                                          const float inv_scale,
+                                          const int_tp zero_point) {
+  const int_tp code = static_cast<int_tp>(std::lrint(value * inv_scale))
+      + zero_point;
+  return static_cast<uint8_t>(std::min(kQuantizedActivationMax,
+      std::max(static_cast<int_tp>(0), code)));
+}
+
+template<typename Dtype>
+void caffe_cpu_quantize_activations(const int_tp n, const Dtype* x,
+                                    const bool is_code,
+                                    const QuantizationParameter& param,
+                                    uint8_t* y) {
+  const float inv_scale = is_code ? 1.0f : 1.0f / ActivationScale(param);
+  const int_tp zero_point = ActivationZeroPoint(param);
+  for (int_tp i = 0; i < n; ++i) {
+    y[i] = quantize_activation(static_cast<float>(x[i]), inv_scale,
+                               zero_point);
+  }
+}
+
+template<typename Dtype>
+void caffe_cpu_quantize_activations_transposed(const int_tp rows,
+                                               const int_tp cols,
+                                               const Dtype* x,
+                                               const bool is_code,
+                                               const QuantizationParameter&
+                                               param, uint8_t* y) {
+  const float inv_scale = is_code ? 1.0f : 1.0f / ActivationScale(param);
+  const int_tp zero_point = ActivationZeroPoint(param);
+  // Transpose in tiles so that both the reads and the writes stay in cache.
+  const int_tp tile = 32;
+  for (int_tp r0 = 0; r0 < rows; r0 += tile) {
+    const int_tp r1 = std::min(rows, r0 + tile);
+    for (int_tp c0 = 0; c0 < cols; c0 += tile) {
+      const int_tp c1 = std::min(cols, c0 + tile);
+      for (int_tp r = r0; r < r1; ++r) {
+        for (int_tp c = c0; c < c1; ++c) {
+          y[c * rows + r] = quantize_activation(
+              static_cast<float>(x[r * cols + c]), inv_scale, zero_point);
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+void QuantizedWeights::Quantize(const int_tp rows, const int_tp cols,
+                                const Dtype* w, const bool transposed) {
+  rows_ = rows;
+  cols_ = cols;
+  data_.resize(rows * cols);
+  scales_.resize(rows);
+  row_sums_.resize(rows);
+  const int_tp row_stride = transposed ? 1 : cols;
+  const int_tp col_stride = transposed ? rows : 1;
+  for (int_tp r = 0; r < rows; ++r) {
+    const Dtype* w_row = w + r * row_stride;
+    float max_abs = 0;
+    for (int_tp c = 0; c < cols; ++c) {
+      max_abs = std::max(max_abs,
+                         std::fabs(static_cast<float>(w_row[c * col_stride])));
+    }
+    const float scale = max_abs > 0 ? max_abs / kQuantizedWeightMax : 1.0f;
+    const float inv_scale = 1.0f / scale;
+    int32_t row_sum = 0;
+    for (int_tp c = 0; c < cols; ++c) {
+      const int_tp code = std::min(kQuantizedWeightMax,
+          std::max(-kQuantizedWeightMax, static_cast<int_tp>(std::lrint(
+              static_cast<float>(w_row[c * col_stride]) * inv_scale))));
+      data_[r * cols + c] = static_cast<int8_t>(code);
+      row_sum += code;
+    }
+    scales_[r] = scale;
+    row_sums_[r] = row_sum;
+  }
+}
+
+ActivationHistogram::ActivationHistogram(const int_tp num_bins)
+    : bins_(num_bins, 0), bin_width_(0), has_negative_(false), count_(0) {
+  CHECK_GT(num_bins, 0);
+  CHECK_EQ(num_bins % 2, 0) << "The number of bins must be even.";
+}
+
+template<typename Dtype>
+void ActivationHistogram::Add(const int_tp n, const Dtype* x) {
+  const int_tp num_bins = bins_.size();
+  float max_abs = 0;
+  for (int_tp i = 0; i < n; ++i) {
+    const float value = static_cast<float>(x[i]);
+    has_negative_ |= value < 0;
+    max_abs = std::max(max_abs, std::fabs(value));
+  }
+  if (max_abs > 0) {
+    if (bin_width_ == 0) {
+      bin_width_ = max_abs / num_bins;
+    }
+    while (max_abs >= bin_width_ * num_bins) {
+      for (int_tp i = 0; i < num_bins / 2; ++i) {
+        bins_[i] = bins_[2 * i] + bins_[2 * i + 1];
+      }
+      std::fill(bins_.begin() + num_bins / 2, bins_.end(), 0);
+      bin_width_ *= 2;
+    }
+  }
+  const float inv_bin_width = bin_width_ > 0 ? 1 / bin_width_ : 0;
+  for (int_tp i = 0; i < n; ++i) {
+    const int_tp bin = static_cast<int_tp>(
+        std::fabs(static_cast<float>(x[i])) * inv_bin_width);
+    ++bins_[std::min(bin, num_bins - 1)];
+  }
+  count_ += n;
+}
+
+float ActivationHistogram::PercentileThreshold(const float percentile) const {
+  const double target = percentile / 100.0 * count_;
+  int64_t cumulative = 0;
+  for (int_tp i = 0; i < bins_.size(); ++i) {
+    cumulative += bins_[i];
+    if (cumulative >= target) {
+      return (i + 1) * bin_width_;
+    }
+  }
+  return bins_.size() * bin_width_;
+}
+
+float ActivationHistogram::KLThreshold(const int_tp num_levels) const {
+  const int_tp num_bins = bins_.size();
+  CHECK_LE(num_levels, num_bins);
+  vector<double> p(num_bins);
+  vector<double> q(num_bins);
+  int64_t outliers = count_;
+  for (int_tp i = 0; i < num_levels - 1; ++i) {
+    outliers -= bins_[i];
+  }
+  double best_divergence = std::numeric_limits<double>::max();
+  int_tp best_bins = num_bins;
+  // Clip after the first i bins: P is the clipped histogram, with the
+  // outliers folded into the last bin, and Q the histogram quantized to
+  // num_levels levels, each spread uniformly over its non-empty bins.
+  for (int_tp i = num_levels; i <= num_bins; ++i) {
+    outliers -= bins_[i - 1];
+    double p_sum = 0;
+    for (int_tp j = 0; j < i; ++j) {
+      p[j] = bins_[j];
+      p_sum += p[j];
+    }
+    p[i - 1] += outliers;
+    p_sum += outliers;
+    if (p_sum == 0) {
+      continue;
+    }
+    double q_sum = 0;
+    const double bins_per_level = static_cast<double>(i) / num_levels;
+    for (int_tp l = 0; l < num_levels; ++l) {
+      const int_tp start = static_cast<int_tp>(l * bins_per_level);
+      const int_tp end = (l == num_levels - 1) ? i :
+          static_cast<int_tp>((l + 1) * bins_per_level);
+      double total = 0;
+      int_tp nonzero = 0;
+      for (int_tp j = start; j < end; ++j) {
+        total += bins_[j];
+        nonzero += bins_[j] != 0;
+      }
+      for (int_tp j = start; j < end; ++j) {
+        q[j] = (bins_[j] != 0) ? total / nonzero : 0;
+      }
+      q_sum += total;
+    }
+    double divergence = 0;
+    for (int_tp j = 0; j < i; ++j) {
+      if (p[j] > 0) {
+        const double p_j = p[j] / p_sum;
+        const double q_j = q[j] > 0 ? q[j] / q_sum : 1e-12;
+        divergence += p_j * std::log(p_j / q_j);
+      }
+    }
+    if (divergence < best_divergence) {
+      best_divergence = divergence;
+      best_bins = i;
+    }
+  }
+  return best_bins * bin_width_;
+}
+
+void ActivationHistogram::GetQuantization(const float threshold,
+                                          QuantizationParameter* param) const {
+  ComputeActivationQuantization(has_negative_ ? -threshold : 0, threshold,
+                                param);
+}
+
+template<typename Dtype>
+void QuantizedBlobToProto(const Blob<Dtype>& blob, BlobProto* proto) {
+  proto->Clear();
+  for (int_tp i = 0; i < blob.num_axes(); ++i) {
+    proto->mutable_shape()->add_dim(blob.shape(i));
+  }
+  proto->set_data_type(INT8_QUANTIZED);
+  const int_tp count = blob.count();
+  if (count == 0) {
+    return;
+  }
+  const int_tp outer = blob.num_axes() > 0 ? blob.shape(0) : 1;
+  QuantizedWeights weights;
+  weights.Quantize(outer, count / outer, blob.cpu_data(), false);
+  proto->set_packed_data(string(reinterpret_cast<const char*>(weights.data()),
+                                count));
+  for (int_tp i = 0; i < outer; ++i) {
+    proto->mutable_quantization()->add_scale(weights.scale(i));
+  }
+}
+
+template<typename Dtype>
+void QuantizedBlobFromProto(const BlobProto& proto, const int_tp count,
+                            Dtype* data) {
+  CHECK_EQ(proto.data_type(), INT8_QUANTIZED);
+  CHECK_EQ(count, proto.packed_data().size())
+      << "INT8_QUANTIZED blob needs one byte per element.";
+  if (count == 0) {
+    return;
+  }
+  const QuantizationParameter& param = proto.quantization();
+  const int_tp outer = param.scale_size();
+  CHECK_GT(outer, 0) << "INT8_QUANTIZED blob without quantization scales.";
+  CHECK_EQ(count % outer, 0)
+      << "Quantization scales must divide the blob evenly.";
+  CHECK(param.zero_point_size() == 0 || param.zero_point_size() == outer)
+      << "Quantization needs either no or one zero point per scale.";
+  const int_tp inner = count / outer;
+  const int8_t* codes =
+      reinterpret_cast<const int8_t*>(proto.packed_data().data());
+  for (int_tp o = 0; o < outer; ++o) {
+    const float scale = param.scale(o);
+    const int_tp zero_point =
+        param.zero_point_size() ? param.zero_point(o) : 0;
+    for (int_tp i = o * inner; i < (o + 1) * inner; ++i) {
+      data[i] = static_cast<Dtype>(scale * (codes[i] - zero_point));
+    }
+  }
+}
+
+#define INSTANTIATE_QUANTIZATION(Dtype) \
+  template void GetBottomQuantization<Dtype>(const LayerParameter& param, \
+      const int_tp n, const Dtype* x, QuantizationParameter* quantization); \
+  template void caffe_cpu_quantize_activations<Dtype>(const int_tp n, \
+      const Dtype* x, const bool is_code, const QuantizationParameter& param, \
+      uint8_t* y); \
+  template void caffe_cpu_quantize_activations_transposed<Dtype>( \
+      const int_tp rows, const int_tp cols, const Dtype* x, \
+      const bool is_code, const QuantizationParameter& param, uint8_t* y); \
+  template void QuantizedWeights::Quantize<Dtype>(const int_tp rows, \
+      const int_tp cols, const Dtype* w, const bool transposed); \
+  template void ActivationHistogram::Add<Dtype>(const int_tp n, \
+      const Dtype* x); \
+  template void QuantizedBlobToProto<Dtype>(const Blob<Dtype>& blob, \
+      BlobProto* proto);
+
+INSTANTIATE_QUANTIZATION(float);
+INSTANTIATE_QUANTIZATION(double);
+
+template void QuantizedBlobFromProto<float>(const BlobProto& proto,
+    const int_tp count, float* data);
+template void QuantizedBlobFromProto<double>(const BlobProto& proto,
+    const int_tp count, double* data);
+template void QuantizedBlobFromProto<int_tp>(const BlobProto& proto,
+    const int_tp count, int_tp* data);
+template void QuantizedBlobFromProto<uint_tp>(const BlobProto& proto,
+    const int_tp count, uint_tp* data);
+
+}  // namespace caffe
@@ -0,0 +1,284 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef USE_MKL
+#include <mkl.h>
+#endif
+
+#ifdef USE_OPENBLAS
+extern "C" void openblas_set_num_threads(int num_threads);
+extern "C" int openblas_get_num_threads();
+#endif
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class ThreadPool::Impl {
+ public:
+  Impl(ThreadPool* pool, int_tp num_threads, const vector<int_tp>& cpus);
+  ~Impl();
+
+  void Push(const Task& task);
+  // Runs a queued task, if any, and returns whether it did.
+  bool RunOne();
+  void Wait(const std::atomic<int_tp>& pending);
+  void Done(std::atomic<int_tp>* pending);
+
+  int_tp num_threads() const { return workers_.size() + 1; }
+
+ private:
+  struct Queue {
+    boost::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void WorkerLoop(int_tp id, int_tp cpu);
+  // The id of the worker calling, or -1.
+  int_tp worker_id() const {
+    return worker_id_.get() ? *worker_id_ : -1;
+  }
+
+  ThreadPool* pool_;
+  vector<shared_ptr<Queue> > queues_;
+  vector<shared_ptr<boost::thread> > workers_;
+  boost::thread_specific_ptr<int_tp> worker_id_;
+  // Workers sleep on cond_ while no task is queued, and the waiting threads
+  // on wait_cond_ while no task is queued either and they wait for tasks.
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  boost::condition_variable wait_cond_;
+  int_tp waiters_;
+  bool stop_;
+  std::atomic<int_tp> queued_;
+  // The queue other threads schedule on next.
+  std::atomic<uint_tp> next_queue_;
+};
+
+ThreadPool::Impl::Impl(ThreadPool* pool, int_tp num_threads,
+                       const vector<int_tp>& cpus)
+    : pool_(pool), waiters_(0), stop_(false), queued_(0), next_queue_(0) {
+  CHECK_GE(num_threads, 1);
+  for (int_tp i = 0; i < num_threads - 1; ++i) {
+    queues_.push_back(shared_ptr<Queue>(new Queue()));
+  }
+  for (int_tp i = 0; i < num_threads - 1; ++i) {
+    const int_tp cpu = cpus.empty() ? -1 : cpus[(i + 1) % cpus.size()];
+    workers_.push_back(shared_ptr<boost::thread>(new boost::thread(
+        &ThreadPool::Impl::WorkerLoop, this, i, cpu)));
+  }
+}
+
+ThreadPool::Impl::~Impl() {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (int_tp i = 0; i < workers_.size(); ++i) {
+    workers_[i]->join();
+  }
+}
+
+void ThreadPool::Impl::Push(const Task& task) {
+  const int_tp id = worker_id();
+  Queue* queue = queues_[id >= 0 ? id : next_queue_++ % queues_.size()].get();
+  {
+    boost::mutex::scoped_lock lock(queue->mutex);
+    queue->tasks.push_back(task);
+  }
+  ++queued_;
+  // Taking mutex_ orders the push before the check of a worker or a waiting
+  // thread going to sleep.
+  bool waiters;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    waiters = waiters_ > 0;
+  }
+  cond_.notify_one();
+  if (waiters) {
+    wait_cond_.notify_all();
+  }
+}
+
+bool ThreadPool::Impl::RunOne() {
+  const int_tp id = worker_id();
+  Task task;
+  if (id >= 0) {
+    Queue* queue = queues_[id].get();
+    boost::mutex::scoped_lock lock(queue->mutex);
+    if (!queue->tasks.empty()) {
+      task = queue->tasks.back();
+      queue->tasks.pop_back();
+    }
+  }
+  for (int_tp i = 1; !task && i <= queues_.size(); ++i) {
+    Queue* queue = queues_[(id + i + queues_.size()) % queues_.size()].get();
+    boost::mutex::scoped_lock lock(queue->mutex);
+    if (!queue->tasks.empty()) {
+      task = queue->tasks.front();
+      queue->tasks.pop_front();
+    }
+  }
+  if (!task) {
+    return false;
+  }
+  --queued_;
+  task();
+  return true;
+}
+
+void ThreadPool::Impl::Wait(const std::atomic<int_tp>& pending) {
+  while (pending > 0) {
+    if (RunOne()) {
+      continue;
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    ++waiters_;
+    while (pending > 0 && queued_ == 0) {
+      wait_cond_.wait(lock);
+    }
+    --waiters_;
+  }
+}
+
+void ThreadPool::Impl::Done(std::atomic<int_tp>* pending) {
+  if (--*pending > 0) {
+    return;
+  }
+  // Taking mutex_ orders the decrement before the check of a waiting thread
+  // going to sleep.
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+  }
+  wait_cond_.notify_all();
+}
+
+void ThreadPool::Impl::WorkerLoop(int_tp id, int_tp cpu) {
+  worker_id_.reset(new int_tp(id));
+  if (cpu >= 0) {
+    PinCallingThread(cpu);
+  }
+  Caffe::set_thread_pool(pool_);
+#ifdef _OPENMP
+  omp_set_num_threads(1);
+#endif
+#ifdef USE_MKL
+  mkl_set_num_threads_local(1);
+#endif
+  while (true) {
+    if (RunOne()) {
+      continue;
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!stop_ && queued_ == 0) {
+      cond_.wait(lock);
+    }
+    if (stop_) {
+      return;
+    }
+  }
+}
+
+ThreadPool::ThreadPool(int_tp num_threads, const vector<int_tp>& cpus)
+    : impl_(new Impl(this, num_threads, cpus)) {
+}
+
+ThreadPool::~ThreadPool() {
+}
+
+int_tp ThreadPool::num_threads() const {
+  return impl_->num_threads();
+}
+
+void ThreadPool::parallel_for(int_tp begin, int_tp end, int_tp grain,
+    const std::function<void(int_tp, int_tp)>& body) {
+  CHECK_GT(grain, 0);
+  const int_tp count = end - begin;
+  if (count <= 0) {
+    return;
+  }
+  // A few chunks per thread balance the load of uneven chunks.
+  const int_tp chunks = std::min((count + grain - 1) / grain,
+                                 4 * num_threads());
+  if (chunks <= 1 || num_threads() == 1) {
+    body(begin, end);
+    return;
+  }
+  std::atomic<int_tp> pending(chunks - 1);
+  for (int_tp i = 1; i < chunks; ++i) {
+    const int_tp chunk_begin = begin + count * i / chunks;
+    const int_tp chunk_end = begin + count * (i + 1) / chunks;
+    impl_->Push([this, &body, &pending, chunk_begin, chunk_end]() {
+      body(chunk_begin, chunk_end);
+      Done(&pending);
+    });
+  }
+  body(begin, begin + count / chunks);
+  Wait(pending);
+}
+
+void ThreadPool::Schedule(const Task& task) {
+  if (num_threads() == 1) {
+    task();
+  } else {
+    impl_->Push(task);
+  }
+}
+
+void ThreadPool::Wait(const std::atomic<int_tp>& pending) {
+  impl_->Wait(pending);
+}
+
+void ThreadPool::Done(std::atomic<int_tp>* pending) {
+  impl_->Done(pending);
+}
+
+void ThreadPool::PinCallingThread(int_tp cpu) {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#endif
+}
+
+#ifdef USE_OPENBLAS
+// The scopes alive, and the OpenBLAS thread count before the first.
+static boost::mutex serial_blas_mutex_;
+static int_tp serial_blas_scopes_ = 0;
+static int serial_blas_threads_ = 1;
+#endif  // USE_OPENBLAS
+
+SerialBlasScope::SerialBlasScope() {
+#ifdef USE_OPENBLAS
+  boost::mutex::scoped_lock lock(serial_blas_mutex_);
+  if (serial_blas_scopes_++ == 0) {
+    serial_blas_threads_ = openblas_get_num_threads();
+    openblas_set_num_threads(1);
+  }
+#endif  // USE_OPENBLAS
+}
+
+SerialBlasScope::~SerialBlasScope() {
+#ifdef USE_OPENBLAS
+  boost::mutex::scoped_lock lock(serial_blas_mutex_);
+  if (--serial_blas_scopes_ == 0) {
+    openblas_set_num_threads(serial_blas_threads_);
+  }
+#endif  // USE_OPENBLAS
+}
+
+}  // namespace caffe
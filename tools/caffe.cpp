@@ -7,6 +7,13 @@ namespace bp = boost::python;
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#ifndef _MSC_VER
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif  // !_MSC_VER
+
+#include <algorithm>
 #include <cstring>
 #include <map>
 #include <string>
@@ -61,7 +68,61 @@ DEFINE_string(sighup_effect, "snapshot",
              "snapshot, stop or none.");
 DEFINE_bool(lt, false,
     "Optional; enable per layer timings");
+DEFINE_bool(memory, false,
+    "Optional; report the memory held by each layer in time");
+DEFINE_int32(threads, 0,
+    "Optional; the number of CPU threads of the layers and of BLAS. "
+    "Uses all cores by default.");
+DEFINE_bool(pin_threads, false,
+    "Optional; pin each CPU thread to a core.");
+DEFINE_int32(replicas, 1,
+    "Optional; the number of replicas of the solver to train data parallel "
+    "on the CPU, splitting the CPU threads among them.");
+DEFINE_int32(procs, 1,
+    "Optional; the number of processes to train data parallel on the CPU, "
+    "splitting the CPU threads among them. They exchange the gradients over "
+    "Unix domain sockets.");
+DEFINE_int32(proc_rank, 0,
+    "Internal; the rank of a process started by -procs.");
+DEFINE_string(proc_dir, "",
+    "Internal; the socket directory of the processes started by -procs.");
+
+
+#ifndef _MSC_VER
+extern char** environ;
+
+// Starts ranks 1 to FLAGS_procs - 1 of a -procs run, as copies of this
+// process connecting through the sockets in dir.
+static vector<pid_t> start_procs(const string& dir) {
+  vector<pid_t> pids;
+  for (int rank = 1; rank < FLAGS_procs; ++rank) {
+    vector<string> args(gflags::GetArgvs());
+    args.push_back("-proc_rank=" + boost::lexical_cast<string>(rank));
+    args.push_back("-proc_dir=" + dir);
+    vector<char*> argv;
+    for (int i = 0; i < args.size(); ++i) {
+      argv.push_back(const_cast<char*>(args[i].c_str()));
+    }
+    argv.push_back(NULL);
+    pid_t pid;
+    const int error = posix_spawnp(&pid, argv[0], NULL, NULL, &argv[0],
+                                   environ);
+    CHECK_EQ(error, 0) << "Cannot start rank " << rank << ": "
+                       << strerror(error);
+    pids.push_back(pid);
+  }
+  return pids;
+}
 
+static void wait_procs(const vector<pid_t>& pids) {
+  for (int i = 0; i < pids.size(); ++i) {
+    int status;
+    CHECK_EQ(waitpid(pids[i], &status, 0), pids[i]);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        << "Rank " << i + 1 << " failed.";
+  }
+}
+#endif  // !_MSC_VER
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -231,11 +292,42 @@ int train() {
       }
   }
 
+  // The threads flag takes precedence over the solver prototxt.
+  if (FLAGS_threads == 0 && solver_param.cpu_threads() > 0) {
+    Caffe::set_cpu_threads(solver_param.cpu_threads(), FLAGS_pin_threads);
+  }
+
+#ifndef _MSC_VER
+  // The processes of the other ranks, started by rank 0.
+  vector<pid_t> procs;
+#endif  // !_MSC_VER
   vector<int> gpus;
   get_gpus(&gpus);
   if (gpus.size() == 0) {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    CHECK_GE(FLAGS_replicas, 1);
+    CHECK_GE(FLAGS_procs, 1);
+    CHECK(FLAGS_replicas == 1 || FLAGS_procs == 1)
+        << "Give -replicas or -procs but not both.";
+    Caffe::set_solver_count(std::max(FLAGS_replicas, FLAGS_procs));
+    if (FLAGS_procs > 1) {
+#ifndef _MSC_VER
+      if (FLAGS_proc_dir.empty()) {
+        FLAGS_proc_dir = caffe::ProcessAllreduce<float>::new_dir();
+        procs = start_procs(FLAGS_proc_dir);
+      }
+      Caffe::set_solver_rank(FLAGS_proc_rank);
+      // Each process takes its share of the CPU threads, on cores next to
+      // each other when pinned.
+      const int_tp threads = std::max(Caffe::cpu_threads() / FLAGS_procs,
+                                      int_tp(1));
+      Caffe::set_cpu_threads(threads, FLAGS_pin_threads,
+                             FLAGS_proc_rank * threads);
+#else
+      LOG(FATAL) << "Multi-process training is not available on Windows.";
+#endif  // !_MSC_VER
+    }
   } else {
 #ifndef CPU_ONLY
     // Load all devices that will be used
@@ -280,10 +372,25 @@ int train() {
     LOG(FATAL) << "Multi-GPU execution not available - rebuild with USE_NCCL";
 #endif  // USE_NCCL
 #endif  // USE_CUDA
+#ifndef _MSC_VER
+  } else if (gpus.size() == 0 && FLAGS_procs > 1) {
+    caffe::ProcessAllreduce<float> allreduce(solver, FLAGS_proc_dir);
+    allreduce.Run();
+#endif  // !_MSC_VER
+  } else if (gpus.size() == 0 && FLAGS_replicas > 1) {
+    caffe::HostAllreduce<float> allreduce(solver);
+    allreduce.Run(FLAGS_replicas, FLAGS_pin_threads,
+                  FLAGS_snapshot.size() > 0 ? FLAGS_snapshot.c_str() : NULL);
   } else {
     solver->Solve();
   }
   LOG(INFO) << "Optimization Done.";
+#ifndef _MSC_VER
+  if (!procs.empty()) {
+    wait_procs(procs);
+    rmdir(FLAGS_proc_dir.c_str());
+  }
+#endif  // !_MSC_VER
 
 #ifdef USE_OPENCL
   if (Caffe::GetDefaultDevice()->backend() == caffe::BACKEND_OPENCL) {
@@ -408,12 +515,18 @@ int time() {
   // Note that for the speed benchmark, we will assume that the network does
   // not take any input blobs.
   float initial_loss;
+  caffe_net.set_profile_memory(FLAGS_memory);
   caffe_net.Forward(&initial_loss);
   LOG(INFO) << "Initial loss: " << initial_loss;
   if (phase == caffe::TRAIN) {
     LOG(INFO) << "Performing Backward";
     caffe_net.Backward();
   }
+  if (FLAGS_memory) {
+    LOG(INFO) << "Memory per layer in bytes:" << std::endl
+              << caffe_net.MemoryReport();
+    caffe_net.set_profile_memory(false);
+  }
 
   const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
   const vector<vector<Blob<float>*> >& bottom_vecs = caffe_net.bottom_vecs();
@@ -569,6 +682,9 @@ int main(int argc, char** argv) {
       "  autotune        autotune a model");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  if (FLAGS_threads > 0 || FLAGS_pin_threads) {
+    Caffe::set_cpu_threads(FLAGS_threads, FLAGS_pin_threads);
+  }
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
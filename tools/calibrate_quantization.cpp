@@ -0,0 +1,176 @@
+// Calibrates a trained model for INT8_QUANTIZED inference. It runs the model
+// over calibration data (e.g. an LMDB read by a Data layer), records a
+// histogram of the input of every Convolution and InnerProduct layer through
+// a Net forward callback and picks the activation clipping thresholds by
+// KL-divergence or percentile.
+//
+// Writes a model definition in which those layers compute in INT8_QUANTIZED
+// with the calibrated bottom_quantization, and weights in which their
+// filters are stored as INT8_QUANTIZED packed_data.
+//
+// Usage:
+//    calibrate_quantization --model=calibration.prototxt
+//        --weights=model.caffemodel --iterations=50
+//        --output_model=int8.prototxt --output_weights=int8.caffemodel
+//        [--method=kl|percentile] [--percentile=99.99] [--skip=conv1,...]
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/quantization.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::ActivationHistogram;
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Net;
+using caffe::NetParameter;
+using caffe::QuantizationParameter;
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+DEFINE_string(model, "",
+    "The model definition, with a data layer reading the calibration set.");
+DEFINE_string(weights, "",
+    "The trained weights to calibrate.");
+DEFINE_int32(iterations, 50,
+    "The number of calibration batches.");
+DEFINE_string(method, "kl",
+    "Optional; how to pick clipping thresholds: 'kl' or 'percentile'.");
+DEFINE_double(percentile, 99.99,
+    "Optional; the percentage of values to keep unclipped for "
+    "--method=percentile.");
+DEFINE_int32(bins, 2048,
+    "Optional; the number of histogram bins.");
+DEFINE_string(skip, "",
+    "Optional; names of layers to keep in FLOAT, separated by ','.");
+DEFINE_string(output_model, "",
+    "The calibrated model definition to write.");
+DEFINE_string(output_weights, "",
+    "The quantized weights to write.");
+
+// Records the input of the layers being calibrated before they run.
+class HistogramCallback : public Net<float>::Callback {
+ public:
+  HistogramCallback(const Net<float>& net,
+                    map<int, ActivationHistogram*>* histograms)
+      : net_(net), histograms_(histograms) {}
+
+ protected:
+  virtual void run(int layer) {
+    map<int, ActivationHistogram*>::iterator it = histograms_->find(layer);
+    if (it != histograms_->end()) {
+      const Blob<float>* bottom = net_.bottom_vecs()[layer][0];
+      it->second->Add(bottom->count(), bottom->cpu_data());
+    }
+  }
+
+ private:
+  const Net<float>& net_;
+  map<int, ActivationHistogram*>* histograms_;
+};
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+  gflags::SetUsageMessage("Calibrate a model for INT8_QUANTIZED inference.\n"
+        "Usage:\n"
+        "    calibrate_quantization --model=calibration.prototxt \\\n"
+        "        --weights=model.caffemodel --output_model=int8.prototxt \\\n"
+        "        --output_weights=int8.caffemodel [--iterations=50] \\\n"
+        "        [--method=kl|percentile] [--skip=conv1,...]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to calibrate.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to calibrate.";
+  CHECK_GT(FLAGS_output_model.size(), 0) << "Need an output model file.";
+  CHECK_GT(FLAGS_output_weights.size(), 0) << "Need an output weights file.";
+  CHECK(FLAGS_method == "kl" || FLAGS_method == "percentile")
+      << "Unknown calibration method " << FLAGS_method;
+  CHECK_GT(FLAGS_iterations, 0);
+
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> net(FLAGS_model, caffe::TEST, Caffe::GetDefaultDevice());
+  net.CopyTrainedLayersFrom(FLAGS_weights);
+
+  vector<string> skip;
+  if (FLAGS_skip.size()) {
+    boost::split(skip, FLAGS_skip, boost::is_any_of(","));
+  }
+  const set<string> skip_layers(skip.begin(), skip.end());
+  map<int, ActivationHistogram*> histograms;
+  for (int i = 0; i < net.layers().size(); ++i) {
+    const string type = net.layers()[i]->type();
+    if ((type == "Convolution" || type == "InnerProduct") &&
+        !skip_layers.count(net.layer_names()[i])) {
+      histograms[i] = new ActivationHistogram(FLAGS_bins);
+    }
+  }
+  CHECK(!histograms.empty()) << "No Convolution or InnerProduct layers to "
+                             << "calibrate.";
+  HistogramCallback callback(net, &histograms);
+  net.add_before_forward(&callback);
+
+  LOG(INFO) << "Calibrating " << histograms.size() << " layers over "
+            << FLAGS_iterations << " batches.";
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    net.Forward();
+  }
+
+  // The calibrated layers keep their float input and quantize it with the
+  // recorded quantization, which avoids an extra Quantizer pass.
+  NetParameter model;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &model);
+  map<string, QuantizationParameter> quantizations;
+  for (map<int, ActivationHistogram*>::iterator it = histograms.begin();
+       it != histograms.end(); ++it) {
+    const ActivationHistogram& histogram = *it->second;
+    const float threshold = (FLAGS_method == "kl") ?
+        histogram.KLThreshold(histogram.has_negative() ? 128 : 256) :
+        histogram.PercentileThreshold(FLAGS_percentile);
+    const string& name = net.layer_names()[it->first];
+    histogram.GetQuantization(threshold, &quantizations[name]);
+    LOG(INFO) << name << ": clipping threshold " << threshold << ", scale "
+              << quantizations[name].scale(0) << ", zero point "
+              << quantizations[name].zero_point(0);
+    delete it->second;
+  }
+  for (int i = 0; i < model.layer_size(); ++i) {
+    caffe::LayerParameter* layer = model.mutable_layer(i);
+    if (quantizations.count(layer->name())) {
+      layer->set_compute_data_type(caffe::INT8_QUANTIZED);
+      layer->mutable_bottom_quantization()->CopyFrom(
+          quantizations[layer->name()]);
+    }
+  }
+  caffe::WriteProtoToTextFile(model, FLAGS_output_model);
+
+  NetParameter weights;
+  net.ToProto(&weights, false);
+  for (int i = 0; i < weights.layer_size(); ++i) {
+    caffe::LayerParameter* layer = weights.mutable_layer(i);
+    if (quantizations.count(layer->name())) {
+      caffe::QuantizedBlobToProto(
+          *net.layer_by_name(layer->name())->blobs()[0],
+          layer->mutable_blobs(0));
+    }
+  }
+  caffe::WriteProtoToBinaryFile(weights, FLAGS_output_weights);
+  LOG(INFO) << "Wrote " << FLAGS_output_model << " and "
+            << FLAGS_output_weights;
+  return 0;
+}
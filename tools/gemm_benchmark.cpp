@@ -0,0 +1,111 @@
+// Compares the packed half precision caffe_cpu_gemm against cblas_sgemm on
+// the GEMM shapes produced by im2col convolution in common models.
+//
+// Usage:
+//    gemm_benchmark [--iterations=10]
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using caffe::CPUTimer;
+using std::vector;
+
+DEFINE_int32(iterations, 10,
+    "The number of timed iterations per shape.");
+
+struct GemmShape {
+  const char* name;
+  // M = output channels (per group), N = output spatial size,
+  // K = input channels (per group) x kernel size.
+  int_tp m, n, k;
+};
+
+static const GemmShape kShapes[] = {
+  {"alexnet/conv1",        96, 3025,  363},
+  {"alexnet/conv2",       128,  729, 1200},
+  {"alexnet/conv3",       384,  169, 2304},
+  {"vgg16/conv1_2",        64, 50176, 576},
+  {"vgg16/conv3_1",       256, 3136, 1152},
+  {"vgg16/conv5_3",       512,  196, 4608},
+  {"resnet50/conv1",       64, 12544, 147},
+  {"resnet50/res2a_2b",    64, 3136,  576},
+  {"resnet50/res3a_2c",   512,  784,  128},
+  {"resnet50/res4a_2b",   256,  196, 2304},
+  {"resnet50/res5a_2b",   512,   49, 4608},
+  {"resnet50/fc1000",    1000,    1, 2048},
+};
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+  gflags::SetUsageMessage("Benchmark the half precision CPU GEMM.\n"
+        "Usage:\n"
+        "    gemm_benchmark [--iterations=10]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_iterations, 0);
+#ifndef USE_GPU_HALF
+  LOG(FATAL) << "gemm_benchmark requires a build with USE_GPU_HALF.";
+#else
+  typedef half_float::half half;
+  LOG(INFO) << "shape, M, N, K, sgemm GFLOP/s, hgemm GFLOP/s, "
+            << "hgemm speedup, max rel. error";
+  for (int_tp s = 0; s < sizeof(kShapes) / sizeof(kShapes[0]); ++s) {
+    const GemmShape& shape = kShapes[s];
+    const int_tp m = shape.m, n = shape.n, k = shape.k;
+    vector<float> a(m * k), b(k * n), c(m * n);
+    caffe::caffe_rng_uniform<float>(m * k, -1.0f, 1.0f, &a[0]);
+    caffe::caffe_rng_uniform<float>(k * n, -1.0f, 1.0f, &b[0]);
+    vector<half> a_half(a.begin(), a.end());
+    vector<half> b_half(b.begin(), b.end());
+    vector<half> c_half(m * n);
+
+    // One untimed call each to warm up caches and the BLAS thread pool.
+    caffe::caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, m, n, k, 1.0f,
+                                 &a[0], &b[0], 0.0f, &c[0]);
+    caffe::caffe_cpu_gemm<half>(CblasNoTrans, CblasNoTrans, m, n, k, half(1),
+                                &a_half[0], &b_half[0], half(0), &c_half[0]);
+
+    CPUTimer timer;
+    timer.Start();
+    for (int_tp i = 0; i < FLAGS_iterations; ++i) {
+      caffe::caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, m, n, k, 1.0f,
+                                   &a[0], &b[0], 0.0f, &c[0]);
+    }
+    timer.Stop();
+    const double sgemm_ms = timer.MilliSeconds() / FLAGS_iterations;
+    timer.Start();
+    for (int_tp i = 0; i < FLAGS_iterations; ++i) {
+      caffe::caffe_cpu_gemm<half>(CblasNoTrans, CblasNoTrans, m, n, k,
+                                  half(1), &a_half[0], &b_half[0], half(0),
+                                  &c_half[0]);
+    }
+    timer.Stop();
+    const double hgemm_ms = timer.MilliSeconds() / FLAGS_iterations;
+
+    // Rounding of the inputs to half precision is part of the error, so
+    // this reports the end-to-end deviation from the FP32 result.
+    double max_error = 0;
+    for (int_tp i = 0; i < m * n; ++i) {
+      const double error = std::fabs(c[i] - static_cast<float>(c_half[i]));
+      max_error = std::max(max_error,
+                           error / std::max(1.0f, std::fabs(c[i])));
+    }
+    const double gflop = 2.0 * m * n * k * 1e-9;
+    LOG(INFO) << shape.name << ", " << m << ", " << n << ", " << k << ", "
+              << gflop / (sgemm_ms * 1e-3) << ", "
+              << gflop / (hgemm_ms * 1e-3) << ", "
+              << sgemm_ms / hgemm_ms << ", " << max_error;
+  }
+#endif  // USE_GPU_HALF
+  return 0;
+}
@@ -0,0 +1,139 @@
+// Times the CPU im2col and col2im, and their N-D variants, on the
+// convolution geometries of common models. The 2D and N-D results are
+// compared against each other as a sanity check. Set OMP_NUM_THREADS to
+// choose the number of threads in an OpenMP build.
+//
+// Usage:
+//    im2col_benchmark [--iterations=10]
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "caffe/common.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/im2col.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using caffe::CPUTimer;
+using std::vector;
+
+DEFINE_int32(iterations, 10,
+    "The number of timed iterations per geometry.");
+
+struct Im2colGeometry {
+  const char* name;
+  // Square images and kernels, without dilation.
+  int_tp channels, size, kernel, pad, stride;
+};
+
+static const Im2colGeometry kGeometries[] = {
+  {"alexnet/conv2",        96, 27, 5, 2, 1},
+  {"vgg16/conv1_2",        64, 224, 3, 1, 1},
+  {"vgg16/conv3_1",       128, 56, 3, 1, 1},
+  {"vgg16/conv5_3",       512, 14, 3, 1, 1},
+  {"resnet50/conv1",        3, 224, 7, 3, 2},
+  {"resnet50/res2a_2b",    64, 56, 3, 1, 1},
+  {"resnet50/res3a_2b",   128, 56, 3, 1, 2},
+  {"resnet50/res4a_2b",   256, 14, 3, 1, 1},
+  {"resnet50/res5a_2b",   512, 7, 3, 1, 1},
+};
+
+// Runs op once untimed and then FLAGS_iterations times, and returns the
+// mean time per call in milliseconds.
+template<typename Op>
+static double TimeOp(Op op) {
+  op();
+  CPUTimer timer;
+  timer.Start();
+  for (int_tp i = 0; i < FLAGS_iterations; ++i) {
+    op();
+  }
+  timer.Stop();
+  return timer.MilliSeconds() / FLAGS_iterations;
+}
+
+static double MaxDifference(const vector<float>& a, const vector<float>& b) {
+  double max_difference = 0;
+  for (int_tp i = 0; i < a.size(); ++i) {
+    max_difference = std::max(max_difference,
+                              static_cast<double>(std::fabs(a[i] - b[i])));
+  }
+  return max_difference;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+  gflags::SetUsageMessage("Benchmark the CPU im2col and col2im.\n"
+        "Usage:\n"
+        "    im2col_benchmark [--iterations=10]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_iterations, 0);
+#ifdef _OPENMP
+  LOG(INFO) << "OpenMP threads: " << omp_get_max_threads();
+#else
+  LOG(INFO) << "OpenMP threads: 1 (built without OpenMP)";
+#endif
+  LOG(INFO) << "geometry, C, H/W, kernel, pad, stride, im2col GB/s, "
+            << "col2im GB/s, im2col_nd GB/s, col2im_nd GB/s, max difference";
+  for (int_tp g = 0; g < sizeof(kGeometries) / sizeof(kGeometries[0]); ++g) {
+    const Im2colGeometry& geometry = kGeometries[g];
+    const int_tp channels = geometry.channels, size = geometry.size;
+    const int_tp kernel = geometry.kernel, pad = geometry.pad;
+    const int_tp stride = geometry.stride;
+    const int_tp output = (size + 2 * pad - kernel) / stride + 1;
+    const int_tp rows = channels * kernel * kernel;
+    vector<float> im(channels * size * size);
+    vector<float> col(rows * output * output);
+    vector<float> im_nd(im.size()), col_nd(col.size());
+    caffe::caffe_rng_uniform<float>(im.size(), -1.0f, 1.0f, &im[0]);
+
+    const int_tp im_shape[] = {channels, size, size};
+    const int_tp col_shape[] = {rows, output, output};
+    const int_tp kernel_shape[] = {kernel, kernel};
+    const int_tp pad_shape[] = {pad, pad};
+    const int_tp stride_shape[] = {stride, stride};
+    const int_tp dilation_shape[] = {1, 1};
+
+    const double im2col_ms = TimeOp([&]() {
+      caffe::im2col_cpu(&im[0], channels, size, size, kernel, kernel, pad,
+                        pad, stride, stride, 1, 1, &col[0]);
+    });
+    const double im2col_nd_ms = TimeOp([&]() {
+      caffe::im2col_nd_cpu(&im[0], 2, im_shape, col_shape, kernel_shape,
+                           pad_shape, stride_shape, dilation_shape,
+                           &col_nd[0]);
+    });
+    double max_difference = MaxDifference(col, col_nd);
+    const double col2im_ms = TimeOp([&]() {
+      caffe::col2im_cpu(&col[0], channels, size, size, kernel, kernel, pad,
+                        pad, stride, stride, 1, 1, &im[0]);
+    });
+    const double col2im_nd_ms = TimeOp([&]() {
+      caffe::col2im_nd_cpu(&col[0], 2, im_shape, col_shape, kernel_shape,
+                           pad_shape, stride_shape, dilation_shape,
+                           &im_nd[0]);
+    });
+    max_difference = std::max(max_difference, MaxDifference(im, im_nd));
+
+    // Both directions read or write the whole column matrix and image once.
+    const double gb = (col.size() + im.size()) * sizeof(float) * 1e-9;
+    LOG(INFO) << geometry.name << ", " << channels << ", " << size << ", "
+              << kernel << ", " << pad << ", " << stride << ", "
+              << gb / (im2col_ms * 1e-3) << ", "
+              << gb / (col2im_ms * 1e-3) << ", "
+              << gb / (im2col_nd_ms * 1e-3) << ", "
+              << gb / (col2im_nd_ms * 1e-3) << ", " << max_difference;
+  }
+  return 0;
+}
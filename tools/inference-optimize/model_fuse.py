@@ -1,4 +1,9 @@
 #!/usr/bin/env python
+#
+# Nets loaded in the TEST phase with "state { fuse_layers: true }" fold the
+# BatchNorm, Scale, ReLU and Eltwise layers that follow convolutions while
+# they load, without this offline conversion. This script also fuses LRN
+# with max pooling and writes the fused model out.
 
 import os,sys
 import caffe